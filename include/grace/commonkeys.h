@@ -126,6 +126,39 @@ namespace key {
 	STRINGRSRC real							VALUE ("real");
 	STRINGRSRC dict							VALUE ("dict");
 	STRINGRSRC integer						VALUE ("integer");
+	
+	STRINGRSRC http_host					VALUE ("Host");
+	STRINGRSRC http_user_agent				VALUE ("User-Agent");
+	STRINGRSRC http_accept					VALUE ("Accept");
+	STRINGRSRC http_accept_language			VALUE ("Accept-Language");
+	STRINGRSRC http_accept_encoding			VALUE ("Accept-Encoding");
+	STRINGRSRC http_accept_charset			VALUE ("Accept-Charset");
+	STRINGRSRC http_connection				VALUE ("Connection");
+	STRINGRSRC http_keep_alive				VALUE ("Keep-Alive");
+	STRINGRSRC http_cookie					VALUE ("Cookie");
+	STRINGRSRC http_referer					VALUE ("Referer");
+	STRINGRSRC http_origin					VALUE ("Origin");
+	STRINGRSRC http_content_length			VALUE ("Content-Length");
+	STRINGRSRC http_content_type			VALUE ("Content-Type");
+	STRINGRSRC http_transfer_encoding		VALUE ("Transfer-Encoding");
+	STRINGRSRC http_expect					VALUE ("Expect");
+	STRINGRSRC http_cache_control			VALUE ("Cache-Control");
+	STRINGRSRC http_pragma					VALUE ("Pragma");
+	STRINGRSRC http_if_modified_since		VALUE ("If-Modified-Since");
+	STRINGRSRC http_if_none_match			VALUE ("If-None-Match");
+	STRINGRSRC http_if_range				VALUE ("If-Range");
+	STRINGRSRC http_range					VALUE ("Range");
+	STRINGRSRC http_authorization			VALUE ("Authorization");
+	STRINGRSRC http_upgrade					VALUE ("Upgrade");
+	STRINGRSRC http_upgrade_insecure_requests	VALUE ("Upgrade-Insecure-Requests");
+	STRINGRSRC http_dnt						VALUE ("DNT");
+	STRINGRSRC http_te						VALUE ("TE");
+	STRINGRSRC http_x_forwarded_for			VALUE ("X-Forwarded-For");
+	STRINGRSRC http_x_requested_with		VALUE ("X-Requested-With");
+	STRINGRSRC http_sec_fetch_site			VALUE ("Sec-Fetch-Site");
+	STRINGRSRC http_sec_fetch_mode			VALUE ("Sec-Fetch-Mode");
+	STRINGRSRC http_sec_fetch_dest			VALUE ("Sec-Fetch-Dest");
+	STRINGRSRC http_sec_fetch_user			VALUE ("Sec-Fetch-User");
 };
 
 #undef STRINGRSRC
@@ -170,9 +170,137 @@ namespace tune
 			/// Minimum headroom space before we should consider
 			/// trimming threads [2].
 			parameter int minoverhead defaultvalue (2);
+			
+			/// \var int tune::httpd::wkthread::acceptwait
+			/// Number of milliseconds a worker waits for a new
+			/// connection between event polling [1000].
+			parameter int acceptwait defaultvalue (1000);
+		}
+		
+		/// Behaviour of the event loop threads.
+		namespace eventloop
+		{
+			/// \var int tune::httpd::eventloop::batch
+			/// Maximum number of socket events to pick up from
+			/// the kernel in one go [64].
+			parameter int batch defaultvalue (64);
+			
+			/// \var int tune::httpd::eventloop::idle
+			/// Number of milliseconds to wait for socket events
+			/// between event polling [1000].
+			parameter int idle defaultvalue (1000);
+		}
+		
+		/// Streamed responses and request bodies.
+		namespace stream
+		{
+			/// \var int tune::httpd::stream::bufsize
+			/// Amount of data a httpdstream collects before it
+			/// sends out a chunk [16 KB].
+			parameter int bufsize defaultvalue (16 KB);
+			
+			/// \var int tune::httpd::stream::timeout
+			/// Number of milliseconds a httpdstream or httpdbody
+			/// waits for a client that does not take or send any
+			/// data before it gives up [30000].
+			parameter int timeout defaultvalue (30000);
+		}
+
+		/// Behaviour of the response cache.
+		namespace cache
+		{
+			/// \var int tune::httpd::cache::waittime
+			/// Number of milliseconds a request waits for another
+			/// request that is filling the same uri, before it
+			/// runs on its own [5000].
+			parameter int waittime defaultvalue (5000);
+
+			/// \var int tune::httpd::cache::passtime
+			/// Number of seconds a uri whose response could not
+			/// be cached is passed straight on [10].
+			parameter int passtime defaultvalue (10);
+		}
+
+		/// Open files kept by a httpdfileshare.
+		namespace fileshare
+		{
+			/// \var int tune::httpd::fileshare::openfiles
+			/// Maximum number of files a httpdfileshare keeps
+			/// open [256].
+			parameter int openfiles defaultvalue (256);
+
+			/// \var int tune::httpd::fileshare::revalidate
+			/// Number of milliseconds before a kept file is
+			/// checked for changes [1000].
+			parameter int revalidate defaultvalue (1000);
+		}
+
+		/// Asynchronous httpdlogger.
+		namespace log
+		{
+			/// \var int tune::httpd::log::flushsize
+			/// Amount of queued log data that wakes up the log
+			/// thread [64 KB].
+			parameter int flushsize defaultvalue (64 KB);
+
+			/// \var int tune::httpd::log::flushtime
+			/// Number of milliseconds queued log data may wait
+			/// before it is written [1000].
+			parameter int flushtime defaultvalue (1000);
+
+			/// \var int tune::httpd::log::maxqueue
+			/// Amount of queued log data before the overflow
+			/// policy kicks in [4 MB].
+			parameter int maxqueue defaultvalue (4 MB);
 		}
 	}
 	
+	/// SSL session reuse.
+	namespace ssl
+	{
+		/// \var int tune::ssl::sessions
+		/// Maximum number of servers an sslsocket keeps a session
+		/// around for, to resume instead of doing a full handshake.
+		/// Set to 0 to always do a full handshake [256].
+		parameter int sessions defaultvalue (256);
+
+		/// \var int tune::ssl::sessionlife
+		/// Number of seconds a kept session is offered to the
+		/// server before it is dropped [3600].
+		parameter int sessionlife defaultvalue (3600);
+		
+		/// \var int tune::ssl::handshakers
+		/// Number of threads a httpsd does its handshakes in, so
+		/// its workers only see established connections. Set to 0
+		/// to do them in the workers [4].
+		parameter int handshakers defaultvalue (4);
+		
+		/// \var int tune::ssl::handshakequeue
+		/// Most connections a httpsd has in a handshake or waiting
+		/// for a worker. Past this, new connections wait in the
+		/// kernel's backlog [64].
+		parameter int handshakequeue defaultvalue (64);
+	}
+	
+	/// HTTP client options.
+	namespace http
+	{
+		/// \var int tune::http::perhost
+		/// Most idle keep-alive connections kept around for a
+		/// single server [4].
+		parameter int perhost defaultvalue (4);
+		
+		/// \var int tune::http::poolsize
+		/// Most idle keep-alive connections kept around for
+		/// all servers together [64].
+		parameter int poolsize defaultvalue (64);
+		
+		/// \var int tune::http::idletime
+		/// Number of seconds an idle keep-alive connection is
+		/// kept around before it is closed [30].
+		parameter int idletime defaultvalue (30);
+	}
+	
 	/// TCP listening options.
 	namespace tcplistener
 	{
@@ -213,6 +341,11 @@ namespace tune
 			/// Minimum headroom space before we should consider
 			/// trimming threads [2].
 			parameter int minoverhead defaultvalue (2);
+			
+			/// \var int tune::smtpd::wkthread::acceptwait
+			/// Number of milliseconds a worker waits for a new
+			/// connection between event polling [1000].
+			parameter int acceptwait defaultvalue (1000);
 		}
 	}
 }
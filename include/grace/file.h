@@ -13,6 +13,8 @@
 #include <grace/exception.h>
 #include <grace/ringbuffer.h>
 
+#include <sys/uio.h>
+
 /// Abstract utility class for encoding/decoding data streams
 /// that pass a file object.
 /// The file class can be told to use objects of a class derived
@@ -51,11 +53,26 @@ public:
 					 /// \param into The ringbuffer.
 	virtual bool	 fetchinput (ringbuffer &into);
 	
+					 /// Returns true if translated input is held back
+					 /// because the ringbuffer had no room for it. It
+					 /// is handed over by the next fetchinput().
+	virtual bool	 pendinginput (void);
+	
 					 /// Get a copy of the entire output buffer.
 					 /// \param into The string object to dump the
 					 ///             buffer data into.
 	virtual void	 peekoutput (string &into);
 	
+					 /// Borrow the output buffer, without copying it.
+					 /// The default implementation goes through
+					 /// peekoutput(), codecs that keep their output
+					 /// in one piece should return it directly.
+					 /// \param sz Set to the number of bytes waiting.
+					 /// \return Pointer to the waiting data, valid
+					 ///         until the next call that adds to or
+					 ///         takes from the output buffer.
+	virtual const char *borrowoutput (size_t &sz);
+	
 					 /// Advance the cursor into the output buffer.
 					 /// \param sz The number of bytes to skip.
 	virtual void	 doneoutput (unsigned int sz);
@@ -74,8 +91,31 @@ public:
 					 /// Disable certificate checking.
 	virtual void	 nocertcheck (void);
 	
+					 /// Tell the codec which peer the link is
+					 /// going to, before setup() is called.
+					 /// \param addr The peer address.
+					 /// \param port The peer port.
+	virtual void	 setpeer (const string &addr, int port);
+	
+					 /// Returns false if a handshake started by
+					 /// setup() needs nothing more from the peer.
+	virtual bool	 expectinput (void);
+	
+					 /// A new codec with the same settings, for the
+					 /// next connection of a socket that handed its
+					 /// current one over to another socket.
+					 /// \return The codec, or NULL if this codec's
+					 ///         connections cannot be handed over.
+	virtual iocodec	*duplicate (void);
+	
+					 /// Describes the settings that make a connection
+					 /// through this codec unfit for a user with other
+					 /// settings, like a skipped certificate check.
+	virtual string	*variant (void);
+	
 protected:
 	string			 err; ///< Last generated error text.
+	string			 outcopy; ///< Output copy for borrowoutput().
 };
 
 #define FERR_OK			0
@@ -89,6 +129,10 @@ protected:
 #define FERR_NOCONNECT	0x395e2cbb
 #define FERR_NORSRC		0x2babc890
 
+/// file::readbuffer() does not read into a buffer with less room than
+/// this, a buffer that is down to it counts as full.
+#define FILE_MINROOM	8
+
 $exception (endOfFileException, "End of file");
 $exception (fileNotOpenException, "File not open");
 $exception (fileReadException, "Read error");
@@ -118,6 +162,7 @@ public:
 					nonblocking = false;
 					codec = NULL;
 					errcode = FERR_OK;
+					holding = false;
 					if (inpath[0] == '<') openread (inpath.mid(1));
 					else if (inpath[0] == '>') openwrite (inpath.mid(1));
 					else openread (inpath);
@@ -246,6 +291,23 @@ public:
 				 /// \throw EX_SSL_BUFFER_SNAFU Error in sslcodec buffer.
 	bool		 puts (const char *data, size_t sz);
 	
+				 /// Write a number of data blocks in one go. Without
+				 /// a codec, this is a single writev() if the kernel
+				 /// takes all of it.
+				 /// \param iov The data blocks.
+				 /// \param cnt Number of blocks.
+				 /// \return Status, \b true for success.
+				 /// \throw EX_SSL_NO_HANDSHAKE No sslcodec handshake done.
+				 /// \throw EX_SSL_BUFFER_SNAFU Error in sslcodec buffer.
+	bool		 puts (const struct iovec *iov, int cnt);
+	
+				 /// Write two data blocks in one go, like a header
+				 /// and a body.
+				 /// \param a The first block.
+				 /// \param b The second block.
+				 /// \return Status, \b true for success.
+	bool		 puts (const string &a, const string &b);
+	
 				 /// Non-blocking puts.
 				 /// \param str Pointer to the data.
 				 /// \param sz Size of the data to be written.
@@ -264,8 +326,21 @@ public:
 				 /// Write out what's left in the buffer.
 	void		 flush (void);
 	
+				 /// Hold back written data, so that a number of
+				 /// writes go out together. Held data is written
+				 /// by releaseoutput(), before the file waits for
+				 /// input, when more than 64KB is held and when
+				 /// the file is closed. A flush() leaves it alone.
+	void		 holdoutput (void) { holding = true; }
+	
+				 /// Write any held data and stop holding.
+				 /// \return Status, \b true for success.
+	bool		 releaseoutput (void);
+	
 				 /// Write out any data that's waiting to get out of the codec.
-	void		 flushcodec (void);
+				 /// \return Status, \b false if the data could not
+				 ///         all be written.
+	bool		 flushcodec (void);
 	
 				 /// End-of-file.
 				 /// \return EOF status, \b true if the end of the file has 
@@ -305,8 +380,18 @@ public:
 	int			 filno; ///< The unix filedescriptor.
 
 protected:
+				 /// Write the held data, keep holding.
+	bool		 flushheld (void);
+	
+				 /// Take translated input the codec held back
+				 /// earlier, before waiting for more.
+				 /// \return \b true if anything was taken.
+	bool		 fetchpending (void);
+
 	bool		 feof; ///< End-of-file
 	bool		 nonblocking; ///< True if the fd is in non-blocking mode.
+	bool		 holding; ///< True if output is held back.
+	string		 holdbuf; ///< Output held back.
 	unsigned int errcode; ///< Last generated error code/
 	string 		 err; ///< Last generated error text.
 	string		 iter; ///< Buffer for iteration
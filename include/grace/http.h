@@ -9,6 +9,7 @@
 #define _HTTP_H 1
 
 #include <grace/tcpsocket.h>
+#include <grace/lock.h>
 #include <grace/value.h>
 #include <grace/str.h>
 #include <grace/strutil.h>
@@ -22,12 +23,93 @@ $exception (httpTimeoutException, "Timeout in HTTP");
 #define HTERR_BROKENPIPE	0x91094a03
 #define HTERR_PROTO			0x93520a19
 
+/// An idle keep-alive connection.
+struct httpidleconn
+{
+	string			 key; ///< Scheme, host and port it goes to.
+	tcpsocket		*sock; ///< The connection.
+	time_t			 lastuse; ///< When it was handed in.
+	httpidleconn	*next, *prev;
+};
+
+/// Idle keep-alive connections of all httpsocket objects, so that
+/// a request to a server that was talked to before, from any object
+/// or thread, can skip the connect (and for https the handshake).
+/// Connections are kept by a key of the scheme, host and port they
+/// go to. The most recently handed in connection is at the head of
+/// the list. There are at most tune::http::perhost connections for
+/// a key and tune::http::poolsize in all, connections that were idle
+/// for more than tune::http::idletime seconds are closed.
+class httpconnectionpool
+{
+public:
+					 httpconnectionpool (void);
+					~httpconnectionpool (void);
+	
+					 /// Takes an idle connection out of the pool.
+					 /// Connections the server closed in the meantime
+					 /// are thrown away.
+					 /// \param key The scheme, host and port.
+					 /// \return The connection, or NULL if there is
+					 ///         none. Caller should delete it.
+	tcpsocket		*checkout (const string &key);
+	
+					 /// Hands an idle connection to the pool. The
+					 /// pool becomes its owner.
+					 /// \param key The scheme, host and port.
+					 /// \param s The connection.
+	void			 checkin (const string &key, tcpsocket *s);
+	
+					 /// Closes all idle connections.
+	void			 clear (void);
+	
+					 /// Returns the number of idle connections.
+	int				 count (void);
+	
+					 /// Returns the number of connections that were
+					 /// checked out for another request.
+	unsigned int	 reused (void) { return nreused; }
+	
+					 /// Returns the number of connections that turned
+					 /// out to be closed by the server on checkout.
+	unsigned int	 stale (void) { return nstale; }
+
+protected:
+					 /// Takes connections that were idle for too long
+					 /// out of the list. Caller should hold the lock.
+					 /// \param into List to add them to.
+	void			 expire (httpidleconn *&into);
+	
+					 /// Takes an entry out of the list. Caller should
+					 /// hold the lock.
+	void			 unlink (httpidleconn *c);
+	
+					 /// Closes and frees a list of connections taken
+					 /// out of the pool. Done outside of the lock, a
+					 /// close may have to talk to the other side.
+	void			 discard (httpidleconn *list);
+	
+	lock<int>		 lck;
+	httpidleconn	*head;
+	httpidleconn	*tail;
+	int				 cnt;
+	unsigned int	 nreused;
+	unsigned int	 nstale;
+};
+
+/// The pool used by all httpsocket objects.
+extern httpconnectionpool HTTPCONNECTIONS;
+
 /// HTTP client class.
 /// Implements the HTTP/1.1 standard POST and GET methods to submit data
 /// to a webserver and read the results. When posting, it can either be
 /// a properly serialized set of name/value pairs out of a value object,
 /// or some arbitrary data with a content-type.
 ///
+/// With keepalive enabled, a connection that is no longer needed
+/// goes to the shared HTTPCONNECTIONS pool, so that a later request
+/// to the same server from another httpsocket can use it.
+///
 /// Example usage (using a GET request):
 /// \verbinclude httpsocket_ex1.cpp
 class httpsocket
@@ -145,8 +227,19 @@ public:
 protected:
 				 /// Internal connect method.
 				 /// Acts smart by reusing an open tcpsocket if the
-				 /// host did not change and keepalive is permitted.
+				 /// host did not change and keepalive is permitted,
+				 /// or an idle one out of the HTTPCONNECTIONS pool.
 	bool		 connectToHost (const string &hostname, int port);
+	
+				 /// Lets go of the current connection. It is handed
+				 /// to the HTTPCONNECTIONS pool if keepalive is
+				 /// permitted and it is still usable, closed
+				 /// otherwise.
+	void		 release (void);
+	
+				 /// Returns the pool key for a connection to a
+				 /// host and port through the current codec.
+	string		*poolkey (const string &hostname, int port);
 	bool		 getData (string &into, size_t bytes);
 	bool		 getChunked (string &into);
 	string		*getResult (value *hdr);
@@ -154,6 +247,7 @@ protected:
 	tcpsocket	 _sock; ///< The tcp socket used for connections.
 	string		 _host; ///< The current host.
 	int			 _port; ///< The current port.
+	string		 _poolkey; ///< Pool key of the current connection.
 	bool		 _keepalive; ///< Flag for HTTP keepalive.
 	int			 _timeout; ///< Timeout value for non-blocking, 0 for blocking.
 	
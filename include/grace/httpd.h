@@ -13,9 +13,12 @@
 #include <grace/cmdtoken.h>
 #include <grace/dictionary.h>
 #include <grace/filesystem.h>
+#include <grace/perthread.h>
 #include <grace/defaults.h>
 #include <grace/ipaddress.h>
 
+class httpdbody;
+
 #define HTTPD_ACCESS 1
 #define HTTPD_ERROR 2
 #define HTTPD_INFO 4
@@ -73,9 +76,35 @@ public:
 						  value &inhdr, string &out, value &outhdr,
 						  value &env, tcpsocket &s);
 	
+					 /// Implementation for objects that set
+					 /// httpdobject::streambody. Gets the request
+					 /// body as a httpdbody that is read from the
+					 /// socket as the object goes, instead of as a
+					 /// string. The default reads the whole body and
+					 /// calls run().
+					 /// \param uri The uri of the request
+					 /// \param body The request body
+					 /// \param inhdr The received headers
+					 /// \param out The output buffer
+					 /// \param outhdr The output headers
+					 /// \param env The request environment
+					 /// \param s The tcpsocket handling the request
+					 /// \return Status code, like run().
+	virtual int		 runbody (string &uri, httpdbody &body,
+							  value &inhdr, string &out, value &outhdr,
+							  value &env, tcpsocket &s);
+	
 	httpdobject		*next; ///< Linked list pointer.
 	string			 urimatch; ///< Match criterium.
 	class httpd		*parent; ///< Pointer to the parent httpd object.
+	
+					 /// Set by objects that want the request body
+					 /// as a stream through runbody(). If any object
+					 /// matching a request's uri has it set, the body
+					 /// is left on the socket. Objects without it
+					 /// that come first in the chain then see an
+					 /// empty postbody. Off by default.
+	bool			 streambody;
 };
 
 /// Data handler for a file type. Objects derived from this class can
@@ -146,6 +175,194 @@ protected:
 					 scriptcache; ///< Cache of parsed scripts (indexed by path)
 };
 
+/// Streaming response writer.
+/// Lets a httpdobject send its body in pieces instead of composing it
+/// in the output buffer first. Data is collected up to
+/// tune::httpd::stream::bufsize and then sent as a chunk with
+/// Transfer-Encoding: chunked, the headers go out with the first one.
+/// Writes block while the client is not taking data, so the handler
+/// can not run ahead of it. A client that takes nothing for
+/// tune::httpd::stream::timeout milliseconds makes writes fail.
+/// HTTP/1.0 clients get the body as it is, with the connection closed
+/// at the end. A body that fits the buffer entirely goes out as a
+/// normal response with a Content-length. Example:
+/// \code
+/// int run (string &uri, string &postbody, value &inhdr, string &out,
+///          value &outhdr, value &env, tcpsocket &s)
+/// {
+///     httpdstream st (s, env, outhdr);
+///     outhdr["Content-type"] = "text/plain";
+///     for (int i=0; i<1000000; ++i)
+///     {
+///         if (! st.write ("line %i\n" %format (i))) break;
+///     }
+///     return st.finish ();
+/// }
+/// \endcode
+class httpdstream
+{
+public:
+					 /// Constructor. Nothing is sent yet.
+					 /// \param s The tcpsocket handling the request.
+					 /// \param env The request environment.
+					 /// \param outhdr The output headers, these can
+					 ///               still be changed until the
+					 ///               first chunk goes out.
+					 httpdstream (tcpsocket &s, value &env, value &outhdr);
+
+					 /// Destructor. A stream that was started but not
+					 /// finished leaves the connection to be closed.
+					~httpdstream (void);
+
+					 /// Set the status code. Only has effect before
+					 /// the first chunk goes out.
+					 /// \param st The HTTP status code [200].
+	void			 setstatus (int st) { status = st; }
+
+					 /// Add data to the body.
+					 /// \param data The data.
+					 /// \return Status, \b false if the client is
+					 ///         gone and the handler can stop.
+	bool			 write (const string &data);
+
+					 /// Add data to the body.
+					 /// \param data Pointer to the data.
+					 /// \param sz Size of the data.
+					 /// \return Status, \b false if the client is
+					 ///         gone and the handler can stop.
+	bool			 write (const char *data, size_t sz);
+
+					 /// Send out what has been collected so far,
+					 /// without waiting for the buffer to fill up.
+					 /// \return Status, \b false if the client is
+					 ///         gone.
+	bool			 flush (void);
+
+					 /// End the body. Sets env["sentbytes"] and
+					 /// env["keepalive"] for the httpd.
+					 /// \return The negated status code, for the
+					 ///         httpdobject to return.
+	int				 finish (void);
+
+					 /// True once the headers went out.
+	bool			 started (void) const { return sentheaders; }
+
+					 /// Number of body bytes sent.
+	unsigned int	 sent (void) const { return nsent; }
+
+protected:
+					 /// Send the buffer, with the headers if they
+					 /// did not go out yet.
+					 /// \param last \b true for the end of the body.
+	bool			 sendchunk (bool last);
+
+	tcpsocket		&sock; ///< The client socket.
+	value			&env; ///< The request environment.
+	value			&outhdr; ///< The output headers.
+	string			 buf; ///< Data waiting to go out.
+	int				 status; ///< The HTTP status code.
+	unsigned int	 nsent; ///< Body bytes sent.
+	bool			 chunked; ///< True if the client takes chunks.
+	bool			 sentheaders; ///< True once the headers went out.
+	bool			 finished; ///< True after finish().
+	bool			 failed; ///< True once a write failed.
+};
+
+/// Request body reader.
+/// Reads a request body from the socket as it comes in, for objects
+/// that set httpdobject::streambody. Handles both bodies with a
+/// Content-length and those sent with Transfer-Encoding: chunked.
+/// A client that sends Expect: 100-continue gets its go-ahead once
+/// the body is first read from. A client that sends nothing for
+/// tune::httpd::stream::timeout milliseconds breaks off the body.
+/// Example, spooling an upload to disk:
+/// \code
+/// int runbody (string &uri, httpdbody &body, value &inhdr, string &out,
+///              value &outhdr, value &env, tcpsocket &s)
+/// {
+///     if (! body.spool ("/var/spool/upload.tgz")) return 500;
+///     out = "stored %i bytes" %format (body.received());
+///     return 200;
+/// }
+/// \endcode
+class httpdbody
+{
+public:
+					 /// Constructor. Nothing is read yet.
+					 /// \param s The tcpsocket handling the request,
+					 ///          with the headers read.
+					 /// \param len The Content-length.
+					 /// \param chunk \b true if the body is chunked,
+					 ///              the length is ignored.
+					 /// \param expect \b true if the client waits for
+					 ///               a 100 Continue.
+					 httpdbody (tcpsocket &s, unsigned int len,
+								bool chunk, bool expect = false);
+
+					 /// Destructor.
+					~httpdbody (void);
+
+					 /// Read the next piece of the body.
+					 /// \param sz Maximum number of bytes.
+					 /// \return The data. Empty at the end of the
+					 ///         body, or if it broke off.
+	string			*read (size_t sz = 65536);
+
+					 /// Read the rest of the body into a string.
+					 /// \param into String to add the data to.
+					 /// \param max Maximum size of the body.
+					 /// \return Status, \b false if the body was
+					 ///         bigger than allowed or broke off.
+	bool			 readall (string &into, unsigned int max);
+
+					 /// Write the rest of the body to a file.
+					 /// \param f An open file.
+					 /// \return Status, \b false if the body broke
+					 ///         off or the file could not be written.
+	bool			 spool (file &f);
+
+					 /// Write the rest of the body to a new file.
+					 /// \param path Path of the file.
+					 /// \return Status, \b false if the body broke
+					 ///         off or the file could not be written.
+	bool			 spool (const string &path);
+
+					 /// True once the whole body was read.
+	bool			 done (void) const { return isdone; }
+
+					 /// True if the body broke off.
+	bool			 failed (void) const { return broken; }
+
+					 /// True if the body is chunked.
+	bool			 chunked (void) const { return ischunked; }
+
+					 /// The Content-length, \b 0 if chunked.
+	unsigned int	 length (void) const { return len; }
+
+					 /// Number of body bytes read so far.
+	unsigned int	 received (void) const { return nread; }
+
+protected:
+					 /// Start on the next chunk.
+					 /// \return Status, \b false if the body is
+					 ///         done or broke off.
+	bool			 nextchunk (void);
+
+					 /// Send the 100 Continue if the client
+					 /// asked for it.
+	void			 sendcontinue (void);
+
+	tcpsocket		&sock; ///< The client socket.
+	unsigned int	 len; ///< The Content-length.
+	unsigned int	 left; ///< Bytes left in the body or chunk.
+	unsigned int	 nread; ///< Body bytes read.
+	bool			 ischunked; ///< True for a chunked body.
+	bool			 inchunk; ///< True after the first chunk.
+	bool			 expectcontinue; ///< True until the 100 went out.
+	bool			 isdone; ///< True once the body is in.
+	bool			 broken; ///< True if the body broke off.
+};
+
 /// Convenient base class for a dynamic page.
 /// Wraps up HTTP POST data into an environment, then calls its virtual
 /// serverpage::execute() method.
@@ -174,7 +391,93 @@ public:
 					 /// \param outhdr Output headers.
 					 /// \return HTTP status code.
 	virtual int		 execute (value &env, value &argv,
-							  string &out, value &outhdr);	
+							  string &out, value &outhdr);
+
+					 /// Streaming implementation.
+					 /// Called before execute(), for pages that
+					 /// send their output through a httpdstream.
+					 /// The stream is finished by the caller.
+					 /// \param env Service environment.
+					 /// \param argv GET/POST variables.
+					 /// \param out The output stream.
+					 /// \return \b 0 to go on with execute(), any
+					 ///         other value if the page was sent.
+	virtual int		 stream (value &env, value &argv, httpdstream &out);
+};
+
+/// Number of hash buckets in a httpdfilecache.
+#define HTTPDFILECACHE_BUCKETS 256
+
+/// Maximum number of ranges in a request, requests with more get
+/// the whole file.
+#define HTTPD_MAXRANGES 16
+
+/// A file as kept open by the httpdfilecache.
+struct httpdfileinfo
+{
+	string				 path; ///< Path of the file.
+	int					 fd; ///< Open descriptor,  -1 if none.
+	bool				 exists; ///< False if there was no such file.
+	bool				 isdir; ///< True for a directory.
+	unsigned long long	 size; ///< Size in bytes.
+	unsigned long long	 dev; ///< Device of the inode.
+	unsigned long long	 ino; ///< Inode number.
+	time_t				 mtime; ///< Modification time.
+	string				 etag; ///< Strong entity tag.
+	string				 lastmodified; ///< The mtime as an HTTP date.
+	long long			 checked; ///< Time of the last stat, in ms.
+	int					 refcount; ///< Users, the cache counts as one.
+	httpdfileinfo		*next; ///< Next in the bucket.
+	httpdfileinfo		*newer; ///< LRU list, towards the head.
+	httpdfileinfo		*older; ///< LRU list, towards the tail.
+};
+
+/// Cache of open files and their stat results.
+/// Saves a httpdfileshare from looking up and opening a file for
+/// every request. An entry that is older than
+/// tune::httpd::fileshare::revalidate milliseconds is checked with a
+/// single stat() and replaced if the file changed. No more than
+/// tune::httpd::fileshare::openfiles entries are kept, the least
+/// recently used go first. Paths that do not exist are remembered
+/// as well.
+class httpdfilecache
+{
+public:
+					 /// Constructor.
+					 httpdfilecache (void);
+
+					 /// Destructor. Closes all files.
+					~httpdfilecache (void);
+
+					 /// Get a file. Every call should be matched by
+					 /// a call to release().
+					 /// \param path The path.
+					 /// \return The entry, check httpdfileinfo::exists.
+	httpdfileinfo	*get (const string &path);
+
+					 /// Let go of a file returned by get().
+	void			 release (httpdfileinfo *f);
+
+					 /// Number of entries.
+	unsigned int	 count (void);
+
+protected:
+					 /// Stat and open a file into a new entry.
+	httpdfileinfo	*load (const string &path);
+
+					 /// Take an entry out of the table and the LRU
+					 /// list, and drop the cache's reference.
+	void			 unlink (httpdfileinfo *f);
+
+					 /// Drop a reference, closes the file on the
+					 /// last one.
+	void			 unref (httpdfileinfo *f);
+
+	lock<int>		 lck; ///< Lock for everything below.
+	httpdfileinfo	*buckets[HTTPDFILECACHE_BUCKETS]; ///< Hash table.
+	httpdfileinfo	*head; ///< Most recently used.
+	httpdfileinfo	*tail; ///< Least recently used.
+	int				 cnt; ///< Number of entries.
 };
 
 /// Publish a directory. Normally used at the end of the chain. Publishes
@@ -203,7 +506,12 @@ public:
 					 /// a directory, "index.html" is appended.
 					 /// A resolved and readable file is sent directly
 					 /// to the socket using tcpsocket::sendfile() and
-					 /// \e -200 is returned.
+					 /// \e -200 is returned. Files carry a strong
+					 /// ETag, If-None-Match and If-Modified-Since
+					 /// get a \e -304. Range requests, with an
+					 /// optional If-Range, get one or more parts of
+					 /// the file and \e -206, or \e -416 if none of
+					 /// the ranges fit the file.
 	virtual int		 run (string &uri, string &postbody,
 						  value &inhdr, string &out, value &outhdr,
 						  value &env, tcpsocket &s);
@@ -221,6 +529,7 @@ protected:
 					 filetypes; ///< Filetype handlers
 	string			 root; ///< The root directory
 	bool			 roothasvolume; ///< True if root dir uses an alias path.
+	httpdfilecache	 files; ///< Open files.
 };
 
 // ------------------------------------------------------------------------
@@ -524,6 +833,7 @@ public:
 
 protected:
 	value			 hostdb; ///< Internal vhosts database.
+	value			 prefixes; ///< Uri prefix per host, with the slash.
 };
 
 
@@ -589,9 +899,46 @@ protected:
 // CLASS httpdlogger: A httpdeventhandler that writes ncsa-style logs.
 // ------------------------------------------------------------------------
 
+/// What an asynchronous httpdlogger does when its queue is full.
+#define HTTPDLOG_BLOCK 0 ///< Wait for the log thread to catch up.
+#define HTTPDLOG_DROP 1 ///< Throw away the line and count it.
+
+/// Log lines queued by a single thread for an asynchronous httpdlogger.
+class httpdlogqueue
+{
+public:
+	string			 access; ///< Queued access log lines.
+	string			 error; ///< Queued error log lines.
+};
+
+/// Background writer for a httpdlogger in async mode.
+class httpdlogwriter : public thread
+{
+public:
+					 /// Constructor.
+					 /// \param o The httpdlogger to write for.
+					 httpdlogwriter (class httpdlogger *o);
+					 
+					 /// Destructor.
+					~httpdlogwriter (void);
+	
+					 /// Implementation. Writes out whatever was
+					 /// queued, whenever the queue grows over
+					 /// tune::httpd::log::flushsize or every
+					 /// tune::httpd::log::flushtime milliseconds.
+	virtual void	 run (void);
+	
+					 /// Write out the last of the queue and stop.
+	void			 shutdown (void);
+
+protected:
+	class httpdlogger	*owner; ///< The logger.
+};
+
 /// Apache-style access and error log writer.
 class httpdlogger : public httpdeventhandler
 {
+friend class httpdlogwriter;
 public:
 						 /// Constructor.
 						 /// \param parent Link to parent httpd.
@@ -612,14 +959,332 @@ public:
 						 /// also written to the error log file.
 	virtual int			 handle (const value &);
 	
+						 /// Switch to asynchronous mode. Each worker
+						 /// thread queues its log lines in a buffer
+						 /// of its own, the httpdlogwriter collects
+						 /// them and writes them in batches.
+						 /// \param overflow What to do when the queue
+						 ///        holds more than
+						 ///        tune::httpd::log::maxqueue bytes,
+						 ///        HTTPDLOG_BLOCK or HTTPDLOG_DROP.
+	void				 async (int overflow = HTTPDLOG_BLOCK);
+	
+						 /// Wait until everything that was queued so
+						 /// far is written out.
+	void				 flush (void);
+	
+						 /// Number of lines thrown away because the
+						 /// queue was full.
+	unsigned int		 dropped (void);
+	
 protected:
+						 /// The current time for a log line. It is
+						 /// only formatted once a second.
+	string				*timestr (void);
+	
+						 /// Add a line to the queue of the calling
+						 /// thread.
+						 /// \param line The log line.
+						 /// \param iserror True for the error log.
+	void				 queue (const string &line, bool iserror);
+	
+						 /// Write out and empty the queues of all
+						 /// threads. Called by the httpdlogwriter.
+	void				 writequeued (void);
+
 	lock<file>			 faccess; ///< The access log file
 	lock<file>			 ferror; ///< The error log file
 	bool				 haserrorlog; ///< True if there is an error log.
 	string				 accessPath; ///< Path to the access log
 	string				 errorPath; ///< Path to the error log
+	
+	lock<int>			 tlock; ///< Lock for the cached time.
+	time_t				 tcached; ///< Second of the cached time.
+	char				 tbuf[32]; ///< The cached time.
+	
+	httpdlogwriter		*writer; ///< Log thread, NULL if synchronous.
+	int					 overflowpolicy; ///< HTTPDLOG_BLOCK or _DROP.
+	perthread< lock<httpdlogqueue> > queues; ///< Queue of each thread.
+	volatile unsigned int qbytes; ///< Queued bytes not yet written.
+	volatile unsigned int ndropped; ///< Lines dropped.
+	volatile int		 nflushing; ///< Threads waiting in flush().
+	conditional			 qwakeup; ///< Wakes up the writer.
+	conditional			 qspace; ///< The writer made room.
+	conditional			 qwritten; ///< The writer wrote a batch.
+};
+
+// ------------------------------------------------------------------------
+// CLASS httpdrouter: Trie of the httpdobjects' urimatch patterns.
+// ------------------------------------------------------------------------
+
+/// Literal pattern prefixes longer than this are only partly used
+/// in the trie, the rest is left to globcmp().
+#define HTTPD_ROUTEDEPTH 64
+
+/// A httpdobject as stored in the routing trie.
+struct httpdroute
+{
+	httpdobject		*obj; ///< The object.
+	int				 index; ///< Position in the chain.
+	bool			 exact; ///< Pattern has no wildcards.
+	bool			 prefix; ///< Pattern is a literal followed by '*'.
+	httpdroute		*next; ///< Next route at the same node.
+};
+
+/// A node in the routing trie.
+struct httpdroutenode
+{
+	unsigned char	 c; ///< Lowercased character leading here.
+	httpdroutenode	*child; ///< First child node.
+	httpdroutenode	*sibling; ///< Next node with the same parent.
+	httpdroute		*routes; ///< Routes ending here, in chain order.
 };
 
+/// Routing trie for the chain of httpdobjects.
+/// Each urimatch pattern is filed under its literal part, up to the
+/// first wildcard. A uri only has to visit the nodes along its own
+/// path to find every pattern that could apply. Patterns without
+/// wildcards and patterns that end in a single '*' need no further
+/// matching, the rest still go through string::globcmp().
+class httpdrouter
+{
+friend class httpdroutecursor;
+public:
+					 /// Constructor.
+					 httpdrouter (void);
+					 
+					 /// Destructor.
+					~httpdrouter (void);
+					
+					 /// Add an object to the end of the chain. The
+					 /// object's urimatch should not be changed
+					 /// afterwards.
+	void			 add (httpdobject *obj);
+	
+					 /// Number of objects in the chain.
+	int				 count (void) const { return cnt; }
+
+protected:
+					 /// Free a node and everything below it.
+	void			 freenode (httpdroutenode *node);
+
+	httpdroutenode	 top; ///< Root node, for patterns without a prefix.
+	int				 cnt; ///< Number of routes.
+};
+
+/// Walks the httpdobjects that match a uri, in chain order.
+class httpdroutecursor
+{
+public:
+					 /// Constructor. Looks up the trie nodes along
+					 /// the uri.
+					 /// \param r The router.
+					 /// \param puri The uri, without query string.
+					 httpdroutecursor (const httpdrouter &r,
+					 				   const string &puri);
+					 
+					 /// Get the next matching object.
+					 /// \return The object, or \b NULL if there
+					 ///         are no more.
+	httpdobject		*next (void);
+
+protected:
+	const string	&uri; ///< The uri being matched.
+	httpdroute		*at[HTTPD_ROUTEDEPTH+1]; ///< Next route per node.
+	bool			 last[HTTPD_ROUTEDEPTH+1]; ///< Node ends the uri.
+	int				 n; ///< Number of nodes with routes.
+};
+
+// ------------------------------------------------------------------------
+// CLASS httpdcache: Keeps responses to GET requests in memory.
+// ------------------------------------------------------------------------
+
+/// Results of httpdcache::lookup().
+#define HTTPDCACHE_HIT 1 ///< The response came from the cache.
+#define HTTPDCACHE_FILL 2 ///< Run the request, then call store().
+#define HTTPDCACHE_PASS 3 ///< Run the request without the cache.
+
+/// Number of hash buckets in a httpdcache.
+#define HTTPDCACHE_BUCKETS 1024
+
+/// A response stored in the httpdcache.
+struct httpdcacheentry
+{
+	struct httpdcacheslot	*slot; ///< The uri this is a variant of.
+	httpdcacheentry			*nextvariant; ///< Next variant of the uri.
+	httpdcacheentry			*newer; ///< LRU list, towards the head.
+	httpdcacheentry			*older; ///< LRU list, towards the tail.
+	value					 vary; ///< Request headers that picked it.
+	string					 headers; ///< Response headers.
+	string					 validators; ///< Headers for a 304.
+	string					 body; ///< Response body.
+	string					 etag; ///< The entity tag.
+	long long				 stored; ///< Time of storage, in ms.
+	long long				 expires; ///< Expiry time, in ms.
+	unsigned int			 size; ///< Bytes counted against the budget.
+};
+
+/// All that is cached for a single method, host and uri.
+struct httpdcacheslot
+{
+	string					 key; ///< Method, host and uri.
+	httpdcacheentry			*variants; ///< Stored responses.
+	httpdcacheslot			*next; ///< Next slot in the bucket.
+	long long				 passuntil; ///< Don't cache until then.
+	bool					 filling; ///< A request is out to fill it.
+};
+
+/// A response as it comes out of the httpdcache.
+struct httpdcachehit
+{
+	string					 headers; ///< Response headers.
+	string					 validators; ///< Headers for a 304.
+	string					 body; ///< Response body.
+	string					 etag; ///< The entity tag.
+	int						 age; ///< Seconds since it was stored.
+};
+
+/// In-memory cache of responses.
+/// Sits in front of the chain of httpdobjects and keeps the responses
+/// to GET requests that objects marked as cacheable, by setting a
+/// Cache-Control header with a max-age or s-maxage in the outhdr.
+/// Responses that are private, no-store or no-cache, that set a
+/// cookie or that answer anything but 200 are left alone. Neither
+/// are requests with an Authorization header, the objects that
+/// check it would be skipped on a hit. A response that lists request
+/// headers in its Vary header is only served to requests with the
+/// same values for those. Objects whose output depends on a cookie
+/// should either say so with Vary or keep it private.
+///
+/// Requests for a uri that is being filled wait for the response to
+/// come in, instead of running the same handler again, for up to
+/// tune::httpd::cache::waittime milliseconds. A uri that turned out
+/// not to be cacheable is passed through without waiting for
+/// tune::httpd::cache::passtime seconds.
+///
+/// Stored responses get an ETag if they had none, requests with a
+/// matching If-None-Match get a 304 back. The cache is kept under a
+/// byte budget by dropping the least recently used responses. The
+/// httpd's cache is off until it gets a size:
+/// \code
+/// httpd srv (80);
+/// srv.cache.size (16 MB);
+/// \endcode
+class httpdcache
+{
+public:
+					 /// Constructor. The cache is off.
+					 httpdcache (void);
+
+					 /// Destructor.
+					~httpdcache (void);
+
+					 /// Set the byte budget. Responses are dropped
+					 /// until the cache fits.
+					 /// \param bytes The budget, \b 0 to turn the
+					 ///              cache off.
+	void			 size (unsigned int bytes);
+
+					 /// The byte budget.
+	unsigned int	 size (void) { return budget; }
+
+					 /// Number of responses served from the cache.
+	unsigned int	 hits (void);
+
+					 /// Number of requests that had to be run.
+	unsigned int	 misses (void);
+
+					 /// Number of stored responses.
+	unsigned int	 count (void);
+
+					 /// Number of bytes used.
+	unsigned int	 bytes (void);
+
+					 /// Drop all stored responses.
+	void			 clear (void);
+
+					 /// Look up a response. Waits if another request
+					 /// is filling the same uri.
+					 /// \param key The method, host and uri.
+					 /// \param inhdr The request headers.
+					 /// \param hit Gets the response on a hit.
+					 /// \return HTTPDCACHE_HIT, HTTPDCACHE_FILL if the
+					 ///         caller should run the request and
+					 ///         call store() or abandon() with the
+					 ///         result, or HTTPDCACHE_PASS if it
+					 ///         should run the request and leave it
+					 ///         at that.
+	int				 lookup (const string &key, const value &inhdr,
+							 httpdcachehit &hit);
+
+					 /// Store the response for a filled uri, if it
+					 /// is cacheable. Adds an ETag to the outhdr.
+					 /// \param key The method, host and uri.
+					 /// \param inhdr The request headers.
+					 /// \param status The HTTP status.
+					 /// \param outhdr The response headers, with
+					 ///               the Content-length set.
+					 /// \param body The response body.
+					 /// \return \b true if it was stored.
+	bool			 store (const string &key, const value &inhdr,
+							int status, value &outhdr, const string &body);
+
+					 /// Give up on filling a uri, if the response was
+					 /// not one that could be stored.
+					 /// \param key The method, host and uri.
+	void			 abandon (const string &key);
+
+					 /// Check a request's If-None-Match.
+					 /// \param inhdr The request headers.
+					 /// \param etag The response's ETag.
+					 /// \return \b true if the client has it.
+	static bool		 notmodified (const value &inhdr, const string &etag);
+
+					 /// The headers of a response that go along with
+					 /// a 304 for it.
+					 /// \param outhdr The response headers.
+	static string	*validators (const value &outhdr);
+
+protected:
+					 /// Find out for how long a response can be
+					 /// kept.
+					 /// \return Seconds, \b 0 if it can't.
+	int				 lifetime (const value &inhdr, int status,
+							   const value &outhdr);
+
+					 /// Get the slot for a key.
+					 /// \param create If \b true, a new slot is made
+					 ///               if there was none.
+	httpdcacheslot	*findslot (const string &key, bool create);
+
+					 /// Remove an entry from its slot and the LRU
+					 /// list, and delete it.
+	void			 unlink (httpdcacheentry *e);
+
+					 /// Free up space until there is room for a
+					 /// number of bytes.
+	void			 makeroom (unsigned int sz);
+
+					 /// Drop the slots in one bucket that have
+					 /// nothing left to remember.
+	void			 sweep (void);
+
+					 /// Clear a slot's filling mark, and let the
+					 /// requests that wait for it go.
+	void			 filled (httpdcacheslot *slot);
+
+	lock<int>		 lck; ///< Lock for everything below.
+	conditional		 fillcond; ///< Raised when a uri got filled.
+	httpdcacheslot	**buckets; ///< Hash table of slots.
+	httpdcacheentry	*head; ///< Most recently used entry.
+	httpdcacheentry	*tail; ///< Least recently used entry.
+	unsigned int	 budget; ///< Maximum number of bytes.
+	unsigned int	 used; ///< Bytes in use.
+	unsigned int	 nentries; ///< Number of entries.
+	unsigned int	 nhits; ///< Hit counter.
+	unsigned int	 nmisses; ///< Miss counter.
+	int				 sweepat; ///< Next bucket for sweep().
+};
 
 $exception (httpdNoListenerException, "Daemon cannot start without listener");
 
@@ -683,6 +1348,7 @@ public:
 	void			 start (void)
 					 {
 					 	if (! listener) throw httpdNoListenerException();
+					 	_shutdown = false;
 					 	spawn();
 					 };	
 	
@@ -708,6 +1374,10 @@ public:
 	int				 maxpostsize (void) { return _maxpostsize; };
 					 /// Returns the system path.
 	const string	&systempath (void) { return syspath; };
+					 /// Returns the number of event loop threads.
+	int				 eventloops (void) { return _eventloops; };
+					 /// Returns true once shutdown() was called.
+	bool			 shuttingdown (void) { return _shutdown; };
 
 					 /// Set the minimum number of threads.
 	void			 minthreads (int i) { minthr = i; };
@@ -717,6 +1387,14 @@ public:
 	void			 maxpostsize (int i) { _maxpostsize = i; };
 					 /// Set the system path.
 	void			 systempath (const string &str) { syspath = str; };
+					 /// Set the number of event loop threads. With
+					 /// event loops, idle keep-alive connections are
+					 /// parked in an epoll set and only connections
+					 /// with a complete request take up a worker
+					 /// thread. With the default of 0, a worker
+					 /// thread stays with a connection until it is
+					 /// closed. Set this before calling start().
+	void			 eventloops (int i) { _eventloops = i; };
 	
 	
 	// ---------------------------------------------------------------------
@@ -742,9 +1420,18 @@ public:
 					 /// \param httpver The HTTP version
 					 /// \param s The tcpsocket handling the request
 					 /// \param keepalive Whether HTTP keepalive should be used.
+					 /// \param body The request body, if it was left
+					 ///             on the socket for the objects that
+					 ///             set httpdobject::streambody.
 	void			 handle (string &uri, string &postbody, value &inhdr,
 							 const string &method, const string &httpver,
-							 tcpsocket &s, bool &keepalive);
+							 tcpsocket &s, bool &keepalive,
+							 httpdbody *body = NULL);
+	
+					 /// Find out if any object matching the uri
+					 /// takes the request body as a stream.
+					 /// \param uri The uri, without the query.
+	bool			 streamsbody (const string &uri);
 	
 					 /// Handle an event through the chain of event handlers.
 					 /// Some example events:
@@ -755,7 +1442,7 @@ public:
 					 /// \param s The request's tcpsocket.
 					 /// \param fn The path of the file to send.
 					 /// \return Number of bytes sent.
-	unsigned int	 sendfile (tcpsocket &s, const string &fn);
+	unsigned long long sendfile (tcpsocket &s, const string &fn);
 	
 					 /// Default document checker.
 					 /// \param sti The http status code.
@@ -771,15 +1458,35 @@ public:
 					 /// Shut down all threads.
 	void			 shutdown (void);
 	
+					 /// Hand a connection with a complete request
+					 /// to the worker threads. Called by the event
+					 /// loops.
+					 /// \param c The connection.
+	void			 queueconnection (class httpdconnection *c);
+	
+					 /// Wait for a connection with a complete request.
+					 /// Called by the worker threads if event loops
+					 /// are used.
+					 /// \param timeout_ms Timeout in milliseconds.
+					 /// \return The connection, or \b NULL if none
+					 ///         came up in time.
+	class httpdconnection *nextconnection (int timeout_ms);
+	
+					 /// Pick the event loop to park a new
+					 /// connection in.
+	class httpdeventloop *pickeventloop (void);
+	
 	value			 defaultdocuments; ///< Default document database.
 	tcplistener		*listener; ///< The listening socket.
 	lock<int>		 load; ///< The current connection load.
-	lock<int>		 tcplock; ///< Lock for the tcp listener.
 	threadgroup		 workers; ///< The httpd worker threads.
+	threadgroup		 loops; ///< The httpd event loop threads.
 	int				 eventmask; ///< Which event classes need handling.
+	httpdcache		 cache; ///< Response cache, off until it gets a size.
 	
 protected:
 	httpdobject			*first; ///< Linked list of httpdobjects.
+	httpdrouter			 routes; ///< Routing trie for the httpdobjects.
 	httpdeventhandler	*firsthandler; ///< Linked list of event handlers.
 	int					 minthr; ///< Minimum threads.
 	int					 maxthr; ///< Maximum threads.
@@ -787,6 +1494,26 @@ protected:
 	int					_maxpostsize; ///< Max post size.
 	bool				_shutdown; ///< True if shutdown mode is on.
 	conditional			 shutdowndone; ///< Shutdown conditional
+	int					_eventloops; ///< Number of event loop threads.
+	int					 nextloop; ///< Event loop for the next connection.
+	lock<int>			 readylock; ///< Lock for the ready queue.
+	conditional			 readycond; ///< Counts the ready queue.
+	class httpdconnection *readyfirst; ///< Ready queue head.
+	class httpdconnection *readylast; ///< Ready queue tail.
+	
+						 /// Send a response from the cache.
+						 /// \param s The request's tcpsocket.
+						 /// \param hit The cached response.
+						 /// \param inhdr The request headers.
+						 /// \param method The HTTP method.
+						 /// \param httpver The HTTP version.
+						 /// \param uri The uri of the request.
+						 /// \param keepalive Whether the connection
+						 ///                  stays open.
+	void				 sendcached (tcpsocket &s, httpdcachehit &hit,
+									 value &inhdr, const string &method,
+									 const string &httpver,
+									 const string &uri, bool keepalive);
 	
 	virtual void createlistener();
 };
@@ -826,6 +1553,10 @@ public:
 					 ///formatted string.
 	void		 	 loadkeystring (const string& cert,
 								    const string& priv = "" );
+					 
+					 /// The listener that does the handshakes, for
+					 /// its queue depth and handshake counters.
+	class ssllistener &handshakepool (void);
 
 protected:
 	virtual void	 createlistener (void);
@@ -863,7 +1594,119 @@ public:
 	virtual void	 run (void);
 
 protected:
+					 /// Read and handle a single request.
+					 /// \param s The connection.
+					 /// \param keepalive Set to \b false if the
+					 ///                  connection should be closed
+					 ///                  afterwards.
+					 /// \throw httpdWorkerException Connection broke
+					 ///        off before a full request came in.
+	void			 handlerequest (tcpsocket &s, bool &keepalive);
+	
+					 /// Turn down a request body that is too large.
+					 /// \param s The connection.
+					 /// \param sz Size of the body.
+	void			 toolarge (tcpsocket &s, unsigned int sz);
+	
+					 /// Thread implementation when the parent uses
+					 /// event loops. Picks up connections with a
+					 /// complete request until it receives an event
+					 /// with ev["command"] set to "die".
+					 /// \param threadid Thread name for events.
+	void			 runqueue (const string &threadid);
+
+	httpd			*parent; ///< Link to parent httpd.
+};
+
+// ------------------------------------------------------------------------
+// CLASS httpdconnection: A client connection handled through an event
+//                        loop.
+// ------------------------------------------------------------------------
+
+/// A client connection owned by an event loop.
+/// Between requests, the connection is parked in its event loop's epoll
+/// set. Once a complete request is buffered, it is handed to a worker
+/// thread, which gives it back after sending its response.
+class httpdconnection
+{
+public:
+					 /// Constructor.
+					 /// \param s The accepted socket (will be deleted).
+					 /// \param l The event loop owning the connection.
+					 httpdconnection (tcpsocket *s, class httpdeventloop *l);
+					 
+					 /// Destructor. Closes the socket.
+					~httpdconnection (void);
+	
+					 /// Check the socket buffer for a complete request.
+					 /// Requests with headers or a body that do not fit
+					 /// the buffer also count, the worker will read
+					 /// the rest straight from the socket.
+					 /// \param maxpostsize Largest acceptable body.
+					 /// \return \b true if a worker should handle the
+					 ///         connection.
+	bool			 hasrequest (int maxpostsize);
+	
+	tcpsocket		*sock; ///< The socket.
+	httpdeventloop	*loop; ///< The owning event loop.
+	httpdconnection	*prev; ///< Event loop list link.
+	httpdconnection	*next; ///< Event loop list link.
+	httpdconnection	*nextready; ///< Ready queue link.
+};
+
+// ------------------------------------------------------------------------
+// CLASS httpdeventloop: Keeps track of idle connections with epoll.
+// ------------------------------------------------------------------------
+
+/// Event loop thread for a httpd.
+/// Waits for data on parked connections and hands the ones with a
+/// complete request to the parent's worker threads. The first event
+/// loop also accepts new connections and divides them over all loops.
+class httpdeventloop : public groupthread
+{
+public:
+					 /// Constructor. Spawns the thread.
+					 /// \param pop Parent httpd object.
+					 /// \param accepts True if this loop should accept
+					 ///                new connections.
+					 httpdeventloop (httpd *pop, bool accepts);
+					 
+					 /// Destructor. Closes all connections.
+					~httpdeventloop (void);
+	
+					 /// Thread implementation.
+					 /// Waits for socket events. Shuts down when it
+					 /// receives an event with ev["command"] set to
+					 /// "die".
+	virtual void	 run (void);
+	
+					 /// Take a new connection and park it.
+					 /// \param c The connection.
+	void			 add (httpdconnection *c);
+	
+					 /// Park a connection that was handed to a
+					 /// worker.
+					 /// \param c The connection.
+	void			 park (httpdconnection *c);
+	
+					 /// Close a connection and forget about it.
+					 /// \param c The connection.
+	void			 drop (httpdconnection *c);
+
+protected:
+					 /// Accept all pending connections.
+	void			 acceptall (void);
+	
+					 /// Read from a connection that has data.
+					 /// \param c The connection.
+	void			 readable (httpdconnection *c);
+
 	httpd			*parent; ///< Link to parent httpd.
+	bool			 accepts; ///< True if we accept connections.
+	int				 epfd; ///< The epoll descriptor.
+	lock<int>		 lck; ///< Lock for the connection list.
+	httpdconnection	*first; ///< List of connections.
+	string			 loopid; ///< Thread name for events.
 };
 
 #endif
@@ -0,0 +1,156 @@
+// This file is part of the Grace library (libgrace).
+// The Grace library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, using version 3 of the License.
+// You should have received a copy of the GNU Lesser General Public License
+// along with Grace library. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _HTTPPARSER_H
+#define _HTTPPARSER_H 1
+
+#include <grace/str.h>
+#include <grace/statstring.h>
+#include <grace/value.h>
+
+/// Maximum number of headers kept for a request, the rest is skipped.
+#define HTTP_MAXHEADERS 48
+
+/// Parser states.
+enum httpparsestate
+{
+	HTTP_PARSE_REQUEST, ///< Waiting for the request line.
+	HTTP_PARSE_HEADERS, ///< Reading header lines.
+	HTTP_PARSE_DONE ///< Saw the empty line after the headers.
+};
+
+/// A piece of the request data, by position.
+struct httpslice
+{
+	unsigned int	 offs; ///< Offset from the start of the request.
+	unsigned int	 len; ///< Length in bytes.
+};
+
+/// A request header, by position.
+struct httpheader
+{
+	httpslice		 name; ///< Header name.
+	httpslice		 value; ///< Header value, without surrounding blanks.
+	const statstring *key; ///< Interned name for common headers, or NULL.
+};
+
+/// Incremental HTTP request parser.
+/// Works in place on request data as it comes in, normally straight
+/// on a socket's ringbuffer. Nothing is copied while parsing: the
+/// request line and headers are kept as positions in the data. Strings
+/// and the header dictionary are only created when they are asked for.
+/// Because only positions are kept, the data may move in memory
+/// between calls, as long as it stays the same from the start of
+/// the request.
+class httpparser
+{
+public:
+					 /// Constructor.
+					 httpparser (void);
+
+					 /// Destructor.
+					~httpparser (void);
+
+					 /// Forget the current request, start over.
+	void			 reset (void);
+
+					 /// Parse whatever complete lines have come in
+					 /// since the last call.
+					 /// \param data Request data, from the start of
+					 ///             the request.
+					 /// \param sz Number of bytes available.
+					 /// \return \b true if all headers are in.
+	bool			 parse (const char *data, unsigned int sz);
+
+					 /// True if all headers are in.
+	bool			 done (void) const { return state == HTTP_PARSE_DONE; }
+
+					 /// True if the request line is in.
+	bool			 gotrequest (void) const
+					 {
+					 	return state != HTTP_PARSE_REQUEST;
+					 }
+
+					 /// Size of the request line and headers, including
+					 /// the empty line. The body starts here.
+	unsigned int	 size (void) const { return pos; }
+
+					 /// Number of headers kept.
+	int				 count (void) const { return nhdr; }
+
+					 /// Access a header by index.
+	const httpheader &operator[] (int i) const { return hdr[i]; }
+
+					 /// Find a header by name, case-insensitive.
+					 /// \param data The request data.
+					 /// \param name The header name.
+					 /// \return Index of the last header by that name,
+					 ///         or \b -1.
+	int				 find (const char *data, const statstring &name) const;
+
+					 /// Compare a header value, case-insensitive.
+					 /// \param data The request data.
+					 /// \param name The header name.
+					 /// \param val The value to look for.
+	bool			 headeris (const char *data, const statstring &name,
+							   const char *val) const;
+
+					 /// Get a header value as an unsigned number.
+					 /// \param data The request data.
+					 /// \param name The header name.
+					 /// \param found Set to \b true if the header
+					 ///              was there.
+	unsigned int	 headeruval (const char *data, const statstring &name,
+								 bool &found) const;
+
+					 /// Get the request method.
+	string			*method (const char *data) const;
+
+					 /// Get the request uri.
+	string			*uri (const char *data) const;
+
+					 /// Get the protocol version, like \b 1.1. Empty
+					 /// for HTTP/0.9 requests.
+	string			*version (const char *data) const;
+
+					 /// True if the protocol named in the request
+					 /// line is HTTP/1.1.
+	bool			 ishttp11 (const char *data) const;
+
+					 /// Create the header dictionary. Keys and
+					 /// attributes come out the same as with
+					 /// strutil::parsehdr().
+					 /// \param data The request data.
+	value			*headers (const char *data) const;
+
+					 /// Look up the interned name for a header.
+					 /// \param name Pointer to the name.
+					 /// \param len Length of the name.
+					 /// \return Pointer to the statstring, or NULL.
+	static const statstring *intern (const char *name, unsigned int len);
+
+protected:
+					 /// Handle a request line.
+	void			 requestline (const char *data, unsigned int start,
+								  unsigned int end);
+
+					 /// Handle a header line.
+	void			 headerline (const char *data, unsigned int start,
+								 unsigned int end);
+
+	string			*slice (const char *data, const httpslice &s) const;
+
+	httpparsestate	 state; ///< Where we are in the request.
+	unsigned int	 pos; ///< Start of the first unparsed line.
+	httpslice		 smethod; ///< The request method.
+	httpslice		 suri; ///< The request uri.
+	httpslice		 sproto; ///< The protocol, like HTTP/1.1.
+	int				 nhdr; ///< Number of headers kept.
+	httpheader		 hdr[HTTP_MAXHEADERS]; ///< The headers.
+};
+
+#endif
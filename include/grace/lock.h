@@ -391,6 +391,7 @@ protected:
 	pthread_mutex_t			*mutex; ///< POSIX mutex.
 	pthread_cond_t			*cond; ///< POSIX conditional.
 	int						 queue; ///< Queue counter.
+	int						 waiting; ///< Number of threads waiting.
 };
 
 #endif
@@ -104,6 +104,20 @@ public:
 		return c->obj;
 	}
 	
+	/// Walk the copies of all threads. Nodes are only ever added
+	/// until destruction, so a walk can go on while other threads
+	/// get() their copy.
+	/// \param prev The previous node, or NULL to start.
+	/// \return The next node, or NULL at the end.
+	perthreadnode<kind> *walk (perthreadnode<kind> *prev)
+	{
+		sharedaccess (lck)
+		{
+			return prev ? prev->next : first;
+		}
+		return NULL;
+	}
+	
 	/// Assign the value. Whatever value you are keeping in this template
 	/// will need to be able to deal with operator= for a reference to
 	/// its own type.
@@ -0,0 +1,22 @@
+#ifndef _PLATFORM_H
+#define _PLATFORM_H
+
+
+
+
+
+
+#define PTHREAD_HAVE_RWLOCK 1
+#define PTHREAD_HAVE_TIMEDLOCK 1
+
+
+#include <crypt.h>
+
+#define HAVE_GMTOFF 1
+#define HAVE_SENDFILE 1
+#define HAVE_EPOLL 1
+#define HAVE_PASSCRED 1
+#define HAVE_SO_PEERCRED 1
+
+#define HAVE_GETHOSTBYNAME_R
+#endif
@@ -24,9 +24,23 @@ $exception (memoryLeakException, "Possible memory leak detected, "
 
 void poolsighandler (int);
 				  
+/// Largest block size (including the header) that gets a direct entry
+/// in the size class table and a per-thread cache.
+#define POOL_MAXCLASS 2048
+
+/// Number of entries in the size class table (one per 8 bytes).
+#define POOL_CLASSES ((POOL_MAXCLASS >> 3) + 1)
+
+/// Number of free blocks per size class a thread may keep for itself.
+/// Half of them are handed back to the pool in one go once the cache
+/// is full.
+#define POOL_MAGAZINE 32
+
 /// Namespace for custom memory management.
 namespace memory
 {
+	struct block;
+	
 	/// A pool of memory blocks that are of equal size.
 	struct sizepool
 	{
@@ -36,6 +50,8 @@ namespace memory
 		char			*blocks; ///< Block data.
 		struct sizepool	*extend; ///< Extension node.
 		lock<bool>		 lck; ///< Thread lock.
+		block			*freelist; ///< Free blocks of this size and its extensions.
+		unsigned int	 wired; ///< Blocks taken out of the freelist.
 	};
 	
 	/// Status of a memory block.
@@ -43,17 +59,32 @@ namespace memory
 
 	/// Allocate a sizepool object.
 	/// \param sz The block size.
-	sizepool *mkpool (unsigned int sz);
+	/// \param owner The primary pool for this size, or NULL if
+	///              the new pool is the primary.
+	sizepool *mkpool (unsigned int sz, sizepool *owner = NULL);
 					
 	/// A memory block.
 	struct block
 	{
-		sizepool		*pool; ///< Owning sizepool.
+		sizepool		*pool; ///< Primary sizepool for its size.
 		size_t			 status; ///< Allocation status.
 		
 		unsigned char	 dt[0]; ///< Data offset.
 	};
 	
+	/// Free blocks of one size kept by a thread.
+	struct magazine
+	{
+		block			*top; ///< First block, linked through their data.
+		unsigned int	 count; ///< Number of blocks.
+	};
+	
+	/// Per-thread block cache, one magazine per size class.
+	struct threadcache
+	{
+		magazine		 mag[POOL_CLASSES]; ///< Magazines by size class.
+	};
+	
 	/// A memory pool for retained pointer objects.
 	class pool
 	{
@@ -88,9 +119,37 @@ namespace memory
 		
 						 /// Free all memory
 		void			 exit (void);
+		
+						 /// Hand the blocks in a thread's cache back
+						 /// to their pools. Called on thread exit.
+		void			 flushcache (threadcache *);
 	
 	protected:
+						 /// Find or create the primary sizepool for
+						 /// a rounded block size.
+		sizepool		*getclass (size_t rndsz);
+		
+						 /// Take blocks out of a size class.
+						 /// \param c The primary sizepool.
+						 /// \param count Number of blocks wanted, set
+						 ///              to the number actually taken.
+						 /// \return Linked list of blocks.
+		block			*take (sizepool *c, unsigned int &count);
+		
+						 /// Put a linked list of blocks back into
+						 /// their size class.
+						 /// \param c The primary sizepool.
+						 /// \param chain First block.
+						 /// \param count Number of blocks.
+		void			 give (sizepool *c, block *chain, unsigned int count);
+		
+						 /// Get the calling thread's block cache.
+		threadcache		*getcache (void);
+	
 		sizepool		*pools; ///< Linked list of sizepools.
+		sizepool		*classes[POOL_CLASSES]; ///< Sizepools by size class.
+		lock<bool>		 classlock; ///< Lock for adding sizepools.
+		volatile unsigned int threadcount; ///< Threads with a block cache.
 	};
 	
 	pool *getretain (void);
@@ -73,6 +73,12 @@ public:
 	bool			 findforward (const char *seq, unsigned int sz,
 								  unsigned int &pos);
 					
+					 /// Make the unread data contiguous in memory, so
+					 /// it can be parsed in place. Only moves data
+					 /// around if it wraps past the end of the buffer.
+					 /// \return Pointer to the first unread byte.
+	const char		*linear (void);
+	
 					 /// Empty the buffer.
 	void			 flush (void) { readcursor = writecursor = 0; }
 	
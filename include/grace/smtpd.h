@@ -78,7 +78,6 @@ public:
 		
 		bool				 _shutdown; ///< If true, daemon should quit.
 		lock<int>			 load; ///< Lock and counter for active threads.
-		lock<int>			 tcplock; ///< Lock for the listener.
 		smtpeventmask		 mask; ///< Mask for worker events.
 
 							 /// Virtual method should implement a check
@@ -12,6 +12,7 @@
 #include <grace/str.h>
 #include <grace/file.h>
 #include <grace/http.h>
+#include <grace/thread.h>
 
 
 /// Exception values emitted by sslcodec
@@ -49,6 +50,11 @@ public:
 					 {
 					 	codec->nocertcheck ();
 					 }
+					 
+					 /// Returns true if the last handshake resumed
+					 /// a session kept from an earlier connection
+					 /// to the same server.
+	bool			 resumed (void);
 };
 
 /// Listening TCP socket.
@@ -56,14 +62,46 @@ public:
 /// port. Acts as a factory for connected tcpsocket objects.
 class ssllistener : public tcplistener
 {
+friend class sslhandshaker;
 public:
-				 ssllistener() : keys(0), allowpassthrough(false) {}
+				 ssllistener (void);
+				~ssllistener (void);
 
 	void		 loadkeyfile( const string& cert, const string& priv = "" );
 	void		 loadkeystring( const string& cert, const string& priv = "" );
 	
 	void		 setallowpassthrough( bool newvalue ) {allowpassthrough=newvalue;}
 	bool		 getallowpassthrough() const { return allowpassthrough;}
+	
+				 /// Do the handshakes in threads of their own. The
+				 /// threads calling accept() then only get connections
+				 /// that are done with their handshake. The threads
+				 /// start with the first accept().
+				 /// \param count Number of handshake threads, 0 to
+				 ///              do handshakes inside accept().
+				 /// \param queuesize Most connections that can be in
+				 ///                  a handshake or waiting for an
+				 ///                  accept() at the same time.
+	void		 handshakers (int count, int queuesize);
+	
+				 /// Number of established connections waiting
+				 /// for an accept().
+	int			 queued (void);
+	
+				 /// Number of handshakes in progress.
+	int			 handshaking (void);
+	
+				 /// Number of completed handshakes.
+	unsigned int handshakes (void);
+	
+				 /// Number of handshakes that failed.
+	unsigned int failedhandshakes (void);
+	
+				 /// Average time a completed handshake took, in ms.
+	double		 handshaketime (void);
+	
+				 /// Longest time a completed handshake took, in ms.
+	double		 maxhandshaketime (void);
 
 				 /// Wait for a new connection.
 				 /// \return Pointer to a new tcpsocket bound to the connection.
@@ -75,9 +113,100 @@ public:
 				 /// \return Pointer to a new tcpsocket bound to the connection,
 				 ///         or NULL when it failed.
 	virtual tcpsocket *tryaccept (double timeout);
+	
+				 /// With handshake threads, a descriptor that is
+				 /// readable while established connections are
+				 /// waiting. Otherwise the listening socket.
+	virtual int	 listenfd (void);
+
+protected:
+				 /// Does the handshake for a new connection.
+				 /// \return The connection, or NULL if the handshake
+				 ///         failed. It is deleted then.
+	tcpsocket	*handshake (tcpsocket *s);
+	
+				 /// Set up the codec for a new connection and
+				 /// count its handshake as in progress.
+	void		 beginhandshake (tcpsocket *s);
+	
+				 /// Take the handshake of a connection one read
+				 /// further.
+				 /// \param timeout Most time to wait for data, in ms.
+				 /// \return 1 if it is done, 0 if it needs more
+				 ///         data, -1 if it failed.
+	int			 stephandshake (tcpsocket *s, unsigned int timeout);
+	
+				 /// Count a handshake that is over.
+				 /// \param ok True if it succeeded.
+				 /// \param tstart When it began.
+				 /// \return The connection, or NULL if the handshake
+				 ///         failed. It is deleted then.
+	tcpsocket	*endhandshake (tcpsocket *s, bool ok,
+							   const timeval &tstart);
+	
+				 /// Start the handshake threads, if they are
+				 /// wanted and not running yet.
+	void		 startpool (void);
+	
+				 /// Claim room in the queue for a connection
+				 /// that is about to be accepted.
+	bool		 reserve (void);
+	
+				 /// Give back room claimed with reserve().
+	void		 unreserve (void);
+	
+				 /// Hand an established connection to accept(),
+				 /// using room claimed with reserve().
+	void		 enqueue (tcpsocket *s);
+	
+				 /// Take the oldest established connection.
+				 /// \return The connection, or NULL if none was
+				 ///         waiting.
+	tcpsocket	*dequeue (void);
+
 private:
 	void      	*keys;
 	bool		allowpassthrough;
+	
+	int						 poolsize; ///< Number of handshake threads.
+	int						 maxqueue; ///< Queue size.
+	class sslhandshaker		**pool; ///< The threads, NULL if not started.
+	lock<int>				 qlock; ///< Lock for the queue and counters.
+	struct sslestablished	*qfirst; ///< First waiting connection.
+	struct sslestablished	*qlast; ///< Last waiting connection.
+	int						 qcount; ///< Number of waiting connections.
+	int						 reserved; ///< Room claimed in the queue.
+	int						 inprogress; ///< Handshakes in progress.
+	unsigned int			 ndone; ///< Completed handshakes.
+	unsigned int			 nfailed; ///< Failed handshakes.
+	double					 totaltime; ///< Time taken by ndone, in ms.
+	double					 maxtime; ///< Longest of ndone, in ms.
+	conditional				 qready; ///< Raised for every queued connection.
+	int						 wakefd[2]; ///< Pipe with a byte per connection.
+};
+
+/// Handshake thread of an ssllistener. Accepts connections on the
+/// listener's socket and queues them once their handshake is done.
+/// It keeps all of its handshakes in a poll set, so a client that
+/// stalls does not hold up the others.
+class sslhandshaker : public thread
+{
+public:
+					 /// Constructor. Spawns the thread.
+					 /// \param o The listener to work for.
+					 sslhandshaker (class ssllistener *o);
+					 
+					 /// Destructor.
+					~sslhandshaker (void);
+					
+					 /// Implementation.
+	virtual void	 run (void);
+	
+					 /// Stop the thread and wait for it.
+	void			 shutdown (void);
+
+protected:
+	class ssllistener	*owner; ///< The listener.
 };
 
 
@@ -95,6 +224,10 @@ public:
 	const string	&codecerror (void);
 					 
 	void			 nocertcheck (void);
+	
+					 /// Returns true if the handshake of the current
+					 /// connection resumed an earlier session.
+	bool			 resumed (void);
 };
 
 #endif
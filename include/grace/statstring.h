@@ -29,8 +29,7 @@
 /// the bookkeeping.
 struct stringref
 {
-	stringref					*parent; ///< Link to parent node in the hash tree.
-	stringref					*lower, *higher; ///< Link to siblings in the hash tree.
+	stringref					*next; ///< Next node in the hash bucket.
 	volatile unsigned int		 key; ///< This string's hash key.
 	volatile unsigned int		 id; ///< This stringref's unique id.
 	volatile unsigned int		 refcnt; ///< Reference count.
@@ -42,42 +41,50 @@ struct stringref
 #ifndef _STRINGREFDB_T
 #define _STRINGREFDB_T 1
 
+/// Number of independently locked parts of the stringref database.
+#define STRINGREF_SHARDS 64
+
+/// Bytes worth of unreferenced strings a shard collects before they
+/// are reaped.
+#define STRINGREF_REAPSIZE 4096
+
 /// Signal handler for USR1.
 /// Dumps the stringref database to disk.
 void dumpstringref (int signal);
 
 extern statstring nokey;
 
+/// One part of the stringref database.
+/// A chained hash table with its own lock. Shards are picked by the
+/// string's hash key, so lookups of different strings rarely have to
+/// wait on each other.
+struct stringrefshard
+{
+	lock<int>					 lck; ///< Lock for the hash table.
+	stringref				   **buckets; ///< Hash buckets.
+	unsigned int				 size; ///< Number of buckets.
+	unsigned int				 count; ///< Number of stringrefs.
+	volatile unsigned int		 dirty; ///< Bytes in unreferenced nodes.
+};
+
 /// Stringref database.
-/// Keeps a global collection of stringref objects.
+/// Keeps a global collection of stringref objects. Reference counts
+/// are kept with atomic operations, so copying and destroying a
+/// statstring does not take any locks. Nodes that drop to zero
+/// references stay in the table, where getref() can pick them up
+/// again, until their shard has collected enough of them to make
+/// a cleanup worthwhile.
 class stringrefdb
 {
 friend class process;
 public:
-							 stringrefdb (void)
-							 {
-							 	root = newref();
-							 	root->key = 0x80000000;
-							 	nukeroot = NULL;
-							 	sequence = 0;
-							 	dirtycount.o = 0;
-							 	cleanups = 0;
-							 	signal (SIGUSR1, dumpstringref);
-							 }
+							 stringrefdb (void);
 							~stringrefdb (void);
 	
-							 /// Write tree to disk.
+							 /// Write database to disk.
 							 /// \param fn File name.
 	void					 print (const char *fn);
 	
-							 /// Write node to a file.
-							 /// Writes a stringref's data to a file.
-							 /// Calls itself recursively for its
-							 /// child links.
-							 /// \param ref The stringref object.
-							 /// \param f The stdio file.
-	void					 print (stringref *ref, FILE *f);
-	
 							 /// Find or allocate reference.
 							 /// Finds a stringref in its database, or
 							 /// creates a new one for a unique string.
@@ -88,18 +95,19 @@ public:
 	stringref				*getref (const char *str, unsigned int key=0);
 	
 							 /// Copy a reference (add 1 to refcount).
-	void					 cpref (stringref *ref);
+	inline void				 cpref (stringref *ref)
+							 {
+							 	__sync_add_and_fetch (&ref->refcnt, 1);
+							 }
 	
 							 /// Down reference count.
 							 /// Lowers the reference count for an allocated
 							 /// stringref object.
 	void					 unref (stringref *r);
 	
-							 /// Remove unreferenced nodes.
-							 /// Goes over a node and its children, de-
-							 /// allocates any nodes that no longer have
-							 /// live references.
-	void					 reap (stringref *);
+							 /// Remove unreferenced nodes from a shard.
+							 /// Should be called with the shard locked.
+	void					 reap (stringrefshard &);
 	
 							 /// Generate new unique id.
 							 /// Each new node in the stringref database
@@ -108,38 +116,38 @@ public:
 							 /// \return new id.
 	unsigned int			 newid (void)
 							 {
-							 	unsigned int res;
-							 	res = sequence++;
-							 	
-							 	return res;
+							 	return __sync_fetch_and_add (&sequence, 1);
 							 }
 							 
 protected:
-	stringref				*root; ///< Root node of the database.
-	stringref				*nukeroot; ///< Root node of deleted entries
-	unsigned int			 sequence; ///< Current sequence number.
-	lock<int>				 treelock; ///< Lock for the database.
+	stringrefshard			 shards[STRINGREF_SHARDS]; ///< The hash tables.
+	volatile unsigned int	 sequence; ///< Current sequence number.
+	int						 cleanups; ///< Number of times reaped.
 	
-							 /// Remove a reference from the tree.
-							 /// \param ref Pointer to the stringref.
-	void					 rmref (stringref *ref);
+							 /// Pick the shard for a hash key.
+	inline stringrefshard	&shardfor (unsigned int key)
+							 {
+							 	return shards[hashfor(key) >> 26];
+							 }
 	
-							 /// Link in new stringref.
-							 /// Adds a newly allocated stringref to
-							 /// the hash tree.
-	void					 linkref (stringref *);
+							 /// Spread a checksum key over 32 bits. The
+							 /// top bits pick the shard, the bottom bits
+							 /// pick the bucket inside the shard.
+	static inline unsigned int hashfor (unsigned int key)
+							 {
+							 	return key * 0x9e3779b1;
+							 }
 	
-							 /// Allocate a new stringref.
-							 /// \return Pointer to the new object.
-	stringref				*newref (void);
+							 /// Double the number of buckets in a shard.
+							 /// Should be called with the shard locked.
+	void					 grow (stringrefshard &);
 	
-							 /// Number of bytes worth of de-allocated
-							 /// nodes. Used by reap() to determine when
-							 /// to spring into action (going over the
-							 /// tree implies locking).
-	lock<unsigned int>		 dirtycount;
+							 /// Lock all shards. Used around fork() so the
+							 /// child process gets a consistent database.
+	void					 lockall (void);
 	
-	int						 cleanups; ///< Number of times reaped.
+							 /// Unlock all shards.
+	void					 unlockall (void);
 };
 
 #endif
@@ -214,6 +222,14 @@ public:
 						 	retainvalue (str);
 						 }
 						 
+						 /// Move-constructor. Takes over the reference
+						 /// without going through the stringref database.
+						 statstring (statstring &&str)
+						 {
+						 	ref = str.ref;
+						 	str.ref = NULL;
+						 }
+						 
 						 /// Copy-constructor (from retained value).
 						 statstring (class value *);
 						 
@@ -300,6 +316,14 @@ public:
 						 	if (ref) assert (ref->refcnt > 0);
 						 	return *this;
 						 }
+	inline statstring	&operator= (statstring &&str)
+						 {
+						 	if (&str == this) return *this;
+						 	if (ref) STRINGREF().unref (ref);
+						 	ref = str.ref;
+						 	str.ref = NULL;
+						 	return *this;
+						 }
 			
 	inline statstring	&operator= (const char *str)
 						{
@@ -52,6 +52,16 @@
 // The string class destructor will only free() the refblock if its
 // refcount is 0, otherwise the refcount will be decreased.
 //
+// The refcount is changed with atomic operations, so string objects in
+// different threads can safely share a refblock. A refcount of 0 means
+// there is a single owner, which can then change the data without any
+// further synchronization.
+//
+// Short strings do not get a refblock from the heap. Every string object
+// has room for a small refblock of its own, which is used whenever the
+// data fits. This inline block is never shared: copying a string that
+// lives in its inline block copies the bytes.
+//
 // The operator= method, when it is passed a _pointer_ to a string in
 // stead of a reference uses the abovementioned behaviour for a specific
 // task: It invokes strcpy() then deletes the pointed-to source object.
@@ -62,7 +72,7 @@
 // ========================================================================
 
 /// Reference counter for string data.
-typedef unsigned short refc_t;
+typedef volatile unsigned int refc_t;
 
 /// Unique thread key for string reference blocks.
 typedef unsigned short threadref_t;
@@ -75,11 +85,29 @@ typedef unsigned short threadref_t;
 /// share their string data if they copy eachother.
 struct refblock
 {
-	refc_t			refcount; ///< Reference count.
-	threadref_t		threadref; ///< Id of the creating thread.
+	refc_t			refcount; ///< Number of owners besides the first.
 	char			v[1]; ///< Actual array.
+	
+					/// Add an owner.
+	inline void		share (void)
+					{
+						__sync_add_and_fetch (&refcount, 1);
+					}
+	
+					/// Remove an owner.
+					/// \return True if the caller was the last
+					///         owner and should free the block.
+	inline bool		release (void)
+					{
+						if (! refcount) return true;
+						return (__sync_fetch_and_sub (&refcount, 1) == 0);
+					}
 };
 
+/// Size of the refblock stored inside a string object, including the
+/// refcount. Strings of up to 22 characters fit.
+#define STRING_INLINEALLOC (sizeof (refc_t) + 28)
+
 #endif
 
 /// Returns the unique id for the current thread.
@@ -123,6 +151,11 @@ public:
 					 /// deletes the old object.
 					 string (string *);
 					 
+					 /// Move-constructor.
+					 /// Takes over the other object's refblock without
+					 /// touching its reference count.
+					 string (string &&);
+					 
 					 /// Constructor (pre-allocated).
 					 /// Sets up the buffer for the string to at
 					 /// least the required size.
@@ -214,6 +247,7 @@ public:
 					 
 	string	&operator= (class value &);
 	string  &operator= (const class value &);
+	string	&operator= (string &&);
 	
 	inline string	&operator= (const char *str)
 					 {
@@ -604,6 +638,11 @@ public:
 					 /// be no reallocation of the buffer.
 	void			 flush (void);
 	
+					 /// Grow the buffer ahead of time.
+					 /// \param sz Number of bytes the string should be
+					 ///           able to hold without reallocation.
+	void			 reserve (unsigned int sz);
+	
 					 /// Empty the buffer.
 					 /// Reallocates the buffer storage to minimum size.
 	void			 crop (void);
@@ -678,15 +717,12 @@ public:
 					 {
 						 if (data && data->refcount)
 						 {
-						 	 threadref_t me = getref();
-						 	 
 							 refblock *old = data;
-							 data = (refblock *) malloc ((size_t) alloc);
+							 data = allocblock (alloc);
 							 bcopy (old->v+offs, data->v, size);
-							 old->refcount--;
+							 if (old->release()) freeblock (old);
 							 data->refcount = 0;
 							 data->v[size] = 0;
-							 data->threadref = me;
 							 offs = 0;
 						 }
 					 }
@@ -979,8 +1015,47 @@ protected:
 	unsigned int	 size; ///< Size of the string data.
 	unsigned int	 offs; ///< Offset of the string in the data block.
 	unsigned int	 alloc; ///< Allocated array size.
+	unsigned int	 inl[STRING_INLINEALLOC/sizeof (unsigned int)]; ///< Inline refblock.
 	refblock		*data; ///< Reference block for our string data.
 	
+					 /// True if the data lives in the inline refblock.
+	inline bool		 isinline (void) const
+					 {
+					 	return (data == (const refblock *) inl);
+					 }
+	
+					 /// Get a fresh, unshared refblock. Uses the inline
+					 /// block if the size allows it. Callers should make
+					 /// sure the inline block is not in use.
+					 /// \param sz Allocation size, including the refcount.
+	inline refblock	*allocblock (size_t sz)
+					 {
+					 	if (sz <= STRING_INLINEALLOC) return (refblock *) inl;
+					 	return (refblock *) malloc (sz);
+					 }
+	
+					 /// Resize our own, unshared, refblock.
+					 /// \param sz New allocation size.
+					 /// \return The new block.
+	refblock		*reallocblock (size_t sz);
+	
+					 /// Free an unreferenced refblock, unless it is
+					 /// the inline block.
+	inline void		 freeblock (refblock *b)
+					 {
+					 	if (b != (refblock *) inl) ::free (b);
+					 }
+	
+					 /// Move inline data out to the heap, for code that
+					 /// builds a new string out of the old data.
+	void			 unline (void);
+	
+					 /// Copy data from another string object. Shares
+					 /// its refblock, unless that is an inline block.
+	void			 sharefrom (const string &s);
+	
+					 /// Copy another string's inline refblock.
+	void			 copyinline (const string &s);
 };
 
 class charmatch
@@ -97,9 +97,43 @@ public:
 				 /// bypassing expensive context-switches.
 				 /// \param path Absolute path of the file.
 				 /// \param sz Number of bytes to send.
-	void		 sendfile (const string &path, unsigned int sz);
+				 /// \return Status, \b false if the file could not
+				 ///         be read or the client went away.
+	bool		 sendfile (const string &path, unsigned long long sz);
 	
-				 /// Derive from other tcpsocket.
+				 /// Use sendfile to send part of an open file.
+				 /// \param fd The file descriptor.
+				 /// \param offset Position in the file to start at.
+				 /// \param sz Number of bytes to send.
+				 /// \return Status, \b false if the file could not
+				 ///         be read or the client went away.
+	bool		 sendfile (int fd, unsigned long long offset,
+						   unsigned long long sz);
+	
+				 /// Hold back partial frames until uncorked, so
+				 /// a response written in pieces goes out in as
+				 /// few segments as possible. Does nothing on
+				 /// platforms without TCP_CORK.
+				 /// \param on \b true to cork, \b false to send
+				 ///           whatever is pending.
+	void		 cork (bool on);
+	
+				 /// Limit the time a blocking write may wait for
+				 /// the other side to take data. A write that
+				 /// times out fails like one on a closed socket.
+				 /// \param timeout_ms Timeout in milliseconds,
+				 ///                   \b 0 to wait forever.
+	void		 sendtimeout (int timeout_ms);
+	
+				 /// Checks a connection that is not expected to
+				 /// carry anything right now, before it is used
+				 /// again for a new request.
+				 /// \return \b true if the other side hung up or
+				 ///         sent something unasked for.
+	bool		 stale (void);
+	
+				 /// Derive from other tcpsocket. The original is
+				 /// left closed, without a codec.
 				 /// \param orig The original socket.
 				 /// \return Reference to self.
 	tcpsocket	&operator= (tcpsocket &orig);
@@ -130,7 +164,7 @@ protected:
 				 /// Backend implementation of all derivation methods.
 				 /// Flushes the internal buffer. Takes over the other
 				 /// object's filno and eof status. Copies the original's
-				 /// buffer contents. 
+				 /// buffer contents. The original is left closed.
 				 /// \param s Reference to the original object.
 	void		 derive (tcpsocket &s);
 	
@@ -193,11 +227,21 @@ public:
 				 /// \throw socketCreateAcception Error creating a BSD socket.
 	virtual tcpsocket *accept (void);
 	
-				 /// Wait for a new connection.
+				 /// Wait for a new connection. Any number of threads
+				 /// can wait on the same listener, each connection
+				 /// goes to one of them.
 				 /// \param timeout Timeout in seconds.
 				 /// \return Pointer to a new tcpsocket bound to the connection,
 				 ///         or NULL when it failed.
 	virtual tcpsocket *tryaccept (double timeout);
+	
+				 /// The listening socket's file descriptor. Can be
+				 /// used to wait for new connections with poll() or
+				 /// epoll. They should still be picked up through
+				 /// tryaccept().
+				 /// \return The descriptor, or \b -1 if the socket
+				 ///         is not listening yet.
+	virtual int	 listenfd (void);
 
 protected:
 	bool		 listening; ///< True if the socket is listening.
@@ -206,6 +250,7 @@ protected:
 	ipaddress	 bindaddress; ///< Listen address (0 for INADDR_ANY)
 	string		 unixdomainpath; ///< Listen path for AF_UNIX.
 	lock<int>	 sock; ///< Lock to allow for cross-thread non blocking.
+	int			 accepttimeout; ///< Current SO_RCVTIMEO in ms.
 };
 
 #endif
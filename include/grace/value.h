@@ -105,6 +105,20 @@ $exception (valueParsingException, "Error parsing file");
 
 typedef bool (*sortmethod) (value *, value *, const string &);
 
+/// Sort key extractor. Fills in the key that a node should be sorted
+/// by, so that a sort only has to work it out once per node.
+typedef void (*sortkeymethod) (value *, const string &, value &);
+
+/// Header of a value's child array.
+/// Copies of a value share their child array, and through it the
+/// entire subtree, until one of them is about to change it. That copy
+/// then gets its own array holding shallow copies of the children.
+struct valuearray
+{
+	volatile unsigned int	 refcount; ///< Number of values using the array.
+	unsigned int			 pad; ///< Keeps the slots pointer-aligned.
+};
+
 /// Sort method for sorting by key.
 bool labelSort (value *, value *, const string &);
 
@@ -125,6 +139,14 @@ bool naturalSort (value *, value *, const string &);
 /// is left empty, the node's key is used for sorting.
 bool naturalLabelSort (value *, value *, const string &);
 
+/// Sort key extractor for a keyed sort by the value of a child node,
+/// compared with valueSort. Picks the same child as recordSort.
+void recordSortKey (value *, const string &, value &);
+
+/// Sort key extractor for a keyed natural sort, compared with
+/// naturalSort. Picks the same string as naturalSort.
+void naturalSortKey (value *, const string &, value &);
+
 /// Function for the valuebuilder syntax. Creates a new value
 /// with one keyed child node.
 /// \param id The key.
@@ -205,6 +227,11 @@ public:
 						 /// Copy-constructor (deletes original).
 						 value (value *);
 						 
+						 /// Move-constructor.
+						 /// Takes over the other object's data, children
+						 /// and attributes, leaving it empty.
+						 value (value &&);
+						 
 						 /// Copy-constructor (from string).
 						 value (const char *);
 						 
@@ -324,6 +351,7 @@ public:
 	
 	value				&operator= (const value &v);
 	value				&operator= (value *v);
+	value				&operator= (value &&v);
 	value				&operator= (class valuable &);
 	value				&operator= (class valuable *);
 	value				&operator= (const class ipaddress &);
@@ -640,6 +668,18 @@ public:
 					 /// \param typ Registered type of the new child.
 	value			&newval (dtenum typ=t_unset);
 	
+					 /// Move a value into a new unkeyed child.
+					 /// \param v The value to take over.
+					 /// \return Reference to the new child.
+	value			&emplace (value &&v);
+	
+					 /// Move a value into a keyed child, replacing
+					 /// any existing child with the same key.
+					 /// \param k Key of the child.
+					 /// \param v The value to take over.
+					 /// \return Reference to the child.
+	value			&emplace (const statstring &k, value &&v);
+	
 					 /// Return reference to a new unkeyed child.
 					 /// \param atpos Insertion point.
 					 /// \param typ Registered type of the new child.
@@ -713,7 +753,8 @@ public:
 					 /// encode attributes.
 					 /// \param withHeaders If true, add a header row.
 					 /// \param indexName Column name for the index field.
-	string			*tocsv (bool withHeaders=true, const char *indexName="id");
+	string			*tocsv (bool withHeaders=true,
+						const char *indexName="id") const;
 	
 					 /// Save in CSV format. This export does not
 					 /// encode attributes.
@@ -721,7 +762,7 @@ public:
 					 /// \param withHeaders If true, add a header row.
 					 /// \param indexName Column name for the index field.
 	bool			 savecsv (const string &fn, bool withHeaders=true,
-							  const char *indexName="id");
+							  const char *indexName="id") const;
 
 					 /// Load from CSV format.
 					 /// \param fn File name.
@@ -876,10 +917,10 @@ public:
 
 
 	
-	void			 encodegrace (string &into, int indent);
+	void			 encodegrace (string &into, int indent) const;
 
 					 /// Convert to grace-style $() notation.
-	string			*tograce (void);
+	string			*tograce (void) const;
 
 					 /// Convert from CXML.
 					 /// Uses a binary storage format comparable to the
@@ -1048,6 +1089,29 @@ public:
 					 /// sort methods.
 	void			 sort (sortmethod, const string &);
 	
+					 /// Sort this object's child nodes using multiple
+					 /// threads. Arrays that are too small to gain
+					 /// from it are sorted by the calling thread.
+					 /// The sort method should be safe to call from
+					 /// other threads.
+					 /// \param cmpare The sort method.
+					 /// \param opt Key string for the sort method.
+					 /// \param nthreads Maximum number of threads.
+	void			 sort (sortmethod cmpare, const string &opt,
+						   int nthreads);
+	
+					 /// Sort this object's child nodes by keys that
+					 /// are extracted once for every node.
+					 /// \param getkey The key extractor, which gets
+					 ///               the key string.
+					 /// \param cmpare The sort method for comparing
+					 ///               keys, which gets an empty key
+					 ///               string.
+					 /// \param opt Key string for the extractor.
+					 /// \param nthreads Maximum number of threads.
+	void			 sort (sortkeymethod getkey, sortmethod cmpare,
+						   const string &opt, int nthreads = 1);
+	
 					 /// Filter out children that have a child node
 					 /// with a specified value.
 					 /// \param label The grandchild key to investigate.
@@ -1120,18 +1184,37 @@ public:
 	bool			 treecmp (const value &other) const;
 
 					 /// Access method for the visitor protocol.
-	value			*visitchild (const statstring &id) const
+	const value		*visitchild (const statstring &id) const
 					 {
 					 	return havechild (id.key(), id.str());
 					 }
 					 /// Access method for the visitor protocol.
-	value			*visitchild (int index) const
+	const value		*visitchild (int index) const
 					 {
+					 	packarray ();
 					 	if (index<0) return NULL;
 					 	if (!arraysz) return NULL;
 					 	if (index >= (int) arraysz) return NULL;
 					 	return array[index];
 					 }
+					 
+					 /// Access method for the visitor protocol.
+					 /// Iterating over a non-const value may change
+					 /// its children, so a shared array is split off.
+	value			*visitchild (const statstring &id)
+					 {
+					 	return havechild (id.key(), id.str());
+					 }
+					 
+					 /// Access method for the visitor protocol.
+	value			*visitchild (int index)
+					 {
+					 	unshare ();
+					 	packarray ();
+					 	if (index<0) return NULL;
+					 	if (index >= (int) arraysz) return NULL;
+					 	return array[index];
+					 }
 
 protected:
 					 /// Parse a line from an ini-file.
@@ -1196,36 +1279,104 @@ protected:
 	string			 s; ///< The string value.
 	dtype			 t; ///< The numeric value.
 	unsigned char	 _itype; ///< The intrinsic type.
+	unsigned char	 hashbits; ///< Log2 of the child hash size.
 	
 	unsigned int	 key; ///< Numeric key.
 	class statstring _name; ///< String key.
 	
-	value			*lower, *higher; ///< Hash tree links.
+	value			**hash; ///< Child hash index (keyed children).
 	value			*attrib; ///< Attributes.
 	
 	value			**array; ///< Child array.
+	unsigned int	  arrayhead; ///< Unused slots before array.
 	unsigned int	  arraysz; ///< Number of children.
 	unsigned int	  arrayalloc; ///< Allocated array size.
+	unsigned int	  arrayholes; ///< Slots of removed keyed children.
 	unsigned int	  ucount; ///< Number of unkeyed children.
-	threadref_t		  threadref; ///< Thread reference.
+	unsigned int	  arraypos; ///< Slot in the parent's array, a hint.
 	
 	void			  alloc (unsigned int c); ///< Array allocation.
 	
 					 /// Access method for the visitor protocol.
-	value			*findchild (const char *) const;
+	const value		*findchild (const char *) const;
 					 /// Access method for the visitor protocol.
 	value			*findchild (const char *);
-	value			*havechild (unsigned int, const char *) const;
+					 /// Find a keyed child, never create one. Children
+					 /// of a const value may be shared with other
+					 /// copies, so they come out const.
+	const value		*havechild (unsigned int, const char *) const;
+					 /// Find a keyed child, never create one. A shared
+					 /// array is split off first.
+	value			*havechild (unsigned int, const char *);
 					 /// Access method for the visitor protocol.
-	value			*findchild (unsigned int, const char *) const;
+	const value		*findchild (unsigned int, const char *) const;
 					 /// Access method for the visitor protocol.
 	value			*findchild (unsigned int, const char *);
 					 /// Access method for the visitor protocol.
 	value			*getposition (unsigned int);
 					 /// Access method for the visitor protocol.
-	value			*getposition (unsigned int) const;
+	const value		*getposition (unsigned int) const;
+	
+					 /// Delete the child at an array position.
+	void			 rmposition (unsigned int);
+	
+					 /// Array position of a keyed child.
+	unsigned int	 keyposition (value *);
+	
+					 /// Close the holes left by removed keyed children.
+					 /// Call this before walking the array by position.
+	inline void		 packarray (void) const
+					 {
+					 	if (arrayholes) closeholes ();
+					 }
+					 
+					 /// Implementation of packarray().
+	void			 closeholes (void) const;
+	
+					 /// Add a keyed child to the hash index, creating or
+					 /// growing the index if needed.
+	void			 hashinsert (value *);
+	
+					 /// Take a removed keyed child out of the hash index.
+	void			 hashremove (value *);
+	
+					 /// Rebuild the hash index from the child array.
+	void			 rehash (void);
+	
+					 /// Release the hash index.
+	void			 freehash (void);
+	
+					 /// Header of the child array.
+	inline valuearray *arrayheader (void) const
+					 {
+					 	return ((valuearray *) (array - arrayhead)) - 1;
+					 }
+					 
+					 /// Make sure the child array is not shared with
+					 /// other values. Call this before touching the array
+					 /// or handing out a non-const child.
+	inline void		 unshare (void)
+					 {
+					 	if (array && (arrayheader()->refcount > 1))
+					 	{
+					 		splitarray ();
+					 	}
+					 }
+					 
+					 /// Replace a shared child array by a private copy.
+	void			 splitarray (void);
+	
+					 /// Implementation of the sort methods.
+	void			 dosort (sortkeymethod getkey, sortmethod cmpare,
+							 const string &opt, int nthreads);
+	
+					 /// Start sharing another value's child array.
+	void			 sharearray (const value &);
 	
-	void			 relinktree (void);
+					 /// Let go of the child array and the hash index.
+					 /// The children are deleted if no other value
+					 /// was sharing them.
+	void			 droparray (void);
 	
 public:
 	void			 init (bool first=true);
@@ -0,0 +1,3 @@
+#ifndef _PLATFORM_H
+#define _PLATFORM_H
+#endif
@@ -0,0 +1,15 @@
+#ifndef _PLATFORM_H
+#define _PLATFORM_H
+
+
+
+
+
+
+#define PTHREAD_HAVE_RWLOCK 1
+#define PTHREAD_HAVE_TIMEDLOCK 1
+
+
+#include <crypt.h>
+
+#endif
@@ -142,12 +142,20 @@ void httpsd::loadkeystring( const string& cert, const string& priv )
 	}
 }
 
+ssllistener &httpsd::handshakepool (void)
+{
+	if (! listener) createlistener ();
+	return *((ssllistener*)listener);
+}
+
 void httpsd::createlistener()
 {
 	if (listener) delete listener;
 	
 	ssllistener* newlistener = new ssllistener();
 	newlistener->setallowpassthrough( true );
+	newlistener->handshakers (tune::ssl::handshakers,
+							  tune::ssl::handshakequeue);
 	listener = newlistener;
 	
 	if( cert_data && priv_data )
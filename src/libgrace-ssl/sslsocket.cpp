@@ -10,6 +10,13 @@
 // ========================================================================
 #include <grace/sslsocket.h>
 #include <grace/filesystem.h>
+#include <grace/defaults.h>
+#include <grace/lock.h>
+#include <grace/system.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #include <matrixssl/matrixSsl.h>
 
@@ -20,6 +27,42 @@ extern void setupMatrixSSL (void);
 
 void __sslsocket_breakme (void) {}
 
+// The most an sslcodec buffer grows to.
+#define SSLCODEC_MAXBUF 262144
+
+// Room an SSL record takes on top of the data it carries.
+#define SSLCODEC_RECORDOVERHEAD 2053
+
+// How long a handshake thread waits for a connection or for room in
+// the queue before it looks for a "die" event, in ms.
+#define SSLLISTENER_WAIT 250
+
+// Most time a handshake gets, in ms.
+#define SSLLISTENER_HANDSHAKETIME 8000
+
+/// A connection done with its handshake, waiting for accept().
+struct sslestablished
+{
+	tcpsocket		*sock; ///< The connection.
+	sslestablished	*next; ///< Next in the queue.
+};
+
+/// A connection a handshake thread is doing the handshake for.
+struct sslhandshaking
+{
+	tcpsocket		*sock; ///< The connection.
+	timeval			 tstart; ///< When the handshake began.
+	sslhandshaking	*next; ///< Next in the thread's list.
+};
+
+// Milliseconds since a point in time.
+static int mssince (const timeval &t)
+{
+	timeval tnow = core.time.unow ();
+	return ((tnow.tv_sec - t.tv_sec) * 1000) +
+		   ((tnow.tv_usec - t.tv_usec) / 1000);
+}
+
 /// An iocodec implementing SSL client traffic through MatrixSSL.
 /// Used by sslsocket as the iocodec of choice.
 class sslcodec : public iocodec
@@ -47,9 +90,16 @@ public:
 					 /// Loads decoded data into a ringbuffer.
 	bool			 fetchinput (ringbuffer &);
 	
+					 /// Returns true if decoded data is waiting for
+					 /// room in the ringbuffer.
+	bool			 pendinginput (void);
+	
 					 /// Copies currently encoded output data to a string.
 	void			 peekoutput (string &);
 	
+					 /// Returns the encoded output data in place.
+	const char		*borrowoutput (size_t &);
+	
 					 /// Used to report the number of coded output bytes
 					 /// that have been succesfully flushed.
 	void			 doneoutput (unsigned int);
@@ -60,10 +110,36 @@ public:
 	
 					 /// If called, certificate checking will be disabled.
 	void			 nocertcheck (void);
+	
+					 /// Keeps the peer, to resume its session.
+	void			 setpeer (const string &addr, int port);
+	
+					 /// Returns false once the handshake is complete.
+	bool			 expectinput (void);
+	
+					 /// A fresh client codec with the same settings.
+					 /// Server codecs stay with their connection.
+	iocodec			*duplicate (void);
+	
+					 /// Returns "nocertcheck" if certificates are
+					 /// not checked.
+	string			*variant (void);
 
 	bool			 handshakedone;
+	bool			 resumed; ///< True if the session was resumed.
 	
 protected:
+					 /// Keeps the session of a client handshake
+					 /// once it is complete.
+	void			 keepsession (void);
+	
+					 /// Makes room at the end of the output buffer,
+					 /// moving or growing it if needed.
+					 /// \return False if it would grow too large.
+	bool			 outputroom (unsigned int sz);
+	
+	string			 peer;
+	bool			 sessionkept;
 	ssl_t			*ssl;
 	sslKeys_t		*keys;
 	sslBuf_t		 inbuf;
@@ -77,6 +153,55 @@ protected:
 };
 
 
+/// A session kept for a peer.
+struct sslsession
+{
+	string			 peer;
+	sslSessionId_t	*sid;
+	time_t			 stored;
+	sslsession		*next, *prev;
+};
+
+/// Sessions of earlier client connections, by peer, so that a new
+/// connection to the same server can skip the full handshake. The
+/// most recently stored session is at the head of the list, the
+/// oldest one is dropped when there are more than
+/// tune::ssl::sessions.
+class sslsessioncache
+{
+public:
+					 sslsessioncache (void);
+					~sslsessioncache (void);
+	
+					 /// Starts a client session, offering the session
+					 /// kept for the peer if there is one.
+					 /// \return The result of matrixSslNewSession.
+	int32			 newsession (ssl_t **into, sslKeys_t *keys,
+								 const string &peer);
+	
+					 /// Keeps the session of a completed handshake.
+	void			 store (const string &peer, ssl_t *ssl);
+	
+					 /// Drops the session kept for a peer.
+	void			 forget (const string &peer);
+
+protected:
+					 /// Finds the entry for a peer. Caller should
+					 /// hold the lock.
+	sslsession		*find (const string &peer);
+	
+					 /// Takes an entry out of the list and frees it.
+					 /// Caller should hold the lock.
+	void			 remove (sslsession *s);
+	
+	lock<int>		 lck;
+	sslsession		*head;
+	sslsession		*tail;
+	int				 cnt;
+};
+
+sslsessioncache SSLSESSIONS;
+
 int dummyCertValidator (sslCertInfo_t *certInfo, void *arg)
 {
 	return 1;
@@ -130,6 +255,113 @@ void setupMatrixSSL (void)
 	}
 }
 
+// ==========================================================================
+// CONSTRUCTOR sslsessioncache
+// ==========================================================================
+sslsessioncache::sslsessioncache (void)
+{
+	head = tail = NULL;
+	cnt = 0;
+}
+
+// ==========================================================================
+// DESTRUCTOR sslsessioncache
+// ==========================================================================
+sslsessioncache::~sslsessioncache (void)
+{
+	while (head) remove (head);
+}
+
+// ==========================================================================
+// METHOD sslsessioncache::newsession
+// ==========================================================================
+int32 sslsessioncache::newsession (ssl_t **into, sslKeys_t *keys,
+								   const string &peer)
+{
+	exclusivesection (lck)
+	{
+		sslsession *s = find (peer);
+		if (s && ((time (NULL) - s->stored) > tune::ssl::sessionlife))
+		{
+			remove (s);
+			s = NULL;
+		}
+		
+		// The session is copied into the new one.
+		return matrixSslNewSession (into, keys, s ? s->sid : NULL, 0);
+	}
+	return -1;
+}
+
+// ==========================================================================
+// METHOD sslsessioncache::store
+// ==========================================================================
+void sslsessioncache::store (const string &peer, ssl_t *ssl)
+{
+	if (tune::ssl::sessions < 1) return;
+	
+	sslSessionId_t *sid = NULL;
+	if (matrixSslGetSessionId (ssl, &sid) < 0) return;
+	
+	exclusivesection (lck)
+	{
+		sslsession *s = find (peer);
+		if (s) remove (s);
+		
+		while (tail && (cnt >= tune::ssl::sessions)) remove (tail);
+		
+		s = new sslsession;
+		s->peer = peer;
+		s->sid = sid;
+		s->stored = time (NULL);
+		s->prev = NULL;
+		s->next = head;
+		if (head) head->prev = s;
+		else tail = s;
+		head = s;
+		cnt++;
+	}
+}
+
+// ==========================================================================
+// METHOD sslsessioncache::forget
+// ==========================================================================
+void sslsessioncache::forget (const string &peer)
+{
+	exclusivesection (lck)
+	{
+		sslsession *s = find (peer);
+		if (s) remove (s);
+	}
+}
+
+// ==========================================================================
+// METHOD sslsessioncache::find
+// ==========================================================================
+sslsession *sslsessioncache::find (const string &peer)
+{
+	for (sslsession *s = head; s; s = s->next)
+	{
+		if (s->peer == peer) return s;
+	}
+	return NULL;
+}
+
+// ==========================================================================
+// METHOD sslsessioncache::remove
+// ==========================================================================
+void sslsessioncache::remove (sslsession *s)
+{
+	if (s->prev) s->prev->next = s->next;
+	else head = s->next;
+	if (s->next) s->next->prev = s->prev;
+	else tail = s->prev;
+	cnt--;
+	
+	matrixSslFreeSessionId (s->sid);
+	delete s;
+}
+
 // ==========================================================================
 // CONSTRUCTOR sslcodec
 // ==========================================================================
@@ -150,8 +382,11 @@ sslcodec::sslcodec (bool server, sslKeys_t* keys)
 	outsock.start = outsock.end = outsock.buf;
 	outsock.size = 16384;
 	
+	ssl = NULL;
 	handshakedone = false;
 	disablecerts = false;
+	resumed = false;
+	sessionkept = false;
 	
 	allowpassthrough = true;
 	passthrough = false;
@@ -192,8 +427,16 @@ bool sslcodec::setup (void)
 		inbuf.start = inbuf.end = inbuf.buf;
 		insock.start = insock.end = insock.buf;
 		outsock.start = outsock.end = outsock.buf;
+		resumed = false;
+		sessionkept = false;
+		
+		// Servers keep their sessions inside MatrixSSL, clients
+		// offer the one they kept for the peer, if any.
+		if (server) rc = matrixSslNewSession (&ssl, keys, NULL, SSL_FLAGS_SERVER);
+		else rc = SSLSESSIONS.newsession (&ssl, keys, peer);
+		
 		//::printf ("setting up client hello\n");
-		if (matrixSslNewSession (&ssl, keys, NULL /*&session*/, server?SSL_FLAGS_SERVER:0 ) < 0)
+		if (rc < 0)
 		{
 			//::printf ("ssl session creation failed\n");
 			err = "MatrixSSL Session Error";
@@ -227,6 +470,62 @@ void sslcodec::nocertcheck (void)
 	disablecerts = true;
 }
 
+// ==========================================================================
+// METHOD setpeer
+// ==========================================================================
+void sslcodec::setpeer (const string &addr, int port)
+{
+	// A session set up without checking the certificate should not
+	// let a later connection that does check skip it.
+	peer.crop ();
+	peer.printf ("%s:%i", addr.str(), port);
+	if (disablecerts) peer.strcat ("/nocertcheck");
+}
+
+// ==========================================================================
+// METHOD expectinput
+// ==========================================================================
+bool sslcodec::expectinput (void)
+{
+	if (! ssl) return true;
+	return (matrixSslHandshakeIsComplete (ssl) == 0);
+}
+
+// ==========================================================================
+// METHOD duplicate
+// ==========================================================================
+iocodec *sslcodec::duplicate (void)
+{
+	if (server) return NULL;
+	
+	sslcodec *res = new sslcodec (false, keys);
+	res->disablecerts = disablecerts;
+	return res;
+}
+
+// ==========================================================================
+// METHOD variant
+// ==========================================================================
+string *sslcodec::variant (void)
+{
+	returnclass (string) res retain;
+	if (disablecerts) res = "nocertcheck";
+	return &res;
+}
+
+// ==========================================================================
+// METHOD keepsession
+// ==========================================================================
+void sslcodec::keepsession (void)
+{
+	if (server || sessionkept || (! ssl) || (! peer)) return;
+	if (matrixSslHandshakeIsComplete (ssl) == 0) return;
+	
+	sessionkept = true;
+	resumed = (matrixSslSessionIsResumed (ssl) != 0);
+	if (! resumed) SSLSESSIONS.store (peer, ssl);
+}
+
 // ==========================================================================
 // METHOD reset
 // ==========================================================================
@@ -305,6 +604,21 @@ bool sslcodec::fetchinput (ringbuffer &into)
 	alertLevel = 0;
 	alertDescription = 0;
 	
+	// Decoded data that did not fit last time goes first.
+	if (inbuf.end > inbuf.start)
+	{
+		unsigned int left = inbuf.end - inbuf.start;
+		room = into.room();
+		if (room < left)
+		{
+			into.add ((const char *) inbuf.start, room);
+			inbuf.start += room;
+			return false;
+		}
+		into.add ((const char *) inbuf.start, left);
+	}
+	inbuf.start = inbuf.end = inbuf.buf;
+	
 	//::printf ("%08x fetchinput() insock.size=%i\n", this, insock.end-insock.start);
 
 again:
@@ -315,6 +629,12 @@ again:
 	{
 		case SSL_SUCCESS:
 			//::printf ("fetchinput SSL_SUCCESS\n");
+			
+			// A resumed handshake ends with the client's message.
+			if (server && !handshakedone && matrixSslHandshakeIsComplete(ssl) != 0) 
+				handshakedone=true;
+			
+			keepsession ();
 			if (insock.end - insock.start) goto again;
 			return false;
 		
@@ -324,6 +644,8 @@ again:
 			if (server && !handshakedone && matrixSslHandshakeIsComplete(ssl) != 0) 
 				handshakedone=true;
 			
+			keepsession ();
+			
 			if (inbuf.start == inbuf.end)
 			{
 				if (into.backlog()) return false;
@@ -335,15 +657,17 @@ again:
 			room = into.room();
 			if (room< (inbuf.end-inbuf.start))
 			{
+				// The rest is handed out on the next call.
 				into.add ((const char *) inbuf.start, room);
-				memmove (inbuf.buf, inbuf.start+room, inbuf.end-(inbuf.start+room));
-				inbuf.start = inbuf.buf;
+				inbuf.start += room;
 				return false;
 			}
 			
 			if (server && !handshakedone && matrixSslHandshakeIsComplete(ssl) != 0) 
 				handshakedone=true;
 			
+			keepsession ();
+			
 			if (inbuf.end>inbuf.start)
 			{
 				into.add ((const char *) inbuf.start, inbuf.end-inbuf.start);
@@ -358,8 +682,7 @@ again:
 			
 		case SSL_SEND_RESPONSE:
 			//::printf ("fetchinput SSL_SEND_RESPONSE\n");
-			if ((outsock.size-(outsock.end - outsock.buf)) < 
-			    (inbuf.end - inbuf.start))
+			if (! outputroom (inbuf.end - inbuf.start))
 			{
 				err = "buffer snafu #18472";
 				//::printf ("buffer snafu #18472\n");
@@ -373,6 +696,7 @@ again:
 
             // once we've sent a response, we can't go back to plaintext			
 			allowpassthrough=false;
+			keepsession ();
 
 			memmove (outsock.start+(inbuf.end-inbuf.start), outsock.start, outsock.end-outsock.start);
 			memcpy (outsock.start, inbuf.start, inbuf.end-inbuf.start);
@@ -429,6 +753,9 @@ again:
 				default:
 					err = "Unknown MatrixSSL error"; break;
 			}
+			
+			// Do not offer a session the server choked on again.
+			if (! server) SSLSESSIONS.forget (peer);
 			inbuf.start = inbuf.end = inbuf.buf;
 			//::printf ("EX_SSL_PROTOCOL_ERROR\n");
 			throw (EX_SSL_PROTOCOL_ERROR);
@@ -463,6 +790,14 @@ again:
 	return false;
 }
 
+// ==========================================================================
+// METHOD pendinginput
+// ==========================================================================
+bool sslcodec::pendinginput (void)
+{
+	return (inbuf.end > inbuf.start);
+}
+
 // ==========================================================================
 // METHOD addclose
 // ==========================================================================
@@ -483,27 +818,18 @@ bool sslcodec::addoutput (const char *dat, size_t sz)
 {
 	int rc;
 
-    // try to clean up the outsocket
-	if (outsock.buf < outsock.start)
-	{
-		if (outsock.start == outsock.end)
-		{
-			outsock.start = outsock.end = outsock.buf;
-		}
-		else
-		{
-			memmove (outsock.buf, outsock.start, outsock.end-outsock.start);
-			outsock.end -= (outsock.start - outsock.buf);
-			outsock.start = outsock.buf;
-		}
-	}
-	
 	if (!passthrough)
 	{
 		if (! handshakedone)
 		{
 			throw (EX_SSL_NO_HANDSHAKE);
 		}
+		
+		if (! outputroom (sz + SSLCODEC_RECORDOVERHEAD))
+		{
+			err = "MatrixSSL Buffer Error";
+			throw (EX_SSL_BUFFER_SNAFU);
+		}
 	
 		rc = matrixSslEncode (ssl, (unsigned char*)dat, sz, &outsock);
 		switch (rc)
@@ -528,7 +854,7 @@ bool sslcodec::addoutput (const char *dat, size_t sz)
 	}
     else
     {
-        if( (outsock.end + sz) > (outsock.buf+outsock.size) )
+        if (! outputroom (sz))
         {
 				err = "MatrixSSL Buffer Error";
 				//::printf ("buffer snafu #626139\n");
@@ -548,11 +874,44 @@ bool sslcodec::addoutput (const char *dat, size_t sz)
 // ==========================================================================
 bool sslcodec::canoutput (unsigned int sz)
 {
-	if (((outsock.end - outsock.buf)+sz) >= outsock.size)
+	unsigned int waiting = outsock.end - outsock.start;
+	if ((waiting + sz + SSLCODEC_RECORDOVERHEAD) > SSLCODEC_MAXBUF)
 		return false;
 	return true;
 }
 
+// ==========================================================================
+// METHOD outputroom
+// ==========================================================================
+bool sslcodec::outputroom (unsigned int sz)
+{
+	if ((outsock.end + sz) <= (outsock.buf + outsock.size)) return true;
+	
+	// Move what is waiting to the front.
+	if (outsock.start == outsock.end)
+	{
+		outsock.start = outsock.end = outsock.buf;
+	}
+	else if (outsock.buf < outsock.start)
+	{
+		memmove (outsock.buf, outsock.start, outsock.end-outsock.start);
+		outsock.end -= (outsock.start - outsock.buf);
+		outsock.start = outsock.buf;
+	}
+	
+	unsigned int endoffs = outsock.end - outsock.buf;
+	unsigned int newsize = outsock.size;
+	while ((endoffs + sz) > newsize) newsize *= 2;
+	if (newsize == outsock.size) return true;
+	if (newsize > SSLCODEC_MAXBUF) return false;
+	
+	outsock.buf = (unsigned char *) realloc (outsock.buf, (size_t) newsize);
+	outsock.size = newsize;
+	outsock.start = outsock.buf;
+	outsock.end = outsock.buf + endoffs;
+	return true;
+}
+
 // ==========================================================================
 // METHOD peekoutput
 // ==========================================================================
@@ -567,6 +926,15 @@ void sslcodec::peekoutput (string &into)
 	into.strcat ((const char *)outsock.start, nsz);
 }
 
+// ==========================================================================
+// METHOD borrowoutput
+// ==========================================================================
+const char *sslcodec::borrowoutput (size_t &sz)
+{
+	sz = outsock.end - outsock.start;
+	return (const char *) outsock.start;
+}
+
 // ==========================================================================
 // METHOD doneoutput
 // ==========================================================================
@@ -602,6 +970,15 @@ sslsocket::~sslsocket (void)
 //	codec = NULL;
 }
 
+// ==========================================================================
+// METHOD sslsocket::resumed
+// ==========================================================================
+bool sslsocket::resumed (void)
+{
+	if (! codec) return false;
+	return ((sslcodec *) codec)->resumed;
+}
+
 // ==========================================================================
 // OPERATOR sslsocket =
 // ==========================================================================
@@ -613,6 +990,57 @@ sslsocket &sslsocket::operator= (sslsocket *orig)
 	return *this;
 }
 
+// ==========================================================================
+// CONSTRUCTOR ssllistener
+// ==========================================================================
+ssllistener::ssllistener (void)
+{
+	keys = NULL;
+	allowpassthrough = false;
+	poolsize = 0;
+	maxqueue = 1;
+	pool = NULL;
+	qfirst = qlast = NULL;
+	qcount = 0;
+	reserved = 0;
+	inprogress = 0;
+	ndone = nfailed = 0;
+	totaltime = maxtime = 0.0;
+	wakefd[0] = wakefd[1] = -1;
+}
+
+// ==========================================================================
+// DESTRUCTOR ssllistener
+// ----------------------
+// The handshake threads go first, connections they queued that nobody
+// picked up are closed.
+// ==========================================================================
+ssllistener::~ssllistener (void)
+{
+	if (pool)
+	{
+		// Tell them all before waiting for the first one.
+		for (int i=0; i<poolsize; ++i) pool[i]->sendevent ("die");
+		for (int i=0; i<poolsize; ++i)
+		{
+			pool[i]->shutdown ();
+			delete pool[i];
+		}
+		delete[] pool;
+		pool = NULL;
+	}
+	
+	tcpsocket *s;
+	while ((s = dequeue ()))
+	{
+		s->close ();
+		delete s;
+	}
+	
+	if (wakefd[0] >= 0) ::close (wakefd[0]);
+	if (wakefd[1] >= 0) ::close (wakefd[1]);
+}
+
 // ==========================================================================
 // METHOD ssllistener::loadkeyfile
 // ==========================================================================
@@ -669,59 +1097,23 @@ tcpsocket *ssllistener::accept (void)
 	
 	while (! result)
 	{
-		result = tcplistener::accept();
-		if (result)
+		if (poolsize)
 		{
-			sslcodec* codec = new sslcodec( true, (sslKeys_t*)keys );
-			result->codec = codec;
-			codec->refcnt=1;
-			codec->allowpassthrough = allowpassthrough;
-			codec->setup();
-			
-			int numrounds = 0;
-			
-			while (!codec->handshakedone && !codec->passthrough)
-			{
-				numrounds++;
-				if (numrounds > 16)
-				{
-					result->close();
-					delete result;
-					result = NULL;
-				}
-				try
-				{
-					result->readbuffer( 128, 500 );
-
-				    // if the codec went to passthrough mode, remove it
-                    if (codec->passthrough)
-                    {
-                    	delete codec;
-                    	result->codec = NULL;
-                    }
-
-					if (result->eof())
-					{
-						result->close();
-						delete result;
-						result = NULL;
-					}
-					result->flush();
-				}
-				catch (...)
-				{
-					delete result;
-					result = NULL;
-					break;
-				}
-			}
+			result = tryaccept (SSLLISTENER_WAIT / 1000.0);
+			continue;
 		}
+		
+		result = tcplistener::accept();
+		if (result) result = handshake (result);
 	}
 	return result;
 }
 	
 // ==========================================================================
 // METHOD ssllistener::tryaccept
+// ------------------------------
+// With handshake threads, waits for one of them to queue a connection.
+// Otherwise the handshake is done right here.
 // ==========================================================================
 tcpsocket *ssllistener::tryaccept(double timeout)
 {
@@ -730,57 +1122,476 @@ tcpsocket *ssllistener::tryaccept(double timeout)
 		throw noKeysAvailableException();
 	}
 	
-	tcpsocket* result = tcplistener::tryaccept( timeout );
-	if (result)
+	if (! poolsize)
 	{
-		sslcodec* codec = new sslcodec( true, (sslKeys_t*)keys );
-		result->codec = codec;
-		codec->refcnt=1;
-		codec->allowpassthrough = allowpassthrough;
-		codec->setup();
+		tcpsocket* result = tcplistener::tryaccept( timeout );
+		if (result) result = handshake (result);
+		return result;
+	}
+	
+	startpool ();
+	
+	tcpsocket *result = dequeue ();
+	if (result || (timeout <= 0.0)) return result;
+	
+	timeval tstart = core.time.unow ();
+	int waitms = (int) (1000.0 * timeout);
+	
+	while (! result)
+	{
+		timeval tnow = core.time.unow ();
+		int spent = ((tnow.tv_sec - tstart.tv_sec) * 1000) +
+					((tnow.tv_usec - tstart.tv_usec) / 1000);
+		
+		if (spent >= waitms) break;
 		
-		int numrounds = 0;
+		// Look at the queue even after a timeout, another thread
+		// may have taken the connection we were woken up for.
+		qready.wait (waitms - spent);
+		result = dequeue ();
+	}
+	
+	return result;
+}
+
+// ==========================================================================
+// METHOD ssllistener::listenfd
+// ==========================================================================
+int ssllistener::listenfd (void)
+{
+	if (! poolsize) return tcplistener::listenfd ();
+	if (! listening) return -1;
+	
+	startpool ();
+	return wakefd[0];
+}
+
+// ==========================================================================
+// METHOD ssllistener::handshake
+// ==========================================================================
+tcpsocket *ssllistener::handshake (tcpsocket *s)
+{
+	timeval tstart = core.time.unow ();
+	beginhandshake (s);
+	
+	int st = 0;
+	while (! st)
+	{
+		int left = SSLLISTENER_HANDSHAKETIME - mssince (tstart);
+		if (left <= 0) st = -1;
+		else st = stephandshake (s, left);
+	}
+	
+	return endhandshake (s, (st > 0), tstart);
+}
+
+// ==========================================================================
+// METHOD ssllistener::beginhandshake
+// ==========================================================================
+void ssllistener::beginhandshake (tcpsocket *s)
+{
+	sslcodec* codec = new sslcodec( true, (sslKeys_t*)keys );
+	s->codec = codec;
+	codec->refcnt=1;
+	codec->allowpassthrough = allowpassthrough;
+	codec->setup();
+	
+	exclusivesection (qlock) { inprogress++; }
+}
+
+// ==========================================================================
+// METHOD ssllistener::stephandshake
+// ==========================================================================
+int ssllistener::stephandshake (tcpsocket *s, unsigned int timeout)
+{
+	sslcodec *codec = (sslcodec *) s->codec;
+	
+	try
+	{
+		s->readbuffer (256, timeout);
+		
+		// if the codec went to passthrough mode, remove it
+		if (codec->passthrough)
+		{
+			delete codec;
+			s->codec = NULL;
+			return 1;
+		}
+		
+		if (s->eof()) return -1;
+		s->flush();
+	}
+	catch (...)
+	{
+		return -1;
+	}
+	
+	return codec->handshakedone ? 1 : 0;
+}
+
+// ==========================================================================
+// METHOD ssllistener::endhandshake
+// ==========================================================================
+tcpsocket *ssllistener::endhandshake (tcpsocket *s, bool ok,
+									  const timeval &tstart)
+{
+	timeval tnow = core.time.unow ();
+	double ms = ((tnow.tv_sec - tstart.tv_sec) * 1000.0) +
+				((tnow.tv_usec - tstart.tv_usec) / 1000.0);
+	
+	exclusivesection (qlock)
+	{
+		inprogress--;
+		if (ok)
+		{
+			ndone++;
+			totaltime += ms;
+			if (ms > maxtime) maxtime = ms;
+		}
+		else nfailed++;
+	}
+	
+	if (! ok)
+	{
+		s->close();
+		delete s;
+		return NULL;
+	}
+	
+	return s;
+}
 
-		while (!codec->handshakedone && !codec->passthrough )
+// ==========================================================================
+// METHOD ssllistener::handshakers
+// ==========================================================================
+void ssllistener::handshakers (int count, int queuesize)
+{
+	exclusivesection (qlock)
+	{
+		if (pool) breaksection return;
+		
+		poolsize = (count > 0) ? count : 0;
+		maxqueue = (queuesize > 0) ? queuesize : 1;
+		
+		if (poolsize && (wakefd[0] < 0))
 		{
-			numrounds++;
-			if (numrounds > 16)
+			if (pipe (wakefd) == 0)
 			{
-				result->close();
-				delete result;
-				return NULL;
+				fcntl (wakefd[0], F_SETFL, O_NONBLOCK);
+				fcntl (wakefd[1], F_SETFL, O_NONBLOCK);
+				fcntl (wakefd[0], F_SETFD, FD_CLOEXEC);
+				fcntl (wakefd[1], F_SETFD, FD_CLOEXEC);
 			}
-			try
-			{
-				result->readbuffer( 256, 500 );
+			else wakefd[0] = wakefd[1] = -1;
+		}
+	}
+}
 
-				// if the codec went to passthrough mode, remove it
-                if (codec->passthrough)
-                {
-                	delete codec;
-                	result->codec = NULL;
-                }
+// ==========================================================================
+// METHOD ssllistener::startpool
+// ==========================================================================
+void ssllistener::startpool (void)
+{
+	if (pool || (! poolsize) || (! listening)) return;
+	
+	exclusivesection (qlock)
+	{
+		if (pool) breaksection return;
+		
+		sslhandshaker **p = new sslhandshaker* [poolsize];
+		for (int i=0; i<poolsize; ++i) p[i] = new sslhandshaker (this);
+		pool = p;
+	}
+}
 
+// ==========================================================================
+// METHOD ssllistener::reserve
+// ==========================================================================
+bool ssllistener::reserve (void)
+{
+	bool res = false;
+	
+	exclusivesection (qlock)
+	{
+		if ((qcount + reserved) < maxqueue)
+		{
+			reserved++;
+			res = true;
+		}
+	}
+	
+	return res;
+}
 
-				if (result->eof())
-				{
-					result->close();
-					delete result;
-					return NULL;
-				}
-				result->flush();
+// ==========================================================================
+// METHOD ssllistener::unreserve
+// ==========================================================================
+void ssllistener::unreserve (void)
+{
+	exclusivesection (qlock) { reserved--; }
+}
+
+// ==========================================================================
+// METHOD ssllistener::enqueue
+// ==========================================================================
+void ssllistener::enqueue (tcpsocket *s)
+{
+	sslestablished *e = new sslestablished;
+	e->sock = s;
+	e->next = NULL;
+	
+	exclusivesection (qlock)
+	{
+		if (qlast) qlast->next = e;
+		else qfirst = e;
+		qlast = e;
+		qcount++;
+		reserved--;
+		
+		if (wakefd[1] >= 0) (void) write (wakefd[1], "", 1);
+	}
+	
+	qready.signal ();
+}
+
+// ==========================================================================
+// METHOD ssllistener::dequeue
+// ==========================================================================
+tcpsocket *ssllistener::dequeue (void)
+{
+	sslestablished *e = NULL;
+	
+	exclusivesection (qlock)
+	{
+		e = qfirst;
+		if (e)
+		{
+			qfirst = e->next;
+			if (! qfirst) qlast = NULL;
+			qcount--;
+			
+			char c;
+			if (wakefd[0] >= 0) (void) read (wakefd[0], &c, 1);
+		}
+	}
+	
+	if (! e) return NULL;
+	
+	tcpsocket *res = e->sock;
+	delete e;
+	return res;
+}
+
+// ==========================================================================
+// METHOD ssllistener::queued
+// ==========================================================================
+int ssllistener::queued (void)
+{
+	int res;
+	sharedsection (qlock) { res = qcount; }
+	return res;
+}
+
+// ==========================================================================
+// METHOD ssllistener::handshaking
+// ==========================================================================
+int ssllistener::handshaking (void)
+{
+	int res;
+	sharedsection (qlock) { res = inprogress; }
+	return res;
+}
+
+// ==========================================================================
+// METHOD ssllistener::handshakes
+// ==========================================================================
+unsigned int ssllistener::handshakes (void)
+{
+	unsigned int res;
+	sharedsection (qlock) { res = ndone; }
+	return res;
+}
+
+// ==========================================================================
+// METHOD ssllistener::failedhandshakes
+// ==========================================================================
+unsigned int ssllistener::failedhandshakes (void)
+{
+	unsigned int res;
+	sharedsection (qlock) { res = nfailed; }
+	return res;
+}
+
+// ==========================================================================
+// METHOD ssllistener::handshaketime
+// ==========================================================================
+double ssllistener::handshaketime (void)
+{
+	double res = 0.0;
+	sharedsection (qlock)
+	{
+		if (ndone) res = totaltime / ndone;
+	}
+	return res;
+}
+
+// ==========================================================================
+// METHOD ssllistener::maxhandshaketime
+// ==========================================================================
+double ssllistener::maxhandshaketime (void)
+{
+	double res;
+	sharedsection (qlock) { res = maxtime; }
+	return res;
+}
+
+// ==========================================================================
+// CONSTRUCTOR sslhandshaker
+// ==========================================================================
+sslhandshaker::sslhandshaker (ssllistener *o) : thread ("sslhandshaker")
+{
+	owner = o;
+	spawn ();
+}
+
+// ==========================================================================
+// DESTRUCTOR sslhandshaker
+// ==========================================================================
+sslhandshaker::~sslhandshaker (void)
+{
+}
+
+// ==========================================================================
+// METHOD sslhandshaker::run
+// -------------------------
+// Polls the listening socket together with the connections whose
+// handshake is under way, and takes each of them a step further as
+// data comes in. Every connection holds room in the queue from the
+// moment it is accepted, a full queue leaves new connections in the
+// kernel's backlog.
+// ==========================================================================
+void sslhandshaker::run (void)
+{
+	struct pollfd *pfd = new struct pollfd[owner->maxqueue + 1];
+	sslhandshaking *first = NULL;
+	bool haveroom = false;
+	
+	while (true)
+	{
+		value ev = nextevent ();
+		if (ev && (ev.type() == "die")) break;
+		
+		if (! haveroom) haveroom = owner->reserve ();
+		
+		int lfd = haveroom ? owner->tcplistener::listenfd () : -1;
+		int n = 0;
+		
+		if (lfd >= 0)
+		{
+			pfd[n].fd = lfd;
+			pfd[n].events = POLLIN;
+			pfd[n].revents = 0;
+			n++;
+		}
+		
+		for (sslhandshaking *h = first; h; h = h->next)
+		{
+			pfd[n].fd = h->sock->filno;
+			pfd[n].events = POLLIN;
+			pfd[n].revents = 0;
+			n++;
+		}
+		
+		if (! n)
+		{
+			__musleep (SSLLISTENER_WAIT / 10);
+			continue;
+		}
+		
+		if (poll (pfd, n, SSLLISTENER_WAIT) < 0) continue;
+		
+		int i = 0;
+		sslhandshaking *fresh = NULL;
+		
+		// Take a new connection. Another thread may have beaten us
+		// to it, then the room we claimed is kept for the next.
+		if ((lfd >= 0) && pfd[i++].revents)
+		{
+			tcpsocket *s = NULL;
+			try
+			{
+				s = owner->tcplistener::tryaccept (0.0);
 			}
-			catch (...)
+			catch (exception e)
 			{
-				delete result;
-				result = NULL;
-				break;
 			}
+			
+			if (s)
+			{
+				owner->beginhandshake (s);
+				fresh = new sslhandshaking;
+				fresh->sock = s;
+				fresh->tstart = core.time.unow ();
+				haveroom = false;
+			}
+		}
+		
+		sslhandshaking **link = &first;
+		while (*link)
+		{
+			sslhandshaking *h = *link;
+			int st = 0;
+			
+			if (pfd[i++].revents) st = owner->stephandshake (h->sock, 0);
+			if ((! st) && (mssince (h->tstart) > SSLLISTENER_HANDSHAKETIME))
+			{
+				st = -1;
+			}
+			
+			if (! st)
+			{
+				link = &h->next;
+				continue;
+			}
+			
+			*link = h->next;
+			tcpsocket *s = owner->endhandshake (h->sock, (st > 0), h->tstart);
+			delete h;
+			
+			if (s) owner->enqueue (s);
+			else owner->unreserve ();
+		}
+		
+		// The new connection was not in this round's poll set.
+		if (fresh)
+		{
+			fresh->next = first;
+			first = fresh;
 		}
 	}
-	return result;
+	
+	// Whatever was still going on is cut off.
+	while (first)
+	{
+		sslhandshaking *h = first;
+		first = h->next;
+		owner->endhandshake (h->sock, false, h->tstart);
+		owner->unreserve ();
+		delete h;
+	}
+	
+	if (haveroom) owner->unreserve ();
+	delete[] pfd;
 }
 
+// ==========================================================================
+// METHOD sslhandshaker::shutdown
+// ==========================================================================
+void sslhandshaker::shutdown (void)
+{
+	sendevent ("die");
+	hasfinished.wait ();
+}
 
 // ==========================================================================
 // CONSTRUCTOR httpssocket
@@ -806,5 +1617,11 @@ void httpssocket::nocertcheck (void)
 	_sock.codec->nocertcheck();
 }
 
-
-
+// ==========================================================================
+// METHOD resumed
+// ==========================================================================
+bool httpssocket::resumed (void)
+{
+	if (! _sock.codec) return false;
+	return ((sslcodec *) _sock.codec)->resumed;
+}
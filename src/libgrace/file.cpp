@@ -18,6 +18,7 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -37,7 +38,7 @@ file::file (void)
 	nonblocking = false;
 	codec = NULL;
 	errcode = FERR_OK;
-	
+	holding = false;
 }
 
 // ========================================================================
@@ -73,31 +74,77 @@ void file::flush (void)
 	flushcodec ();
 }
 
+// Held output is written once it grows over this.
+#define FILE_MAXHOLD 65536
+
+// Plain data is handed to a codec in pieces of this size, which is
+// the most an SSL record can carry.
+#define FILE_CODECRECORD 16384
+
+// Coded output is written once this much is waiting.
+#define FILE_CODECBATCH 65536
+
+// ========================================================================
+// METHOD ::releaseoutput
+// ========================================================================
+bool file::releaseoutput (void)
+{
+	if (! holding) return true;
+	
+	bool res = flushheld ();
+	holding = false;
+	return res;
+}
+
+// ========================================================================
+// METHOD ::flushheld
+// ========================================================================
+bool file::flushheld (void)
+{
+	if (! holdbuf.strlen()) return true;
+	
+	string out = holdbuf;
+	holdbuf.crop ();
+	
+	holding = false;
+	bool res = puts (out);
+	holding = true;
+	return res;
+}
+
+// ========================================================================
+// METHOD ::fetchpending
+// ========================================================================
+bool file::fetchpending (void)
+{
+	if ((! codec) || (! codec->pendinginput())) return false;
+	
+	unsigned int before = buffer.backlog();
+	if (codec->fetchinput (buffer)) flushcodec ();
+	return (buffer.backlog() != before);
+}
+
 // ========================================================================
 // METHOD ::flushcodec
 // ========================================================================
-void file::flushcodec (void)
+bool file::flushcodec (void)
 {
-	if (! codec) return;
-	string dt;
-	codec->peekoutput (dt);
+	if (! codec) return true;
+	
+	size_t szleft;
+	const char *dt = codec->borrowoutput (szleft);
 	
-	if (dt.strlen())
+	while (szleft > 0)
 	{
-		int szleft = dt.strlen();
-		int szdone = 0;
-		int sz;
-		
-		while (szleft > 0)
-		{
-			sz = ::write (filno, dt.str() + szdone, szleft);
-			if (sz<=0) break;
-			szdone += sz;
-			szleft -=sz;
-		}
+		int sz = ::write (filno, dt, szleft);
+		if (sz<=0) return false;
 		
-		if (szdone) codec->doneoutput (szdone);
+		// The borrowed buffer may move once output is taken.
+		codec->doneoutput ((unsigned int) sz);
+		dt = codec->borrowoutput (szleft);
 	}
+	
+	return true;
 }
 
 // ========================================================================
@@ -172,25 +219,12 @@ bool file::openwrite (const string &path, int mode)
 	
 	if (codec)
 	{
-		if (! codec->setup())
+		if ((! codec->setup()) || (! flushcodec ()))
 		{
 			::close (filno);
 			feof = true;
 			return false;
 		}
-		string outbuf;
-		int szdone;
-		codec->peekoutput (outbuf);
-		if (outbuf.strlen())
-		{
-			szdone = write (filno, outbuf.str(), outbuf.strlen());
-			if ( (szdone<=0) && (errno != EAGAIN) )
-			{
-				::close (filno);
-				feof = true;
-				return false;
-			}
-		}
 	}
 	
 	return true;
@@ -237,17 +271,7 @@ bool file::openwrite (int fid)
 	feof = false;
 	if (codec)
 	{
-		if (! codec->setup())
-		{
-			::close (filno);
-			feof = true;
-			return false;
-		}
-		string outbuf;
-		int szdone;
-		codec->peekoutput (outbuf);
-		szdone = write (filno, outbuf.str(), outbuf.strlen());
-		if ( (szdone<=0) && (errno != EAGAIN) )
+		if ((! codec->setup()) || (! flushcodec ()))
 		{
 			::close (filno);
 			feof = true;
@@ -264,22 +288,17 @@ bool file::openwrite (int fid)
 // ========================================================================
 void file::close (void)
 {
+	if (holding)
+	{
+		if (filno >= 0) flushheld ();
+		holding = false;
+		holdbuf.crop ();
+	}
+	
 	if (codec)
 	{
-		string dat;
 		codec->addclose();
-		codec->peekoutput (dat);
-		int result = write (filno, dat.str(), dat.strlen());
-		if (result == -1)
-		{
-			// assume a temporary hickup
-			result = write (filno, dat.str() + result, dat.strlen() - result);
-			
-			if (result == -1)
-			{
-				// ignore
-			}
-		}
+		if (filno >= 0) (void) flushcodec ();
 	}
 	if (filno>=0) ::close (filno);
 	filno = -1;
@@ -315,17 +334,13 @@ int file::tryputs (const char *str, size_t sz, unsigned int timeout_ms)
 {
 	if (feof) return -1;
 	if (filno<0) return -1;
+	if (holding && (! flushheld ())) return -1;
 
 	int szdone = 0;
 	
-	fd_set fds;
-	struct timeval tv;
-			
-	tv.tv_sec = timeout_ms/1000;
-	tv.tv_usec = (timeout_ms % 1000) * 1000;
-	
-	FD_ZERO(&fds);
-	FD_SET(filno,&fds);
+	struct pollfd pfd;
+	pfd.fd = filno;
+	pfd.events = POLLOUT;
 
 	if (! nonblocking)
 	{
@@ -337,37 +352,36 @@ int file::tryputs (const char *str, size_t sz, unsigned int timeout_ms)
 
 	if (codec)
 	{
-		string outbuf;
-		codec->peekoutput (outbuf);
-		szdone = write (filno, outbuf.str(), outbuf.strlen());
-		if ( (szdone<=0) && (errno == EAGAIN) )
+		// Get rid of what is still waiting first.
+		size_t outsz;
+		const char *outbuf = codec->borrowoutput (outsz);
+		if (outsz)
 		{
-			if (select (filno+1, NULL, &fds, NULL, &tv) > 0)
+			szdone = write (filno, outbuf, outsz);
+			if ( (szdone<=0) && (errno == EAGAIN) )
 			{
-				szdone = write (filno, outbuf.str(), outbuf.strlen());
+				if (poll (&pfd, 1, timeout_ms) > 0)
+				{
+					szdone = write (filno, outbuf, outsz);
+				}
 			}
+			if ((szdone < 0) && (errno == EAGAIN)) szdone = 0;
+			if (szdone < 0) return szdone;
+			if (szdone > 0) codec->doneoutput ((unsigned int) szdone);
 		}
-		if ((szdone < 0) && (errno == EAGAIN)) szdone = 0;
-		if (szdone>0) codec->doneoutput ((unsigned int) szdone);
-		
-		if (szdone < 0) return szdone;
 		
-		if (codec->canoutput (sz))
+		// Then take what fits, which counts as written once the
+		// codec has it.
+		if (sz > FILE_CODECRECORD) sz = FILE_CODECRECORD;
+		if ((! codec->canoutput (sz)) || (! codec->addoutput (str, sz)))
 		{
-			if (codec->addoutput (str, sz))
-			{
-				szdone = sz;
-			}
-			else szdone = 0;
+			return 0;
 		}
-		else szdone = 0;
+		szdone = sz;
 
-		if (szdone>0)
-		{
-			codec->peekoutput (outbuf);
-			szdone = write (filno, outbuf.str(), outbuf.strlen());
-			if ( (szdone<=0) && (errno == EAGAIN) ) szdone = 0;
-		}
+		outbuf = codec->borrowoutput (outsz);
+		int wr = write (filno, outbuf, outsz);
+		if (wr > 0) codec->doneoutput ((unsigned int) wr);
 	}
 	else
 	{
@@ -375,7 +389,7 @@ int file::tryputs (const char *str, size_t sz, unsigned int timeout_ms)
 		
 		if ( (szdone<=0) && (errno == EAGAIN) )
 		{
-			if (select (filno+1, NULL, &fds, NULL, &tv) > 0)
+			if (poll (&pfd, 1, timeout_ms) > 0)
 			{
 				szdone = write (filno, str, sz);
 			}
@@ -394,6 +408,13 @@ bool file::puts (const char *str, size_t sz)
 	if (feof) return false;
 	if (filno<0) return false;
 	
+	if (holding)
+	{
+		holdbuf.strcat (str, sz);
+		if (holdbuf.strlen() > FILE_MAXHOLD) return flushheld ();
+		return true;
+	}
+	
 	size_t szleft = sz;
 	size_t szdone = 0;
 
@@ -410,36 +431,26 @@ bool file::puts (const char *str, size_t sz)
 	
 	if (codec)
 	{
-		size_t inszleft = sz;
-		size_t inszdone = 0;
-		while (inszleft > 0)
+		// Code whole records, and write a batch of them at a time
+		// straight out of the codec's buffer.
+		while (szleft > 0)
 		{
-			//::printf ("codec called\n");
-			if (codec->addoutput (str+inszdone, (inszleft > 4096 ? 4096 : inszleft)))
+			size_t rec = (szleft > FILE_CODECRECORD) ? FILE_CODECRECORD
+													 : szleft;
+			
+			if (! codec->addoutput (str+szdone, rec)) return false;
+			szdone += rec;
+			szleft -= rec;
+			
+			size_t waiting;
+			(void) codec->borrowoutput (waiting);
+			if (szleft && (waiting < FILE_CODECBATCH)) continue;
+			
+			if (! flushcodec ())
 			{
-				szdone = 0;
-				int sz;
-				inszdone += (inszleft > 4096 ? 4096 : inszleft);
-				inszleft -= (inszleft > 4096 ? 4096 : inszleft);
-				
-				string dat;
-				codec->peekoutput (dat);
-				szleft = dat.strlen();
-				//::printf ("2.szleft=%i\n", szleft);
-				while (szleft>0)
-				{
-					sz = write (filno, dat.str() + szdone, szleft);
-					if (sz<=0)
-					{
-						feof = true;
-						return false;
-					}
-					szdone += sz;
-					szleft -= sz;
-				}
-				codec->doneoutput (szdone);
+				feof = true;
+				return false;
 			}
-			else return false;
 		}
 		return true;
 	}
@@ -460,6 +471,106 @@ bool file::puts (const char *str, size_t sz)
 	return true;
 }
 
+// ========================================================================
+// METHOD ::puts
+// -------------
+// Gathering write. A codec gets the blocks one by one, it has to
+// encode them anyway, held output gets them one by one as well.
+// Otherwise they go to writev() in batches of
+// FILE_MAXIOV, picking up where a short write left off.
+// ========================================================================
+#define FILE_MAXIOV 16
+
+bool file::puts (const struct iovec *iov, int cnt)
+{
+	if (feof) return false;
+	if (filno<0) return false;
+	
+	if (codec || holding)
+	{
+		for (int i=0; i<cnt; ++i)
+		{
+			if (! puts ((const char *) iov[i].iov_base, iov[i].iov_len))
+				return false;
+		}
+		return true;
+	}
+
+	if (nonblocking)
+	{
+		int opts;
+		opts = fcntl (filno,F_GETFL);
+		if (opts>=0)
+		{
+			(void) fcntl (filno,F_SETFL, opts & (~O_NONBLOCK));
+			nonblocking = false;
+		}
+	}
+	
+	struct iovec vec[FILE_MAXIOV];
+	int done = 0; // First block not completely written.
+	size_t skip = 0; // Bytes of that block already written.
+	
+	while (true)
+	{
+		while ((done < cnt) && (skip == iov[done].iov_len))
+		{
+			++done;
+			skip = 0;
+		}
+		if (done >= cnt) break;
+		
+		int n = 0;
+		for (int i=done; (i<cnt) && (n<FILE_MAXIOV); ++i)
+		{
+			vec[n] = iov[i];
+			if (i == done)
+			{
+				vec[n].iov_base = ((char *) iov[i].iov_base) + skip;
+				vec[n].iov_len -= skip;
+			}
+			++n;
+		}
+		
+		ssize_t sz = ::writev (filno, vec, n);
+		if (sz<=0)
+		{
+			feof = true;
+			return false;
+		}
+		
+		while ((done < cnt) && (sz > 0))
+		{
+			size_t left = iov[done].iov_len - skip;
+			if ((size_t) sz < left)
+			{
+				skip += sz;
+				break;
+			}
+			sz -= left;
+			skip = 0;
+			++done;
+		}
+	}
+	
+	return true;
+}
+
+// ========================================================================
+// METHOD ::puts
+// ========================================================================
+bool file::puts (const string &a, const string &b)
+{
+	struct iovec iov[2];
+	
+	iov[0].iov_base = (void *) a.str();
+	iov[0].iov_len = a.strlen();
+	iov[1].iov_base = (void *) b.str();
+	iov[1].iov_len = b.strlen();
+	
+	return puts (iov, 2);
+}
+
 // ========================================================================
 // METHOD ::printf
 // ---------------
@@ -637,6 +748,8 @@ string *file::gets (int maxlinesize)
 		int sz;
 		size_t wanted;
 		
+		if (fetchpending ()) continue;
+		
 		wanted = defaults::sz::file::readbuf;
 		if (wanted > buffer.room()) wanted = buffer.room();
 
@@ -744,6 +857,7 @@ bool file::waitforline (string &into, int timeout_ms, int maxlinesize)
 		throw fileNotOpenException();
 	}
 	
+	if (! buffer.hasline()) fetchpending ();
 	unsigned int room = buffer.room();
 
 	if (room && (! buffer.hasline()))
@@ -756,16 +870,12 @@ bool file::waitforline (string &into, int timeout_ms, int maxlinesize)
 			nonblocking = true;
 		}
 		
-		fd_set fds;
-		struct timeval tv;
+		struct pollfd pfd;
 		char buf[8192];
 		int ssz;
 		
-		tv.tv_sec = timeout_ms/1000;
-		tv.tv_usec = (timeout_ms % 1000) * 1000;
-		
-		FD_ZERO(&fds);
-		FD_SET(filno,&fds);
+		pfd.fd = filno;
+		pfd.events = POLLIN;
 
 readmore:		
 		ssz = ::read (filno, buf, (room<8192) ? room : 8192);
@@ -796,7 +906,7 @@ readmore:
 		}
 		else
 		{
-			if (select (filno+1, &fds, NULL, NULL, &tv) > 0)
+			if (poll (&pfd, 1, timeout_ms) > 0)
 			{
 				ssz = ::read (filno, buf, (room<8192) ? room : 8192);
 				if (ssz > 0)
@@ -835,11 +945,6 @@ readmore:
 
 	if (buffer.hasline (eolpos))
 	{
-		if (! eolpos)
-		{
-			into.crop(0);
-			return true;
-		}
 		if (eolpos >= (unsigned int) maxlinesize)
 		{
 			into = buffer.read (maxlinesize);
@@ -899,7 +1004,13 @@ int file::readbuffer (size_t sz, unsigned int timeout_ms)
 		throw fileNotOpenException();
 	}
 	
-	if (buffer.room() < 8) return 0;
+	if (buffer.room() < FILE_MINROOM) return 0;
+	
+	// Anything held back goes out before waiting for the other side.
+	if (holding) flushheld ();
+	
+	unsigned int before = buffer.backlog();
+	if (fetchpending ()) return buffer.backlog() - before;
 
 
 	unsigned int rsz = sz;
@@ -913,22 +1024,18 @@ int file::readbuffer (size_t sz, unsigned int timeout_ms)
 		nonblocking = true;
 	}
 	
-	fd_set fds;
-	struct timeval tv;
+	struct pollfd pfd;
 	char buf[65536];
 	
-	tv.tv_sec = timeout_ms/1000;
-	tv.tv_usec = (timeout_ms % 1000) * 1000;
-	
-	FD_ZERO(&fds);
-	FD_SET(filno,&fds);
+	pfd.fd = filno;
+	pfd.events = POLLIN;
 	
 	int ssz;
 	ssz = ::read (filno, buf, rsz < sizeof(buf) ? rsz : sizeof(buf));
 	
 	if (timeout_ms)
 	{
-		if ((ssz <= 0) && (errno==EAGAIN) && (select (filno+1, &fds, NULL, NULL, &tv) > 0) )
+		if ((ssz <= 0) && (errno==EAGAIN) && (poll (&pfd, 1, timeout_ms) > 0) )
 		{
 			ssz = ::read (filno, buf, rsz < sizeof(buf) ? rsz : sizeof(buf) );
 		}
@@ -963,7 +1070,9 @@ int file::readbuffer (size_t sz, unsigned int timeout_ms)
 	}
 	else if (ssz <= 0)
 	{
-		if (errno != EAGAIN) feof = true;
+		// A read of zero bytes is the end of the file, errno may
+		// still be left over from an earlier call.
+		if ((ssz == 0) || (errno != EAGAIN)) feof = true;
 	}
 	return 0;
 }
@@ -1006,6 +1115,8 @@ string *file::read (size_t psz)
 	char buf[defaults::sz::file::readbuf];
 	while ( (! feof) && (buffer.backlog() < sz) )
 	{
+		if (fetchpending ()) continue;
+		
 		unsigned int am = defaults::sz::file::readbuf;
 		if (am > buffer.room()) am = buffer.room();
 
@@ -1053,7 +1164,7 @@ string *file::read (size_t sz, int timeout_ms)
 		throw endOfFileException();
 	}
 
-	if (buffer.backlog() >= sz)
+	if ((buffer.backlog() >= sz) || fetchpending ())
 	{
 		return buffer.read (sz);
 	}
@@ -1067,28 +1178,24 @@ string *file::read (size_t sz, int timeout_ms)
 	}
 	
 	
-	fd_set fds;
-	struct timeval tv;
+	struct pollfd pfd;
 	char buf[defaults::sz::file::readbuf];
 	int ssz;
 	unsigned int am = defaults::sz::file::readbuf;
 	if (am > buffer.room()) am = buffer.room();
 	
-	tv.tv_sec = timeout_ms/1000;
-	tv.tv_usec = (timeout_ms % 1000) * 1000;
-	
-	FD_ZERO(&fds);
-	FD_SET(filno,&fds);
+	pfd.fd = filno;
+	pfd.events = POLLIN;
 	
 	if (codec)
 	{
-		string obuf;
+		size_t osz;
 		int szdone;
 		
-		codec->peekoutput (obuf);
-		if (obuf.strlen())
+		const char *obuf = codec->borrowoutput (osz);
+		if (osz)
 		{
-			szdone = write (filno, obuf.str(), obuf.strlen());
+			szdone = write (filno, obuf, osz);
 			if (szdone>0) codec->doneoutput ((unsigned int) szdone);
 			else if (szdone < 0)
 			{
@@ -1116,7 +1223,7 @@ string *file::read (size_t sz, int timeout_ms)
 		}
 				  
 		if ( (timeout_ms) &&
-	         (select (filno+1, &fds, NULL, NULL, &tv) <= 0) )
+	         (poll (&pfd, 1, timeout_ms) <= 0) )
 	    {
 	    	errcode = FERR_TIMEOUT;
 	    	err = errortext::file::rdto_select;
@@ -1250,6 +1357,14 @@ bool iocodec::fetchinput (ringbuffer &into)
 	return false;
 }
 
+// ========================================================================
+// METHOD ::pendinginput
+// ========================================================================
+bool iocodec::pendinginput (void)
+{
+	return false;
+}
+
 // ========================================================================
 // METHOD ::peekoutput
 // ========================================================================
@@ -1257,6 +1372,17 @@ void iocodec::peekoutput (string &into)
 {
 }
 
+// ========================================================================
+// METHOD ::borrowoutput
+// ========================================================================
+const char *iocodec::borrowoutput (size_t &sz)
+{
+	outcopy.crop ();
+	peekoutput (outcopy);
+	sz = outcopy.strlen();
+	return outcopy.str();
+}
+
 // ========================================================================
 // METHOD ::doneoutput
 // ========================================================================
@@ -1286,3 +1412,35 @@ const string &iocodec::error (void)
 void iocodec::nocertcheck (void)
 {
 }
+
+// ==========================================================================
+// METHOD iocodec::setpeer
+// ==========================================================================
+void iocodec::setpeer (const string &addr, int port)
+{
+}
+
+// ==========================================================================
+// METHOD iocodec::expectinput
+// ==========================================================================
+bool iocodec::expectinput (void)
+{
+	return true;
+}
+
+// ==========================================================================
+// METHOD iocodec::duplicate
+// ==========================================================================
+iocodec *iocodec::duplicate (void)
+{
+	return NULL;
+}
+
+// ==========================================================================
+// METHOD iocodec::variant
+// ==========================================================================
+string *iocodec::variant (void)
+{
+	returnclass (string) res retain;
+	return &res;
+}
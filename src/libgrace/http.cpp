@@ -13,6 +13,8 @@
 #include <grace/defaults.h>
 #include <grace/application.h>
 
+httpconnectionpool HTTPCONNECTIONS;
+
 // ========================================================================
 // CONSTRUCTOR
 // -----------
@@ -34,11 +36,11 @@ httpsocket::httpsocket (void)
 // ========================================================================
 // DESTRUCTOR
 // ----------
-// Closes the http socket if there was one open
+// Lets go of the http socket if there was one open
 // ========================================================================
 httpsocket::~httpsocket (void)
 {
-	if (_host.strlen()) _sock.close();
+	release ();
 }
 
 // ========================================================================
@@ -136,12 +138,7 @@ string *httpsocket::post (const string &url, const string &ctype,
 	// not supposed to open a direct connection
 	if (unixdomain)
 	{
-		if (_host.strlen())
-		{
-			_sock.close();
-			_host.crop(0);
-			_port = 0;
-		}
+		release ();
 		_host = hostpart;
 		_keepalive = false;
 		
@@ -278,12 +275,7 @@ string *httpsocket::get (const string &url, value *hdr)
 tryagain:
 	if (unixdomain)
 	{
-		if (_host.strlen())
-		{
-			_sock.close();
-			_host.crop(0);
-			_port = 0;
-		}
+		release ();
 		_host = hostpart;
 		_keepalive = false;
 		
@@ -376,25 +368,98 @@ tryagain:
 // ========================================================================
 bool httpsocket::connectToHost (const string &hostname, int port)
 {
-	if ((_keepalive) && (_host == hostname) && (_port == port) && (! _sock.eof()))
+	string key = poolkey (hostname, port);
+	
+	if ((_keepalive) && (_host.strlen()) && (_poolkey == key) &&
+		(! _sock.stale()))
 	{
 		return true;
 	}
-	if (_host.strlen())
+	
+	release ();
+	
+	if (_keepalive)
 	{
-		_sock.close();
-		_host.crop(0);
-		_port = 0;
+		tcpsocket *s = HTTPCONNECTIONS.checkout (key);
+		if (s)
+		{
+			_sock = s;
+			_host = hostname;
+			_port = port;
+			_poolkey = key;
+			return true;
+		}
 	}
+	
 	if (_sock.connect (hostname, port))
 	{
 		_host = hostname;
 		_port = port;
+		_poolkey = key;
 		return true;
 	}
 	return false;
 }
 
+// ========================================================================
+// METHOD ::release
+// ----------------
+// A connection can only go to the pool if the socket gets a fresh codec
+// for its next connection. Plain connections have no codec to begin
+// with.
+// ========================================================================
+void httpsocket::release (void)
+{
+	if (! _host.strlen()) return;
+	
+	bool keep = (_keepalive && _poolkey.strlen() && (! _sock.stale()));
+	iocodec *next = NULL;
+	
+	if (keep && _sock.codec)
+	{
+		next = _sock.codec->duplicate ();
+		if (! next) keep = false;
+	}
+	
+	if (keep)
+	{
+		tcpsocket *s = new tcpsocket;
+		*s = _sock;
+		_sock.codec = next;
+		HTTPCONNECTIONS.checkin (_poolkey, s);
+	}
+	else
+	{
+		_sock.close ();
+	}
+	
+	_host.crop (0);
+	_port = 0;
+	_poolkey.crop (0);
+}
+
+// ========================================================================
+// METHOD ::poolkey
+// ----------------
+// Connections through a codec only fit requests with the same codec
+// settings.
+// ========================================================================
+string *httpsocket::poolkey (const string &hostname, int port)
+{
+	returnclass (string) res retain;
+	
+	res.printf ("%s://%s:%i", _sock.codec ? "https" : "http",
+				hostname.str(), port);
+	
+	if (_sock.codec)
+	{
+		string variant = _sock.codec->variant ();
+		if (variant.strlen()) res.printf ("/%s", variant.str());
+	}
+	
+	return &res;
+}
+
 // ========================================================================
 // METHOD ::getChunked
 // -------------------
@@ -650,6 +715,14 @@ string *httpsocket::getResult (value *hdr)
 		
 		status = thestatus;
 		
+		// A server that says it will hang up leaves nothing worth
+		// keeping around.
+		bool closing = false;
+		if (headers->exists ("Connection"))
+		{
+			closing = ((*headers)["Connection"].sval().strcasecmp ("close") == 0);
+		}
+		
 		if (headers->exists ("Content-Length"))
 			csz = (*headers)["Content-Length"].uval();
 
@@ -663,7 +736,16 @@ string *httpsocket::getResult (value *hdr)
 				
 				try
 				{
-					if (getChunked (result)) return &result;
+					if (getChunked (result))
+					{
+						if (closing)
+						{
+							_sock.close ();
+							_host.crop (0);
+							_port = 0;
+						}
+						return &result;
+					}
 				}
 				catch (...)
 				{
@@ -673,6 +755,9 @@ string *httpsocket::getResult (value *hdr)
 					_sock.close ();
 					_host.crop (0);
 				}
+				_sock.close ();
+				_host.crop (0);
+				_port = 0;
 				result.crop (0);
 				return &result;
 			}
@@ -682,8 +767,20 @@ string *httpsocket::getResult (value *hdr)
 		
 		if (getData (result, csz))
 		{
+			if (closing)
+			{
+				_sock.close ();
+				_host.crop (0);
+				_port = 0;
+			}
 			return &result;
 		}
+		
+		// What is left of the body may still show up, the connection
+		// is of no use for another request.
+		_sock.close ();
+		_host.crop (0);
+		_port = 0;
 		result.crop (0);
 		return &result;
 	}
@@ -719,3 +816,205 @@ void httpsocket::authentication (const string &user, const string &pass)
 	
 	postheaders["Authorization"] = authdata;
 }
+
+// ========================================================================
+// CONSTRUCTOR httpconnectionpool
+// ========================================================================
+httpconnectionpool::httpconnectionpool (void)
+{
+	head = tail = NULL;
+	cnt = 0;
+	nreused = 0;
+	nstale = 0;
+}
+
+// ========================================================================
+// DESTRUCTOR httpconnectionpool
+// -----------------------------
+// Only runs when the process exits, the kernel closes whatever is
+// left. Closing through the codecs at this point would use parts of
+// the library that may already be gone.
+// ========================================================================
+httpconnectionpool::~httpconnectionpool (void)
+{
+}
+
+// ========================================================================
+// METHOD httpconnectionpool::checkout
+// -----------------------------------
+// Takes the most recently used connection for the key. Whether the
+// server hung up in the meantime is checked outside of the lock, a
+// connection that did is thrown away and the next one is tried.
+// ========================================================================
+tcpsocket *httpconnectionpool::checkout (const string &key)
+{
+	while (true)
+	{
+		httpidleconn *gone = NULL;
+		httpidleconn *c = NULL;
+		
+		exclusivesection (lck)
+		{
+			expire (gone);
+			for (c = head; c; c = c->next)
+			{
+				if (c->key == key) break;
+			}
+			if (c) unlink (c);
+		}
+		
+		discard (gone);
+		if (! c) return NULL;
+		
+		tcpsocket *res = c->sock;
+		delete c;
+		
+		if (! res->stale())
+		{
+			exclusivesection (lck) { nreused++; }
+			return res;
+		}
+		
+		exclusivesection (lck) { nstale++; }
+		res->close ();
+		delete res;
+	}
+}
+
+// ========================================================================
+// METHOD httpconnectionpool::checkin
+// ----------------------------------
+// Makes room by dropping the oldest connection for the key, or the
+// oldest one overall.
+// ========================================================================
+void httpconnectionpool::checkin (const string &key, tcpsocket *s)
+{
+	if ((tune::http::perhost < 1) || (tune::http::poolsize < 1))
+	{
+		s->close ();
+		delete s;
+		return;
+	}
+	
+	httpidleconn *gone = NULL;
+	httpidleconn *c = new httpidleconn;
+	c->key = key;
+	c->sock = s;
+	c->lastuse = time (NULL);
+	c->prev = NULL;
+	
+	exclusivesection (lck)
+	{
+		expire (gone);
+		
+		int samekey = 0;
+		httpidleconn *oldest = NULL;
+		for (httpidleconn *crsr = head; crsr; crsr = crsr->next)
+		{
+			if (crsr->key == key)
+			{
+				samekey++;
+				oldest = crsr;
+			}
+		}
+		
+		if (oldest && (samekey >= tune::http::perhost))
+		{
+			unlink (oldest);
+			oldest->next = gone;
+			gone = oldest;
+		}
+		
+		while (tail && (cnt >= tune::http::poolsize))
+		{
+			httpidleconn *old = tail;
+			unlink (old);
+			old->next = gone;
+			gone = old;
+		}
+		
+		c->next = head;
+		if (head) head->prev = c;
+		else tail = c;
+		head = c;
+		cnt++;
+	}
+	
+	discard (gone);
+}
+
+// ========================================================================
+// METHOD httpconnectionpool::clear
+// ========================================================================
+void httpconnectionpool::clear (void)
+{
+	httpidleconn *gone = NULL;
+	
+	exclusivesection (lck)
+	{
+		gone = head;
+		head = tail = NULL;
+		cnt = 0;
+	}
+	
+	discard (gone);
+}
+
+// ========================================================================
+// METHOD httpconnectionpool::count
+// ========================================================================
+int httpconnectionpool::count (void)
+{
+	sharedsection (lck)
+	{
+		breaksection return cnt;
+	}
+	return 0;
+}
+
+// ========================================================================
+// METHOD httpconnectionpool::expire
+// ---------------------------------
+// The list is ordered by the time of checkin, so the connections that
+// were idle for too long are all at the tail.
+// ========================================================================
+void httpconnectionpool::expire (httpidleconn *&into)
+{
+	time_t now = time (NULL);
+	
+	while (tail && ((now - tail->lastuse) > tune::http::idletime))
+	{
+		httpidleconn *old = tail;
+		unlink (old);
+		old->next = into;
+		into = old;
+	}
+}
+
+// ========================================================================
+// METHOD httpconnectionpool::unlink
+// ========================================================================
+void httpconnectionpool::unlink (httpidleconn *c)
+{
+	if (c->prev) c->prev->next = c->next;
+	else head = c->next;
+	if (c->next) c->next->prev = c->prev;
+	else tail = c->prev;
+	c->next = c->prev = NULL;
+	cnt--;
+}
+
+// ========================================================================
+// METHOD httpconnectionpool::discard
+// ========================================================================
+void httpconnectionpool::discard (httpidleconn *list)
+{
+	while (list)
+	{
+		httpidleconn *next = list->next;
+		list->sock->close ();
+		delete list->sock;
+		delete list;
+		list = next;
+	}
+}
@@ -13,6 +13,8 @@
 //      ^	^
 
 #include <grace/httpd.h>
+#include <grace/httpparser.h>
+#include <grace/commonkeys.h>
 #include <grace/value.h>
 #include <grace/lock.h>
 #include <grace/strutil.h>
@@ -21,6 +23,13 @@
 #include <grace/timestamp.h>
 #include <grace/xmlschema.h>
 #include <grace/case.h>
+#include "platform.h"
+
+#ifdef HAVE_EPOLL
+  #include <sys/epoll.h>
+#endif
+#include <errno.h>
+#include <sys/stat.h>
 
 // ========================================================================
 // CONSTRUCTOR httpd
@@ -38,6 +47,9 @@ httpd::httpd (const string &DomainSocket, int inmint, int inmaxt)
 	first = NULL;
 	firsthandler = NULL;
 	_shutdown = false;
+	_eventloops = 0;
+	nextloop = 0;
+	readyfirst = readylast = NULL;
 }
 
 httpd::httpd (int listenport, int inmint, int inmaxt)
@@ -53,6 +65,9 @@ httpd::httpd (int listenport, int inmint, int inmaxt)
 	first = NULL;
 	firsthandler = NULL;
 	_shutdown = false;
+	_eventloops = 0;
+	nextloop = 0;
+	readyfirst = readylast = NULL;
 }
 
 httpd::httpd (void)
@@ -67,6 +82,9 @@ httpd::httpd (void)
 	first = NULL;
 	firsthandler = NULL;
 	_shutdown = false;
+	_eventloops = 0;
+	nextloop = 0;
+	readyfirst = readylast = NULL;
 }
 
 // ========================================================================
@@ -153,21 +171,37 @@ const string &httpd::defaultdocument (int sti)
 // threads, then starts keeping track of the connection load and spawns
 // new threads up to a configured maximum if needed. If the load gets low,
 // it will ask some threads to end their life the next time they wake up.
+// With event loops, the load counts the requests being handled, rather
+// than the open connections.
 // ========================================================================
 void httpd::run (void)
 {
 	int skimcount = 0;
 	int tdelay = 0;
 	
+#ifndef HAVE_EPOLL
+	_eventloops = 0;
+#endif
+	
 	// Spawn the worker threads
 	for (int i=0; i<minthr; ++i)
 		new httpdworker (this);
 	
+	// Spawn the event loops. The first one takes care of the
+	// listening socket, it goes last so that the others are
+	// there to take connections.
+	for (int i=_eventloops-1; i>=0; --i)
+		new httpdeventloop (this, i == 0);
+	
 	// Main loop
 	while (! _shutdown)
 	{
 		value ev = waitevent (tune::httpd::mainthread::idle * 1000);
-		if (ev.type() == "die") break;
+		if (ev.type() == "die")
+		{
+			_shutdown = true;
+			break;
+		}
 
 		int tload;
 		
@@ -223,6 +257,15 @@ void httpd::run (void)
 		workers.gc ();
 	}
 	
+	// The workers are gone, so every connection is back with its
+	// event loop, which closes them all on its way out.
+	loops.broadcastevent ("die");
+	while (loops.count())
+	{
+		loops.gc ();
+	}
+	readyfirst = readylast = NULL;
+	
 	shutdowndone.broadcast ();
 }
 
@@ -233,17 +276,77 @@ void httpd::shutdown (void)
 {
 	sendevent ("die");
 	shutdowndone.wait ();
+
+	// The thread still touches the object on its way out after
+	// run() returns, so the caller may not delete it before then.
+	hasfinished.wait ();
 	workers.gc ();
 }
 
+// ========================================================================
+// METHOD httpd::queueconnection
+// ========================================================================
+void httpd::queueconnection (httpdconnection *c)
+{
+	c->nextready = NULL;
+	
+	exclusivesection (readylock)
+	{
+		if (readylast) readylast->nextready = c;
+		else readyfirst = c;
+		readylast = c;
+	}
+	
+	readycond.signal ();
+}
+
+// ========================================================================
+// METHOD httpd::nextconnection
+// ========================================================================
+httpdconnection *httpd::nextconnection (int timeout_ms)
+{
+	httpdconnection *res = NULL;
+	
+	// Look at the queue even after a timeout, in case we lost
+	// a wakeup somewhere.
+	readycond.wait (timeout_ms);
+	
+	exclusivesection (readylock)
+	{
+		res = readyfirst;
+		if (res)
+		{
+			readyfirst = res->nextready;
+			if (! readyfirst) readylast = NULL;
+			res->nextready = NULL;
+		}
+	}
+	
+	return res;
+}
+
+// ========================================================================
+// METHOD httpd::pickeventloop
+// ---------------------------
+// Divides new connections over the event loops round robin. Only
+// called from the event loop that accepts connections.
+// ========================================================================
+httpdeventloop *httpd::pickeventloop (void)
+{
+	if (nextloop >= loops.count()) nextloop = 0;
+	return (httpdeventloop *) &(loops[nextloop++]);
+}
+
 // ========================================================================
 // METHOD httpd::addobject
 // -----------------------
 // Normally called from the httpdobject creator, links a httpdobject to
-// the end of the chain.
+// the end of the chain and files it in the routing trie.
 // ========================================================================
 void httpd::addobject (httpdobject *obj)
 {
+	routes.add (obj);
+	
 	obj->next = NULL;
 	if (! first)
 	{
@@ -256,6 +359,22 @@ void httpd::addobject (httpdobject *obj)
 	crsr->next = obj;
 }
 
+// ========================================================================
+// METHOD httpd::streamsbody
+// ========================================================================
+bool httpd::streamsbody (const string &uri)
+{
+	httpdroutecursor route (routes, uri);
+	httpdobject *crsr;
+	
+	while ((crsr = route.next()))
+	{
+		if (crsr->streambody) return true;
+	}
+	
+	return false;
+}
+
 // ========================================================================
 // METHOD httpd::addeventhandler
 // -----------------------------
@@ -300,6 +419,7 @@ const char *httpstatusstr (int st)
 		case 301: return "MOVED PERM";
 		case 302: return "FOUND";
 		case 303: return "SEE OTHER";
+		case 304: return "NOT MODIFIED";
 		case 400: return "BAD REQUEST";
 		case 401: return "UNAUTHORIZED";
 		case 403: return "FORBIDDEN";
@@ -382,13 +502,17 @@ void httpd::eventhandle (const value &ev)
 // ==========================================================================
 // METHOD httpd::sendfile
 // ==========================================================================
-unsigned int httpd::sendfile (tcpsocket &s, const string &fn)
+unsigned long long httpd::sendfile (tcpsocket &s, const string &fn)
 {
-	if (! fs.exists (fn)) return 0;
-	unsigned int sz = fs.size (fn);
+	struct stat st;
+	string path = fs.transr (fn);
+	
+	// fs.size() stops at 4 GB, ask for the size ourselves.
+	if (::stat (path.str(), &st)) return 0;
+	unsigned long long sz = st.st_size;
 	
-	s.puts ("Content-length: %i\r\n\r\n" %format (sz));
-	s.sendfile (fn, sz);
+	s.puts ("Content-length: %U\r\n\r\n" %format (sz));
+	if (! s.sendfile (path, sz)) return 0;
 	return sz;
 }
 
@@ -409,19 +533,25 @@ unsigned int httpd::sendfile (tcpsocket &s, const string &fn)
 // On a positive status return, this method picks up any provided
 // headers out of the outhdr value object, adds a content-length and
 // returns the headers + outbody to the client socket.
+//
+// If the request body was left on the socket, objects that set
+// streambody get it through runbody(), the others see the empty
+// postbody.
 // ========================================================================
 void httpd::handle (string &uri, string &postbody, value &inhdr,
 					const string &method, const string &httpver,
-					tcpsocket &s, bool &keepalive)
+					tcpsocket &s, bool &keepalive, httpdbody *body)
 {
-	httpdobject *crsr = first;
+	httpdobject *crsr;
 	value env;
 	value outhdr;
 	string outbody;
 	string rawuri = uri;
 	rawuri.cropat ('?');
 	
-	unprotected (load)
+	// Parked connections do not tie up a worker thread, so with
+	// event loops there is no need to turn keepalive down.
+	if (! _eventloops) unprotected (load)
 	{
 		if ( (tune::httpd::keepalive::trigger * load) > workers.count() )
 		keepalive = false;
@@ -430,102 +560,175 @@ void httpd::handle (string &uri, string &postbody, value &inhdr,
 	// Give the objects access to the keepalive status
 	env << $("keepalive", keepalive) ->
 		   $("method", method) ->
+		   $("httpver", httpver) ->
 		   $("ip", s.peer_name) ->
 		   $("referrer", inhdr["Referer"]);
 	
-	// Loop over the chain
-	while (crsr)
+	// A cached response goes out before any object gets to see the
+	// request. Requests with credentials always go through the chain,
+	// or the objects that check them would be skipped.
+	string cachekey;
+	bool cachefill = false;
+	
+	if (cache.size() && (method == "GET") &&
+		(! inhdr.exists ("Authorization")))
 	{
-		// Does this one match?
-		if (rawuri.globcmp (crsr->urimatch))
+		httpdcachehit hit;
+		
+		cachekey = "%s %s %s" %format (method, inhdr["Host"], uri);
+		int st = cache.lookup (cachekey, inhdr, hit);
+		
+		if (st == HTTPDCACHE_HIT)
+		{
+			sendcached (s, hit, inhdr, method, httpver, uri, keepalive);
+			return;
+		}
+		
+		cachefill = (st == HTTPDCACHE_FILL);
+	}
+	
+	// Walk the objects whose urimatch applies, in chain order
+	httpdroutecursor route (routes, rawuri);
+	while ((crsr = route.next()))
+	{
+		int res;
+		
+		// Let it do its magic
+		try
+		{
+			if (body && crsr->streambody)
+			{
+				res = crsr->runbody (uri, *body, inhdr, outbody,
+									 outhdr, env, s);
+				
+				// The connection can't be used for another
+				// request if the body was left half read.
+				if (res && (! body->done())) env["keepalive"] = false;
+			}
+			else
+			{
+				res = crsr->run (uri, postbody, inhdr, outbody,
+								 outhdr, env, s);
+			}
+		}
+		catch (...)
 		{
-			int res;
+			// Don't leave other requests waiting for it, whatever
+			// the handler threw.
+			if (cachefill) cache.abandon (cachekey);
+			throw;
+		}
+		
+		// Positive non-zero reply?
+		if (res > 0)
+		{
+			string hdrblob;
+			outhdr["Content-length"] = outbody.strlen();
+			if (cachefill)
+			{
+				cache.store (cachekey, inhdr, res, outhdr, outbody);
+			}
 			
-			// Let it do its magic
-			res = crsr->run (uri, postbody, inhdr, outbody, outhdr, env, s);
+			keepalive = env["keepalive"].bval();
 			
-			// Positive non-zero reply?
-			if (res > 0)
+			// The client may already have what the object came
+			// up with.
+			if ((res == 200) && cachekey.strlen() &&
+				outhdr.exists ("ETag") &&
+				httpdcache::notmodified (inhdr, outhdr["ETag"]))
 			{
-				string hdrblob;
-				// Send the http response, headers and body
-				hdrblob = "HTTP/1.1 %i %s\r\n" %format(res, httpstatusstr (res));
-				outhdr["Content-length"] = outbody.strlen();
-				keepalive = env["keepalive"].bval();
-				if (! outhdr.exists ("Connection"))
-					outhdr["Connection"] = keepalive ? "keep-alive" : "close";
-
-				foreach (hdr, outhdr)
-				{
-					hdrblob.strcat ("%s: %s\r\n" %format (hdr.id(), hdr));
-				}
-				hdrblob.strcat ("\r\n");
-				s.puts (hdrblob);
-				s.puts (outbody);
-				
-				s.flush();
-				
-				// Create a log-event if needed
-				if (eventmask & HTTPD_ACCESS)
-				{
-					eventhandle ($attr("class", "access") ->
-								 $("method", method) ->
-								 $("httpver", httpver) ->
-								 $("uri", uri) ->
-								 $("file", env["file"]) ->
-								 $("ip", env["ip"]) ->
-								 $("user", env["user"]) ->
-								 $("referrer", inhdr["Referer"]) ->
-								 $("useragent", inhdr["User-Agent"]) ->
-								 $("status", res) ->
-								 $("bytes", outbody.strlen())
-								);
-				}
-				
+				httpdcachehit hit;
+				hit.validators = httpdcache::validators (outhdr);
+				hit.etag = outhdr["ETag"].sval();
+				hit.age = -1;
+				sendcached (s, hit, inhdr, method, httpver, uri, keepalive);
 				return;
 			}
-			if (res < 0) // Non-zero negative reply
+			
+			// Send the http response, headers and body
+			hdrblob = "HTTP/1.1 %i %s\r\n" %format(res, httpstatusstr (res));
+			if (! outhdr.exists ("Connection"))
+				outhdr["Connection"] = keepalive ? "keep-alive" : "close";
+
+			foreach (hdr, outhdr)
 			{
-				s.flush();
+				hdrblob.strcat ("%s: %s\r\n" %format (hdr.id(), hdr));
+			}
+			hdrblob.strcat ("\r\n");
 			
-				// Create a log-event if needed
-				if (eventmask & HTTPD_ACCESS)
-				{
-					eventhandle ($attr("class", "access") ->
-								 $("method", method) ->
-								 $("httpver", httpver) ->
-								 $("uri", uri) ->
-								 $("file", env["file"]) ->
-								 $("ip", env["ip"]) ->
-								 $("user", env["user"]) ->
-								 $("referrer", inhdr["Referer"]) ->
-								 $("useragent", inhdr["User-Agent"]) ->
-								 $("status", -res) ->
-								 $("bytes", env["sentbytes"].ival())
-								);
-				}
-				
-				// Retain the keepalive status
-				keepalive = env["keepalive"].bval();
-				return;
+			// One write for headers and body, so a small
+			// response goes out as a single segment.
+			s.puts (hdrblob, outbody);
+			
+			s.flush();
+			
+			// Create a log-event if needed
+			if (eventmask & HTTPD_ACCESS)
+			{
+				eventhandle ($attr("class", "access") ->
+							 $("method", method) ->
+							 $("httpver", httpver) ->
+							 $("uri", uri) ->
+							 $("file", env["file"]) ->
+							 $("ip", env["ip"]) ->
+							 $("user", env["user"]) ->
+							 $("referrer", inhdr["Referer"]) ->
+							 $("useragent", inhdr["User-Agent"]) ->
+							 $("status", res) ->
+							 $("bytes", outbody.strlen())
+							);
+			}
+			
+			return;
+		}
+		if (res < 0) // Non-zero negative reply
+		{
+			// Whatever went out is not in our hands.
+			if (cachefill) cache.abandon (cachekey);
+			s.flush();
+		
+			// Create a log-event if needed
+			if (eventmask & HTTPD_ACCESS)
+			{
+				eventhandle ($attr("class", "access") ->
+							 $("method", method) ->
+							 $("httpver", httpver) ->
+							 $("uri", uri) ->
+							 $("file", env["file"]) ->
+							 $("ip", env["ip"]) ->
+							 $("user", env["user"]) ->
+							 $("referrer", inhdr["Referer"]) ->
+							 $("useragent", inhdr["User-Agent"]) ->
+							 $("status", -res) ->
+							 $("bytes", env["sentbytes"].ulval())
+							);
 			}
+			
+			// Retain the keepalive status
+			keepalive = env["keepalive"].bval();
+			return;
 		}
-		crsr = crsr->next;
 	}
 	
 	// Tough luck, fall back to ugliness
-	s.puts ("HTTP/1.1 404 NOT FOUND\r\n");
+	unsigned long long fbytes;
 	
-	int fbytes;
+	if (cachefill) cache.abandon (cachekey);
 	
 	if (havedefault (404))
 	{
-		s.puts ("Content-type: text/html\r\n");
+		// The file goes out separately, keep the socket corked
+		// so it can share a segment with the headers.
+		s.cork (true);
+		s.puts ("HTTP/1.1 404 NOT FOUND\r\n"
+				"Content-type: text/html\r\n");
 		fbytes = sendfile (s, defaultdocument (404));
+		s.cork (false);
 	}
 	else
 	{
-		s.puts ("Content-length: 36\r\n"
+		s.puts ("HTTP/1.1 404 NOT FOUND\r\n"
+				"Content-length: 36\r\n"
 				"Content-type: text/html\r\n\r\n"
 				"<html><h1>404 Not Found</h1></html>\n");
 		fbytes = 36;
@@ -552,6 +755,57 @@ void httpd::handle (string &uri, string &postbody, value &inhdr,
 	keepalive = false;
 }
 
+// ========================================================================
+// METHOD httpd::sendcached
+// ------------------------
+// Sends a response from the cache, or a 304 if the client already
+// has it. The stored headers lack a Connection, that one depends on
+// the request.
+// ========================================================================
+void httpd::sendcached (tcpsocket &s, httpdcachehit &hit, value &inhdr,
+						const string &method, const string &httpver,
+						const string &uri, bool keepalive)
+{
+	string hdrblob;
+	int status = 200;
+	
+	if (httpdcache::notmodified (inhdr, hit.etag))
+	{
+		status = 304;
+		hdrblob = "HTTP/1.1 304 NOT MODIFIED\r\n";
+		hdrblob.strcat (hit.validators);
+		hit.body.crop ();
+	}
+	else
+	{
+		hdrblob = "HTTP/1.1 200 OK\r\n";
+		hdrblob.strcat (hit.headers);
+	}
+	
+	if (hit.age >= 0) hdrblob.strcat ("Age: %i\r\n" %format (hit.age));
+	hdrblob.strcat ("Connection: %s\r\n\r\n"
+					%format (keepalive ? "keep-alive" : "close"));
+	
+	s.puts (hdrblob, hit.body);
+	s.flush ();
+	
+	if (eventmask & HTTPD_ACCESS)
+	{
+		eventhandle ($attr("class", "access") ->
+					 $("method", method) ->
+					 $("httpver", httpver) ->
+					 $("uri", uri) ->
+					 $("file", "") ->
+					 $("ip", s.peer_name) ->
+					 $("user", "") ->
+					 $("referrer", inhdr["Referer"]) ->
+					 $("useragent", inhdr["User-Agent"]) ->
+					 $("status", status) ->
+					 $("bytes", hit.body.strlen())
+					);
+	}
+}
+
 // ==========================================================================
 // METHOD httpd::createlistener
 // ==========================================================================
@@ -591,7 +845,6 @@ void httpdworker::run (void)
 {
 	tcpsocket s;
 	value ev;
-	string line;
 	string threadid;
 	bool run = true;
 	
@@ -607,34 +860,25 @@ void httpdworker::run (void)
 							);
 	}
 	
+	// With event loops, connections come to us with a request
+	// waiting.
+	if (parent->eventloops())
+	{
+		runqueue (threadid);
+		return;
+	}
+	
 	// As long as we weren't asked to die
 	while (run)
 	{
 		try
 		{
-			while (! parent->tcplock.trylockw(1))
-			{
-				// Anyone calling us?
-				ev = nextevent();
-				if (ev)
-				{
-					if (ev.type() == "die") // time to go
-					{
-						run = false;
-						if (parent->eventmask & HTTPD_INFO)
-						{
-							parent->eventhandle ($attr("class", "info") ->
-												 $("type", "threadstopped") ->
-												 $("thread", threadid));
-						}
-						return;
-					}
-				}
-			}
-			
+			// Every worker waits in accept, the kernel hands each
+			// new connection to one of them.
 			while (! s)
 			{
-				s = parent->listener->tryaccept(2.0);
+				s = parent->listener->tryaccept
+						(tune::httpd::wkthread::acceptwait / 1000.0);
 				if (!s)
 				{
 					ev = nextevent();
@@ -643,7 +887,6 @@ void httpdworker::run (void)
 						if (ev.type() == "die") // time to go
 						{
 							run = false;
-							parent->tcplock.unlock();
 							if (parent->eventmask & HTTPD_INFO)
 							{
 								parent->eventhandle ($attr("class", "info") ->
@@ -655,7 +898,6 @@ void httpdworker::run (void)
 					}
 				}
 			}
-			parent->tcplock.unlock();
 		}
 		catch (exception e)
 		{
@@ -681,198 +923,574 @@ void httpdworker::run (void)
 		
 		try
 		{
-			// Startup state, wait for a http command
-			// and read headers. Will keep coming back to
-			// the top until the connection is gone or
-			// somewhere we decided to ditch keepalive.
-			
+			// Keep handling requests until the connection is
+			// gone or somewhere we decided to ditch keepalive.
 			while ( (! s.eof()) && (keepalive) )
 			{
-				bool gotCommand = false;
-				string httpCommand;
-				value httpHeaders;
-				string bodyData;
-				
-				while (! s.eof())
-				{
-					line = s.gets();
-					// Empty line, our turn
-					if (gotCommand && (! line.strlen())) break;
-					
-					// Ok, but did we get anything useful?
-					if (line.strlen())
-					{
-						// The first line, this is the http command
-						if (! gotCommand)
-						{
-							gotCommand = true;
-							httpCommand = line;
-						}
-						else // No, these are headers. Munge.
-						{
-							if (httpHeaders.count() < 48)
-							{
-								value test = strutil::parsehdr (line);
-								httpHeaders << test;
-							}
-						}
-					}
-				}
-				
-				// If we got nothing useful, totally drop out of
-				// the session.
-				if (! gotCommand) throw httpdWorkerException("No command");
-				if (s.eof()) throw httpdWorkerException("End of file");
-				
-				// Now we'll start interpreting the http comand
-				string cmd;
-				string uri;
-				
-				cmd = httpCommand.cutat (' ');
-				cmd.ctoupper();
-				
-				// If it was a post, get the post body.
-				if ((cmd == "POST") || (cmd == "PUT"))
-				{
-					size_t sz = httpHeaders["Content-length"].uval();
-					
-					// It's not over size, is it?
-					if (sz > (unsigned int) parent->maxpostsize())
-					{
-						// tis? Whine!
-						s.puts ("HTTP/1.1 413 ENTITY TOO LARGE\r\n"
-								"Content-type: text/html\r\n\r\n");
-						s.puts (errortext::httpd::html_body
-								  %format (errortext::httpd::html_413));
-						keepalive = false;
-						
-						// Whine upstream if needed
-						if (parent->eventmask & HTTPD_ERROR)
-						{
-							parent->eventhandle (
-								$attr("class", "error") ->
-								$("ip", s.peer_name) ->
-								$("text", errortext::httpd::toolarge
-											%format ((int) sz)));
-						}
-						break;
-					}
-					
-					// If we're here, it means we may suck data
-					if (sz)
-					{
-						bodyData = s.read (sz);
-					}
-				}
-				else if (cmd == "GET")
-				{
-					if (httpHeaders.exists ("Content-length"))
-					{
-						if (httpHeaders["Content-length"].ival() > 0)
-						{
-							s.puts ("HTTP/1.1 400 BAD REQUEST\r\n"
-									"Content-type: text/html\r\n\r\n"
-									"<html><h1>GET request with POST body"
-									" not allowed</h1></html>\n");
-							keepalive = false;
-							
-							if (parent->eventmask & HTTPD_ERROR)
-							{
-								parent->eventhandle (
-									$attr("class", "error") ->
-									$("ip", s.peer_name) ->
-									$("text", errortext::httpd::getbody));
-							}
-							break;
-						}
-					}
-				}
-				
-				// Get the URI part. Compensate for http/0.9's lack of
-				// well-formedness.
-				if (httpCommand.strchr (' ') < 0)
-				{
-					uri = httpCommand;
-					httpCommand.crop (0);
-				}
-				else uri = httpCommand.cutat (' ');
-				
-				// Set the default keepalive scheme for the protocol
-				// version.
-				if (httpCommand.strcasecmp ("http/1.1") == 0)
-					keepalive = true;
-				else
-					keepalive = false;
-				
-				// The httpCommand now hosts the actual version string
-				// like '1.0' or '1.1'.
-				delete httpCommand.cutat ('/');
-				
-				// No version? Assume 0.9.
-				if (! httpCommand.strlen())
-				{
-					httpCommand = "0.9";
-				}
-				
-				// Change all this explicitly if the client asked
-				// for a differnet scheme using the Connection header
-				if (httpHeaders["Connection"] == "close")
-					keepalive = false;
-				else if (httpHeaders["Connection"] == "keep-alive")
-					keepalive = true;
-				
-				// As of now, we only recognize get and post requests
-				if ((cmd == "POST") || (cmd == "PUT") || (cmd == "GET") ||
-					(cmd == "DELETE"))
-				{
-					parent->handle (uri, bodyData, httpHeaders,
-									cmd, httpCommand,
-									s, keepalive);
-				}
-				else // The rest gets the 500 EFINGER
-				{
-					s.puts ("HTTP/1.1 501 METHOD '%S' NOT IMPLEMENTED\r\n" %format (cmd));
-					s.puts ("Content-type: text/html\r\n\r\n");
-					s.puts (errortext::httpd::html_body %format
-							  		(errortext::httpd::html_500_method));
-					keepalive = false;
-					
-					// Tell the world if it cares
-					if (parent->eventmask & HTTPD_ERROR)
-					{
-						parent->eventhandle (
-							$attr("class", "error") ->
-							$("ip", s.peer_name) ->
-							$("text", errortext::httpd::method %format (cmd)));
-					}
-				}
+				handlerequest (s, keepalive);
+				if (! s.buffer.backlog()) s.releaseoutput ();
+			}
+			s.releaseoutput ();
+		}
+		
+		catch (exception e)
+		{
+			parent->eventhandle (
+				$attr("class","errpr") ->
+				$("thread", threadid)->
+				$("ip", s.peer_name)->
+				$("text", "socket exception: %s" %format (e.description)));
+		}
+
+		s.close();
+		
+		// Downgrade to DEFCON foo-1
+		exclusiveaccess (parent->load) { nload = parent->load.o--; }
+
+		// Inform those who want to be informed
+		if (parent->eventmask & HTTPD_INFO)
+		{
+			parent->eventhandle (
+				$attr("class", "info") ->
+				$("type", "connectionclosed") ->
+				$("thread", threadid) ->
+				$("load", nload) ->
+				$("ip", s.peer_name));
+		}
+	}
+}
+
+// ========================================================================
+// METHOD httpdworker::handlerequest
+// ---------------------------------
+// Reads the HTTP request, any headers and any posted body data, then
+// sets httpd::handle() on the case.
+// ========================================================================
+void httpdworker::handlerequest (tcpsocket &s, bool &keepalive)
+{
+	httpparser req;
+	const char *data;
+	value httpHeaders;
+	string bodyData;
+	
+	// The request is parsed in place in the socket buffer, as far
+	// as it has come in.
+	while (true)
+	{
+		data = s.buffer.linear ();
+		if (req.parse (data, s.buffer.backlog())) break;
+		if (s.eof()) break;
+		
+		// A keep-alive client that has nothing to ask should not
+		// keep the server from shutting down.
+		if (parent->shuttingdown() && (! s.buffer.backlog()))
+		{
+			keepalive = false;
+			return;
+		}
+		
+		if (s.buffer.room() < FILE_MINROOM)
+		{
+			throw httpdWorkerException("Request headers too large");
+		}
+		s.readbuffer (s.buffer.room(), 1000);
+	}
+	
+	// If we got nothing useful, totally drop out of
+	// the session.
+	if (! req.gotrequest()) throw httpdWorkerException("No command");
+	if (! req.done()) throw httpdWorkerException("End of file");
+	
+	// Now we'll start interpreting the http comand
+	string cmd;
+	string uri;
+	string httpCommand;
+	bool haslength;
+	bool chunked;
+	bool streamed = false;
+	size_t sz;
+	
+	cmd = req.method (data);
+	cmd.ctoupper();
+	sz = req.headeruval (data, key::http_content_length, haslength);
+	chunked = req.headeris (data, key::http_transfer_encoding, "chunked");
+	uri = req.uri (data);
+	
+	// If it was a post, get the post body.
+	if ((cmd == "POST") || (cmd == "PUT"))
+	{
+		// Objects that take the body as a stream deal with its
+		// size themselves.
+		string rawuri = uri;
+		rawuri.cropat ('?');
+		streamed = parent->streamsbody (rawuri);
+		
+		// It's not over size, is it?
+		if ((! streamed) && (! chunked) &&
+			(sz > (unsigned int) parent->maxpostsize()))
+		{
+			s.buffer.advance (req.size());
+			toolarge (s, sz);
+			keepalive = false;
+			return;
+		}
+	}
+	else if (cmd == "GET")
+	{
+		if ((haslength && (sz > 0)) || chunked)
+		{
+			s.buffer.advance (req.size());
+			
+			s.puts ("HTTP/1.1 400 BAD REQUEST\r\n"
+					"Content-type: text/html\r\n\r\n"
+					"<html><h1>GET request with POST body"
+					" not allowed</h1></html>\n");
+			keepalive = false;
+			
+			if (parent->eventmask & HTTPD_ERROR)
+			{
+				parent->eventhandle (
+					$attr("class", "error") ->
+					$("ip", s.peer_name) ->
+					$("text", errortext::httpd::getbody));
+			}
+			return;
+		}
+		sz = 0;
+	}
+	else
+	{
+		sz = 0;
+		chunked = false;
+	}
+	
+	// Set the default keepalive scheme for the protocol
+	// version.
+	keepalive = req.ishttp11 (data);
+	
+	// The httpCommand now hosts the actual version string
+	// like '1.0' or '1.1'. No version? Assume 0.9.
+	httpCommand = req.version (data);
+	if (! httpCommand.strlen())
+	{
+		httpCommand = "0.9";
+	}
+	
+	// Change all this explicitly if the client asked
+	// for a differnet scheme using the Connection header
+	if (req.headeris (data, key::http_connection, "close"))
+		keepalive = false;
+	else if (req.headeris (data, key::http_connection, "keep-alive"))
+		keepalive = true;
+	
+	// Only requests that get handled need the headers as a value.
+	bool known = ((cmd == "POST") || (cmd == "PUT") || (cmd == "GET") ||
+				  (cmd == "DELETE"));
+	
+	if (known) httpHeaders = req.headers (data);
+	
+	bool expect = req.headeris (data, key::http_expect, "100-continue");
+	
+	// Done with the request headers, the body comes after them.
+	s.buffer.advance (req.size());
+	httpdbody body (s, sz, chunked, expect);
+	
+	if (! streamed)
+	{
+		// A chunked body only shows its size as it comes in.
+		if (! body.readall (bodyData, parent->maxpostsize()))
+		{
+			if (body.failed()) throw httpdWorkerException("End of file");
+			toolarge (s, body.received());
+			keepalive = false;
+			return;
+		}
+		
+		// If the client pipelined another request behind this one,
+		// hold back the response. The responses to a batch of
+		// requests then go out in one write, once the buffer runs dry.
+		if (s.buffer.backlog()) s.holdoutput ();
+	}
+	else
+	{
+		// The object may wait for the rest of the body, anything
+		// held for the client goes out first.
+		s.releaseoutput ();
+	}
+	
+	// As of now, we only recognize get and post requests
+	if (known)
+	{
+		parent->handle (uri, bodyData, httpHeaders,
+						cmd, httpCommand,
+						s, keepalive, streamed ? &body : NULL);
+		
+		// What is left of a body that was not read in full can't
+		// be told apart from the next request.
+		if (! body.done()) keepalive = false;
+	}
+	else // The rest gets the 500 EFINGER
+	{
+		s.puts ("HTTP/1.1 501 METHOD '%S' NOT IMPLEMENTED\r\n" %format (cmd));
+		s.puts ("Content-type: text/html\r\n\r\n");
+		s.puts (errortext::httpd::html_body %format
+				  		(errortext::httpd::html_500_method));
+		keepalive = false;
+		
+		// Tell the world if it cares
+		if (parent->eventmask & HTTPD_ERROR)
+		{
+			parent->eventhandle (
+				$attr("class", "error") ->
+				$("ip", s.peer_name) ->
+				$("text", errortext::httpd::method %format (cmd)));
+		}
+	}
+}
+
+// ========================================================================
+// METHOD httpdworker::toolarge
+// ========================================================================
+void httpdworker::toolarge (tcpsocket &s, unsigned int sz)
+{
+	// tis? Whine!
+	s.puts ("HTTP/1.1 413 ENTITY TOO LARGE\r\n"
+			"Content-type: text/html\r\n\r\n");
+	s.puts (errortext::httpd::html_body
+			  %format (errortext::httpd::html_413));
+	
+	// Whine upstream if needed
+	if (parent->eventmask & HTTPD_ERROR)
+	{
+		parent->eventhandle (
+			$attr("class", "error") ->
+			$("ip", s.peer_name) ->
+			$("text", errortext::httpd::toolarge
+						%format ((int) sz)));
+	}
+}
+
+// ========================================================================
+// METHOD httpdworker::runqueue
+// ----------------------------
+// Takes connections with a complete request from the parent's ready
+// queue. Any requests the client already sent along are handled right
+// away, then the connection goes back to its event loop.
+// ========================================================================
+void httpdworker::runqueue (const string &threadid)
+{
+	value ev;
+	
+	while (true)
+	{
+		ev = nextevent();
+		if (ev && (ev.type() == "die")) // time to go
+		{
+			if (parent->eventmask & HTTPD_INFO)
+			{
+				parent->eventhandle ($attr("class", "info") ->
+									 $("type", "threadstopped") ->
+									 $("thread", threadid));
 			}
+			return;
+		}
+		
+		httpdconnection *c = parent->nextconnection (1000);
+		if (! c) continue;
+		
+		tcpsocket &s = *(c->sock);
+		bool keepalive = true;
+		
+		exclusiveaccess (parent->load) { parent->load.o++; }
+		
+		try
+		{
+			do
+			{
+				handlerequest (s, keepalive);
+				if (! s.buffer.backlog()) s.releaseoutput ();
+			} while ( keepalive && (! s.eof()) &&
+					  c->hasrequest (parent->maxpostsize()) );
+			
+			// Nothing may be held back once the connection
+			// goes back to waiting.
+			s.releaseoutput ();
+		}
+		catch (exception e)
+		{
+			parent->eventhandle (
+				$attr("class","errpr") ->
+				$("thread", threadid)->
+				$("ip", s.peer_name)->
+				$("text", "socket exception: %s" %format (e.description)));
+			keepalive = false;
 		}
 		
-		catch (exception e)
+		exclusiveaccess (parent->load) { parent->load.o--; }
+		
+		if (keepalive && (! s.eof())) c->loop->park (c);
+		else c->loop->drop (c);
+	}
+}
+
+// ========================================================================
+// CONSTRUCTOR httpdconnection
+// ========================================================================
+httpdconnection::httpdconnection (tcpsocket *s, httpdeventloop *l)
+{
+	sock = s;
+	loop = l;
+	prev = next = nextready = NULL;
+}
+
+// ========================================================================
+// DESTRUCTOR httpdconnection
+// ========================================================================
+httpdconnection::~httpdconnection (void)
+{
+	sock->close ();
+	delete sock;
+}
+
+// ========================================================================
+// METHOD httpdconnection::hasrequest
+// ----------------------------------
+// Parses the request headers in the socket buffer as far as they have
+// come in. If they carry a Content-length, the body should be there
+// as well.
+// ========================================================================
+bool httpdconnection::hasrequest (int maxpostsize)
+{
+	ringbuffer &buf = sock->buffer;
+	httpparser req;
+	const char *data;
+	bool haslength;
+	
+	if (! buf.backlog()) return false;
+	
+	data = buf.linear ();
+	if (! req.parse (data, buf.backlog()))
+	{
+		// A buffer readbuffer() won't add to is as far as it gets,
+		// let the worker turn it down.
+		return (buf.room() < FILE_MINROOM);
+	}
+	
+	unsigned int hdrsize = req.size ();
+	unsigned int sz = req.headeruval (data, key::http_content_length,
+									  haslength);
+	if (! haslength) return true;
+	
+	// Oversized bodies get turned down by the worker, bodies that
+	// will not fit the buffer get read by the worker.
+	if (sz > (unsigned int) maxpostsize) return true;
+	if ((hdrsize + sz + 256) > buf.size()) return true;
+	
+	return (buf.backlog() >= (hdrsize + sz));
+}
+
+// ========================================================================
+// CONSTRUCTOR httpdeventloop
+// ========================================================================
+httpdeventloop::httpdeventloop (httpd *pop, bool acc)
+	: groupthread (pop->loops, "httpdeventloop")
+{
+	parent = pop;
+	accepts = acc;
+	first = NULL;
+	epfd = -1;
+
+#ifdef HAVE_EPOLL
+	epfd = epoll_create (1024);
+#endif
+
+	spawn ();
+}
+
+// ========================================================================
+// DESTRUCTOR httpdeventloop
+// ========================================================================
+httpdeventloop::~httpdeventloop (void)
+{
+	if (epfd >= 0) ::close (epfd);
+}
+
+// ========================================================================
+// METHOD httpdeventloop::run
+// --------------------------
+// Waits for new connections and for data on parked ones. Anything
+// coming in on the listening socket is accepted right away and divided
+// over the event loops. Connections are registered one-shot: once they
+// fire, they stay out of the epoll set until their data is dealt with.
+// ========================================================================
+void httpdeventloop::run (void)
+{
+	loopid = "httpdeventloop/%x" %format (this->threadid());
+	
+#ifdef HAVE_EPOLL
+	struct epoll_event *evs;
+	int batch = tune::httpd::eventloop::batch;
+	int lfd = -1;
+	
+	if (batch < 1) batch = 1;
+	evs = new struct epoll_event[batch];
+	
+	if (accepts) lfd = parent->listener->listenfd();
+	if (lfd >= 0)
+	{
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		epoll_ctl (epfd, EPOLL_CTL_ADD, lfd, &ev);
+	}
+	
+	while (true)
+	{
+		value tev = nextevent();
+		if (tev && (tev.type() == "die")) break;
+		
+		int n = epoll_wait (epfd, evs, batch, tune::httpd::eventloop::idle);
+		
+		for (int i=0; i<n; ++i)
 		{
-			parent->eventhandle (
-				$attr("class","errpr") ->
-				$("thread", threadid)->
-				$("ip", s.peer_name)->
-				$("text", "socket exception: %s" %format (e.description)));
+			if (! evs[i].data.ptr) acceptall ();
+			else readable ((httpdconnection *) evs[i].data.ptr);
 		}
+	}
+	
+	if (lfd >= 0) epoll_ctl (epfd, EPOLL_CTL_DEL, lfd, NULL);
+	delete[] evs;
+#endif
 
-		s.close();
-		
-		// Downgrade to DEFCON foo-1
-		exclusiveaccess (parent->load) { nload = parent->load.o--; }
+	// Close whatever is still parked with us.
+	exclusivesection (lck)
+	{
+		while (first)
+		{
+			httpdconnection *c = first;
+			first = c->next;
+			delete c;
+		}
+	}
+}
 
-		// Inform those who want to be informed
+// ========================================================================
+// METHOD httpdeventloop::acceptall
+// ========================================================================
+void httpdeventloop::acceptall (void)
+{
+	tcpsocket *s;
+	
+	while ((s = parent->listener->tryaccept (0.0)))
+	{
+		httpdeventloop *l = parent->pickeventloop ();
+		
 		if (parent->eventmask & HTTPD_INFO)
 		{
-			parent->eventhandle (
-				$attr("class", "info") ->
-				$("type", "connectionclosed") ->
-				$("thread", threadid) ->
-				$("load", nload) ->
-				$("ip", s.peer_name));
+			int nload = parent->getload ();
+			parent->eventhandle ($attr("class", "info") ->
+								 $("type", "connectionaccepted") ->
+								 $("thread", loopid) ->
+								 $("load", nload) ->
+								 $("ip", s->peer_name));
 		}
+		
+		l->add (new httpdconnection (s, l));
+	}
+}
+
+// ========================================================================
+// METHOD httpdeventloop::readable
+// -------------------------------
+// Pulls in all data that is waiting on a connection. If that makes a
+// complete request, the connection goes to the workers. Otherwise, it
+// gets parked until more data arrives.
+// ========================================================================
+void httpdeventloop::readable (httpdconnection *c)
+{
+	tcpsocket &s = *(c->sock);
+	
+	// Stop reading once a request is complete. A client that sends
+	// its last request and hangs up its side in one go would leave
+	// the socket at its end, where nothing can be written to it
+	// anymore. The end is found again once the request is answered.
+	try
+	{
+		while ((! c->hasrequest (parent->maxpostsize())) &&
+			   (s.readbuffer (defaults::sz::file::readbuf) > 0));
+	}
+	catch (exception e)
+	{
+		drop (c);
+		return;
+	}
+	
+	if (c->hasrequest (parent->maxpostsize())) parent->queueconnection (c);
+	else if (s.eof()) drop (c);
+	else park (c);
+}
+
+// ========================================================================
+// METHOD httpdeventloop::add
+// ========================================================================
+void httpdeventloop::add (httpdconnection *c)
+{
+	exclusivesection (lck)
+	{
+		c->prev = NULL;
+		c->next = first;
+		if (first) first->prev = c;
+		first = c;
+	}
+
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = c;
+	epoll_ctl (epfd, EPOLL_CTL_ADD, c->sock->filno, &ev);
+#endif
+}
+
+// ========================================================================
+// METHOD httpdeventloop::park
+// ========================================================================
+void httpdeventloop::park (httpdconnection *c)
+{
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = c;
+	epoll_ctl (epfd, EPOLL_CTL_MOD, c->sock->filno, &ev);
+#endif
+}
+
+// ========================================================================
+// METHOD httpdeventloop::drop
+// ========================================================================
+void httpdeventloop::drop (httpdconnection *c)
+{
+	string peer = c->sock->peer_name;
+	
+	exclusivesection (lck)
+	{
+		if (c->prev) c->prev->next = c->next;
+		else first = c->next;
+		if (c->next) c->next->prev = c->prev;
+	}
+	
+#ifdef HAVE_EPOLL
+	epoll_ctl (epfd, EPOLL_CTL_DEL, c->sock->filno, NULL);
+#endif
+	delete c;
+	
+	if (parent->eventmask & HTTPD_INFO)
+	{
+		int nload = parent->getload ();
+		parent->eventhandle ($attr("class", "info") ->
+							 $("type", "connectionclosed") ->
+							 $("thread", loopid) ->
+							 $("load", nload) ->
+							 $("ip", peer));
 	}
 }
 
@@ -886,6 +1504,7 @@ httpdobject::httpdobject (httpd &pparent, const string &purimatch)
 	next = NULL;
 	parent = &pparent;
 	urimatch = purimatch;
+	streambody = false;
 	pparent.addobject (this);
 }
 
@@ -910,6 +1529,28 @@ int httpdobject::run (string &uri, string &postbody,
 	return 404;
 }
 
+// ========================================================================
+// METHOD httpdobject::runbody
+// ---------------------------
+// For objects that asked for a streamed body but would rather have it
+// as a string after all.
+// ========================================================================
+int httpdobject::runbody (string &uri, httpdbody &body,
+						  value &inhdr, string &out, value &outhdr,
+						  value &env, tcpsocket &s)
+{
+	string postbody;
+	
+	if (! body.readall (postbody, parent->maxpostsize()))
+	{
+		env["keepalive"] = false;
+		out = errortext::httpd::html_body %format (errortext::httpd::html_413);
+		return 413;
+	}
+	
+	return run (uri, postbody, inhdr, out, outhdr, env, s);
+}
+
 // ========================================================================
 // CONSTRUCTOR httpdbasicauth
 // ----------------------
@@ -1074,25 +1715,40 @@ httpdlogger::httpdlogger (httpd &parent, const string &accesslog,
 		ferror.o.openappend (errorlog);
 	}
 	else haserrorlog = false;
+	
+	tcached = 0;
+	tbuf[0] = 0;
+	writer = NULL;
+	overflowpolicy = HTTPDLOG_BLOCK;
+	qbytes = 0;
+	ndropped = 0;
+	nflushing = 0;
 }
 
 // ========================================================================
 // DESTRUCTOR httpdlogger
+// ----------------------
+// The log thread writes out whatever is still queued before it goes.
 // ========================================================================
 httpdlogger::~httpdlogger (void)
 {
+	if (writer)
+	{
+		writer->shutdown ();
+		delete writer;
+	}
 }
 
 // ========================================================================
 // METHOD httpdlogger::handle
 // --------------------------
 // Writes access events to an apache-style accesslog. Writes error events
-// to an apache-style errorlog. Life is simple.
+// to an apache-style errorlog. Life is simple. In async mode, the lines
+// are only queued here.
 // ========================================================================
 int httpdlogger::handle (const value &ev)
 {
-	timestamp ti = core.time.now();
-	string timestr = ti.format ("%d/%b/%Y:%H:%M:%S %z");
+	string ts = timestr ();
 	string uri = ev["uri"];
 	if (uri.strchr ('?') >= 0) delete uri.cutafter ('?');
 
@@ -1101,27 +1757,262 @@ int httpdlogger::handle (const value &ev)
 		string remuser = ev["user"];
 		if (! remuser.strlen()) remuser = "-";
 		
-		// We'll be called from any thread, lock the file access.
-		exclusivesection (faccess)
+		string line = "%[ip]s - %{1}S [%{2}s] \"%[method]s %{3}s "
+					  "HTTP/%[httpver]s\" %[status]i %[bytes]U "
+					  "\"%[referrer]S\" \"%[useragent]S\"\n"
+					  %format (ev, remuser, ts, uri);
+		
+		if (writer) queue (line, false);
+		else
 		{
-			faccess.puts ("%[ip]s - %{1}S [%{2}s] \"%[method]s %{3}s "
-						  "HTTP/%[httpver]s\" %[status]i %[bytes]i "
-						  "\"%[referrer]S\" \"%[useragent]S\"\n"
-						  %format (ev, remuser, timestr, uri));
+			// We'll be called from any thread, lock the file access.
+			exclusivesection (faccess)
+			{
+				faccess.puts (line);
+			}
 		}
 	}
 	else if (haserrorlog)
 	{
-		// We'll be called from any thread, lock the file access.
-		exclusivesection (ferror)
+		string line = "[%{1}s] [error] [client %[ip]s] "
+					  "%[text]s\n" %format (ev, ts);
+		
+		if (writer) queue (line, true);
+		else
 		{
-			ferror.puts ("[%{1}s] [error] [client %[ip]s] "
-						 "%[text]s\n" %format (ev, timestr));
+			// We'll be called from any thread, lock the file access.
+			exclusivesection (ferror)
+			{
+				ferror.puts (line);
+			}
 		}
 	}
 	return 1;
 }
 
+// ========================================================================
+// METHOD httpdlogger::async
+// ========================================================================
+void httpdlogger::async (int overflow)
+{
+	overflowpolicy = overflow;
+	if (! writer) writer = new httpdlogwriter (this);
+}
+
+// ========================================================================
+// METHOD httpdlogger::flush
+// -------------------------
+// Wakes up the writer and waits for it to report back, until nothing
+// that was queued is left unwritten.
+// ========================================================================
+void httpdlogger::flush (void)
+{
+	if (! writer) return;
+	
+	__sync_add_and_fetch (&nflushing, 1);
+	while (__sync_add_and_fetch (&qbytes, 0))
+	{
+		qwakeup.signal ();
+		qwritten.wait (tune::httpd::log::flushtime);
+	}
+	__sync_sub_and_fetch (&nflushing, 1);
+}
+
+// ========================================================================
+// METHOD httpdlogger::dropped
+// ========================================================================
+unsigned int httpdlogger::dropped (void)
+{
+	return ndropped;
+}
+
+// ========================================================================
+// METHOD httpdlogger::timestr
+// ---------------------------
+// Every request in the same second gets the same string, there is no
+// need to go through localtime and strftime for each of them.
+// ========================================================================
+string *httpdlogger::timestr (void)
+{
+	returnclass (string) res retain;
+	time_t now = core.time.now ();
+	
+	sharedsection (tlock)
+	{
+		if (tcached == now)
+		{
+			res = tbuf;
+			return &res;
+		}
+	}
+	
+	timestamp ti = now;
+	res = ti.format ("%d/%b/%Y:%H:%M:%S %z");
+	
+	exclusivesection (tlock)
+	{
+		tcached = now;
+		::strncpy (tbuf, res.str(), sizeof (tbuf) - 1);
+		tbuf[sizeof (tbuf) - 1] = 0;
+	}
+	
+	return &res;
+}
+
+// ========================================================================
+// METHOD httpdlogger::queue
+// -------------------------
+// Appends a line to the queue of the calling thread, which is all a
+// worker has to do. The only lock it takes is its own, which it shares
+// with the writer alone. A full queue either holds the worker up until
+// the writer has made room, or costs the line.
+// ========================================================================
+void httpdlogger::queue (const string &line, bool iserror)
+{
+	unsigned int maxq = tune::httpd::log::maxqueue;
+	unsigned int flushsz = tune::httpd::log::flushsize;
+	unsigned int len = line.strlen();
+	unsigned int queued;
+	
+	while (true)
+	{
+		// A line that is too big on its own still goes into an
+		// empty queue.
+		queued = qbytes;
+		if ((! queued) || ((queued + len) <= maxq)) break;
+		
+		if (overflowpolicy == HTTPDLOG_DROP)
+		{
+			__sync_add_and_fetch (&ndropped, 1);
+			return;
+		}
+		
+		qwakeup.signal ();
+		qspace.wait (100);
+	}
+	
+	lock<httpdlogqueue> &mine = queues.get ();
+	
+	exclusivesection (mine)
+	{
+		if (iserror) mine.error.strcat (line);
+		else mine.access.strcat (line);
+		
+		// Counted while the writer can't get at it, so it never
+		// takes lines that aren't counted yet.
+		queued = __sync_add_and_fetch (&qbytes, len);
+	}
+	
+	// Only the line that pushes the queue over the mark needs to wake
+	// up the writer.
+	if ((queued >= flushsz) && ((queued - len) < flushsz))
+	{
+		qwakeup.signal ();
+	}
+}
+
+// ========================================================================
+// METHOD httpdlogger::writequeued
+// -------------------------------
+// Collects the queues of all threads and writes them out in one go,
+// holding each thread's lock only for as long as it takes to empty
+// its queue.
+// ========================================================================
+void httpdlogger::writequeued (void)
+{
+	string outaccess;
+	string outerror;
+	perthreadnode< lock<httpdlogqueue> > *node = NULL;
+	
+	while ((node = queues.walk (node)))
+	{
+		lock<httpdlogqueue> &q = node->obj;
+		
+		exclusivesection (q)
+		{
+			if (q.access.strlen())
+			{
+				outaccess.strcat (q.access);
+				q.access.crop ();
+			}
+			if (q.error.strlen())
+			{
+				outerror.strcat (q.error);
+				q.error.crop ();
+			}
+		}
+	}
+	
+	unsigned int taken = outaccess.strlen() + outerror.strlen();
+	if (! taken) return;
+	
+	if (outaccess.strlen())
+	{
+		exclusivesection (faccess)
+		{
+			faccess.puts (outaccess);
+		}
+	}
+	
+	if (outerror.strlen())
+	{
+		exclusivesection (ferror)
+		{
+			ferror.puts (outerror);
+		}
+	}
+	
+	// The lines are on their way to disk, let anyone who is waiting
+	// for that know.
+	__sync_sub_and_fetch (&qbytes, taken);
+	qspace.broadcast ();
+	if (__sync_add_and_fetch (&nflushing, 0)) qwritten.broadcast ();
+}
+
+// ========================================================================
+// CONSTRUCTOR httpdlogwriter
+// ========================================================================
+httpdlogwriter::httpdlogwriter (httpdlogger *o) : thread ("httpdlogwriter")
+{
+	owner = o;
+	spawn ();
+}
+
+// ========================================================================
+// DESTRUCTOR httpdlogwriter
+// ========================================================================
+httpdlogwriter::~httpdlogwriter (void)
+{
+}
+
+// ========================================================================
+// METHOD httpdlogwriter::run
+// --------------------------
+// Sleeps until the logger wakes us up or it is time for a round
+// anyway. Whatever was queued is written out before a "die" is
+// honored.
+// ========================================================================
+void httpdlogwriter::run (void)
+{
+	while (true)
+	{
+		owner->qwakeup.wait (tune::httpd::log::flushtime);
+		value ev = nextevent ();
+		owner->writequeued ();
+		if (ev && (ev.type() == "die")) break;
+	}
+}
+
+// ========================================================================
+// METHOD httpdlogwriter::shutdown
+// ========================================================================
+void httpdlogwriter::shutdown (void)
+{
+	sendevent ("die");
+	owner->qwakeup.signal ();
+	hasfinished.wait ();
+}
+
 // ========================================================================
 // CONSTRUCTOR httpdrewrite
 // ------------------------
@@ -1166,6 +2057,15 @@ httpdvhost::httpdvhost (httpd &pparent, const value &phostdb)
 	: httpdobject (pparent, "*")
 {
 	hostdb = phostdb;
+	
+	// Prepare the uri prefix for each host, so a request only
+	// needs a single lookup.
+	foreach (h, hostdb)
+	{
+		string pfx = "/";
+		pfx.strcat (h.sval());
+		prefixes[h.id()] = pfx;
+	}
 }
 
 // ========================================================================
@@ -1196,7 +2096,11 @@ int httpdvhost::run (string &uri, string &postbody, value &inhdr,
 					 tcpsocket &s)
 {
 	int colonpos;
-	string host = inhdr["Host"];
+	const value &hdr = inhdr;
+	const value *hosthdr = hdr.visitchild (key::http_host);
+	string host;
+	
+	if (hosthdr) host = hosthdr->sval();
 	
 	// Strip off port designation
 	colonpos = host.strchr (':');
@@ -1205,16 +2109,20 @@ int httpdvhost::run (string &uri, string &postbody, value &inhdr,
 	// No usable host header, assume default
 	if (! host.strlen()) host = "*";
 	
-	// Host doesn't exist? Assume default.
-	if (! hostdb.exists (host))
+	// Every prefix has at least the slash, an empty one means the
+	// host isn't there. Assume default.
+	const value &pfxdb = prefixes;
+	const string *pfx = &(pfxdb[host].sval());
+	if (! pfx->strlen())
+	{
 		host = "*";
+		pfx = &(pfxdb[host].sval());
+	}
 	
 	// If it exists now, use it for the rewrite
-	if (hostdb.exists (host))
+	if (pfx->strlen())
 	{
-		string newuri;
-		newuri = "/";
-		newuri.strcat (hostdb[host].sval());
+		string newuri = *pfx;
 		if (uri[0] != '/') newuri.strcat ('/');
 		newuri.strcat (uri);
 		uri = newuri;
@@ -1575,6 +2483,10 @@ int serverpage::run (string &uri, string &postbody, value &inhdr,
 
 	outhdr["Content-type"] = "text/html";
 
+	httpdstream st (s, env, outhdr);
+	if (stream (env, reqenv, st)) return st.finish ();
+	if (st.started ()) return st.finish ();
+
 	res = execute (env, reqenv, out, outhdr);
 	if (res>0) return res;
 	
@@ -1590,3 +2502,12 @@ int serverpage::execute (value &env, value &argv, string &out, value &outhdr)
 	// Useless method in base class.
 	return 0;
 }
+
+// ========================================================================
+// METHOD ::stream
+// ========================================================================
+int serverpage::stream (value &env, value &argv, httpdstream &out)
+{
+	// Pages that do not stream use execute().
+	return 0;
+}
@@ -0,0 +1,562 @@
+// This file is part of the Grace library (libgrace).
+// The Grace library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, using version 3 of the License.
+// You should have received a copy of the GNU Lesser General Public License
+// along with Grace library. If not, see <http://www.gnu.org/licenses/>.
+
+// ========================================================================
+// httpd_cache.cpp: In-memory cache of httpd responses.
+// ========================================================================
+
+#include <grace/httpd.h>
+#include <grace/defaults.h>
+#include <grace/checksum.h>
+#include <grace/strutil.h>
+#include <grace/system.h>
+#include <grace/md5.h>
+
+// ========================================================================
+// FUNCTION cachetime
+// ------------------
+// Time in milliseconds, a max-age of a second is not much use with a
+// clock that only does seconds.
+// ========================================================================
+static long long cachetime (void)
+{
+	struct timeval tv = core.time.unow ();
+	return (tv.tv_sec * 1000LL) + (tv.tv_usec / 1000);
+}
+
+// ========================================================================
+// FUNCTION headervalue
+// --------------------
+// Header names in a Vary are not necessarily spelled the way the
+// client sent them.
+// ========================================================================
+static string *headervalue (const value &inhdr, const string &name)
+{
+	returnclass (string) res retain;
+
+	if (inhdr.exists (name))
+	{
+		res = inhdr[name].sval();
+		return &res;
+	}
+
+	foreach (hdr, inhdr)
+	{
+		if (! hdr.id().sval().strcasecmp (name))
+		{
+			res = hdr.sval();
+			break;
+		}
+	}
+
+	return &res;
+}
+
+// ========================================================================
+// FUNCTION varymatch
+// ========================================================================
+static bool varymatch (httpdcacheentry *e, const value &inhdr)
+{
+	foreach (v, e->vary)
+	{
+		string hval = headervalue (inhdr, v.id().sval());
+		if (hval != v.sval()) return false;
+	}
+
+	return true;
+}
+
+// ========================================================================
+// CONSTRUCTOR httpdcache
+// ========================================================================
+httpdcache::httpdcache (void)
+{
+	buckets = new httpdcacheslot* [HTTPDCACHE_BUCKETS];
+	for (int i=0; i<HTTPDCACHE_BUCKETS; ++i) buckets[i] = NULL;
+
+	head = tail = NULL;
+	budget = 0;
+	used = 0;
+	nentries = 0;
+	nhits = 0;
+	nmisses = 0;
+	sweepat = 0;
+}
+
+// ========================================================================
+// DESTRUCTOR httpdcache
+// ========================================================================
+httpdcache::~httpdcache (void)
+{
+	while (head) unlink (head);
+
+	for (int i=0; i<HTTPDCACHE_BUCKETS; ++i)
+	{
+		httpdcacheslot *slot = buckets[i];
+		while (slot)
+		{
+			httpdcacheslot *nslot = slot->next;
+			delete slot;
+			slot = nslot;
+		}
+	}
+
+	delete[] buckets;
+}
+
+// ========================================================================
+// METHOD httpdcache::size
+// ========================================================================
+void httpdcache::size (unsigned int bytes)
+{
+	exclusivesection (lck)
+	{
+		budget = bytes;
+		makeroom (0);
+	}
+}
+
+// ========================================================================
+// METHOD httpdcache::hits
+// ========================================================================
+unsigned int httpdcache::hits (void)
+{
+	unsigned int res;
+	sharedsection (lck) { res = nhits; }
+	return res;
+}
+
+// ========================================================================
+// METHOD httpdcache::misses
+// ========================================================================
+unsigned int httpdcache::misses (void)
+{
+	unsigned int res;
+	sharedsection (lck) { res = nmisses; }
+	return res;
+}
+
+// ========================================================================
+// METHOD httpdcache::count
+// ========================================================================
+unsigned int httpdcache::count (void)
+{
+	unsigned int res;
+	sharedsection (lck) { res = nentries; }
+	return res;
+}
+
+// ========================================================================
+// METHOD httpdcache::bytes
+// ========================================================================
+unsigned int httpdcache::bytes (void)
+{
+	unsigned int res;
+	sharedsection (lck) { res = used; }
+	return res;
+}
+
+// ========================================================================
+// METHOD httpdcache::clear
+// ========================================================================
+void httpdcache::clear (void)
+{
+	exclusivesection (lck)
+	{
+		while (head) unlink (head);
+	}
+}
+
+// ========================================================================
+// METHOD httpdcache::lookup
+// -------------------------
+// The first request to miss on a uri gets to fill it. Others that
+// come in meanwhile wait for it, unless it takes too long.
+// ========================================================================
+int httpdcache::lookup (const string &key, const value &inhdr,
+						httpdcachehit &hit)
+{
+	long long deadline = cachetime() + tune::httpd::cache::waittime;
+
+	while (true)
+	{
+		long long now = cachetime ();
+
+		exclusivesection (lck)
+		{
+			httpdcacheslot *slot = findslot (key, true);
+			httpdcacheentry *e = slot->variants;
+
+			while (e)
+			{
+				httpdcacheentry *nexte = e->nextvariant;
+				if (e->expires <= now) unlink (e);
+				else if (varymatch (e, inhdr)) break;
+				e = nexte;
+			}
+
+			if (e)
+			{
+				// Move it to the head of the LRU list.
+				if (e != head)
+				{
+					e->newer->older = e->older;
+					if (e->older) e->older->newer = e->newer;
+					else tail = e->newer;
+
+					e->newer = NULL;
+					e->older = head;
+					head->newer = e;
+					head = e;
+				}
+
+				hit.headers = e->headers;
+				hit.validators = e->validators;
+				hit.body = e->body;
+				hit.etag = e->etag;
+				hit.age = (now - e->stored) / 1000;
+				nhits++;
+				return HTTPDCACHE_HIT;
+			}
+
+			if (slot->passuntil > now)
+			{
+				nmisses++;
+				return HTTPDCACHE_PASS;
+			}
+
+			if (! slot->filling)
+			{
+				slot->filling = true;
+				nmisses++;
+				return HTTPDCACHE_FILL;
+			}
+
+			if (now >= deadline)
+			{
+				nmisses++;
+				return HTTPDCACHE_PASS;
+			}
+		}
+
+		// Filled slots raise the condition, the timeout only
+		// covers a signal that came before we got here.
+		fillcond.wait (50);
+	}
+}
+
+// ========================================================================
+// METHOD httpdcache::store
+// ------------------------
+// The entry is put together before taking the lock, it only has to be
+// linked in. Anything that can't be stored marks the uri as one to
+// pass on for a while, so requests for it don't wait in line.
+// ========================================================================
+bool httpdcache::store (const string &key, const value &inhdr, int status,
+						value &outhdr, const string &body)
+{
+	httpdcacheentry *e = NULL;
+	bool stored = false;
+	int ttl = lifetime (inhdr, status, outhdr);
+
+	if (ttl > 0)
+	{
+		if (! outhdr.exists ("ETag"))
+		{
+			md5checksum md5;
+			md5.append (body);
+			string hex = md5.hex ();
+			outhdr["ETag"] = "\"%s\"" %format (hex);
+		}
+
+		e = new httpdcacheentry;
+		e->slot = NULL;
+		e->nextvariant = NULL;
+		e->newer = e->older = NULL;
+		e->etag = outhdr["ETag"].sval();
+		e->body = body;
+		e->validators = validators (outhdr);
+
+		foreach (hdr, outhdr)
+		{
+			if (hdr.id() == "Connection") continue;
+			e->headers.strcat ("%s: %s\r\n" %format (hdr.id(), hdr));
+		}
+
+		if (outhdr.exists ("Vary"))
+		{
+			value names = strutil::split (outhdr["Vary"].sval(), ',');
+			foreach (n, names)
+			{
+				string name = n.sval().trim (" \t");
+				if (name.strlen()) e->vary[name] = headervalue (inhdr, name);
+			}
+		}
+
+		e->size = sizeof (httpdcacheentry) + e->headers.strlen() +
+				  e->validators.strlen() + e->body.strlen() +
+				  e->etag.strlen() + key.strlen();
+	}
+
+	exclusivesection (lck)
+	{
+		long long now = cachetime ();
+		httpdcacheslot *slot = findslot (key, true);
+		filled (slot);
+
+		// No single response gets to push out most of the rest.
+		if (e && budget && (e->size <= (budget / 4)))
+		{
+			httpdcacheentry *v = slot->variants;
+			while (v)
+			{
+				httpdcacheentry *nextv = v->nextvariant;
+				if (varymatch (v, inhdr)) unlink (v);
+				v = nextv;
+			}
+
+			makeroom (e->size);
+
+			e->slot = slot;
+			e->nextvariant = slot->variants;
+			slot->variants = e;
+
+			e->older = head;
+			if (head) head->newer = e;
+			head = e;
+			if (! tail) tail = e;
+
+			e->stored = now;
+			e->expires = now + (1000LL * ttl);
+			used += e->size;
+			nentries++;
+			slot->passuntil = 0;
+			stored = true;
+		}
+		else
+		{
+			slot->passuntil = now + (1000LL * tune::httpd::cache::passtime);
+		}
+
+		sweep ();
+	}
+
+	if (e && (! stored)) delete e;
+	return stored;
+}
+
+// ========================================================================
+// METHOD httpdcache::abandon
+// ========================================================================
+void httpdcache::abandon (const string &key)
+{
+	exclusivesection (lck)
+	{
+		httpdcacheslot *slot = findslot (key, true);
+		filled (slot);
+		slot->passuntil = cachetime() +
+						  (1000LL * tune::httpd::cache::passtime);
+		sweep ();
+	}
+}
+
+// ========================================================================
+// STATIC METHOD httpdcache::notmodified
+// -------------------------------------
+// If-None-Match holds a list of entity tags, or a '*' for any. Weak
+// tags are good enough for a GET.
+// ========================================================================
+bool httpdcache::notmodified (const value &inhdr, const string &etag)
+{
+	if (! etag.strlen()) return false;
+
+	string inm = headervalue (inhdr, "If-None-Match");
+	if (! inm.strlen()) return false;
+
+	string want = etag.trim ("\"");
+	value tags = strutil::split (inm, ',');
+
+	foreach (t, tags)
+	{
+		string tag = t.sval().trim (" \t");
+		if (tag == "*") return true;
+		if (tag.strncmp ("W/", 2) == 0) tag = tag.mid (2);
+		tag = tag.trim ("\"");
+		if (tag == want) return true;
+	}
+
+	return false;
+}
+
+// ========================================================================
+// STATIC METHOD httpdcache::validators
+// ========================================================================
+string *httpdcache::validators (const value &outhdr)
+{
+	static const char *names[] = { "Cache-Control", "Content-Location",
+								   "Date", "ETag", "Expires", "Vary",
+								   "Last-Modified", NULL };
+	returnclass (string) res retain;
+
+	for (int i=0; names[i]; ++i)
+	{
+		if (! outhdr.exists (names[i])) continue;
+		res.strcat ("%s: %s\r\n" %format (names[i], outhdr[names[i]]));
+	}
+
+	return &res;
+}
+
+// ========================================================================
+// METHOD httpdcache::lifetime
+// ---------------------------
+// A shared cache goes by s-maxage first, max-age second.
+// ========================================================================
+int httpdcache::lifetime (const value &inhdr, int status,
+						  const value &outhdr)
+{
+	if (status != 200) return 0;
+	if (outhdr.exists ("Set-Cookie")) return 0;
+	if (! outhdr.exists ("Cache-Control")) return 0;
+	if (outhdr.exists ("Vary") && (outhdr["Vary"].sval().strchr ('*') >= 0))
+		return 0;
+
+	int maxage = 0;
+	int smaxage = -1;
+	value directives = strutil::split (outhdr["Cache-Control"].sval(), ',');
+
+	foreach (d, directives)
+	{
+		string dir = d.sval().trim (" \t");
+		dir.ctolower ();
+
+		if ((dir == "no-store") || (dir == "no-cache") ||
+			(dir == "private"))
+		{
+			return 0;
+		}
+
+		string arg = dir;
+		string name = arg.cutat ('=');
+		
+		if (name == "max-age") maxage = arg.toint();
+		else if (name == "s-maxage") smaxage = arg.toint();
+	}
+
+	if (smaxage >= 0) return smaxage;
+	return (maxage > 0) ? maxage : 0;
+}
+
+// ========================================================================
+// METHOD httpdcache::findslot
+// ========================================================================
+httpdcacheslot *httpdcache::findslot (const string &key, bool create)
+{
+	unsigned int b = checksum (key.str()) % HTTPDCACHE_BUCKETS;
+	httpdcacheslot *slot = buckets[b];
+
+	while (slot)
+	{
+		if (slot->key == key) return slot;
+		slot = slot->next;
+	}
+
+	if (! create) return NULL;
+
+	slot = new httpdcacheslot;
+	slot->key = key;
+	slot->variants = NULL;
+	slot->passuntil = 0;
+	slot->filling = false;
+	slot->next = buckets[b];
+	buckets[b] = slot;
+	return slot;
+}
+
+// ========================================================================
+// METHOD httpdcache::unlink
+// ========================================================================
+void httpdcache::unlink (httpdcacheentry *e)
+{
+	httpdcacheentry **crsr = &(e->slot->variants);
+	while (*crsr)
+	{
+		if (*crsr == e)
+		{
+			*crsr = e->nextvariant;
+			break;
+		}
+		crsr = &((*crsr)->nextvariant);
+	}
+
+	if (e->newer) e->newer->older = e->older;
+	else head = e->older;
+
+	if (e->older) e->older->newer = e->newer;
+	else tail = e->newer;
+
+	used -= e->size;
+	nentries--;
+	delete e;
+}
+
+// ========================================================================
+// METHOD httpdcache::makeroom
+// ========================================================================
+void httpdcache::makeroom (unsigned int sz)
+{
+	while (tail && ((used + sz) > budget)) unlink (tail);
+}
+
+// ========================================================================
+// METHOD httpdcache::sweep
+// ------------------------
+// Every uri that was ever asked for gets a slot. Sweeping a bucket at
+// a time on every store keeps the ones that are no longer of use from
+// piling up, without ever walking the whole table in one go.
+// ========================================================================
+void httpdcache::sweep (void)
+{
+	long long now = cachetime ();
+	httpdcacheslot **crsr = &(buckets[sweepat]);
+
+	while (*crsr)
+	{
+		httpdcacheslot *slot = *crsr;
+		httpdcacheentry *e = slot->variants;
+
+		while (e)
+		{
+			httpdcacheentry *nexte = e->nextvariant;
+			if (e->expires <= now) unlink (e);
+			e = nexte;
+		}
+
+		if ((! slot->variants) && (! slot->filling) &&
+			(slot->passuntil <= now))
+		{
+			*crsr = slot->next;
+			delete slot;
+		}
+		else
+		{
+			crsr = &(slot->next);
+		}
+	}
+
+	sweepat = (sweepat + 1) % HTTPDCACHE_BUCKETS;
+}
+
+// ========================================================================
+// METHOD httpdcache::filled
+// ========================================================================
+void httpdcache::filled (httpdcacheslot *slot)
+{
+	if (! slot->filling) return;
+	slot->filling = false;
+	fillcond.broadcast ();
+}
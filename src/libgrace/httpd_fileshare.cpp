@@ -20,6 +20,216 @@
 #include <grace/system.h>
 #include <grace/timestamp.h>
 #include <grace/xmlschema.h>
+#include <grace/defaults.h>
+#include <grace/checksum.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+/// A range of bytes, both ends included.
+struct httpdbyterange
+{
+	unsigned long long	 first;
+	unsigned long long	 last;
+};
+
+static const char *HTTPDAYS[7] =
+	{ "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+
+static const char *HTTPMONTHS[12] =
+	{ "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// ========================================================================
+// FUNCTION filecachetime
+// ========================================================================
+static long long filecachetime (void)
+{
+	struct timeval tv = core.time.unow ();
+	return (tv.tv_sec * 1000LL) + (tv.tv_usec / 1000);
+}
+
+// ========================================================================
+// FUNCTION httpdate
+// -----------------
+// Formats a time the way RFC 1123 wants it. Not through timestamp or
+// strftime(), those follow the local timezone and the locale.
+// ========================================================================
+static string *httpdate (time_t t)
+{
+	returnclass (string) res retain;
+	struct tm tm;
+	
+	gmtime_r (&t, &tm);
+	res.printf ("%s, %02i %s %i %02i:%02i:%02i GMT", HTTPDAYS[tm.tm_wday],
+				tm.tm_mday, HTTPMONTHS[tm.tm_mon], tm.tm_year + 1900,
+				tm.tm_hour, tm.tm_min, tm.tm_sec);
+	return &res;
+}
+
+// ========================================================================
+// FUNCTION parsehttpdate
+// ----------------------
+// Reads a date in any of the three formats HTTP/1.1 allows:
+//
+//     Sun, 06 Nov 1994 08:49:37 GMT
+//     Sunday, 06-Nov-94 08:49:37 GMT
+//     Sun Nov  6 08:49:37 1994
+//
+// Returns -1 if it makes no sense.
+// ========================================================================
+static time_t parsehttpdate (const string &str)
+{
+	int num[8];
+	int nnum = 0;
+	int month = -1;
+	bool monthfirst = false;
+	bool seenword = false;
+	const char *c = str.str();
+	
+	while (*c)
+	{
+		if (isdigit (*c))
+		{
+			if (nnum == 8) return -1;
+			int n = 0;
+			for (int i=0; isdigit (*c); ++i, ++c)
+			{
+				if (i == 4) return -1;
+				n = (n * 10) + (*c - '0');
+			}
+			num[nnum++] = n;
+		}
+		else if (isalpha (*c))
+		{
+			const char *w = c;
+			while (isalpha (*c)) ++c;
+			
+			if ((c - w) == 3)
+			{
+				for (int i=0; i<12; ++i)
+				{
+					if (strncasecmp (w, HTTPMONTHS[i], 3) == 0)
+					{
+						month = i;
+						monthfirst = (nnum == 0) && seenword;
+					}
+				}
+			}
+			seenword = true;
+		}
+		else ++c;
+	}
+	
+	if ((month < 0) || (nnum != 5)) return -1;
+	
+	struct tm tm;
+	memset (&tm, 0, sizeof (tm));
+	tm.tm_mon = month;
+	
+	if (monthfirst)
+	{
+		tm.tm_mday = num[0];
+		tm.tm_hour = num[1];
+		tm.tm_min = num[2];
+		tm.tm_sec = num[3];
+		tm.tm_year = num[4];
+	}
+	else
+	{
+		tm.tm_mday = num[0];
+		tm.tm_year = num[1];
+		tm.tm_hour = num[2];
+		tm.tm_min = num[3];
+		tm.tm_sec = num[4];
+	}
+	
+	// Two digit years are in this century up to 69.
+	if (tm.tm_year < 70) tm.tm_year += 2000;
+	else if (tm.tm_year < 100) tm.tm_year += 1900;
+	tm.tm_year -= 1900;
+	
+	if ((tm.tm_mday < 1) || (tm.tm_mday > 31) || (tm.tm_hour > 23) ||
+		(tm.tm_min > 59) || (tm.tm_sec > 60)) return -1;
+	
+	return timegm (&tm);
+}
+
+// ========================================================================
+// FUNCTION parseranges
+// --------------------
+// Reads a Range header into a list of satisfiable byte ranges for a
+// file of the given size. Returns the number of ranges, or -1 if the
+// header is to be ignored: a unit other than bytes, a syntax error,
+// or more than HTTPD_MAXRANGES ranges. Zero means none of them fit.
+// ========================================================================
+static int parseranges (const string &spec, unsigned long long size,
+						httpdbyterange *ranges)
+{
+	const char *c = spec.str();
+	int count = 0;
+	int nspecs = 0;
+	
+	while (isspace (*c)) ++c;
+	if (strncasecmp (c, "bytes=", 6)) return -1;
+	c += 6;
+	
+	while (true)
+	{
+		unsigned long long first = 0;
+		unsigned long long last = 0;
+		bool hasfirst = false;
+		bool haslast = false;
+		
+		while (isspace (*c)) ++c;
+		for (; isdigit (*c); ++c)
+		{
+			if (first > 0x0fffffffffffffffULL) return -1;
+			first = (first * 10) + (*c - '0');
+			hasfirst = true;
+		}
+		if (*c != '-') return -1;
+		++c;
+		for (; isdigit (*c); ++c)
+		{
+			if (last > 0x0fffffffffffffffULL) return -1;
+			last = (last * 10) + (*c - '0');
+			haslast = true;
+		}
+		while (isspace (*c)) ++c;
+		
+		if ((! hasfirst) && (! haslast)) return -1;
+		if (hasfirst && haslast && (last < first)) return -1;
+		if (++nspecs > HTTPD_MAXRANGES) return -1;
+		
+		if (! hasfirst)
+		{
+			// The last n bytes.
+			if (last && size)
+			{
+				if (last > size) last = size;
+				ranges[count].first = size - last;
+				ranges[count].last = size - 1;
+				++count;
+			}
+		}
+		else if (first < size)
+		{
+			ranges[count].first = first;
+			ranges[count].last = (haslast && (last < size)) ? last : size-1;
+			++count;
+		}
+		
+		if (! *c) break;
+		if (*c != ',') return -1;
+		++c;
+	}
+	
+	return count;
+}
 
 // ========================================================================
 // CONSTRUCTOR httpdfiletypehandler
@@ -272,17 +482,30 @@ int httpdfileshare::run (string &uri, string &postbody,
 		return 500;
 	}
 	
-	// No file, no ride.
-	if ( (realpath.strlen() == 0) || (! fs.exists (realpath)) )
+	// No file, no ride. Directories get their index.html, or
+	// nothing.
+	httpdfileinfo *f = files.get (realpath);
+	if (f->exists && f->isdir)
+	{
+		files.release (f);
+		realpath.strcat ("/index.html");
+		f = files.get (realpath);
+	}
+	
+	if ((! f->exists) || f->isdir || (f->fd < 0))
 	{
+		files.release (f);
+		
 		// TODO add option for a 404 document
 		if (parent->havedefault (404))
 		{
-			unsigned int bytes;
+			unsigned long long bytes;
+			s.cork (true);
 			s.puts ("HTTP/1.1 404 NOT FOUND\r\n"
 					"Content-type: text/html\r\n");
 			
 			bytes = parent->sendfile (s, parent->defaultdocument (404));
+			s.cork (false);
 			env["sentbytes"] = bytes;
 			return -404;
 		}
@@ -291,13 +514,6 @@ int httpdfileshare::run (string &uri, string &postbody,
 		return 404;
 	}
 	
-	// TODO: change default document behavior
-	if (fs.isdir (realpath)) realpath.strcat ("/index.html");
-	
-	unsigned int outsz;
-	
-	outsz = fs.size (realpath);
-	
 	// Figure out the extension
 	int extpos = realpath.strchr ('.');
 	int nextpos;
@@ -313,6 +529,7 @@ int httpdfileshare::run (string &uri, string &postbody,
 		
 		if (filetypes.exists (ext))
 		{
+			files.release (f);
 			return filetypes[ext]->run (realpath, postbody, inhdr, out,
 										outhdr, env, s);
 		}
@@ -322,82 +539,186 @@ int httpdfileshare::run (string &uri, string &postbody,
 	}
 	
 	bool keepalive = env["keepalive"].bval();
-
-	#define HTTP_F "%a, %e %b %Y %H:%M:%S %Z"
-
-	value vinf = fs.getinfo (realpath);
-	timestamp tmodif = vinf["mtime"].uval();
-	timestamp tnow = core.time.now ();
-	string smodif = tmodif.format (HTTP_F);
-	if (inhdr.exists ("If-Modified-Since"))
-	{
-		if (inhdr["If-Modified-Since"].sval() == smodif)
-		{
-			s.puts ("HTTP/1.1 304 NOT CHANGED\r\n"
-					"Connection: %s\r\n"
-					"Content-length: 0\r\n\r\n"
-					%format (keepalive ? "keepalive" : "close"));
-			
-			env["sentbytes"] = 0;
-			return -304;
-		}
-	}
-
-	int maxage = (tnow.unixtime() - tmodif.unixtime()) / 2;
-	if (maxage < 60) maxage = 60;
+	const char *connection = keepalive ? "keep-alive" : "close";
 	
-	timestamp texp = tnow.unixtime () + maxage;
-
+	// A compressed version is sent instead if the client can take it.
+	// Either way the response depends on Accept-Encoding.
 	string gzpath = realpath;
 	gzpath += ".gz";
 	
-	if ( fs.exists (gzpath) && 
+	httpdfileinfo *gzf = files.get (gzpath);
+	bool hasgz = gzf->exists && (! gzf->isdir) && (gzf->fd >= 0);
+	
+	if ( hasgz && 
 		inhdr.exists ("Accept-Encoding") && 
 		inhdr["Accept-Encoding"].sval().strstr("gzip") != -1 )
 	{
-		
-		outsz = fs.size (gzpath);
-		s.puts ("HTTP/1.1 200 OK\r\n"
-			"Connection: %s\r\n"
-			"Content-Type: %s\r\n"
-			"Cache-Control: max-age=%i\r\n"
-			"Date: %s\r\n"
-			"Last-Modified: %s\r\n"
-			"Expires: %s\r\n"
-			"Content-Encoding: gzip\r\n"
-			"Content-Length: %i\r\n\r\n"
-			%format (keepalive ? "keepalive" : "close",
-					 mimetype,
-					 maxage,
-					 tnow.format (HTTP_F),
-					 smodif,
-					 texp.format (HTTP_F),
-					 outsz));
-					 
-		s.sendfile (gzpath, outsz);
-	}
-	else 
-	{
-		s.puts ("HTTP/1.1 200 OK\r\n"
-				"Connection: %s\r\n"
-				"Content-Type: %s\r\n"
+		files.release (f);
+		f = gzf;
+	}
+	else
+	{
+		files.release (gzf);
+		gzf = NULL;
+	}
+
+	time_t tnow = core.time.now ();
+	int maxage = (tnow - f->mtime) / 2;
+	if (maxage < 60) maxage = 60;
+	
+	string sdate = httpdate (tnow);
+	string sexpires = httpdate (tnow + maxage);
+	string hdr;
+	hdr.printf ("Connection: %s\r\n"
 				"Cache-Control: max-age=%i\r\n"
 				"Date: %s\r\n"
 				"Last-Modified: %s\r\n"
 				"Expires: %s\r\n"
-				"Content-Length: %i\r\n\r\n"
-				%format (keepalive ? "keepalive" : "close",
-						 mimetype,
-						 maxage,
-						 tnow.format (HTTP_F),
-						 smodif,
-						 texp.format (HTTP_F),
-						 outsz));
-
-		s.sendfile (realpath, outsz);
-	}
-	env["sentbytes"] = outsz;
-	return -200;
+				"ETag: %s\r\n",
+				connection, maxage, sdate.str(), f->lastmodified.str(),
+				sexpires.str(), f->etag.str());
+	
+	if (hasgz) hdr.strcat ("Vary: Accept-Encoding\r\n");
+	
+	// The client may already have it. An If-None-Match gets the
+	// last word over an If-Modified-Since.
+	bool notmodified = false;
+	if (inhdr.exists ("If-None-Match"))
+	{
+		notmodified = httpdcache::notmodified (inhdr, f->etag);
+	}
+	else if (inhdr.exists ("If-Modified-Since"))
+	{
+		time_t ims = parsehttpdate (inhdr["If-Modified-Since"].sval());
+		if ((ims >= 0) && (f->mtime <= ims)) notmodified = true;
+	}
+	
+	if (notmodified)
+	{
+		s.puts ("HTTP/1.1 304 NOT MODIFIED\r\n%s\r\n" %format (hdr));
+		files.release (f);
+		env["sentbytes"] = 0;
+		return -304;
+	}
+	
+	if (gzf) hdr.strcat ("Content-Encoding: gzip\r\n");
+	hdr.strcat ("Accept-Ranges: bytes\r\n");
+	
+	// Ranges only count if the If-Range, if any, still matches. The
+	// header parser may have taken the quotes off an entity tag, so
+	// anything that does not read as a date is taken for one. It has
+	// to be a strong match.
+	httpdbyterange ranges[HTTPD_MAXRANGES];
+	int nranges = -1;
+	
+	if (inhdr.exists ("Range"))
+	{
+		bool current = true;
+		if (inhdr.exists ("If-Range"))
+		{
+			string ifrange = inhdr["If-Range"];
+			time_t ifdate = parsehttpdate (ifrange);
+			
+			if (ifdate >= 0) current = (ifdate == f->mtime);
+			else if (ifrange.strncmp ("W/", 2) == 0) current = false;
+			else
+			{
+				string tag = ifrange.trim ("\"");
+				string want = f->etag.trim ("\"");
+				current = (tag == want);
+			}
+		}
+		
+		if (current)
+		{
+			nranges = parseranges (inhdr["Range"].sval(), f->size, ranges);
+		}
+	}
+	
+	unsigned long long total = 0;
+	bool sent = true;
+	
+	// Headers and file data go out corked, so that small files
+	// leave in a single segment.
+	s.cork (true);
+	
+	if (nranges == 0)
+	{
+		s.puts ("HTTP/1.1 416 RANGE NOT SATISFIABLE\r\n%s"
+				"Content-Range: bytes */%U\r\n"
+				"Content-Length: 0\r\n\r\n" %format (hdr, f->size));
+		s.cork (false);
+		files.release (f);
+		env["sentbytes"] = 0;
+		return -416;
+	}
+	else if (nranges == 1)
+	{
+		total = ranges[0].last - ranges[0].first + 1;
+		s.puts ("HTTP/1.1 206 PARTIAL CONTENT\r\n%s"
+				"Content-Type: %s\r\n"
+				"Content-Range: bytes %U-%U/%U\r\n"
+				"Content-Length: %U\r\n\r\n"
+				%format (hdr, mimetype, ranges[0].first, ranges[0].last,
+						 f->size, total));
+		
+		sent = s.sendfile (f->fd, ranges[0].first, total);
+	}
+	else if (nranges > 1)
+	{
+		// Every part gets a header of its own. Work out the whole
+		// length before anything goes out.
+		string tag = f->etag.trim ("\"");
+		string boundary = "grace-byteranges-%s" %format (tag);
+		string parthdr[HTTPD_MAXRANGES];
+		string trailer = "\r\n--%s--\r\n" %format (boundary);
+		
+		for (int i=0; i<nranges; ++i)
+		{
+			parthdr[i] = "\r\n--%s\r\n"
+						 "Content-Type: %s\r\n"
+						 "Content-Range: bytes %U-%U/%U\r\n\r\n"
+						 %format (boundary, mimetype, ranges[i].first,
+								  ranges[i].last, f->size);
+			
+			total += parthdr[i].strlen();
+			total += ranges[i].last - ranges[i].first + 1;
+		}
+		total += trailer.strlen();
+		
+		s.puts ("HTTP/1.1 206 PARTIAL CONTENT\r\n%s"
+				"Content-Type: multipart/byteranges; boundary=%s\r\n"
+				"Content-Length: %U\r\n\r\n"
+				%format (hdr, boundary, total));
+		
+		for (int i=0; sent && (i<nranges); ++i)
+		{
+			s.puts (parthdr[i]);
+			sent = s.sendfile (f->fd, ranges[i].first,
+							   ranges[i].last - ranges[i].first + 1);
+		}
+		if (sent) s.puts (trailer);
+	}
+	else
+	{
+		total = f->size;
+		s.puts ("HTTP/1.1 200 OK\r\n%s"
+				"Content-Type: %s\r\n"
+				"Content-Length: %U\r\n\r\n"
+				%format (hdr, mimetype, total));
+		
+		sent = s.sendfile (f->fd, 0, total);
+	}
+	
+	s.cork (false);
+	files.release (f);
+	
+	// The client was promised more than it got, the connection
+	// cannot be used anymore.
+	if (! sent) env["keepalive"] = false;
+	
+	env["sentbytes"] = total;
+	return (nranges > 0) ? -206 : -200;
 }
 
 // ========================================================================
@@ -410,3 +731,230 @@ void httpdfileshare::addhandler (httpdfiletypehandler *handler,
 {
 	filetypes[forextension] = handler;
 }
+
+// ========================================================================
+// CONSTRUCTOR httpdfilecache
+// ========================================================================
+httpdfilecache::httpdfilecache (void)
+{
+	for (int i=0; i<HTTPDFILECACHE_BUCKETS; ++i) buckets[i] = NULL;
+	head = tail = NULL;
+	cnt = 0;
+}
+
+// ========================================================================
+// DESTRUCTOR httpdfilecache
+// ========================================================================
+httpdfilecache::~httpdfilecache (void)
+{
+	httpdfileinfo *f, *nf;
+	
+	for (f = head; f; f = nf)
+	{
+		nf = f->older;
+		if (f->fd >= 0) ::close (f->fd);
+		delete f;
+	}
+}
+
+// ========================================================================
+// METHOD httpdfilecache::get
+// --------------------------
+// An entry that was checked recently enough is handed out as it is.
+// Anything else takes a stat() and, if the file changed, an open(),
+// neither of which happen with the lock held.
+// ========================================================================
+httpdfileinfo *httpdfilecache::get (const string &path)
+{
+	unsigned int b = checksum (path.str()) % HTTPDFILECACHE_BUCKETS;
+	long long now = filecachetime ();
+	httpdfileinfo *f = NULL;
+	
+	exclusivesection (lck)
+	{
+		for (f = buckets[b]; f; f = f->next)
+		{
+			if (f->path == path) break;
+		}
+		
+		if (f)
+		{
+			f->refcount++;
+			
+			// Move to the front of the LRU list.
+			if (f != head)
+			{
+				f->newer->older = f->older;
+				if (f->older) f->older->newer = f->newer;
+				else tail = f->newer;
+				f->newer = NULL;
+				f->older = head;
+				head->newer = f;
+				head = f;
+			}
+			
+			if ((now - f->checked) < tune::httpd::fileshare::revalidate)
+			{
+				return f;
+			}
+		}
+	}
+	
+	if (f)
+	{
+		struct stat st;
+		bool same;
+		
+		if (::stat (path.str(), &st)) same = (! f->exists);
+		else same = f->exists && (f->dev == (unsigned long long) st.st_dev) &&
+					(f->ino == (unsigned long long) st.st_ino) &&
+					(f->size == (unsigned long long) st.st_size) &&
+					(f->mtime == st.st_mtime);
+		
+		if (same)
+		{
+			exclusivesection (lck)
+			{
+				f->checked = now;
+			}
+			return f;
+		}
+		
+		release (f);
+	}
+	
+	httpdfileinfo *nf = load (path);
+	nf->checked = now;
+	nf->refcount = 2;
+	
+	exclusivesection (lck)
+	{
+		// Whatever is in the table now is older than what we just
+		// found on disk.
+		for (f = buckets[b]; f; f = f->next)
+		{
+			if (f->path == path)
+			{
+				unlink (f);
+				break;
+			}
+		}
+		
+		nf->next = buckets[b];
+		buckets[b] = nf;
+		nf->newer = NULL;
+		nf->older = head;
+		if (head) head->newer = nf;
+		else tail = nf;
+		head = nf;
+		cnt++;
+		
+		while ((cnt > tune::httpd::fileshare::openfiles) && (tail != nf))
+		{
+			unlink (tail);
+		}
+	}
+	
+	return nf;
+}
+
+// ========================================================================
+// METHOD httpdfilecache::release
+// ========================================================================
+void httpdfilecache::release (httpdfileinfo *f)
+{
+	exclusivesection (lck)
+	{
+		unref (f);
+	}
+}
+
+// ========================================================================
+// METHOD httpdfilecache::count
+// ========================================================================
+unsigned int httpdfilecache::count (void)
+{
+	sharedsection (lck)
+	{
+		return cnt;
+	}
+	return 0;
+}
+
+// ========================================================================
+// METHOD httpdfilecache::load
+// ---------------------------
+// The stat() that counts is the one on the open descriptor, so that
+// size and entity tag belong to the file that is actually sent.
+// ========================================================================
+httpdfileinfo *httpdfilecache::load (const string &path)
+{
+	httpdfileinfo *f = new httpdfileinfo;
+	struct stat st;
+	
+	f->path = path;
+	f->fd = -1;
+	f->exists = false;
+	f->isdir = false;
+	f->size = 0;
+	f->dev = f->ino = 0;
+	f->mtime = 0;
+	f->checked = 0;
+	f->refcount = 0;
+	f->next = f->newer = f->older = NULL;
+	
+	if (::stat (path.str(), &st)) return f;
+	
+	if (! S_ISDIR (st.st_mode))
+	{
+		f->fd = ::open (path.str(), O_RDONLY);
+		if ((f->fd >= 0) && ::fstat (f->fd, &st))
+		{
+			::close (f->fd);
+			f->fd = -1;
+		}
+		if (f->fd >= 0) ::fcntl (f->fd, F_SETFD, FD_CLOEXEC);
+	}
+	
+	f->exists = true;
+	f->isdir = S_ISDIR (st.st_mode);
+	f->size = st.st_size;
+	f->dev = st.st_dev;
+	f->ino = st.st_ino;
+	f->mtime = st.st_mtime;
+	f->lastmodified = httpdate (f->mtime);
+	f->etag = "\"%X-%X-%X\"" %format (f->ino, f->size,
+									   (unsigned long long) f->mtime);
+	return f;
+}
+
+// ========================================================================
+// METHOD httpdfilecache::unlink
+// ========================================================================
+void httpdfilecache::unlink (httpdfileinfo *f)
+{
+	unsigned int b = checksum (f->path.str()) % HTTPDFILECACHE_BUCKETS;
+	httpdfileinfo **p = &buckets[b];
+	
+	while (*p && (*p != f)) p = &((*p)->next);
+	if (*p) *p = f->next;
+	
+	if (f->newer) f->newer->older = f->older;
+	else head = f->older;
+	if (f->older) f->older->newer = f->newer;
+	else tail = f->newer;
+	
+	f->next = f->newer = f->older = NULL;
+	cnt--;
+	unref (f);
+}
+
+// ========================================================================
+// METHOD httpdfilecache::unref
+// ========================================================================
+void httpdfilecache::unref (httpdfileinfo *f)
+{
+	if (--(f->refcount)) return;
+	if (f->fd >= 0) ::close (f->fd);
+	delete f;
+}
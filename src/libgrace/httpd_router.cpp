@@ -0,0 +1,196 @@
+// This file is part of the Grace library (libgrace).
+// The Grace library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, using version 3 of the License.
+// You should have received a copy of the GNU Lesser General Public License 
+// along with Grace library. If not, see <http://www.gnu.org/licenses/>.
+
+// ========================================================================
+// httpd_router.cpp: Routing trie for the httpdobject chain.
+// ========================================================================
+
+#include <grace/httpd.h>
+
+// Case folding table from tolower.cpp. Its header is left out, the
+// _tolower() macro in it clashes with the one from <ctype.h>.
+extern u_char lower_tab[256];
+
+// ========================================================================
+// CONSTRUCTOR httpdrouter
+// ========================================================================
+httpdrouter::httpdrouter (void)
+{
+	top.c = 0;
+	top.child = top.sibling = NULL;
+	top.routes = NULL;
+	cnt = 0;
+}
+
+// ========================================================================
+// DESTRUCTOR httpdrouter
+// ========================================================================
+httpdrouter::~httpdrouter (void)
+{
+	httpdroutenode *crsr = top.child;
+	while (crsr)
+	{
+		httpdroutenode *nxt = crsr->sibling;
+		freenode (crsr);
+		crsr = nxt;
+	}
+	
+	httpdroute *r = top.routes;
+	while (r)
+	{
+		httpdroute *nxt = r->next;
+		delete r;
+		r = nxt;
+	}
+}
+
+// ========================================================================
+// METHOD httpdrouter::freenode
+// ========================================================================
+void httpdrouter::freenode (httpdroutenode *node)
+{
+	httpdroutenode *crsr = node->child;
+	while (crsr)
+	{
+		httpdroutenode *nxt = crsr->sibling;
+		freenode (crsr);
+		crsr = nxt;
+	}
+	
+	httpdroute *r = node->routes;
+	while (r)
+	{
+		httpdroute *nxt = r->next;
+		delete r;
+		r = nxt;
+	}
+	
+	delete node;
+}
+
+// ========================================================================
+// METHOD httpdrouter::add
+// -----------------------
+// Files the object under the literal start of its pattern. That part
+// is compared the same way as wild_match() does it: byte by byte,
+// through lower_tab. Any of the characters wild_match() treats as
+// special ends it.
+// ========================================================================
+void httpdrouter::add (httpdobject *obj)
+{
+	const string &pat = obj->urimatch;
+	int len = pat.strlen();
+	int plen = 0;
+	
+	while (plen < len)
+	{
+		char c = pat[plen];
+		if ((c == '*') || (c == '%') || (c == '?') || (c == '\\')) break;
+		++plen;
+	}
+	
+	httpdroute *r = new httpdroute;
+	r->obj = obj;
+	r->index = cnt++;
+	r->next = NULL;
+	r->exact = (plen == len);
+	r->prefix = ((plen+1) == len) && (pat[plen] == '*');
+	
+	if (plen > HTTPD_ROUTEDEPTH)
+	{
+		plen = HTTPD_ROUTEDEPTH;
+		r->exact = r->prefix = false;
+	}
+	
+	httpdroutenode *node = &top;
+	for (int i=0; i<plen; ++i)
+	{
+		unsigned char c = lower_tab[(unsigned char) pat[i]];
+		httpdroutenode *ch = node->child;
+		
+		while (ch && (ch->c != c)) ch = ch->sibling;
+		if (! ch)
+		{
+			ch = new httpdroutenode;
+			ch->c = c;
+			ch->child = NULL;
+			ch->routes = NULL;
+			ch->sibling = node->child;
+			node->child = ch;
+		}
+		node = ch;
+	}
+	
+	httpdroute **tail = &(node->routes);
+	while (*tail) tail = &((*tail)->next);
+	*tail = r;
+}
+
+// ========================================================================
+// CONSTRUCTOR httpdroutecursor
+// ========================================================================
+httpdroutecursor::httpdroutecursor (const httpdrouter &r,
+									const string &puri)
+	: uri (puri)
+{
+	const httpdroutenode *node = &(r.top);
+	const char *s = uri.str();
+	int len = uri.strlen();
+	
+	n = 0;
+	
+	for (int i=0; node; ++i)
+	{
+		if (node->routes)
+		{
+			at[n] = node->routes;
+			last[n] = (i == len);
+			++n;
+		}
+		
+		if (i >= len) break;
+		
+		unsigned char c = lower_tab[(unsigned char) s[i]];
+		const httpdroutenode *ch = node->child;
+		while (ch && (ch->c != c)) ch = ch->sibling;
+		node = ch;
+	}
+}
+
+// ========================================================================
+// METHOD httpdroutecursor::next
+// -----------------------------
+// Takes the route with the lowest chain position from the nodes along
+// the uri, until one of them matches.
+// ========================================================================
+httpdobject *httpdroutecursor::next (void)
+{
+	while (true)
+	{
+		int best = -1;
+		
+		for (int i=0; i<n; ++i)
+		{
+			if (! at[i]) continue;
+			if ((best < 0) || (at[i]->index < at[best]->index)) best = i;
+		}
+		
+		if (best < 0) return NULL;
+		
+		httpdroute *r = at[best];
+		at[best] = r->next;
+		
+		if (r->exact)
+		{
+			if (last[best]) return r->obj;
+			continue;
+		}
+		
+		if (r->prefix) return r->obj;
+		if (uri.globcmp (r->obj->urimatch)) return r->obj;
+	}
+}
@@ -0,0 +1,400 @@
+// This file is part of the Grace library (libgrace).
+// The Grace library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, using version 3 of the License.
+// You should have received a copy of the GNU Lesser General Public License
+// along with Grace library. If not, see <http://www.gnu.org/licenses/>.
+
+// ========================================================================
+// httpd_stream.cpp: Streamed responses and request bodies.
+// ========================================================================
+
+#include <grace/httpd.h>
+#include <grace/defaults.h>
+
+#include <sys/uio.h>
+#include <string.h>
+
+extern const char *httpstatusstr (int);
+
+// ========================================================================
+// CONSTRUCTOR httpdstream
+// ------------------------
+// Only HTTP/1.1 clients are known to take a chunked body.
+// ========================================================================
+httpdstream::httpdstream (tcpsocket &s, value &penv, value &pouthdr)
+	: sock (s), env (penv), outhdr (pouthdr)
+{
+	status = 200;
+	nsent = 0;
+	chunked = (env["httpver"] == "1.1");
+	sentheaders = false;
+	finished = false;
+	failed = false;
+}
+
+// ========================================================================
+// DESTRUCTOR httpdstream
+// ----------------------
+// A half-sent body can not be repaired, the client will have to see
+// the connection go.
+// ========================================================================
+httpdstream::~httpdstream (void)
+{
+	if (sentheaders && (! finished))
+	{
+		env["keepalive"] = false;
+		sock.sendtimeout (0);
+	}
+}
+
+// ========================================================================
+// METHOD httpdstream::write
+// ========================================================================
+bool httpdstream::write (const string &data)
+{
+	return write (data.str(), data.strlen());
+}
+
+bool httpdstream::write (const char *data, size_t sz)
+{
+	if (failed || finished) return false;
+	if (! sz) return true;
+
+	buf.strcat (data, sz);
+	if (buf.strlen() < (unsigned int) tune::httpd::stream::bufsize)
+		return true;
+
+	return sendchunk (false);
+}
+
+// ========================================================================
+// METHOD httpdstream::flush
+// ========================================================================
+bool httpdstream::flush (void)
+{
+	if (failed || finished) return false;
+	if (! buf.strlen()) return true;
+	return sendchunk (false);
+}
+
+// ========================================================================
+// METHOD httpdstream::finish
+// --------------------------
+// If nothing went out yet, the whole body is in the buffer and can go
+// out as a plain response with a Content-length.
+// ========================================================================
+int httpdstream::finish (void)
+{
+	if (! finished)
+	{
+		if (! sentheaders) chunked = false;
+		if (! failed) sendchunk (true);
+		finished = true;
+		sock.sendtimeout (0);
+	}
+
+	env["sentbytes"] = nsent;
+	if (failed) env["keepalive"] = false;
+	return -status;
+}
+
+// ========================================================================
+// METHOD httpdstream::sendchunk
+// -----------------------------
+// Headers, chunk size, data and trailer go out in a single write. The
+// socket write blocks while the client is not taking data, that is
+// what keeps a fast handler from filling up memory.
+// ========================================================================
+bool httpdstream::sendchunk (bool last)
+{
+	struct iovec iov[4];
+	string hdrblob;
+	string szline;
+	int cnt = 0;
+
+	if (! sentheaders)
+	{
+		bool keepalive = env["keepalive"].bval();
+
+		// Without chunks or a length, only the connection closing
+		// tells the client where the body ends.
+		if ((! last) && (! chunked)) keepalive = false;
+		env["keepalive"] = keepalive;
+
+		hdrblob = "HTTP/1.1 %i %s\r\n" %format (status,
+												httpstatusstr (status));
+
+		if (! last)
+		{
+			if (chunked) outhdr["Transfer-Encoding"] = "chunked";
+			outhdr.rmval ("Content-length");
+		}
+		else
+		{
+			outhdr["Content-length"] = buf.strlen();
+		}
+
+		if (! outhdr.exists ("Connection"))
+			outhdr["Connection"] = keepalive ? "keep-alive" : "close";
+
+		foreach (hdr, outhdr)
+		{
+			hdrblob.strcat ("%s: %s\r\n" %format (hdr.id(), hdr));
+		}
+		hdrblob.strcat ("\r\n");
+
+		iov[cnt].iov_base = (void *) hdrblob.str();
+		iov[cnt++].iov_len = hdrblob.strlen();
+
+		sock.sendtimeout (tune::httpd::stream::timeout);
+		sentheaders = true;
+	}
+
+	if (chunked && buf.strlen())
+	{
+		szline.printf ("%x\r\n", buf.strlen());
+		iov[cnt].iov_base = (void *) szline.str();
+		iov[cnt++].iov_len = szline.strlen();
+	}
+
+	if (buf.strlen())
+	{
+		iov[cnt].iov_base = (void *) buf.str();
+		iov[cnt++].iov_len = buf.strlen();
+	}
+
+	if (chunked)
+	{
+		const char *trail;
+		if (! buf.strlen()) trail = "0\r\n\r\n";
+		else if (last) trail = "\r\n0\r\n\r\n";
+		else trail = "\r\n";
+
+		iov[cnt].iov_base = (void *) trail;
+		iov[cnt++].iov_len = strlen (trail);
+	}
+
+	// Held output from pipelined requests goes along, the client
+	// is waiting for this part.
+	if ((! sock.puts (iov, cnt)) || (! sock.releaseoutput ()))
+	{
+		buf.crop ();
+		failed = true;
+		env["keepalive"] = false;
+		return false;
+	}
+
+	nsent += buf.strlen();
+	buf.crop ();
+	return true;
+}
+
+// ========================================================================
+// CONSTRUCTOR httpdbody
+// ========================================================================
+httpdbody::httpdbody (tcpsocket &s, unsigned int plen, bool chunk,
+					  bool expect)
+	: sock (s)
+{
+	ischunked = chunk;
+	len = ischunked ? 0 : plen;
+	left = len;
+	nread = 0;
+	inchunk = false;
+	expectcontinue = expect;
+	isdone = ((! ischunked) && (! len));
+	broken = false;
+}
+
+// ========================================================================
+// DESTRUCTOR httpdbody
+// ========================================================================
+httpdbody::~httpdbody (void)
+{
+}
+
+// ========================================================================
+// METHOD httpdbody::read
+// ----------------------
+// Takes what is in the socket buffer first, and only waits for the
+// client if there is nothing there.
+// ========================================================================
+string *httpdbody::read (size_t sz)
+{
+	returnclass (string) res retain;
+	string *data;
+
+	if (isdone || broken) return &res;
+	sendcontinue ();
+
+	if (ischunked && (! left))
+	{
+		if (! nextchunk ()) return &res;
+	}
+
+	if (sz > left) sz = left;
+	
+	// Whatever is buffered already is enough for this round.
+	unsigned int backlog = sock.buffer.backlog();
+	if (backlog && (sz > backlog)) sz = backlog;
+
+	try
+	{
+		data = sock.read (sz, tune::httpd::stream::timeout);
+	}
+	catch (exception e)
+	{
+		data = NULL;
+	}
+
+	if ((! data) || (! data->strlen()))
+	{
+		if (data) delete data;
+		broken = true;
+		return &res;
+	}
+
+	res = data;
+	left -= res.strlen();
+	nread += res.strlen();
+	if ((! ischunked) && (! left)) isdone = true;
+	return &res;
+}
+
+// ========================================================================
+// METHOD httpdbody::readall
+// ========================================================================
+bool httpdbody::readall (string &into, unsigned int max)
+{
+	while (! isdone)
+	{
+		if ((! ischunked) && ((nread + left) > max)) return false;
+		
+		string data = read ();
+		if (broken) return false;
+		if (nread > max) return false;
+		into.strcat (data);
+	}
+	
+	return true;
+}
+
+// ========================================================================
+// METHOD httpdbody::spool
+// ========================================================================
+bool httpdbody::spool (file &f)
+{
+	while (! isdone)
+	{
+		string data = read ();
+		if (broken) return false;
+		if (! f.puts (data)) return false;
+	}
+	
+	return true;
+}
+
+bool httpdbody::spool (const string &path)
+{
+	file f;
+	
+	if (! f.openwrite (path)) return false;
+	bool res = spool (f);
+	f.close ();
+	return res;
+}
+
+// ========================================================================
+// METHOD httpdbody::nextchunk
+// ---------------------------
+// Every chunk is preceded by its size in hex, optionally followed by
+// extensions we don't care about. A chunk of size zero ends the body,
+// after whatever trailer headers the client sends along.
+// ========================================================================
+bool httpdbody::nextchunk (void)
+{
+	string ln;
+	int timeout = tune::httpd::stream::timeout;
+	
+	try
+	{
+		// The previous chunk ends with a newline of its own.
+		if (inchunk)
+		{
+			if ((! sock.waitforline (ln, timeout)) || ln.strlen())
+			{
+				broken = true;
+				return false;
+			}
+		}
+		inchunk = true;
+		
+		if (! sock.waitforline (ln, timeout, 256))
+		{
+			broken = true;
+			return false;
+		}
+		
+		ln.cropat (';');
+		ln = ln.trim (" \t");
+		
+		// No more than 8 hex digits, a chunk has to fit an int.
+		if ((! ln.strlen()) || (ln.strlen() > 8))
+		{
+			broken = true;
+			return false;
+		}
+		
+		left = 0;
+		for (unsigned int i=0; i<ln.strlen(); ++i)
+		{
+			char c = ln[i];
+			unsigned int d;
+			
+			if ((c >= '0') && (c <= '9')) d = c - '0';
+			else if ((c >= 'a') && (c <= 'f')) d = 10 + (c - 'a');
+			else if ((c >= 'A') && (c <= 'F')) d = 10 + (c - 'A');
+			else
+			{
+				broken = true;
+				return false;
+			}
+			
+			left = (left << 4) | d;
+		}
+		
+		if (left) return true;
+		
+		// Skip the trailers, up to the empty line.
+		do
+		{
+			ln.crop ();
+			if (! sock.waitforline (ln, timeout))
+			{
+				broken = true;
+				return false;
+			}
+		} while (ln.strlen());
+	}
+	catch (exception e)
+	{
+		broken = true;
+		return false;
+	}
+	
+	isdone = true;
+	return false;
+}
+
+// ========================================================================
+// METHOD httpdbody::sendcontinue
+// ========================================================================
+void httpdbody::sendcontinue (void)
+{
+	if (! expectcontinue) return;
+	expectcontinue = false;
+	
+	sock.puts ("HTTP/1.1 100 CONTINUE\r\n\r\n");
+	sock.releaseoutput ();
+}
@@ -0,0 +1,372 @@
+// This file is part of the Grace library (libgrace).
+// The Grace library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, using version 3 of the License.
+// You should have received a copy of the GNU Lesser General Public License
+// along with Grace library. If not, see <http://www.gnu.org/licenses/>.
+
+// ========================================================================
+// httpparser.cpp: Incremental in-place HTTP request parser.
+// ========================================================================
+
+#include <grace/httpparser.h>
+#include <grace/commonkeys.h>
+#include <grace/strutil.h>
+
+#include <string.h>
+#include <strings.h>
+
+// Header names that get interned. Lookups on these never have to
+// hash or allocate a name.
+static const statstring *commonheaders[] = {
+	&key::http_host,
+	&key::http_user_agent,
+	&key::http_accept,
+	&key::http_accept_language,
+	&key::http_accept_encoding,
+	&key::http_accept_charset,
+	&key::http_connection,
+	&key::http_keep_alive,
+	&key::http_cookie,
+	&key::http_referer,
+	&key::http_origin,
+	&key::http_content_length,
+	&key::http_content_type,
+	&key::http_transfer_encoding,
+	&key::http_expect,
+	&key::http_cache_control,
+	&key::http_pragma,
+	&key::http_if_modified_since,
+	&key::http_if_none_match,
+	&key::http_if_range,
+	&key::http_range,
+	&key::http_authorization,
+	&key::http_upgrade,
+	&key::http_upgrade_insecure_requests,
+	&key::http_dnt,
+	&key::http_te,
+	&key::http_x_forwarded_for,
+	&key::http_x_requested_with,
+	&key::http_sec_fetch_site,
+	&key::http_sec_fetch_mode,
+	&key::http_sec_fetch_dest,
+	&key::http_sec_fetch_user,
+	NULL
+};
+
+// ========================================================================
+// CONSTRUCTOR httpparser
+// ========================================================================
+httpparser::httpparser (void)
+{
+	reset ();
+}
+
+// ========================================================================
+// DESTRUCTOR httpparser
+// ========================================================================
+httpparser::~httpparser (void)
+{
+}
+
+// ========================================================================
+// METHOD ::reset
+// ========================================================================
+void httpparser::reset (void)
+{
+	state = HTTP_PARSE_REQUEST;
+	pos = 0;
+	nhdr = 0;
+	smethod.offs = smethod.len = 0;
+	suri.offs = suri.len = 0;
+	sproto.offs = sproto.len = 0;
+}
+
+// ========================================================================
+// METHOD ::parse
+// --------------
+// Works through the complete lines that are in. A line is ended by a
+// newline, a carriage return before it is not part of the line. Empty
+// lines before the request line are skipped, the first empty line after
+// it ends the headers.
+// ========================================================================
+bool httpparser::parse (const char *data, unsigned int sz)
+{
+	while ((state != HTTP_PARSE_DONE) && (pos < sz))
+	{
+		const char *nl;
+		unsigned int end;
+		unsigned int next;
+
+		nl = (const char *) memchr (data + pos, '\n', sz - pos);
+		if (! nl) break;
+
+		next = (nl - data) + 1;
+		end = next - 1;
+		if ((end > pos) && (data[end-1] == '\r')) --end;
+
+		if (end == pos)
+		{
+			if (state == HTTP_PARSE_HEADERS) state = HTTP_PARSE_DONE;
+		}
+		else if (state == HTTP_PARSE_REQUEST)
+		{
+			requestline (data, pos, end);
+			state = HTTP_PARSE_HEADERS;
+		}
+		else
+		{
+			headerline (data, pos, end);
+		}
+
+		pos = next;
+	}
+
+	return (state == HTTP_PARSE_DONE);
+}
+
+// ========================================================================
+// METHOD ::requestline
+// --------------------
+// Splits the request line into method, uri and protocol. A request
+// without a protocol is taken for HTTP/0.9.
+// ========================================================================
+void httpparser::requestline (const char *data, unsigned int start,
+							  unsigned int end)
+{
+	httpslice *parts[3] = { &smethod, &suri, &sproto };
+	unsigned int p = start;
+
+	for (int i=0; i<3; ++i)
+	{
+		while ((p < end) && (data[p] == ' ')) ++p;
+		parts[i]->offs = p;
+
+		// The protocol takes the rest of the line.
+		if (i < 2) while ((p < end) && (data[p] != ' ')) ++p;
+		else p = end;
+
+		parts[i]->len = p - parts[i]->offs;
+	}
+
+	while (sproto.len && (data[sproto.offs + sproto.len - 1] == ' '))
+	{
+		sproto.len--;
+	}
+}
+
+// ========================================================================
+// METHOD ::headerline
+// -------------------
+// Records a 'Name: value' line. Lines without a colon are skipped, as
+// are any headers over the limit.
+// ========================================================================
+void httpparser::headerline (const char *data, unsigned int start,
+							 unsigned int end)
+{
+	if (nhdr >= HTTP_MAXHEADERS) return;
+
+	const char *cln = (const char *) memchr (data + start, ':', end - start);
+	if (! cln) return;
+
+	unsigned int c = cln - data;
+	unsigned int v = c + 1;
+	unsigned int ve = end;
+
+	while ((v < ve) && ((data[v] == ' ') || (data[v] == '\t'))) ++v;
+	while ((ve > v) && ((data[ve-1] == ' ') || (data[ve-1] == '\t'))) --ve;
+
+	httpheader &h = hdr[nhdr++];
+	h.name.offs = start;
+	h.name.len = c - start;
+	h.value.offs = v;
+	h.value.len = ve - v;
+	h.key = intern (data + start, c - start);
+}
+
+// ========================================================================
+// STATIC METHOD ::intern
+// ========================================================================
+const statstring *httpparser::intern (const char *name, unsigned int len)
+{
+	for (int i=0; commonheaders[i]; ++i)
+	{
+		const string &k = commonheaders[i]->sval();
+		if (k.strlen() != len) continue;
+		if (! ::strncasecmp (k.str(), name, len)) return commonheaders[i];
+	}
+
+	return NULL;
+}
+
+// ========================================================================
+// METHOD ::find
+// ========================================================================
+int httpparser::find (const char *data, const statstring &name) const
+{
+	const string &nm = name.sval();
+	unsigned int len = nm.strlen();
+
+	for (int i=nhdr-1; i>=0; --i)
+	{
+		const httpheader &h = hdr[i];
+
+		// Interned names can be compared by pointer.
+		if (h.key == &name) return i;
+		if (h.name.len != len) continue;
+		if (! ::strncasecmp (data + h.name.offs, nm.str(), len)) return i;
+	}
+
+	return -1;
+}
+
+// ========================================================================
+// METHOD ::headeris
+// ========================================================================
+bool httpparser::headeris (const char *data, const statstring &name,
+						   const char *val) const
+{
+	int i = find (data, name);
+	if (i < 0) return false;
+
+	const httpslice &v = hdr[i].value;
+	if (::strlen (val) != v.len) return false;
+	return (::strncasecmp (data + v.offs, val, v.len) == 0);
+}
+
+// ========================================================================
+// METHOD ::headeruval
+// ========================================================================
+unsigned int httpparser::headeruval (const char *data,
+									 const statstring &name,
+									 bool &found) const
+{
+	unsigned int res = 0;
+	int i = find (data, name);
+
+	found = (i >= 0);
+	if (! found) return 0;
+
+	const httpslice &v = hdr[i].value;
+	for (unsigned int p=0; p<v.len; ++p)
+	{
+		char c = data[v.offs + p];
+		if ((c < '0') || (c > '9')) break;
+		res = (res * 10) + (c - '0');
+	}
+
+	return res;
+}
+
+// ========================================================================
+// METHOD ::slice
+// ========================================================================
+string *httpparser::slice (const char *data, const httpslice &s) const
+{
+	returnclass (string) res retain;
+
+	if (s.len) res.strcat (data + s.offs, s.len);
+	return &res;
+}
+
+// ========================================================================
+// METHOD ::method
+// ========================================================================
+string *httpparser::method (const char *data) const
+{
+	return slice (data, smethod);
+}
+
+// ========================================================================
+// METHOD ::uri
+// ========================================================================
+string *httpparser::uri (const char *data) const
+{
+	return slice (data, suri);
+}
+
+// ========================================================================
+// METHOD ::version
+// ----------------
+// Returns the version part of the protocol, HTTP/1.1 gives '1.1'.
+// ========================================================================
+string *httpparser::version (const char *data) const
+{
+	httpslice v = sproto;
+	const char *slash;
+
+	slash = (const char *) memchr (data + v.offs, '/', v.len);
+	if (slash)
+	{
+		unsigned int skip = (slash - (data + v.offs)) + 1;
+		v.offs += skip;
+		v.len -= skip;
+	}
+
+	return slice (data, v);
+}
+
+// ========================================================================
+// METHOD ::ishttp11
+// ========================================================================
+bool httpparser::ishttp11 (const char *data) const
+{
+	if (sproto.len != 8) return false;
+	return (::strncasecmp (data + sproto.offs, "http/1.1", 8) == 0);
+}
+
+// ========================================================================
+// METHOD ::headers
+// ----------------
+// Builds the header dictionary. Plain values are stored as they are.
+// Values with parameters or quoting go through the same attribute
+// splitting as strutil::parsehdr() uses.
+// ========================================================================
+value *httpparser::headers (const char *data) const
+{
+	returnclass (value) res retain;
+
+	for (int i=0; i<nhdr; ++i)
+	{
+		const httpheader &h = hdr[i];
+		statstring name;
+		string val;
+
+		if (h.key) name = *(h.key);
+		else name = slice (data, h.name);
+
+		if (h.value.len) val.strcat (data + h.value.offs, h.value.len);
+
+		bool plain = (h.key == &key::http_cookie);
+		if (! plain)
+		{
+			plain = true;
+			for (unsigned int p=0; p<h.value.len; ++p)
+			{
+				char c = data[h.value.offs + p];
+				if ((c == ';') || (c == '\"') || (c == '\'') ||
+					(c == '\\') || (c == '('))
+				{
+					plain = false;
+					break;
+				}
+			}
+		}
+
+		if (plain)
+		{
+			res[name] = val;
+			continue;
+		}
+
+		string line;
+		line.strcat (data + h.name.offs, h.name.len);
+		line.strcat (": ");
+		line.strcat (val);
+
+		value parsed = strutil::parsehdr (line);
+		res[name] = parsed[0];
+	}
+
+	return &res;
+}
@@ -358,6 +358,7 @@ conditional::conditional (void)
 	mutex = new pthread_mutex_t;
 	cond = new pthread_cond_t;
 	queue = 0;
+	waiting = 0;
 	
 	pthread_mutexattr_init (attr);
 	pthread_mutex_init (mutex, attr);
@@ -391,7 +392,7 @@ void conditional::signal (void)
 void conditional::broadcast (void)
 {
 	pthread_mutex_lock (mutex);
-	queue++;
+	queue += (waiting ? waiting : 1);
 	pthread_cond_broadcast (cond);
 	pthread_mutex_unlock (mutex);
 }
@@ -403,14 +404,18 @@ bool conditional::wait (void)
 {
 	bool result = false;
 	
+	// Another thread can get to the queue between the signal and our
+	// wakeup, so check it again rather than taking the wakeup on
+	// faith. A negative queue would make every later wait return
+	// right away.
 	pthread_mutex_lock (mutex);
-	if (queue)
+	waiting++;
+	while (! queue)
 	{
-		--queue;
-		pthread_mutex_unlock (mutex);
-		return true;
+		if (pthread_cond_wait (cond, mutex)) break;
 	}
-	if (! pthread_cond_wait (cond, mutex))
+	waiting--;
+	if (queue > 0)
 	{
 		--queue;
 		result = true;
@@ -440,13 +445,13 @@ bool conditional::wait (int timeout)
 	}
 
 	pthread_mutex_lock (mutex);
-	if (queue)
+	waiting++;
+	while (! queue)
 	{
-		--queue;
-		pthread_mutex_unlock (mutex);
-		return true;
+		if (pthread_cond_timedwait (cond, mutex, &ts)) break;
 	}
-	if (! pthread_cond_timedwait (cond, mutex, &ts))
+	waiting--;
+	if (queue > 0)
 	{
 		--queue;
 		result = true;
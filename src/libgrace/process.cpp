@@ -24,9 +24,9 @@ void process::init (const string &name, bool withStdErr)
 	 pipe (inpipe);
 	 pipe (outpipe);
 	 
-	 try {STRINGREF().treelock.lockw();} catch (...) {}
+	 try {STRINGREF().lockall();} catch (...) {}
 	 _pid = fork();
-	 if (_pid) try {STRINGREF().treelock.unlock();} catch (...) {}
+	 if (_pid) try {STRINGREF().unlockall();} catch (...) {}
 	
 	 if (_pid == 0)
 	 {
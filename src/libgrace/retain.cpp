@@ -9,9 +9,13 @@
 #include <grace/defaults.h>
 #include <grace/file.h>
 #include <signal.h>
+#include <pthread.h>
 
 memory::pool *__retain_ptr;
 
+/// Free blocks are linked through their data area.
+#define NEXTBLOCK(b) (*((memory::block **) ((b)->dt)))
+
 void poolsighandler (int sig)
 {
 	__retain_ptr->dump ("memory.dump");
@@ -22,6 +26,28 @@ void __pool_breakme (void) { }
 
 namespace memory
 {
+	static __thread threadcache *__pool_cache = NULL;
+	static pthread_key_t __pool_cachekey;
+	static pthread_once_t __pool_cacheonce = PTHREAD_ONCE_INIT;
+	
+	// ====================================================================
+	// FUNCTION __pool_threadexit
+	// --------------------------
+	// Destructor for the thread cache key. Gives the blocks cached by an
+	// exiting thread back to the shared pools.
+	// ====================================================================
+	static void __pool_threadexit (void *p)
+	{
+		threadcache *tc = (threadcache *) p;
+		if (__retain_ptr) __retain_ptr->flushcache (tc);
+		if (__pool_cache == tc) __pool_cache = NULL;
+		::free (tc);
+	}
+	
+	static void __pool_mkkey (void)
+	{
+		pthread_key_create (&__pool_cachekey, __pool_threadexit);
+	}
 	
 	// ====================================================================
 	// FUNCTION getretain
@@ -40,6 +66,8 @@ namespace memory
 	{
 		signal (SIGUSR2, poolsighandler);
 		pools = NULL;
+		threadcount = 0;
+		for (int i=0; i<POOL_CLASSES; ++i) classes[i] = NULL;
 	}
 
 	// ====================================================================
@@ -62,14 +90,12 @@ namespace memory
 	// ====================================================================
 	// FUNCTION mkpool
 	// ====================================================================
-	sizepool *mkpool (unsigned int rndsz)
+	sizepool *mkpool (unsigned int rndsz, sizepool *owner)
 	{
 		unsigned int count;
 		sizepool *c = new sizepool;
 		if (! c) return NULL;
 		
-		c->lck.lockw ();
-		
 		// For tiny sizes, allocate in 8K blocks. For medium, use 64K blocks.
 		// For larger objects, keep a count of 16.
 		if (rndsz < 512) count = 8192/rndsz;
@@ -80,133 +106,221 @@ namespace memory
 		c->extend = NULL;
 		c->count = count;
 		c->sz = rndsz;
+		c->wired = 0;
+		c->freelist = NULL;
 		c->blocks = (char *) calloc (count, rndsz);
+		if (! c->blocks)
+		{
+			delete c;
+			return NULL;
+		}
 		
-		for (unsigned int i=0; i<count; ++i)
+		// Link the blocks into a freelist, lowest address first.
+		for (unsigned int i=count; i>0; --i)
 		{
-			block *bl = (block *) (c->blocks + (i*c->sz));
-			bl->pool = c;
+			block *bl = (block *) (c->blocks + ((i-1)*c->sz));
+			bl->pool = owner ? owner : c;
+			NEXTBLOCK(bl) = c->freelist;
+			c->freelist = bl;
 		}
 		
-		c->lck.unlock ();
 		return c;
 	}
-
+	
 	// ====================================================================
-	// METHOD ::alloc
+	// METHOD ::getclass
 	// ====================================================================
-	void *pool::alloc (size_t sz)
+	sizepool *pool::getclass (size_t rndsz)
 	{
-		// The requested size does not include the overhead for the
-		// block header. For efficiency purposes, we use a 64 bits
-		// boundary.
-		size_t rndsz = (sz+sizeof(block)+7) & 0xfffffff8;
-		
-		// First let's hunt for an existing primary size pool.
 		sizepool *c, *lastc;
-		c = lastc = pools;
-		while (c)
+		
+		if (rndsz <= POOL_MAXCLASS)
+		{
+			if ((c = classes[rndsz >> 3])) return c;
+		}
+		
+		classlock.lockw ();
+		
+		lastc = NULL;
+		for (c = pools; c; c = c->next)
 		{
 			lastc = c;
 			if (c->sz == rndsz) break;
-			c = c->next;
 		}
-
-		// c is set if we found a pool with a matching blocksize.
-		// if not, we need to allocate it.
+		
 		if (! c)
 		{
 			c = mkpool (rndsz);
-			if (! c) return NULL;
-
-			c->lck.lockw ();
-
-			block *b = (block *) c->blocks;
-			b->status = wired;
-			
-			if (lastc) lastc->next = c;
-			else pools = c;
-			
-			c->lck.unlock ();
-			
-			return (void *) b->dt;
+			if (c)
+			{
+				if (lastc) lastc->next = c;
+				else pools = c;
+			}
 		}
 		
-		// Set a lock on the current sizepool.
-		c->lck.lockw();
+		if (c && (rndsz <= POOL_MAXCLASS))
+		{
+			__sync_synchronize ();
+			classes[rndsz >> 3] = c;
+		}
+		
+		classlock.unlock ();
+		return c;
+	}
+	
+	// ====================================================================
+	// METHOD ::getcache
+	// ====================================================================
+	threadcache *pool::getcache (void)
+	{
+		if (__pool_cache) return __pool_cache;
+		
+		pthread_once (&__pool_cacheonce, __pool_mkkey);
 		
-		// Look for a free block.
-		for (unsigned int i=0; i<c->count; ++i)
+		threadcache *tc = (threadcache *) calloc (1, sizeof (threadcache));
+		pthread_setspecific (__pool_cachekey, tc);
+		__sync_add_and_fetch (&threadcount, 1);
+		__pool_cache = tc;
+		return tc;
+	}
+	
+	// ====================================================================
+	// METHOD ::flushcache
+	// ====================================================================
+	void pool::flushcache (threadcache *tc)
+	{
+		for (int i=0; i<POOL_CLASSES; ++i)
 		{
-			block *b = (block *) (c->blocks + (i * c->sz));
-			
-			// Are you free, Mr. Humphrey?
-			if (b->status == memory::free)
+			magazine &m = tc->mag[i];
+			if (m.count) give (m.top->pool, m.top, m.count);
+			m.top = NULL;
+			m.count = 0;
+		}
+		__sync_sub_and_fetch (&threadcount, 1);
+	}
+	
+	// ====================================================================
+	// METHOD ::take
+	// ====================================================================
+	block *pool::take (sizepool *c, unsigned int &count)
+	{
+		block *res = NULL;
+		unsigned int got = 0;
+		
+		c->lck.lockw ();
+		
+		// There should never be more blocks in use than fit in the
+		// primary pool, not counting the ones sitting in the thread
+		// caches. If leak protection is set in the defaults, this is
+		// the end of the line.
+		unsigned int limit = c->count;
+		if (c->sz <= POOL_MAXCLASS) limit += threadcount * POOL_MAGAZINE;
+		
+		if ((c->wired + count) > limit)
+		{
+			if (defaults::memory::leakprotection)
 			{
-				// Jay, we can stop looking. Claim the block and
-				// unlock the allocation pool.
-				b->status = wired;
-				b->pool = c;
+				dump ("memoryleak.dump");
 				c->lck.unlock();
-				return (void *) b->dt;
+				abort();
+				// just in case some jackass catches SIGABRT.
+				throw memoryLeakException();
 			}
-			
-			if (i>96)
+			if (defaults::memory::leakcallback)
 			{
-				__pool_breakme();
+				defaults::memory::leakcallback();
 			}
 		}
 		
-		// The initial pool is full. If leak protection is set in the
-		// defaults, this is the end of the line.
-		if (defaults::memory::leakprotection)
+		while (got < count)
 		{
-			dump ("memoryleak.dump");
-			c->lck.unlock();
-			abort();
-			// just in case some jackass catches SIGABRT.
-			throw memoryLeakException();
-		}
-		if (defaults::memory::leakcallback)
-		{
-			defaults::memory::leakcallback();
+			if (! c->freelist)
+			{
+				// Ok, the user actually _wants_ these massive amounts of
+				// retainable objects, add an extension pool.
+				sizepool *last = c;
+				while (last->extend) last = last->extend;
+				
+				last->extend = mkpool (c->sz, c);
+				if (! last->extend) break;
+				
+				c->freelist = last->extend->freelist;
+				last->extend->freelist = NULL;
+			}
+			
+			block *b = c->freelist;
+			c->freelist = NEXTBLOCK(b);
+			NEXTBLOCK(b) = res;
+			res = b;
+			++got;
 		}
 		
-		// Ok, the user actually _wants_ these massive amounts of
-		// retainable objects, we will use the extent pointer to
-		// create/access extension pools.
-		while (true)
+		c->wired += got;
+		c->lck.unlock ();
+		
+		count = got;
+		return res;
+	}
+	
+	// ====================================================================
+	// METHOD ::give
+	// ====================================================================
+	void pool::give (sizepool *c, block *chain, unsigned int count)
+	{
+		block *tail = chain;
+		for (unsigned int i=1; i<count; ++i) tail = NEXTBLOCK(tail);
+		
+		c->lck.lockw ();
+		NEXTBLOCK(tail) = c->freelist;
+		c->freelist = chain;
+		c->wired -= count;
+		c->lck.unlock ();
+	}
+
+	// ====================================================================
+	// METHOD ::alloc
+	// ====================================================================
+	void *pool::alloc (size_t sz)
+	{
+		// The requested size does not include the overhead for the
+		// block header. For efficiency purposes, we use a 64 bits
+		// boundary.
+		size_t rndsz = (sz+sizeof(block)+7) & 0xfffffff8;
+		block *b;
+		
+		if (rndsz <= POOL_MAXCLASS)
 		{
-			sizepool *tc = c;
-			if (c->extend) c = c->extend;
-			else
-			{
-				c->extend = mkpool (rndsz);
-				c = c->extend;
-				if (! c)
-				{
-					tc->lck.unlock();
-					return NULL;
-				}
-			}
-			c->lck.lockw();
-			tc->lck.unlock();
+			// Small blocks come out of the thread's own cache, which
+			// only needs the sizepool lock when it runs dry.
+			magazine &m = getcache()->mag[rndsz >> 3];
 			
-			for (unsigned int i=0; i<c->count; ++i)
+			if (! m.count)
 			{
-				block *b = (block *) (c->blocks + (i * c->sz));
-				if (b->status == memory::free)
-				{
-					b->status = wired;
-					b->pool = c;
-					c->lck.unlock();
-					return (void *) b->dt;
-				}
+				sizepool *c = getclass (rndsz);
+				if (! c) return NULL;
+				
+				unsigned int count = POOL_MAGAZINE/2;
+				m.top = take (c, count);
+				m.count = count;
+				if (! m.count) return NULL;
 			}
+			
+			b = m.top;
+			m.top = NEXTBLOCK(b);
+			m.count--;
+		}
+		else
+		{
+			sizepool *c = getclass (rndsz);
+			if (! c) return NULL;
+			
+			unsigned int count = 1;
+			b = take (c, count);
+			if (! count) return NULL;
 		}
 		
-		// End never reached.
-		return NULL;
+		b->status = wired;
+		return (void *) b->dt;
 	}
 	
 	// ====================================================================
@@ -236,6 +350,33 @@ namespace memory
 #endif
 		
 		b->status = memory::free;
+		
+		sizepool *owner = b->pool;
+		if (owner->sz > POOL_MAXCLASS)
+		{
+			give (owner, b, 1);
+			return;
+		}
+		
+		magazine &m = getcache()->mag[owner->sz >> 3];
+		NEXTBLOCK(b) = m.top;
+		m.top = b;
+		
+		// Once the cache is full, keep the most recently freed half
+		// and hand the rest back in one go.
+		if (++m.count >= POOL_MAGAZINE)
+		{
+			block *keep = m.top;
+			for (unsigned int i=1; i<(POOL_MAGAZINE/2); ++i)
+			{
+				keep = NEXTBLOCK(keep);
+			}
+			
+			block *rest = NEXTBLOCK(keep);
+			NEXTBLOCK(keep) = NULL;
+			give (owner, rest, m.count - (POOL_MAGAZINE/2));
+			m.count = POOL_MAGAZINE/2;
+		}
 	}
 	
 	// ====================================================================
@@ -270,6 +411,19 @@ namespace memory
 		}
 		
 		pools = NULL;
+		for (int i=0; i<POOL_CLASSES; ++i) classes[i] = NULL;
+		
+		// Blocks cached by this thread went down with the pools. Caches
+		// of other threads are not touched, they should be done with
+		// retainables by now.
+		if (__pool_cache)
+		{
+			for (int i=0; i<POOL_CLASSES; ++i)
+			{
+				__pool_cache->mag[i].top = NULL;
+				__pool_cache->mag[i].count = 0;
+			}
+		}
 	}
 	
 	// ====================================================================
@@ -313,6 +313,36 @@ string *ringbuffer::readline (void)
 	return result;
 }
 
+// ========================================================================
+// METHOD ::linear
+// ---------------
+// Moves the unread data to the start of the buffer if it currently
+// wraps around, so that all of it can be accessed through a single
+// pointer.
+// ========================================================================
+const char *ringbuffer::linear (void)
+{
+	if (! buffer)
+	{
+		init (count);
+	}
+	
+	if (readcursor <= writecursor) return buffer + readcursor;
+	
+	unsigned int toend = count - readcursor;
+	unsigned int sz = toend + writecursor;
+	char *tmp = new char[toend];
+	
+	memcpy (tmp, buffer + readcursor, toend);
+	memmove (buffer + toend, buffer, writecursor);
+	memcpy (buffer, tmp, toend);
+	delete[] tmp;
+	
+	readcursor = 0;
+	writecursor = sz;
+	return buffer;
+}
+
 // ========================================================================
 // METHOD ::copy
 // -------------
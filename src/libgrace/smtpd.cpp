@@ -221,41 +221,28 @@ void smtpworker::run (void)
 		string exip; // Remote host ip.
 	
 		// Wait for a connection, if there's nothing to be had
-		// we might as well check events.
-		while (! parent->tcplock.trylockw(5))
-		{
-			ev = nextevent();
-			if (ev)
-			{
-				// Oh no, the event of death!
-				if (ev.type() == "die")
-				{
-					run = false;
-					if (parent->mask & SMTP_INFO)
-					{
-						parent->eventhandle (
-							$attr("class","info") ->
-							$("type", "threadstopped") ->
-							$("thread", threadid));
-					}
-					return;
-				}
-			}
-		}
-		
-		// We got the lock, now try to accept a socket.
+		// we might as well check events. The kernel hands each
+		// new connection to one of the waiting workers.
 		while (! s)
 		{
-			s = parent->lsock.tryaccept (2.0);
+			s = parent->lsock.tryaccept
+					(tune::smtpd::wkthread::acceptwait / 1000.0);
 			if (! s) // No socket, might as well check events.
 			{
 				ev = nextevent();
 				if (ev)
 				{
+					// Oh no, the event of death!
 					if (ev.type() == "die")
 					{
-						parent->tcplock.unlock();
 						run = false;
+						if (parent->mask & SMTP_INFO)
+						{
+							parent->eventhandle (
+								$attr("class","info") ->
+								$("type", "threadstopped") ->
+								$("thread", threadid));
+						}
 						return;
 					}
 				}
@@ -267,8 +254,6 @@ void smtpworker::run (void)
 		int nload; // New load counter once we're up.
 		
 		// Get the new load number.
-		parent->tcplock.unlock();
-		
 		exclusiveaccess (parent->load) { nload = parent->load.o++; }
 		
 		exip = s.peer_name;
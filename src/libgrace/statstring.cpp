@@ -55,190 +55,157 @@ stringrefdb &STRINGREF()
 }
 
 // ========================================================================
-// DESTRUCTOR stringrefdb
-// ----------------------
-// Uses rmref to recursively delete the stringref tree
+// CONSTRUCTOR stringrefdb
 // ========================================================================
-stringrefdb::~stringrefdb (void)
+stringrefdb::stringrefdb (void)
 {
-	if (root)
+	for (int i=0; i<STRINGREF_SHARDS; ++i)
 	{
-		rmref (root);
-		root = NULL;
+		stringrefshard &s = shards[i];
+		s.size = 16;
+		s.count = 0;
+		s.dirty = 0;
+		s.buckets = (stringref **) calloc (s.size, sizeof (stringref *));
 	}
+	sequence = 0;
+	cleanups = 0;
+	signal (SIGUSR1, dumpstringref);
 }
 
 // ========================================================================
-// METHOD stringrefdb::print
-// -------------------------
-// Write out the db contents to a file.
-// ========================================================================
-void stringrefdb::print (const char *fname)
-{
-	FILE *f = ::fopen (fname, "w");
-	print (root, f);
-	::fclose (f);
-}
-
-void stringrefdb::print (stringref *ref, FILE *output)
-{
-	fprintf (output,"%08x,%i,%i,\"%s\"\n", ref->key, ref->id,
-			 ref->refcnt, ref->str.str());
-	if (ref->lower) print (ref->lower, output);
-	if (ref->higher) print (ref->higher, output);
-}
-
-// ========================================================================
-// METHOD stringrefdb::rmref
-// -------------------------
-// The recursive tree eater
+// DESTRUCTOR stringrefdb
 // ========================================================================
-void stringrefdb::rmref (stringref *ref)
+stringrefdb::~stringrefdb (void)
 {
-	if (ref->lower) rmref (ref->lower);
-	if (ref->higher) rmref (ref->higher);
-	
-	ref->lower = NULL;
-	ref->higher = NULL;
-	stringref *r = nukeroot;
-	if (! r) nukeroot = ref;
-	else
+	for (int i=0; i<STRINGREF_SHARDS; ++i)
 	{
-		while (r->lower) r = r->lower;
-		r->lower = ref;
+		stringrefshard &s = shards[i];
+		for (unsigned int b=0; b<s.size; ++b)
+		{
+			stringref *ref = s.buckets[b];
+			while (ref)
+			{
+				stringref *nx = ref->next;
+				delete ref;
+				ref = nx;
+			}
+		}
+		::free (s.buckets);
+		s.buckets = NULL;
+		s.size = s.count = 0;
 	}
 }
 
 // ========================================================================
-// METHOD stringrefdb::unref
+// METHOD stringrefdb::print
 // -------------------------
-// Decrease a stringref's reference count, if it is 0, remove it from
-// the tree and relink any children.
+// Write out the db contents to a file.
 // ========================================================================
-void stringrefdb::unref (stringref *ref)
+void stringrefdb::print (const char *fname)
 {
-	if (! root) return;
-	treelock.lockw();
+	FILE *f = ::fopen (fname, "w");
+	if (! f) return;
+	
+	for (int i=0; i<STRINGREF_SHARDS; ++i)
 	{
-		assert (ref->refcnt > 0);
-		unsigned int x = ref->refcnt;
-		x--;
-		ref->refcnt = x;
-		
-		if (ref->parent && (ref->refcnt == 0))
+		stringrefshard &s = shards[i];
+		for (unsigned int b=0; b<s.size; ++b)
 		{
-			unsigned int oldcount;
-			unsigned int sz = ref->str.strlen();
-			
-			exclusivesection (dirtycount)
+			for (stringref *ref = s.buckets[b]; ref; ref = ref->next)
 			{
-				oldcount = dirtycount;
-				dirtycount += ref->str.strlen();
-				if ((dirtycount > 65536) || (sz && (dirtycount <= oldcount)))
-				{
-					dirtycount = 0;
-					if (nukeroot)
-					{
-						stringref *nx;
-						stringref *x = nukeroot;
-						while (x)
-						{
-							nx = x->lower;
-							delete x;
-							x = nx;
-						}
-						nukeroot = NULL;
-					}
-					reap (root);
-					cleanups++;
-				}
+				fprintf (f, "%08x,%i,%i,\"%s\"\n", ref->key, ref->id,
+						 ref->refcnt, ref->str.str());
 			}
 		}
 	}
-	treelock.unlock();
+	::fclose (f);
 }
 
 // ========================================================================
-// METHOD stringrefdb::cpref
+// METHOD stringrefdb::unref
 // -------------------------
-// Increment a reference counter.
+// Decrease a stringref's reference count. Nodes that are no longer
+// referenced are left in place, the shard is cleaned up once enough
+// of them have piled up.
 // ========================================================================
-void stringrefdb::cpref (stringref *ref)
+void stringrefdb::unref (stringref *ref)
 {
-	treelock.lockw();
+	assert (ref->refcnt > 0);
+	
+	// Once the count hits zero, the node may be reaped by another
+	// thread at any time, so anything we need from it is read first.
+	unsigned int key = ref->key;
+	unsigned int sz = ref->str.strlen() + 1;
+	
+	if (__sync_sub_and_fetch (&ref->refcnt, 1)) return;
+	
+	stringrefshard &s = shardfor (key);
+	if (__sync_add_and_fetch (&s.dirty, sz) < STRINGREF_REAPSIZE) return;
+	
+	s.lck.lockw();
+	if (s.dirty >= STRINGREF_REAPSIZE)
 	{
-		unsigned int x = ref->refcnt;
-		x++;
-		ref->refcnt = x;
+		reap (s);
+		__sync_add_and_fetch (&cleanups, 1);
 	}
-	treelock.unlock();
+	s.lck.unlock();
 }
 
 // ========================================================================
 // METHOD stringrefdb::reap
 // ------------------------
-// Clean up free nodes.
+// Clean up free nodes. The only way a node with no references can
+// come back to life is through getref(), which holds the same lock.
 // ========================================================================
-void stringrefdb::reap (stringref *ref)
+void stringrefdb::reap (stringrefshard &s)
 {
-	stringref *lower = ref->lower;
-	stringref *higher = ref->higher;
-
-	if ( (ref->parent) && (ref->refcnt == 0) )
+	for (unsigned int b=0; b<s.size; ++b)
 	{
-		if (ref->parent->lower == ref)
-		{
-			ref->parent->lower = NULL;
-		}
-		else
-		{
-			ref->parent->higher = NULL;
-		}
-
-		if (ref->higher)
-		{		
-			ref->higher->parent = NULL;
-			linkref (ref->higher);
-		}
-		
-		if (ref->lower)
+		stringref **link = &(s.buckets[b]);
+		while (*link)
 		{
-			ref->lower->parent = NULL;
-			linkref (ref->lower);
-		}
-		
-		ref->lower = NULL;
-		ref->higher = NULL;
-		stringref *r = nukeroot;
-		if (! r) nukeroot = ref;
-		else
-		{
-			while (r->lower)
+			stringref *ref = *link;
+			if (ref->refcnt == 0)
 			{
-				r = r->lower;
+				*link = ref->next;
+				delete ref;
+				s.count--;
 			}
-			r->lower = ref;
+			else link = &(ref->next);
 		}
 	}
-	if (lower) reap (lower);
-	if (higher) reap (higher);
+	s.dirty = 0;
 }
 
 // ========================================================================
-// METHOD stringrefdb::newref
-// --------------------------
-// Allocate and initialize a new stringref structure
+// METHOD stringrefdb::grow
+// ------------------------
+// Rehash a shard into twice the number of buckets.
 // ========================================================================
-stringref *stringrefdb::newref (void)
+void stringrefdb::grow (stringrefshard &s)
 {
-	stringref *ref = new stringref;
-	ref->parent = NULL;
-	ref->lower = NULL;
-	ref->higher = NULL;
-	ref->key = 0;
-	ref->id = newid();
-	ref->refcnt = 0; 
-	return ref;
+	unsigned int nsize = s.size * 2;
+	stringref **nbuckets;
+	
+	nbuckets = (stringref **) calloc (nsize, sizeof (stringref *));
+	if (! nbuckets) return;
+	
+	for (unsigned int b=0; b<s.size; ++b)
+	{
+		stringref *ref = s.buckets[b];
+		while (ref)
+		{
+			stringref *nx = ref->next;
+			unsigned int nb = ref->key & (nsize-1);
+			ref->next = nbuckets[nb];
+			nbuckets[nb] = ref;
+			ref = nx;
+		}
+	}
+	
+	::free (s.buckets);
+	s.buckets = nbuckets;
+	s.size = nsize;
 }
 
 // ========================================================================
@@ -256,101 +223,57 @@ stringref *stringrefdb::getref (const char *str, unsigned int key)
 	}
 	
 	stringref *crsr;
-	stringref *oldcrsr;
-	unsigned int cnt;
 	size_t slen = ::strlen (str);
+	stringrefshard &s = shardfor (key);
 	
 	// Need write-lock because we'll add stuff if there's no match.
-	treelock.lockw();
+	s.lck.lockw();
+	
+	for (crsr = s.buckets[key & (s.size-1)]; crsr; crsr = crsr->next)
 	{
-		crsr = root;
-		oldcrsr = root;
-		
-		while (crsr)
+		if ((crsr->key == key) && (crsr->str.strlen() == slen) &&
+			(::strcmp (crsr->str.str(), str) == 0))
 		{
-			oldcrsr = crsr;
-			
-			if (crsr->key == key)
+			if (__sync_add_and_fetch (&crsr->refcnt, 1) == 1)
 			{
-				if ((crsr->str.strlen() == slen) &&
-					(::strcmp (crsr->str.str(), str) == 0))
-				{
-					unsigned int x = crsr->refcnt;
-					x++;
-					crsr->refcnt = x;
-					cnt = x;
-					if (cnt == 1)
-					{
-						exclusivesection (dirtycount)
-						{
-							dirtycount -= crsr->str.strlen();
-						}
-					}
-					treelock.unlock();
-					return crsr;
-				}
-				else crsr = crsr->lower;
+				__sync_sub_and_fetch (&s.dirty, slen+1);
 			}
-			else if (crsr->key < key) crsr = crsr->higher;
-			else crsr = crsr->lower;
+			s.lck.unlock();
+			return crsr;
 		}
-		
-		crsr = newref ();
-		crsr->str = str;
-		crsr->refcnt = 1;
-		crsr->key = key;
-		crsr->parent = oldcrsr;
-	
-		if (oldcrsr->key < key) oldcrsr->higher = crsr;
-		else oldcrsr->lower = crsr;
 	}
-	treelock.unlock();
+	
+	if (s.count >= s.size) grow (s);
+	
+	crsr = new stringref;
+	crsr->str = str;
+	crsr->key = key;
+	crsr->id = newid();
+	crsr->refcnt = 1;
+	
+	unsigned int b = key & (s.size-1);
+	crsr->next = s.buckets[b];
+	s.buckets[b] = crsr;
+	s.count++;
+	
+	s.lck.unlock();
 	return crsr;
 }
 
 // ========================================================================
-// METHOD stringrefdb::linkref
-// ---------------------------
-// Adds a stringref object into the tree
+// METHOD stringrefdb::lockall
 // ========================================================================
-void stringrefdb::linkref (stringref *ref)
+void stringrefdb::lockall (void)
 {
-	stringref *crsr = root;
-	
-	while (crsr)
-	{
-		if (crsr->key == ref->key)
-		{
-			if (crsr->id == ref->id) return;
-			if (crsr->lower) crsr = crsr->lower;
-			else
-			{
-				crsr->lower = ref;
-				ref->parent = crsr;
-				return;
-			}
-		}
-		else if (crsr->key < ref->key)
-		{
-			if (crsr->higher) crsr = crsr->higher;
-			else
-			{
-				crsr->higher = ref;
-				ref->parent = crsr;
-				return;
-			}
-		}
-		else
-		{
-			if (crsr->lower) crsr = crsr->lower;
-			else
-			{
-				crsr->lower = ref;
-				ref->parent = crsr;
-				return;
-			}
-		}
-	}
+	for (int i=0; i<STRINGREF_SHARDS; ++i) shards[i].lck.lockw();
+}
+
+// ========================================================================
+// METHOD stringrefdb::unlockall
+// ========================================================================
+void stringrefdb::unlockall (void)
+{
+	for (int i=0; i<STRINGREF_SHARDS; ++i) shards[i].lck.unlock();
 }
 
 // ========================================================================
@@ -62,6 +62,9 @@ namespace grace
 // 16 for numbers <256 or multiples of 256 in other cases.
 #define GROW(n) ( ((n)<256) ? 16 + ((n)-((n)&15)) : 256 + ((n)-((n)&255)) )
 
+// Same, but sizes that fit the inline refblock get exactly that.
+#define BLOCKSZ(n) ( ((n)<=STRING_INLINEALLOC) ? STRING_INLINEALLOC : GROW(n) )
+
 // Conversion table for printing hexadecimal numbers
 const char __HEXTAB[] = "0123456789abcdef";
 
@@ -69,54 +72,20 @@ const char __HEXTAB[] = "0123456789abcdef";
 const char __B64TAB[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvw"
 						"xyz0123456789+/";
 
-// Callback routine for pthreads to de-allocate a thread-specific
-// storage containing the unique sequence number for a thread.
-void removeref (void *refAddress)
-{
-	delete (threadref_t *) refAddress;
-}
-
 // ========================================================================
 // FUNCTION getref
 // ---------------
-// Returns the unique sequence number for the current thread.
+// Returns the unique sequence number for the current thread. String
+// data no longer cares which thread it belongs to, this is kept for
+// code that wants a cheap thread id.
 // ========================================================================
 threadref_t getref (void)
 {
-	if (! __THREADED)
-		return 0;
-		
-	static bool createdKey = false;
-	static pthread_key_t pkey;
-	static lock<threadref_t> sequence;
+	static volatile unsigned int sequence = 0;
+	static __thread threadref_t res = 0;
 	
-	threadref_t *res;
-	
-	if (! createdKey)
-	{
-		exclusivesection (sequence)
-		{
-			if (! createdKey)
-			{
-				pthread_key_create (&pkey, removeref);
-				sequence = 1;
-				createdKey = true;
-			}
-		}
-	}
-	
-	res = (threadref_t *) pthread_getspecific (pkey);
-	if (! res)
-	{
-		exclusivesection (sequence)
-		{
-			res = new threadref_t;
-			(*res) = sequence++;
-			pthread_setspecific (pkey, res);
-		}
-	}
-	
-	return (*res);
+	if (! res) res = (threadref_t) __sync_add_and_fetch (&sequence, 1);
+	return res;
 }
 
 // ========================================================================
@@ -136,9 +105,8 @@ string::string (unsigned int sz) : retainable()
 	size = 0;
 	offs = 0;
 	alloc = sz + sizeof (refblock);
-	data = (refblock *) malloc ((size_t) alloc);
+	data = allocblock (alloc);
 	data->refcount = 0;
-	data->threadref = getref();
 }
 
 // ========================================================================
@@ -157,11 +125,10 @@ string::string (const char *s) : retainable()
 		
 		offs = 0;
 		size = ::strlen (s);
-		alloc = GROW(size+1+sizeof (refblock));
-		data = (refblock *) malloc ((size_t) alloc);
+		alloc = BLOCKSZ(size+1+sizeof (refblock));
+		data = allocblock (alloc);
 		::strcpy (data->v, s);
 		data->refcount = 0;
-		data->threadref = getref();
 	}
 	else
 	{
@@ -195,11 +162,10 @@ string::string (const unsigned char *ss)
 		// Copy the c-string
 		offs = 0;
 		size = ::strlen (s);
-		alloc = GROW(size+1+sizeof (refblock));
-		data = (refblock *) malloc ((size_t) alloc);
+		alloc = BLOCKSZ(size+1+sizeof (refblock));
+		data = allocblock (alloc);
 		::strcpy (data->v, s);
 		data->refcount = 0;
-		data->threadref = getref();
 	}
 	else
 	{
@@ -227,29 +193,11 @@ string::string (const string &s) : retainable()
 	offs = 0;
 	data = NULL;
 	
-	if ((size = s.strlen()))
+	if (s.size)
 	{
 		// Make a copy-on-write reference
 	
-		if (s.data->threadref != getref())
-		{
-			strclone (s);
-			return;
-		}
-		offs = s.offs;
-		alloc = s.alloc;
-		size = s.size;
-		data = s.data;
-		data->refcount++;
-	}
-	else
-	{
-		// Allocate as empty
-	
-		size = 0;
-		offs = 0;
-		alloc = 0;
-		data = NULL;
+		sharefrom (s);
 	}
 }
 
@@ -267,34 +215,11 @@ string::string (const statstring &s) : retainable()
 	data = NULL;
 	offs = 0;
 	
-	if (s && (size = s.sval().strlen()))
+	if (s && s.sval().size)
 	{
 		// Make a copy-on-write reference
-		threadref_t me = getref();
-	
-		// That is, if we live on the same planet, copy-on-write
-		// is not mixed between threads to make it unnecessary
-		// to perform excessive locking.
-		if (s.sval().data->threadref != me)
-		{
-			strclone (s.sval());
-			return;
-		}
 		
-		// Copy all the details and just copy the reference.
-		alloc = s.sval().alloc;
-		size = s.sval().size;
-		data = s.sval().data;
-		offs = s.sval().offs;
-		data->refcount++;
-		data->threadref = me;
-	}
-	else
-	{
-		// Allocate as empty
-		size = 0;
-		alloc = 0;
-		data = NULL;
+		sharefrom (s.sval());
 	}
 }
 
@@ -306,7 +231,12 @@ string::string (const statstring &s) : retainable()
 // ========================================================================
 string::string (string *s) : retainable()
 {
-	if (s && s->strlen())
+	if (s && s->size && s->isinline())
+	{
+		copyinline (*s);
+		destroyvalue (s);
+	}
+	else if (s && s->strlen())
 	{
 		size = s->size;
 		alloc = s->alloc;
@@ -322,6 +252,31 @@ string::string (string *s) : retainable()
 	}
 }
 
+// ========================================================================
+// MOVE CONSTRUCTOR
+// ----------------
+// Takes over the refblock of a temporary. The reference count stays
+// the same, there is just a different owner for one of the references.
+// ========================================================================
+string::string (string &&s) : retainable()
+{
+	if (s.isinline())
+	{
+		copyinline (s);
+		s.size = s.alloc = s.offs = 0;
+		s.data = NULL;
+		return;
+	}
+	
+	size = s.size;
+	alloc = s.alloc;
+	data = s.data;
+	offs = s.offs;
+	
+	s.size = s.alloc = s.offs = 0;
+	s.data = NULL;
+}
+
 // ========================================================================
 // DESTRUCTOR
 // ----------
@@ -333,18 +288,10 @@ string::~string (void)
 	
 	if (data)
 	{
-		// Is it shared by another reference?
+		// Deallocate the data block if we were the last reference
+		// to it.
 	
-		if (data->refcount)
-		{
-			// Decrease the reference count
-			data->refcount--;
-		}
-		else
-		{
-			// Deallocate the data block
-			free (data);
-		}
+		if (data->release()) freeblock (data);
 	}
 }
 
@@ -407,6 +354,33 @@ string &string::operator= (const value &val)
 	return (*this);
 }
 
+string &string::operator= (string &&s)
+{
+	if (this == &s) return *this;
+	
+	if (data)
+	{
+		if (data->release()) freeblock (data);
+	}
+	
+	if (s.isinline())
+	{
+		copyinline (s);
+		s.size = s.alloc = s.offs = 0;
+		s.data = NULL;
+		return *this;
+	}
+	
+	size = s.size;
+	alloc = s.alloc;
+	data = s.data;
+	offs = s.offs;
+	
+	s.size = s.alloc = s.offs = 0;
+	s.data = NULL;
+	return *this;
+}
+
 // ========================================================================
 // METHOD ::operator+=
 // ========================================================================
@@ -661,6 +635,8 @@ void string::escape (void)
 {
 	unsigned char c;
 	unsigned int   old_size, old_offs;
+
+	unline ();
 	refblock *old_data = data;
 	old_size = size;
 	old_offs = offs;
@@ -701,14 +677,7 @@ void string::escape (void)
 			}
 			else strcat ((char ) c);
 		}
-		if (old_data->refcount)
-		{
-			old_data->refcount--;
-		}
-		else
-		{
-			free (old_data);
-		}
+		if (old_data->release()) freeblock (old_data);
 	}
 }
 
@@ -719,6 +688,8 @@ void string::escapexml (void)
 {
 	unsigned char c;
 	unsigned int old_size, old_offs;
+
+	unline ();
 	refblock *old_data = data;
 	old_size = size;
 	old_offs = offs;
@@ -751,14 +722,7 @@ void string::escapexml (void)
 			}
 			else strcat ((char ) c);
 		}
-		if (old_data->refcount)
-		{
-			old_data->refcount--;
-		}
-		else
-		{
-			free (old_data);
-		}
+		if (old_data->release()) freeblock (old_data);
 	}
 }
 
@@ -772,6 +736,8 @@ void string::unescapexml (void)
 {
 	char c;
 	unsigned int old_size, old_offs;
+
+	unline ();
 	refblock *old_data = data;
 	old_size = size;
 	old_offs = offs;
@@ -856,14 +822,7 @@ void string::unescapexml (void)
 			}
 			else strcat (c);
 		}
-		if (old_data->refcount)
-		{
-			old_data->refcount--;
-		}
-		else
-		{
-			free (old_data);
-		}
+		if (old_data->release()) freeblock (old_data);
 	}
 }
 
@@ -877,6 +836,8 @@ void string::unescape (void)
 {
 	char c;
 	unsigned int old_size, old_offs;
+
+	unline ();
 	refblock *old_data = data;
 	old_size = size;
 	old_offs = offs;
@@ -930,14 +891,7 @@ void string::unescape (void)
 			}
 			else strcat (c);
 		}
-		if (old_data->refcount)
-		{
-			old_data->refcount--;
-		}
-		else
-		{
-			free (old_data);
-		}
+		if (old_data->release()) freeblock (old_data);
 	}
 }
 
@@ -955,17 +909,16 @@ void string::strcat (char s)
 	{
 		if (data->refcount)
 		{
-			refblock *newdata = (refblock *) malloc ((size_t) alloc);
+			refblock *newdata = allocblock (alloc);
 			bcopy (data->v+offs, newdata->v, size+1);
 			newdata->refcount = 0;
-			data->refcount--;
+			if (data->release()) freeblock (data);
 			data = newdata;
-			data->threadref = getref();
 			offs = 0;
 		}
 		
 		++size;
-		register size_t sz2 = size+2+sizeof (refblock);
+		register size_t sz2 = offs+size+2+sizeof (refblock);
 		
 		// New size bigger than allocated memory?
 		
@@ -979,8 +932,7 @@ void string::strcat (char s)
 			
 			// Is this a copy-on-write refblock?
 			
-				data = (refblock *)
-					realloc (data, (size_t) alloc);
+				data = reallocblock (alloc);
 		}
 		
 		// Append new data
@@ -995,11 +947,10 @@ void string::strcat (char s)
 	
 		alloc = sizeof (refblock) + 8;
 		if (alloc<16) alloc = 16;
-		data = (refblock *) malloc ((size_t) alloc);
+		data = allocblock (alloc);
 		size = 1;
 		offs = 0;
 		data->refcount = 0;
-		data->threadref = getref();
 		data->v[0] = s;
 		data->v[1] = '\0';
 	}
@@ -1024,12 +975,11 @@ void string::insert (const string &s)
 	{
 		if (data->refcount)
 		{
-			refblock *newdata = (refblock *) malloc ((size_t) alloc);
+			refblock *newdata = allocblock (alloc);
 			bcopy (data->v+offs, newdata->v, size+1);
 			newdata->refcount = 0;
-			data->refcount--;
+			if (data->release()) freeblock (data);
 			data = newdata;
-			data->threadref = getref();
 			offs = 0;
 		}
 		
@@ -1037,10 +987,10 @@ void string::insert (const string &s)
 		unsigned int newsize = s.strlen();
 		size += newsize;
 		
-		if ((size+1+sizeof (refblock)) >= alloc)
+		if ((offs+size+1+sizeof (refblock)) >= alloc)
 		{
-			alloc = GROW(offs+size+1+sizeof (refblock));
-			data = (refblock *) realloc (data, alloc);
+			alloc = BLOCKSZ(offs+size+1+sizeof (refblock));
+			data = reallocblock (alloc);
 		}
 		
 		if (oldsize)
@@ -1068,22 +1018,21 @@ void string::strcat (const string &s)
 	{
 		if (data->refcount)
 		{
-			refblock *newdata = (refblock *) malloc ((size_t) alloc);
+			refblock *newdata = allocblock (alloc);
 			bcopy (data->v+offs, newdata->v, size+1);
 			newdata->refcount = 0;
-			data->refcount--;
+			if (data->release()) freeblock (data);
 			data = newdata;
-			data->threadref = getref();
 			offs = 0;
 		}
 		
 		unsigned int oldsize = size;
 		size += s.strlen();
 		
-		if ((size+1+sizeof (refblock)) >= alloc)
+		if ((offs+size+1+sizeof (refblock)) >= alloc)
 		{
-			alloc = GROW(offs+size+1+sizeof (refblock));
-			data = (refblock *) realloc (data, alloc);
+			alloc = BLOCKSZ(offs+size+1+sizeof (refblock));
+			data = reallocblock (alloc);
 		}
 		
 		memmove (data->v + offs + oldsize, s.str(), s.strlen());
@@ -1182,27 +1131,25 @@ void string::strcat (const char *s, size_t sz)
 	
 	if (data && data->refcount)
 	{
-		refblock *newdata = (refblock *) malloc ((size_t) alloc);
+		refblock *newdata = allocblock (alloc);
 		bcopy (data->v+offs, newdata->v, size+1);
 		newdata->refcount = 0;
-		data->refcount--;
+		if (data->release()) freeblock (data);
 		data = newdata;
-		data->threadref = getref();
 		offs = 0;
 	}
 	
 	unsigned int oldsize = size;
 	size += sz;
 	
-	if ((size+1+sizeof (refblock)) >= alloc)
+	if ((offs+size+1+sizeof (refblock)) >= alloc)
 	{
-		alloc = GROW(offs+size+1+sizeof (refblock));
-		if (oldsize) data = (refblock *) realloc (data, alloc);
+		alloc = BLOCKSZ(offs+size+1+sizeof (refblock));
+		if (data) data = reallocblock (alloc);
 		else
 		{
-			data = (refblock *) malloc (alloc);
+			data = allocblock (alloc);
 			data->refcount = 0;
-			data->threadref = getref();
 		}
 	}
 	memmove (data->v + offs + oldsize, s, sz);
@@ -1227,12 +1174,11 @@ void string::strcat (const char *s)
 		if (data->refcount)
 		{
 			testTwo = true;
-			refblock *newdata = (refblock *) malloc ((size_t) alloc);
+			refblock *newdata = allocblock (alloc);
 			bcopy (data->v+offs, newdata->v, size+1);
 			newdata->refcount = 0;
-			data->refcount--;
+			if (data->release()) freeblock (data);
 			data = newdata;
-			data->threadref = getref();
 			offs = 0;
 		}
 	
@@ -1242,11 +1188,11 @@ void string::strcat (const char *s)
 		while (s[len]) len++;
 		
 		size += len;
-		if ((size+1+sizeof (refblock)) >= alloc)
+		if ((offs+size+1+sizeof (refblock)) >= alloc)
 		{
 			testThree = true;
-			alloc =  GROW(offs+size+1+sizeof (refblock));
-			data = (refblock *) realloc (data, alloc);
+			alloc = BLOCKSZ(offs+size+1+sizeof (refblock));
+			data = reallocblock (alloc);
 		}
 		memmove (data->v + offs + oldsize, s, size-oldsize);
 		data->v[offs+size] = '\0';
@@ -1273,25 +1219,24 @@ void string::strcpy (const char *s)
 	
 	if (data && data->refcount)
 	{
-		data->refcount--;
+		if (data->release()) freeblock (data);
 		data = NULL;
 		size = alloc = 0;
 	}
 	
 	size = ::strlen (s);
 	offs = 0;
-	if ((size+1+sizeof (refblock)) >= alloc)
+	if ((offs+size+1+sizeof (refblock)) >= alloc)
 	{
-		alloc = GROW(offs+size+1+sizeof (refblock));
+		alloc = BLOCKSZ(offs+size+1+sizeof (refblock));
 		if (data)
 		{
-			data = (refblock *) realloc (data, alloc);
+			data = reallocblock (alloc);
 		}
 		else
 		{
-			data = (refblock *) malloc (alloc);
+			data = allocblock (alloc);
 			data->refcount = 0;
-			data->threadref = getref();
 		}
 	}
 	::strcpy (data->v+offs, s);
@@ -1307,44 +1252,89 @@ void string::strcpy (const string &s)
 {
 	if (data && (data == s.data))
 	{
-		if (! data->refcount) data->refcount = 1;
 		offs = s.offs;
 		size = s.size;
 		return;
 	}
 	
-	if (s.data)
+	if (data)
 	{
-		threadref_t me;
-		if (data) me = data->threadref;
-		else me = getref();
-	
-		if (s.data->threadref != me) // different threads
-		{
-			strclone (s);
-			return;
-		}
+		if (data->release()) freeblock (data);
 	}
 	
-	if (data)
+	size = alloc = offs = 0;
+	data = NULL;
+	if (s.data) sharefrom (s);
+}
+
+// ========================================================================
+// METHOD ::sharefrom
+// ------------------
+// Takes a copy-on-write reference to another string's data. Inline
+// refblocks belong to their string object, so those get copied.
+// Expects this object to be empty.
+// ========================================================================
+void string::sharefrom (const string &s)
+{
+	if (s.isinline())
 	{
-		if (data->refcount)
-		{
-			data->refcount--;
-		}
-		else
-		{
-			free (data);
-		}
+		copyinline (s);
+		return;
 	}
-
-	if (s.data) s.data->refcount++;	
-	size = s.strlen();
+	
+	s.data->share();
+	size = s.size;
 	alloc = s.alloc;
 	data = s.data;
 	offs = s.offs;
 }
 
+// ========================================================================
+// METHOD ::copyinline
+// -------------------
+// Copies another string's inline refblock into our own. Expects this
+// object to be empty.
+// ========================================================================
+void string::copyinline (const string &s)
+{
+	memcpy (inl, s.inl, STRING_INLINEALLOC);
+	data = (refblock *) inl;
+	size = s.size;
+	offs = s.offs;
+	alloc = s.alloc;
+}
+
+// ========================================================================
+// METHOD ::reallocblock
+// ---------------------
+// Resizes our refblock. Data that outgrows the inline block is moved
+// to the heap.
+// ========================================================================
+refblock *string::reallocblock (size_t sz)
+{
+	if (! isinline()) return (refblock *) realloc (data, sz);
+	if (sz <= STRING_INLINEALLOC) return data;
+	
+	refblock *res = (refblock *) malloc (sz);
+	memcpy (res, data, STRING_INLINEALLOC);
+	return res;
+}
+
+// ========================================================================
+// METHOD ::unline
+// ---------------
+// Moves data in the inline refblock to the heap.
+// ========================================================================
+void string::unline (void)
+{
+	if (! isinline()) return;
+	
+	refblock *res = (refblock *) malloc (STRING_INLINEALLOC);
+	memcpy (res, data, STRING_INLINEALLOC);
+	data = res;
+	alloc = STRING_INLINEALLOC;
+}
+
 // ========================================================================
 // METHOD ::strclone
 // -----------------
@@ -1355,24 +1345,16 @@ void string::strclone (const string &s)
 {
 	if (data)
 	{
-		if (data->refcount)
-		{
-			data->refcount--;
-		}
-		else
-		{
-			::free (data);
-			data = NULL;
-		}
+		if (data->release()) freeblock (data);
+		data = NULL;
 	}
 	
 	size = s.strlen();
 	alloc = s.alloc;
 	if (s.data)
 	{
-		data = (refblock *) malloc (alloc);
+		data = allocblock (alloc);
 		data->refcount = 0;
-		data->threadref = getref();
 		::memmove (data->v, s.data->v+s.offs, size+1);
 	}
 	else
@@ -1391,25 +1373,24 @@ void string::strcpy (const char *src, size_t sz)
 {
 	if (data && data->refcount)
 	{
-		data->refcount--;
+		if (data->release()) freeblock (data);
 		data = NULL;
 		alloc = 0;
 	}
 	
 	size = sz;
 	offs = 0;
-	if ((size+1+sizeof (refblock)) >= alloc)
+	if ((offs+size+1+sizeof (refblock)) >= alloc)
 	{
-		alloc = GROW(offs+size+1+sizeof (refblock));
+		alloc = BLOCKSZ(offs+size+1+sizeof (refblock));
 		if (data)
 		{
-			data = (refblock *) realloc (data, alloc);
+			data = reallocblock (alloc);
 		}
 		else
 		{
-			data = (refblock *) malloc (alloc);
+			data = allocblock (alloc);
 			data->refcount = 0;
-			data->threadref = getref();
 		}
 	}
 	::memmove (data->v+offs, src, sz);
@@ -1635,16 +1616,17 @@ string *string::mid (int pos, int psz) const
 	if ((pos+sz) > (int) size) sz = (size-pos);
 	
 	string *res = new (memory::retainable::onstack) string;
-
-	threadref_t me = getref();
-	if (data->threadref != me)
+	
+	if (isinline())
 	{
-		res->strcpy (((const char *)data->v) + pos + offs, sz);
+		res->copyinline (*this);
+		res->size = sz;
+		res->offs = pos+offs;
 		return res;
 	}
-	
+
 	res->data = data;
-	data->refcount++;
+	data->share();
 	res->size = sz;
 	res->offs = pos+offs;
 	res->alloc = alloc;
@@ -1652,6 +1634,32 @@ string *string::mid (int pos, int psz) const
 	return res;
 }
 
+// ========================================================================
+// METHOD ::reserve
+// ----------------
+// Makes sure there is room for a number of bytes of string data
+// without further reallocation.
+// ========================================================================
+void string::reserve (unsigned int sz)
+{
+	docopyonwrite ();
+	
+	size_t need = offs + sz + 1 + sizeof (refblock);
+	if (need < alloc) return;
+	
+	alloc = BLOCKSZ(need+1);
+	if (data)
+	{
+		data = reallocblock (alloc);
+		return;
+	}
+	
+	data = allocblock (alloc);
+	data->refcount = 0;
+	data->v[0] = 0;
+	size = offs = 0;
+}
+
 // ========================================================================
 // METHOD ::flush
 // --------------
@@ -1664,7 +1672,7 @@ void string::flush (void)
 	{
 		if (data->refcount)
 		{
-			data->refcount--;
+			if (data->release()) freeblock (data);
 			data = NULL;
 			alloc = 0;
 		}
@@ -1691,13 +1699,13 @@ void string::crop (int sz)
 		
 		if (data->refcount)
 		{
-			data->refcount--;
+			if (data->release()) freeblock (data);
 			data = NULL;
 			alloc = size = offs = 0;
 		}
 		else
 		{
-			free (data);
+			freeblock (data);
 			data = NULL;
 			alloc = size = offs = 0;
 		}
@@ -1718,12 +1726,11 @@ void string::crop (int sz)
 		
 		if (data->refcount)
 		{
-			refblock *newdata = (refblock *) malloc ((size_t) alloc);
+			refblock *newdata = allocblock (alloc);
 			bcopy (data, newdata, alloc);
 			newdata->refcount = 0;
-			data->refcount--;
+			if (data->release()) freeblock (data);
 			data = newdata;
-			data->threadref = getref();
 		}
 	
 		if (sz<0)
@@ -1732,10 +1739,10 @@ void string::crop (int sz)
 		}
 		size = _sz;
 		data->v[offs+size] = '\0';
-		if (GROW(offs+size+1+sizeof (refblock)) < alloc)
+		if (BLOCKSZ(offs+size+1+sizeof (refblock)) < alloc)
 		{
-			alloc = GROW(offs+size+1+sizeof (refblock));
-			data = (refblock *) realloc (data, alloc);
+			alloc = BLOCKSZ(offs+size+1+sizeof (refblock));
+			data = reallocblock (alloc);
 		}
 	}
 }
@@ -1763,8 +1770,8 @@ void string::pad (int psz, char p)
 	
 	if ((offs+sz+sizeof(refblock)) >= alloc)
 	{
-		alloc = GROW(offs + sz + sizeof (refblock) +1);
-		data = (refblock *) realloc (data, alloc);
+		alloc = BLOCKSZ(offs + sz + sizeof (refblock) +1);
+		data = reallocblock (alloc);
 	}
 	if (p)
 	{
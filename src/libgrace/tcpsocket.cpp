@@ -19,12 +19,15 @@
 #include <grace/filesystem.h>
 #include <grace/netdb.h>
 #include <fcntl.h>
+#include <poll.h>
 #include "platform.h"
 
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/un.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/errno.h>
 #ifdef HAVE_PASSCRED
   #include <linux/socket.h>
@@ -137,8 +140,7 @@ int tcpsocket::libcconnect (int sock, const struct sockaddr *a, socklen_t l)
 {
 	int res = 1;
 	int i, valopt=0;
-	fd_set fdset;
-	struct timeval tv;
+	struct pollfd pfd;
 	int opts = fcntl (sock, F_GETFL);
 	socklen_t lon = (socklen_t) sizeof(int);
 	
@@ -152,11 +154,9 @@ int tcpsocket::libcconnect (int sock, const struct sockaddr *a, socklen_t l)
 	
 	if ((i < 0) && (errno == EINPROGRESS))
 	{
-		tv.tv_sec = defaults::tcp::connecttimeout;
-		tv.tv_usec = 0;
-		FD_ZERO(&fdset);
-		FD_SET(sock, &fdset);
-		if (select (sock+1, NULL, &fdset, NULL, &tv) == 1)
+		pfd.fd = sock;
+		pfd.events = POLLOUT;
+		if (poll (&pfd, 1, defaults::tcp::connecttimeout * 1000) == 1)
 		{
 			if (getsockopt (sock, SOL_SOCKET, SO_ERROR,
 							(void*)(&valopt), &lon) >= 0)
@@ -335,6 +335,7 @@ bool tcpsocket::connect (ipaddress addr, int port)
 		size_t szdone;
 		size_t sz;
 		
+		codec->setpeer (ipaddress::ip2str (peer_addr), peer_port);
 		if (! codec->setup())
 		{
 			errcode = FERR_CODEC;
@@ -349,9 +350,7 @@ bool tcpsocket::connect (ipaddress addr, int port)
 		bool mayskip = false;
 		
 handshakes:
-		string dt;
-		codec->peekoutput (dt);
-		szleft = dt.strlen();
+		const char *dt = codec->borrowoutput (szleft);
 		szdone = 0;
 		
 		//::printf ("handshakes szleft=%i mayskip=%i\n", szleft, mayskip?1:0);
@@ -360,7 +359,7 @@ handshakes:
 		
 		while (szleft > 0)
 		{
-			sz = ::write (filno, dt.str() + szdone, szleft);
+			sz = ::write (filno, dt + szdone, szleft);
 			if (sz<=0)
 			{
 				::close (filno);
@@ -378,6 +377,17 @@ handshakes:
 			mayskip = false;
 			char buf[4096];
 			if (szdone) codec->doneoutput (szdone);
+			
+			// A resumed handshake can end with our own message. The
+			// peer does not answer it, so it is not acked before we
+			// send again and Nagle would hold up our first request.
+			if (! codec->expectinput())
+			{
+				int nodelay = 1;
+				(void) setsockopt (filno, IPPROTO_TCP, TCP_NODELAY,
+								   (char *) &nodelay, sizeof (nodelay));
+				return true;
+			}
 
 			sz = ::read (filno, buf, 4095);
 			if (sz>0)
@@ -680,6 +690,7 @@ void tcpsocket::derive (tcpsocket *s)
 	buffer.flush();
 	filno = s->filno;
 	feof = s->feof;
+	nonblocking = s->nonblocking;
 	
 	codec = s->codec;
 	peer_pid = s->peer_pid;
@@ -712,6 +723,7 @@ void tcpsocket::derive (tcpsocket &s)
 	buffer.flush();
 	filno = s.filno;
 	feof = s.feof;
+	nonblocking = s.nonblocking;
 	codec = s.codec;
 	peer_pid = s.peer_pid;
 	peer_uid = s.peer_uid;
@@ -725,6 +737,9 @@ void tcpsocket::derive (tcpsocket &s)
 	errcode = s.errcode;
 	ti_established = s.ti_established;
 	buffer.copy (s.buffer);
+	s.buffer.flush();
+	s.filno = -1;
+	s.feof = true;
 	s.codec = 0;
 }
 
@@ -767,6 +782,7 @@ tcpsocket *listenerbase::tryaccept (double t)
 tcplistener::tcplistener (int port)
 {
 	listening = false;
+	accepttimeout = 0;
 	listento (port);
 }
 
@@ -774,6 +790,7 @@ tcplistener::tcplistener (void)
 {
 	unprotected (sock) { sock = 0; }
 	listening = false;
+	accepttimeout = 0;
 	tcpdomain = true;
 	tcpdomainport = 0;
 }
@@ -884,6 +901,7 @@ void tcplistener::listento (ipaddress addr, int port)
 			throw socketCreateException();
 		}
 
+		accepttimeout = 0;
 		listening = true;
 	}
 }
@@ -896,6 +914,7 @@ void tcplistener::listento (ipaddress addr, int port)
 tcplistener::tcplistener (const string &path)
 {
 	listening = false;
+	accepttimeout = 0;
 	listento (path);
 }
 
@@ -945,6 +964,7 @@ void tcplistener::listento (const string &path)
 		}
 		
 		listen (sock, tune::tcplistener::backlog);
+		accepttimeout = 0;
 		listening = true;
 	}
 }
@@ -1017,42 +1037,67 @@ tcpsocket *tcplistener::accept (void)
 // 
 // The actual return data when a timeout occurs or the accept fails
 // is a NULL-pointer.
+//
+// With a timeout, the thread blocks in the kernel's accept() with the
+// timeout set as SO_RCVTIMEO. The kernel wakes up a single waiting
+// thread for every new connection, so any number of threads can wait
+// on the same listener without taking turns.
 // ========================================================================
 tcpsocket *tcplistener::tryaccept (double timeout)
 {
 	int pram=1;
-	fd_set fds;
 	int s = -1;
-	struct timeval tv;
+	int fd = -1;
+	int ms;
+	struct sockaddr_in6	remote;
+	socklen_t remote_len = sizeof(remote);
 	
 	if (timeout < 0.0) return NULL;
+	ms = (int) (1000.0 * timeout);
 	
-	tv.tv_sec = (int) timeout;
-	tv.tv_usec = (int) (10000.0 * (timeout - ((double) tv.tv_sec)));
-
-	int selresult;
-	unprotected (sock)
+	if (! listening)
 	{
-		FD_ZERO (&fds);
-		FD_SET (sock, &fds);
-		selresult = select (sock+1, &fds, NULL, NULL, &tv);
+		if (ms) __musleep (ms);
+		return NULL;
 	}
 	
-	if (selresult > 0)
+	if (! ms)
 	{
+		struct pollfd pfd;
+		pfd.events = POLLIN;
+		
 		exclusivesection (sock)
 		{
-			FD_ZERO (&fds);
-			FD_SET (sock, &fds);
-			tv.tv_sec = tv.tv_usec = 0;
-			if (select (sock+1, &fds, NULL, NULL, &tv) > 0)
+			pfd.fd = sock;
+			if (poll (&pfd, 1, 0) > 0)
 			{
-				struct sockaddr_in6	remote;
-				socklen_t remote_len = sizeof(remote);
 				s = ::accept (sock, (struct sockaddr *) &remote, &remote_len);
 			}
 		}
 	}
+	else
+	{
+		exclusivesection (sock)
+		{
+			fd = sock;
+			if (accepttimeout != ms)
+			{
+				struct timeval tv;
+				tv.tv_sec = ms / 1000;
+				tv.tv_usec = (ms % 1000) * 1000;
+				(void) setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO,
+								   (char *) &tv, sizeof (tv));
+				accepttimeout = ms;
+			}
+		}
+		
+	#ifdef SOCK_CLOEXEC
+		s = ::accept4 (fd, (struct sockaddr *) &remote, &remote_len,
+					   SOCK_CLOEXEC);
+	#else
+		s = ::accept (fd, (struct sockaddr *) &remote, &remote_len);
+	#endif
+	}
 	
 	if (s<0)
 	{
@@ -1089,54 +1134,141 @@ tcpsocket *tcplistener::tryaccept (double timeout)
 	return myfil;
 }
 
+// ========================================================================
+// METHOD ::listenfd
+// ========================================================================
+int tcplistener::listenfd (void)
+{
+	int res = -1;
+	
+	if (! listening) return -1;
+	sharedsection (sock) { res = sock; }
+	return res;
+}
+
+// ========================================================================
+// METHOD ::cork
+// ========================================================================
+void tcpsocket::cork (bool on)
+{
+#ifdef TCP_CORK
+	if (filno < 0) return;
+	
+	int pram = on ? 1 : 0;
+	(void) setsockopt (filno, IPPROTO_TCP, TCP_CORK, (char *) &pram,
+					   sizeof (pram));
+#endif
+}
+
+// ========================================================================
+// METHOD ::stale
+// --------------
+// A quiet connection that turns readable was either closed by the other
+// side or got something we did not ask for. Neither is any good for a
+// new request.
+// ========================================================================
+bool tcpsocket::stale (void)
+{
+	if ((filno < 0) || feof) return true;
+	if (buffer.backlog()) return true;
+	if (codec && codec->pendinginput()) return true;
+	
+	struct pollfd pfd;
+	pfd.fd = filno;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	
+	return (poll (&pfd, 1, 0) != 0);
+}
+
+// ========================================================================
+// METHOD ::sendtimeout
+// ========================================================================
+void tcpsocket::sendtimeout (int timeout_ms)
+{
+	if (filno < 0) return;
+	
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	(void) setsockopt (filno, SOL_SOCKET, SO_SNDTIMEO, (char *) &tv,
+					   sizeof (tv));
+}
+
 // ========================================================================
 // METHOD ::sendfile
 // -----------------
 // Uses the sendfile syscall, if available, to effectively stream
 // a file from disk to a tcpsocket.
 // ========================================================================
-void tcpsocket::sendfile (const string &path, unsigned int amount)
+bool tcpsocket::sendfile (const string &path, unsigned long long amount)
 {
+	int fd = ::open (path.str(), O_RDONLY);
+	if (fd < 0) return false;
+	
+	bool res = sendfile (fd, 0, amount);
+	::close (fd);
+	return res;
+}
+
+bool tcpsocket::sendfile (int fd, unsigned long long offset,
+						  unsigned long long amount)
+{
+	// Held output comes first.
+	if (holding) flushheld ();
+	
 #ifdef HAVE_SENDFILE
 	if (!codec)
 	{
-		file fi;
-		off_t off = 0;
-	
-		if (fi.openread (path))
+		off_t off = offset;
+		
+		// The kernel moves the offset along, and sends no more
+		// than about 2GB per call.
+		while (amount > 0)
 		{
-			while (amount > 0)
+			size_t chunk = (amount > 0x40000000ULL) ? 0x40000000 : amount;
+			ssize_t ssz = ::sendfile (filno, fd, &off, chunk);
+			
+			if (ssz < 0)
 			{
-				unsigned int ssz = 0;
-				ssz = ::sendfile (filno, fi.filno, &off, amount);
-				amount -= ssz;
-				off += ssz;
+				if (errno == EINTR) continue;
+				return false;
 			}
-			fi.close();
+			
+			// The file got shorter under our feet.
+			if (ssz == 0) return false;
+			amount -= ssz;
 		}
-		return;
+		return true;
 	}
 #endif
 	
-	file fi;
-	string buf;
-	
-	fi.openread (path);
+	char buf[65536];
 	
-	try {
+	while (amount > 0)
+	{
+		size_t sz = (amount > sizeof (buf)) ? sizeof (buf) : amount;
+		ssize_t rsz = ::pread (fd, buf, sz, offset);
 		
+		if (rsz < 0)
+		{
+			if (errno == EINTR) continue;
+			return false;
+		}
+		if (rsz == 0) return false;
 		
-		while (! fi.eof() && amount > 0)
+		try
 		{
-			unsigned int sz = amount > 4096 ? 4096 : amount;
-			buf = fi.read (sz);
-			if (buf.strlen()) puts (buf);
-			
-			amount -= buf.strlen();
+			if (! puts (buf, rsz)) return false;
 		}
+		catch (...)
+		{
+			return false;
+		}
+		
+		offset += rsz;
+		amount -= rsz;
 	}
-	catch (...)
-	{
-	}
-	fi.close ();
+	
+	return true;
 }
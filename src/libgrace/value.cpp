@@ -25,8 +25,7 @@
 
 #include <stdio.h>
 #include <string.h>
-
-extern threadref_t getref (void);
+#include <utility>
 
 value *$ (const statstring &id, const value &v)
 {
@@ -113,13 +112,16 @@ value::value (creatorlabel l, unsigned int k)
 	_itype = i_unset;
 	t.lval = 0;
 	key = k;
-	lower = higher = NULL;
+	hash = NULL;
+	hashbits = 0;
 	array = NULL;
+	arrayhead = 0;
 	arraysz = 0;
 	arrayalloc = 0;
+	arrayholes = 0;
+	arraypos = 0;
 	ucount = 0;
 	attrib = NULL;
-	threadref = getref();
 }
 
 // ========================================================================
@@ -133,13 +135,16 @@ value::value (creatorlabel l,const char *k)
 	t.lval = 0;
 	key = checksum (k);
 	_name = k;
-	lower = higher = NULL;
+	hash = NULL;
+	hashbits = 0;
 	array = NULL;
+	arrayhead = 0;
 	ucount = 0;
 	arraysz = 0;
 	arrayalloc = 0;
+	arrayholes = 0;
+	arraypos = 0;
 	attrib = NULL;
-	threadref = getref();
 }
 
 // ========================================================================
@@ -156,13 +161,16 @@ value::value (creatorlabel l, const char *k, unsigned int ki)
 	t.lval = 0;
 	key = ki;
 	_name = k;
-	lower = higher = NULL;
+	hash = NULL;
+	hashbits = 0;
 	array = NULL;
+	arrayhead = 0;
 	ucount = 0;
 	arraysz = 0;
 	arrayalloc = 0;
+	arrayholes = 0;
+	arraypos = 0;
 	attrib = NULL;
-	threadref = getref();
 }
 
 // ========================================================================
@@ -182,14 +190,17 @@ value::value (creatorlabel l, const string &k)
 	// Copy the _name element to te C string (a string object would be bloat here)
 	_name = k;
 		
-	// Linking is done from the parent
-	lower = higher = NULL;
+	// Indexing is done from the parent
+	hash = NULL;
+	hashbits = 0;
 	array = NULL;
+	arrayhead = 0;
 	arraysz = 0;
 	arrayalloc = 0;
+	arrayholes = 0;
+	arraypos = 0;
 	ucount = 0;
 	attrib = NULL;
-	threadref = getref();
 }
 
 // ========================================================================
@@ -272,18 +283,9 @@ value::value (value &v)
 		(*attrib) = (*(v.attrib));
 	}
 	
-	// Iterate through the children and make copies as our own
+	// The children are shared until either side changes them.
 	
-	for (unsigned int i=0; i<v.arraysz; ++i)
-	{
-		if (v.array[i])
-		{
-			if (v.array[i]->_name)
-				*(findchild (v.array[i]->key, v.array[i]->_name.str())) = *(v.array[i]);
-			else
-				newval() = *(v.array[i]);
-		}
-	}
+	sharearray (v);
 }
 
 value::value (const value &v)
@@ -293,13 +295,16 @@ value::value (const value &v)
 	
 	t.lval = 0;
 	key = 0;
-	lower = higher = NULL;
+	hash = NULL;
+	hashbits = 0;
 	array = NULL;
+	arrayhead = 0;
 	arraysz = 0;
 	arrayalloc = 0;
+	arrayholes = 0;
+	arraypos = 0;
 	ucount = 0;
 	attrib = NULL;
-	threadref = getref();
 	
 	(*this) = v;
 }
@@ -316,6 +321,17 @@ value::value (value *v)
 	(*this) = v;
 }
 
+// ========================================================================
+// MOVE CONSTRUCTOR
+// ----------------
+// Initializes a value by taking over the data of a temporary.
+// ========================================================================
+value::value (value &&v)
+{
+	init (true);
+	(*this) = std::move (v);
+}
+
 // ========================================================================
 // COPY CONSTRUCTOR
 // ========================================================================
@@ -419,20 +435,7 @@ value::value (bool b)
 // ========================================================================
 value::~value (void)
 {
-	if (arraysz) // Infanticide
-	{
-		for (unsigned int i=0; i<arraysz; ++i)
-		{
-			if (array[i]) delete array[i];
-			array[i] = NULL;
-		}
-		::free (array);
-		array = NULL;
-		arraysz = 0;
-		arrayalloc = 0;
-		ucount = 0;
-	}
-	
+	droparray (); // Infanticide, unless someone else holds the children
 	if (attrib) delete attrib;
 	// In death, we do not need a name.
 }
@@ -621,7 +624,8 @@ value &value::operator= (const value &v)
 		case i_int: t = v.t; break;
 	}
 	
-	// Now clone the children if needed
+	// Now share the children, they get cloned when either of us
+	// changes them.
 	
 	if (attrib)
 	{
@@ -629,24 +633,7 @@ value &value::operator= (const value &v)
 		attrib = NULL;
 	}
 	
-	if (v.count()) // has children
-	{
-		for (int i=0; i<v.count(); ++i)
-		{
-			if (v[i]._name)
-			{
-				(*this)[v[i]._name] = v[i];
-			}
-			else
-			{
-				newval() = v[i];
-			}
-		}
-		if (arraysz != (unsigned int) v.count())
-		{
-			throw valueCountMismmatchException();
-		}
-	}
+	sharearray (v);
 	if (v.attrib)
 	{
 		attrib = new value;
@@ -662,87 +649,94 @@ value &value::operator= (const value &v)
 // ========================================================================
 value &value::operator= (value *v)
 {
-	if (v && v->threadref != threadref)
+	if (! v)
 	{
-		(*this) = (*v);
-		delete v;
+		clear ();
 		return *this;
 	}
 	
-	clear();
-	
-	// Prefer to keep the original type
+	(*this) = std::move (*v);
 	
-	if (v != NULL)
-	{
-		switch (v->_itype)
-		{
-			case i_ipaddr: t = v->t; break;
-			case i_string: s = v->s; break;
-			case i_bool:
-			case i_unsigned:
-			case i_int:
-			case i_date:
-			case i_double: t.dval = v->t.dval; break;
-			case i_long:
-			case i_ulong: t.ulval = v->t.ulval; break;
-		}
-		_itype = v->_itype;
-		_type = v->type();
-	}
-	else
-	{
-		_type = t_unset;
-	}
+	// Get rid of the original
 	
-	// FIXME: Shouldn't this be handled by clear()?
+	delete v;
+	return *this;
+}
+
+// ========================================================================
+// METHOD ::operator=
+// ------------------
+// Move another value into this one. The children, attributes and
+// string data change owner without being copied.
+// ========================================================================
+value &value::operator= (value &&v)
+{
+	if (this == &v) return *this;
 	
-	if (arraysz>0)
-	{
-		for (unsigned int i=0; i<arraysz; ++i)
-		{
-			if (array[i]) delete array[i];
-		}
-		::free (array);
-		array = NULL;
-		arrayalloc = 0;
-		arraysz = 0;
-		ucount = 0;
-	}
-	if (attrib)
-	{
-		delete attrib;
-		attrib = NULL;
-	}
-	ucount = 0;
+	// Take everything out of the original before clearing ourselves,
+	// it may well be one of our own children.
+	
+	string			 vs;
+	dtype			 vt = v.t;
+	unsigned char	 vitype = v._itype;
+	dtenum			 vtype = std::move (v._type);
+	value			**varray = v.array;
+	unsigned int	 varrayhead = v.arrayhead;
+	unsigned int	 varraysz = v.arraysz;
+	unsigned int	 varrayalloc = v.arrayalloc;
+	unsigned int	 varrayholes = v.arrayholes;
+	unsigned int	 vucount = v.ucount;
+	value			**vhash = v.hash;
+	unsigned char	 vhashbits = v.hashbits;
+	value			*vattrib = v.attrib;
+	
+	if (vitype == i_string) vs = std::move (v.s);
+	
+	v.array = NULL;
+	v.arrayhead = 0;
+	v.arraysz = 0;
+	v.arrayalloc = 0;
+	v.arrayholes = 0;
+	v.ucount = 0;
+	v.hash = NULL;
+	v.hashbits = 0;
+	v.attrib = NULL;
+	v._type = t_unset;
+	v._itype = i_unset;
 	
-	// Nick the children, we're gonna shoot the original anyway
+	clear();
 	
-	if ((v != NULL) && (v->arraysz)) // has children
-	{
-		array = v->array;
-		arraysz = v->arraysz;
-		arrayalloc = v->arrayalloc;
-		ucount = v->ucount;
-		v->arraysz = 0;
-		v->ucount = 0;
-		v->arrayalloc = 0;
-		v->array = NULL;
-	}
+	// Prefer to keep the original type
 	
-	if ((v != NULL) && (v->attrib))
-	{
-		attrib = v->attrib;
-		v->attrib = NULL;
-	}
+	if (vitype == i_string) s = std::move (vs);
+	else t = vt;
+	_itype = vitype;
+	_type = vtype;
 	
-	// Get rid of the original
+	// Nick the children, the original has no further use for them
 	
-	delete v;
+	array = varray;
+	arrayhead = varrayhead;
+	arraysz = varraysz;
+	arrayalloc = varrayalloc;
+	arrayholes = varrayholes;
+	ucount = vucount;
+	hash = vhash;
+	hashbits = vhashbits;
+	attrib = vattrib;
 	
 	return *this;
 }
 
+// Copies of a value share their child nodes, so one node can be
+// converted to a string by several threads at the same time. Writes to
+// the cached string representation are serialized on a small set of
+// spinlocks, picked by the node's address.
+#define VALUE_SVAL_LOCKS 64
+#define SVALSLOT(p) ((((unsigned long) (p)) >> 4) & (VALUE_SVAL_LOCKS-1))
+
+static volatile int __value_sval_locks[VALUE_SVAL_LOCKS];
+
 // ========================================================================
 // METHOD ::sval (dynamic versions)
 // ------------------------------------------
@@ -750,6 +744,8 @@ value &value::operator= (value *v)
 // ========================================================================
 const string &value::sval (void) const
 {
+	packarray ();
+	
 	// If we're an array, return the string cast of our first child	
 	if (arraysz) return array[0]->sval();
 	
@@ -764,7 +760,7 @@ const string &value::sval (void) const
 	// its side-effects  do not harm the principal constness, the
 	// code 'owning' a value-object and passing it as const to another
 	// function does not find the object in a functionally altered state.
-    string &S = (string &) s;
+	string S;
 
 	switch (_itype)
 	{
@@ -772,47 +768,55 @@ const string &value::sval (void) const
 			return s;
 
 		case i_ipaddr:
-		    S.crop(); 
 		    ipaddress::ip2str( t.ipval, S );
-		    return s;
+		    break;
 
 		case i_bool:
 			S = t.ival ? "true" : "false";
-			return s;
+			break;
 			
 		case i_int:
-			S.crop(); S.printf ("%i", t.ival);
-			return s;
+			S.printf ("%i", t.ival);
+			break;
 			
 		case i_unsigned:
-			S.crop(); S.printf ("%u", t.uval);
-			return s;
+			S.printf ("%u", t.uval);
+			break;
 			
 		case i_date:
 			S = __make_timestr (t.uval);
-			return s;
+			break;
 		
 		case i_double:
-			S.crop(); S.printf ("%f", t.dval);
-			return s;
+			S.printf ("%f", t.dval);
+			break;
 
 		case i_currency:
-			S.crop();
 			printcurrency (S, t.lval);
-			return s;
+			break;
 
 		case i_long:
-			S.crop(); S.printf ("%L", t.lval);
-			return s;
+			S.printf ("%L", t.lval);
+			break;
 			
 		case i_ulong:
-			S.crop(); S.printf ("%U", t.ulval);
-			return s;
-	}	
-		
-	// Unknown datatype, treat as an empty string
+			S.printf ("%U", t.ulval);
+			break;
+			
+		default:
+			// Unknown datatype, treat as an empty string
+			break;
+	}
+	
+	// Only replace the cached representation if it changed, so that
+	// references handed out by earlier calls stay valid.
+	string &cache = (string &) s;
+	volatile int *lck = __value_sval_locks + SVALSLOT(this);
+	
+	while (__sync_lock_test_and_set (lck, 1));
+	if (cache != S) cache = S;
+	__sync_lock_release (lck);
 	
-	S = "";
 	return s;
 }
 
@@ -823,6 +827,7 @@ const string &value::sval (void) const
 // ========================================================================
 const char *value::cval (void) const
 {
+	packarray ();
 	if (arraysz) return array[0]->sval().str();
 	return sval().str();
 }
@@ -1047,163 +1052,280 @@ bool value::ismixed (void) const
 }
 
 // ========================================================================
-// METHOD ::findchild
-// ------------------
-// Locate a sub-value inside the array by its key value
+// Child hash index
+// ----------------
+// Keyed children live in array[ucount..arraysz). Up to VALUE_HASH_MINKEYS
+// of them are located by a linear scan. Beyond that, an open addressing
+// hash table with linear probing maps a child's checksum key to the
+// child. The table is kept at most half full, so the expected probe
+// length stays constant regardless of the order keys were added in.
 // ========================================================================
-value *value::findchild (const char *key) const
-{
-		// Calculate the checksum key
-		unsigned int ki = checksum (key);
-		return findchild (ki,key);
-}
-value *value::findchild (const char *key)
+#define VALUE_HASH_MINKEYS	8
+#define VALUE_HASH_MINBITS	5
+
+// Fibonacci hashing: spreads the checksum's high-order entropy over
+// the low bits used as a table index.
+#define HASHSLOT(ki,bits) (((ki) * 2654435769U) >> (32 - (bits)))
+
+#define KEYMATCH(obj) ((obj->key == ki) && \
+					   ( (!key) || (::strcasecmp (key, obj->_name.str()) == 0)))
+
+// ========================================================================
+// METHOD ::hashinsert
+// ========================================================================
+void value::hashinsert (value *child)
 {
-		// Calculate the checksum key
-		unsigned int ki = checksum (key);
-		return findchild (ki,key);
+	unsigned int nkeys = arraysz - ucount;
+	
+	if (! hash)
+	{
+		if (nkeys <= VALUE_HASH_MINKEYS) return;
+		rehash ();
+		return;
+	}
+	
+	if ((nkeys << 1) > (1U << hashbits))
+	{
+		rehash ();
+		return;
+	}
+	
+	unsigned int mask = (1U << hashbits) - 1;
+	unsigned int slot = HASHSLOT (child->key, hashbits);
+	while (hash[slot]) slot = (slot+1) & mask;
+	hash[slot] = child;
 }
 
-value *value::findchild (unsigned int ki, const char *key)
-{	
-	// Have children already been assigned to this value?
-	if (arraysz > ucount) // yes
+// ========================================================================
+// METHOD ::rehash
+// ========================================================================
+void value::rehash (void)
+{
+	unsigned int nkeys = arraysz - ucount;
+	
+	freehash ();
+	if (nkeys <= VALUE_HASH_MINKEYS) return;
+	
+	unsigned char bits = VALUE_HASH_MINBITS;
+	while ((1U << bits) < (nkeys << 1)) ++bits;
+	
+	hashbits = bits;
+	hash = (value **) calloc (1U << bits, sizeof (value *));
+	
+	unsigned int mask = (1U << bits) - 1;
+	
+	// Insert in array order, so that a lookup for a key that occurs
+	// more than once will find the oldest node first. Every child
+	// gets visited anyway, so their position hints are renewed too.
+	unsigned int end = arraysz + arrayholes;
+	for (unsigned int i=ucount; i<end; ++i)
 	{
-		// Start searching from the first array index
-		value *crsr = array[ucount];
-		
-		// If the node does not exist yet, this pointer will point at
-		// the "lower" or "higher" pointer of the last end of the branch
-		value *insert_at = NULL;
+		if (! array[i]) continue;
 		
-		while (crsr)
-		{
-			// The new key is lower than this node
-			if (ki < crsr->key)
-			{
-				// There are lower nodes
-				if (crsr->lower)
-					crsr = crsr->lower;
-				else
-				{
-					// No lower nodes, a node with the key does not exist
-					// yet.
-					insert_at = crsr;
-					crsr = NULL;
-				}
-			}
-			else
-			{
-				// Perhaps this is the node we're looking for?
-				if ((crsr->key == ki) && ( (!key) || (::strcasecmp (key, crsr->_name.str()) == 0)) )
-				{
-					return crsr;
-				}
-				
-				// Seems not, are there higher nodes?
-				if (crsr->higher)
-					crsr = crsr->higher;
-				else
-				{
-					// Insert after this node then.
-					insert_at = crsr;
-					crsr = NULL;
-				}
-			}
-		}
-
-		// If control reaches this point, no node was found so we haves
-		// to create a new one.
+		unsigned int slot = HASHSLOT (array[i]->key, bits);
+		while (hash[slot]) slot = (slot+1) & mask;
+		hash[slot] = array[i];
+		array[i]->arraypos = arrayhead + i;
+	}
+}
 
-		++arraysz;
-		alloc (arraysz);
-		array[arraysz-1] = key ? new value (valueWithKey,key,ki) : 
-						   new value (valueWithKey,ki);
+// ========================================================================
+// METHOD ::hashremove
+// -------------------
+// Take a keyed child that was already removed from the array out of
+// the hash index. Entries further down the probe chain are shifted back
+// into the gap, so no tombstones are left behind. The index is shrunk
+// or dropped once it gets sparse.
+// ========================================================================
+void value::hashremove (value *child)
+{
+	if (! hash) return;
+	
+	unsigned int nkeys = arraysz - ucount;
+	unsigned int size = 1U << hashbits;
+	
+	if (nkeys <= VALUE_HASH_MINKEYS)
+	{
+		freehash ();
+		return;
+	}
+	
+	unsigned int mask = size - 1;
+	unsigned int slot = HASHSLOT (child->key, hashbits);
+	while (hash[slot] != child) slot = (slot+1) & mask;
+	hash[slot] = NULL;
+	
+	unsigned int j = slot;
+	value *crsr;
+	
+	while ((crsr = hash[j = ((j+1) & mask)]))
+	{
+		unsigned int home = HASHSLOT (crsr->key, hashbits);
 		
-		// And link it in the tree.
-		if (insert_at) 
+		// Move the entry into the gap, unless its home slot lies
+		// between the gap and its current slot.
+		if (((j - home) & mask) >= ((j - slot) & mask))
 		{
-			if (insert_at->key > ki)
-				insert_at->lower = array[arraysz-1];
-			else
-				insert_at->higher = array[arraysz-1];
+			hash[slot] = crsr;
+			hash[j] = NULL;
+			slot = j;
 		}
 	}
-	else
+	
+	if ((size > (1U << VALUE_HASH_MINBITS)) && ((nkeys << 3) < size))
 	{
-		if (! arraysz)
-		{
-			arraysz = 1;
-			ucount = 0;
-			alloc (arraysz);
-			array[0] = key ? new value (valueWithKey,key,ki) : 
-					   new value (valueWithKey,ki);
-		}
-		else
-		{
-			++arraysz;
-			alloc (arraysz);
-			array[arraysz-1] = key ? new value (valueWithKey,key,ki) : 
-							   new value (valueWithKey,ki);
-		}
+		rehash ();
 	}
-	return (array[arraysz-1]);
 }
 
-value *value::findchild (unsigned int ki, const char *key) const
-{	
-	// Have children already been assigned to this value?
-	if (arraysz > ucount) // yes
+// ========================================================================
+// METHOD ::freehash
+// ========================================================================
+void value::freehash (void)
+{
+	if (hash)
 	{
-		// Start searching from the first array index
-		value *crsr = array[ucount];
-		
-		// If the node does not exist yet, this pointer will point at
-		// the "lower" or "higher" pointer of the last end of the branch
-		value *insert_at = NULL;
+		::free (hash);
+		hash = NULL;
+	}
+	hashbits = 0;
+}
+
+// ========================================================================
+// METHOD ::sharearray
+// -------------------
+// Take a reference to another value's child array and hash index. The
+// caller should have dropped its own array first. A shared array never
+// has holes in it, so any left by removals are closed first.
+// ========================================================================
+void value::sharearray (const value &v)
+{
+	if (! v.array) return;
+	
+	v.packarray ();
+	__sync_add_and_fetch (&(v.arrayheader()->refcount), 1);
+	array = v.array;
+	arrayhead = v.arrayhead;
+	arraysz = v.arraysz;
+	arrayalloc = v.arrayalloc;
+	ucount = v.ucount;
+	hash = v.hash;
+	hashbits = v.hashbits;
+}
+
+// ========================================================================
+// METHOD ::droparray
+// ========================================================================
+void value::droparray (void)
+{
+	if (array)
+	{
+		valuearray *hdr = arrayheader();
 		
-		while (crsr)
+		// A count of 1 means nobody else can be looking at the array,
+		// so the atomic decrement can be skipped.
+		if ((hdr->refcount == 1) ||
+			(__sync_sub_and_fetch (&(hdr->refcount), 1) == 0))
 		{
-			// The new key is lower than this node
-			if (ki < crsr->key)
+			for (unsigned int i=0; i<(arraysz+arrayholes); ++i)
 			{
-				// There are lower nodes
-				if (crsr->lower)
-					crsr = crsr->lower;
-				else
-				{
-					// No lower nodes, a node with the key does not exist
-					// yet.
-					insert_at = crsr;
-					crsr = NULL;
-				}
-			}
-			else
-			{
-				// Perhaps this is the node we're looking for?
-				if ((crsr->key == ki) && ( (!key) || (::strcasecmp (key, crsr->_name.str()) == 0)) )
-				{
-					return crsr;
-				}
-				
-				// Seems not, are there higher nodes?
-				if (crsr->higher)
-					crsr = crsr->higher;
-				else
-				{
-					// Insert after this node then.
-					insert_at = crsr;
-					crsr = NULL;
-				}
+				if (array[i]) delete array[i];
 			}
+			::free (hdr);
+			if (hash) ::free (hash);
 		}
-		return NULL;
 	}
-	else
+	
+	array = NULL;
+	arrayhead = 0;
+	arraysz = 0;
+	arrayalloc = 0;
+	arrayholes = 0;
+	ucount = 0;
+	hash = NULL;
+	hashbits = 0;
+}
+
+// ========================================================================
+// METHOD ::splitarray
+// -------------------
+// Give this value a private copy of a child array it was sharing. The
+// children themselves are copied shallowly: each copy shares the
+// grandchildren, so only the path that actually gets modified ends up
+// being cloned.
+// ========================================================================
+void value::splitarray (void)
+{
+	value tmp;
+	
+	tmp.array = array;
+	tmp.arrayhead = arrayhead;
+	tmp.arraysz = arraysz;
+	tmp.arrayalloc = arrayalloc;
+	tmp.ucount = ucount;
+	tmp.hash = hash;
+	tmp.hashbits = hashbits;
+	
+	array = NULL;
+	arrayhead = 0;
+	arrayalloc = 0;
+	hash = NULL;
+	hashbits = 0;
+	
+	alloc (arraysz);
+	for (unsigned int i=0; i<arraysz; ++i)
 	{
-		return NULL;
+		if (tmp.array[i]) array[i] = new value (*(tmp.array[i]));
 	}
-	return (array[arraysz-1]);
+	rehash ();
+	
+	// The temporary gives back our reference to the original.
+}
+
+// ========================================================================
+// METHOD ::findchild
+// ------------------
+// Locate a sub-value inside the array by its key value
+// ========================================================================
+const value *value::findchild (const char *key) const
+{
+		// Calculate the checksum key
+		unsigned int ki = checksum (key);
+		return findchild (ki,key);
+}
+value *value::findchild (const char *key)
+{
+		// Calculate the checksum key
+		unsigned int ki = checksum (key);
+		return findchild (ki,key);
+}
+
+value *value::findchild (unsigned int ki, const char *key)
+{
+	unshare ();
+	value *res = havechild (ki, key);
+	if (res) return res;
+	
+	// If control reaches this point, no node was found so we have
+	// to create a new one. It goes after any holes left by removals.
+	
+	if (! arraysz) ucount = 0;
+	unsigned int end = arraysz + arrayholes;
+	alloc (end+1);
+	res = key ? new value (valueWithKey,key,ki) :
+				new value (valueWithKey,ki);
+	array[end] = res;
+	res->arraypos = arrayhead + end;
+	++arraysz;
+	
+	// And add it to the index.
+	hashinsert (res);
+	return res;
+}
+
+const value *value::findchild (unsigned int ki, const char *key) const
+{
+	return havechild (ki, key);
 }
 
 // ========================================================================
@@ -1212,48 +1334,37 @@ value *value::findchild (unsigned int ki, const char *key) const
 // Locate a sub-value inside the array by its key value, never create
 // a node on demand.
 // ========================================================================
-value *value::havechild (unsigned int ki, const char *key) const
-{	
-	// Have children already been assigned to this value?
-	if (arraysz > ucount) // yes
+value *value::havechild (unsigned int ki, const char *key)
+{
+	unshare ();
+	
+	// The array is ours alone now, so are its children.
+	return (value *) ((const value *) this)->havechild (ki, key);
+}
+
+const value *value::havechild (unsigned int ki, const char *key) const
+{
+	// Have keyed children been assigned to this value?
+	if (arraysz <= ucount) return NULL;
+	
+	if (! hash)
 	{
-		// Start searching from the first array index
-		value *crsr = array[ucount];
-		
-		while (crsr)
+		// Too few keys to bother with the index.
+		for (unsigned int i=ucount; i<arraysz; ++i)
 		{
-			// The new key is lower than this node
-			if (ki < crsr->key)
-			{
-				// There are lower nodes
-				if (crsr->lower)
-					crsr = crsr->lower;
-				else
-				{
-					// No lower nodes, a node with the key does not exist
-					// yet.
-					return NULL;
-				}
-			}
-			else
-			{
-				// Perhaps this is the node we're looking for?
-				if ((crsr->key == ki) && 
-					( (!key) || (::strcasecmp (key, crsr->_name.str()) == 0)) )
-				{
-					return crsr;
-				}
-				
-				// Seems not, are there higher nodes?
-				if (crsr->higher)
-					crsr = crsr->higher;
-				else
-				{
-					// Insert after this node then.
-					return NULL;
-				}
-			}
+			if (KEYMATCH(array[i])) return array[i];
 		}
+		return NULL;
+	}
+	
+	unsigned int mask = (1U << hashbits) - 1;
+	unsigned int slot = HASHSLOT (ki, hashbits);
+	value *crsr;
+	
+	while ((crsr = hash[slot]))
+	{
+		if (KEYMATCH(crsr)) return crsr;
+		slot = (slot+1) & mask;
 	}
 	return NULL;
 }
@@ -1277,92 +1388,179 @@ void value::rmval (unsigned int ki, const char *key, int pindex)
 {
 	// Check for children, if there are none we might as well
 	// leave. Sort of like Michael Jackson.
+	if (! arraysz) return;
+	unshare ();
 	
 	int index = pindex;
 	
-	#define KEYMATCH(obj) ((obj->key == ki) && ( (!key) || (::strcasecmp (key, obj->_name.str()) == 0)))
-	
 	if ((index<0) && (ki == 31337) && (key == NULL))
 	{
 		index += arraysz;
 		if (index<0) return;
 	}
 	
-	unsigned int uindex = index;
+	if (index >= 0)
+	{
+		packarray ();
+		if ((unsigned int) index < arraysz) rmposition (index);
+		return;
+	}
+	
+	if (! key)
+	{
+		// A bare numeric key can also match an unkeyed node, so
+		// skip through the entire array to find it.
+		packarray ();
+		for (unsigned int i=0; i<arraysz; ++i)
+		{
+			if (KEYMATCH(array[i]))
+			{
+				rmposition (i);
+				return;
+			}
+		}
+		return;
+	}
 	
-	if (arraysz) // yes
+	value *crsr = havechild (ki, key);
+	if (! crsr) return;
+	
+	if (! hash)
 	{
-		bool rearrange = false;
-		
-		// Skip through the array to find it
-		for (unsigned int i = (unsigned int) (index<0 ? 0:index); i<arraysz; ++i)
+		// Only a handful of keys, they can be scanned.
+		for (unsigned int i=ucount; i<arraysz; ++i)
 		{
-			if ((i==uindex)||(KEYMATCH(array[i])))
+			if (array[i] == crsr)
 			{
-				value *crsr= array[i];
-				if ((i+1) < arraysz)
-				{
-					::memmove (array+i, array+i+1,
-							   (arraysz - (i+1)) * sizeof (value *));
-				}
-				delete crsr;
-				--arraysz;
-				array[arraysz] = NULL;
-				if (! arraysz)
-				{
-					::free (array);
-					array = NULL;
-					arrayalloc = 0;
-				}
-				if (i<ucount) --ucount;
-				rearrange = true;
-				i = arraysz;
+				rmposition (i);
+				return;
 			}
 		}
-		if (rearrange) relinktree ();
+		return;
 	}
+	
+	unsigned int i = keyposition (crsr);
+	
+	// The ends of a packed array can be taken off without moving
+	// anything.
+	if ((! arrayholes) && ((i == 0) || ((i+1) == arraysz)))
+	{
+		rmposition (i);
+		return;
+	}
+	
+	// Anywhere else, leave a hole rather than moving half the array.
+	// The holes are closed in one pass once they outnumber the
+	// children, or when the array is next walked by position.
+	array[i] = NULL;
+	--arraysz;
+	++arrayholes;
+	
+	hashremove (crsr);
+	delete crsr;
+	
+	if (! arraysz) droparray ();
+	else if ((! hash) || (arrayholes > arraysz)) packarray ();
 }
 
-
-void value::relinktree (void)
+// ========================================================================
+// METHOD ::keyposition
+// --------------------
+// Find the array position of a keyed child through the hint it keeps.
+// The hint counts from the start of the allocation, so removals at the
+// head leave it intact. If the array was reordered since, all hints
+// are renewed in one pass.
+// ========================================================================
+unsigned int value::keyposition (value *child)
 {
-	unsigned int i;
-	for (i=0; i<arraysz; ++i)
+	unsigned int end = arraysz + arrayholes;
+	unsigned int i = child->arraypos - arrayhead;
+	
+	if ((i < end) && (array[i] == child)) return i;
+	
+	for (i=ucount; i<end; ++i)
 	{
-		array[i]->lower = array[i]->higher = NULL;
+		if (array[i]) array[i]->arraypos = arrayhead + i;
 	}
 	
-	for (i=ucount+1; i<arraysz; ++i)
+	return child->arraypos - arrayhead;
+}
+
+// ========================================================================
+// METHOD ::closeholes
+// -------------------
+// Move the keyed children together over the holes left by rmval().
+// A const value can be read by several threads at once, so they take
+// turns on the spinlocks that also guard sval(). A value that is not
+// const is not supposed to be shared between threads, and no other
+// method leaves new holes.
+// ========================================================================
+void value::closeholes (void) const
+{
+	value *self = (value *) this;
+	volatile int *lck = __value_sval_locks + SVALSLOT(this);
+	
+	while (__sync_lock_test_and_set (lck, 1));
+	
+	if (arrayholes)
 	{
-		value *nobj = array[i];
-		value *crsr = array[ucount];
+		unsigned int end = arraysz + arrayholes;
+		unsigned int j = ucount;
 		
-		while (crsr)
+		for (unsigned int i=ucount; i<end; ++i)
 		{
-			if (nobj->key < crsr->key)
-			{
-				if (crsr->lower)
-					crsr = crsr->lower;
-				else
-				{
-					crsr->lower = nobj;
-					crsr = NULL;
-					break;
-				}
-			}
-			else
-			{
-				if (crsr->higher)
-					crsr = crsr->higher;
-				else
-				{
-					crsr->higher = nobj;
-					crsr = NULL;
-					break;
-				}
-			}
+			if (! array[i]) continue;
+			array[i]->arraypos = arrayhead + j;
+			array[j++] = array[i];
+		}
+		while (j < end) array[j++] = NULL;
+		
+		__sync_synchronize ();
+		self->arrayholes = 0;
+	}
+	
+	__sync_lock_release (lck);
+}
+
+// ========================================================================
+// METHOD ::rmposition
+// -------------------
+// Delete the node at an array position. The elements on the shorter
+// side of the gap are moved to close it, so removing near the head or
+// tail of the array costs the same regardless of its size. Removing
+// from the middle still moves up to half of the array.
+// ========================================================================
+void value::rmposition (unsigned int i)
+{
+	value *crsr = array[i];
+	bool keyed = (i >= ucount);
+	
+	if (! keyed) --ucount;
+	
+	if (i < (arraysz >> 1))
+	{
+		if (i) ::memmove (array+1, array, i * sizeof (value *));
+		array[0] = NULL;
+		++array;
+		++arrayhead;
+		--arrayalloc;
+		--arraysz;
+	}
+	else
+	{
+		if ((i+1) < arraysz)
+		{
+			::memmove (array+i, array+i+1,
+					   (arraysz - (i+1)) * sizeof (value *));
 		}
+		--arraysz;
+		array[arraysz] = NULL;
 	}
+	
+	if (keyed) hashremove (crsr);
+	delete crsr;
+	
+	if (! arraysz) droparray ();
 }
 
 void value::rmval (unsigned int ki)
@@ -1402,8 +1600,9 @@ value &value::last (void)
 // ========================================================================
 const value	&value::operator[] (int i) const
 {
+	packarray ();
 	if ((i<0) && ((arraysz+i) >=0)) return *(array[arraysz+i]);
-	value *v = getposition (i);
+	const value *v = getposition (i);
 	if (!v) return emptyvalue;
 	return *v;
 }
@@ -1411,6 +1610,8 @@ value &value::operator[] (int i)
 {
 	static value emptyvalue;
 
+	unshare ();
+	packarray ();
 	if (_type == t_unset)
 		_type = t_array;
 
@@ -1462,6 +1663,8 @@ value* value::$val (const value &v)
 // ========================================================================
 value &value::newval (dtenum typ)
 {
+	unshare ();
+	packarray ();
 	if (arraysz)
 	{
 		++arraysz;
@@ -1486,11 +1689,33 @@ value &value::newval (dtenum typ)
 	return *(array[ucount-1]);
 }
 
+// ========================================================================
+// METHOD ::emplace
+// ----------------
+// Moves a value into a new child node, so that trees built out of
+// temporaries do not get copied node by node.
+// ========================================================================
+value &value::emplace (value &&v)
+{
+	value &res = newval ();
+	res = std::move (v);
+	return res;
+}
+
+value &value::emplace (const statstring &k, value &&v)
+{
+	value &res = (*this)[k];
+	res = std::move (v);
+	return res;
+}
+
 // ========================================================================
 // METHOD ::insertval
 // ========================================================================
 value &value::insertval (unsigned int atpos, dtenum typ)
 {
+	unshare ();
+	packarray ();
 	if (ucount > atpos)
 	{
 		++arraysz;
@@ -1510,14 +1735,17 @@ value &value::insertval (unsigned int atpos, dtenum typ)
 // --------------------
 // Get a numbered sub value out of the array.
 // ========================================================================
-value *value::getposition (unsigned int idx) const
+const value *value::getposition (unsigned int idx) const
 {
+	packarray ();
 	if (idx >= arraysz) return NULL;
 	return array[idx];
 }
 
 value *value::getposition (unsigned int idx)
 {
+	unshare ();
+	packarray ();
 	if (idx >= arraysz)
 	{
 		alloc (idx+1);
@@ -1525,11 +1753,11 @@ value *value::getposition (unsigned int idx)
 		{
 			ucount = idx+1;
 		}
-		for (;arraysz<idx;++arraysz)
+		while (arraysz <= idx)
 		{
-			array[arraysz] = new value;
+			array[arraysz++] = new value;
+			if (arraysz > ucount) hashinsert (array[arraysz-1]);
 		}
-		array[arraysz++] = new value;
 	}
 	if (array[idx] == NULL)
 		array[idx] = new value;
@@ -1571,6 +1799,7 @@ const char *_VALUE_INDENT_TABS="\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
 // ========================================================================
 value *value::filter (const statstring &label, const string &what) const
 {
+	packarray ();
 	returnclass (value) res retain;
 	
 	for (unsigned int i=0; i<arraysz; ++i)
@@ -1595,21 +1824,7 @@ value *value::filter (const statstring &label, const string &what) const
 // ========================================================================
 void value::clear (void)
 {
-	if (arraysz)
-	{
-		for (unsigned int i=0; i<arraysz; ++i)
-		{
-			delete array[i];
-		}
-	}
-	if (array)
-	{
-		::free (array);
-		array = NULL;
-	}
-	arraysz = 0;
-	arrayalloc = 0;
-	ucount = 0;
+	droparray ();
 	_type = t_unset;
 	_itype = i_unset;
 	s.crop (0);
@@ -1622,21 +1837,7 @@ void value::clear (void)
 
 void value::cleararray (void)
 {
-	if (arraysz)
-	{
-		for (unsigned int i=0; i<arraysz; ++i)
-		{
-			delete array[i];
-		}
-	}
-	if (array)
-	{
-		::free (array);
-		array = NULL;
-	}
-	arraysz = 0;
-	arrayalloc = 0;
-	ucount = 0;
+	droparray ();
 }
 
 // ========================================================================
@@ -1652,16 +1853,36 @@ void value::alloc (unsigned int count)
 		else wanted = wanted + 16384;
 	}
 	
+	if ((wanted > arrayalloc) && arrayhead)
+	{
+		// Reclaim the slots left at the front by earlier removals.
+		// Callers may have counted the new child in arraysz already,
+		// only the slots that were allocated hold anything.
+		unsigned int live = arraysz + arrayholes;
+		if (live > arrayalloc) live = arrayalloc;
+		value **base = array - arrayhead;
+		::memmove (base, array, live * sizeof (value *));
+		array = base;
+		arrayalloc += arrayhead;
+		arrayhead = 0;
+		for (unsigned int i=live; i<arrayalloc; ++i) array[i] = NULL;
+	}
+	
 	if (wanted > arrayalloc)
 	{
-		if (arrayalloc)
+		valuearray *hdr;
+		size_t sz = sizeof (valuearray) + (wanted * sizeof (value *));
+		
+		if (array)
 		{
-			array = (value **) realloc (array, wanted * sizeof (value *));
+			hdr = (valuearray *) realloc (arrayheader(), sz);
 		}
 		else
 		{
-			array = (value **) malloc (wanted * sizeof (value *));
+			hdr = (valuearray *) malloc (sz);
+			hdr->refcount = 1;
 		}
+		array = (value **) (hdr + 1);
 		while (arrayalloc < wanted) array[arrayalloc++] = NULL;
 	}
 }
@@ -1671,6 +1892,7 @@ void value::alloc (unsigned int count)
 // ========================================================================
 value *value::cutleft (int pcnt)
 {
+	packarray ();
 	returnclass (value) res retain;
 
 	if (! pcnt) return &res;
@@ -1705,6 +1927,7 @@ value *value::cutleft (int pcnt)
 // ========================================================================
 value *value::copyleft (int pcnt) const
 {
+	packarray ();
 	returnclass (value) res retain;
 
 	if (! pcnt) return &res;
@@ -1738,6 +1961,7 @@ value *value::copyleft (int pcnt) const
 // ========================================================================
 value *value::cutright (int pcnt)
 {
+	packarray ();
 	returnclass (value) res retain;
 	if (! pcnt) return &res;
 	if (! arraysz) return &res;
@@ -1771,6 +1995,7 @@ value *value::cutright (int pcnt)
 // ========================================================================
 value *value::copyright (int pcnt) const
 {
+	packarray ();
 	returnclass (value) res retain;
 
 	if (! pcnt) return &res;
@@ -1804,6 +2029,7 @@ value *value::copyright (int pcnt) const
 // ========================================================================
 value *value::splice (int _pos, int _count) const
 {
+	packarray ();
 	if (_pos < 0) _pos += arraysz;
 	if (_pos < 0) _pos = arraysz;
 	
@@ -1895,7 +2121,10 @@ string *value::join (const string &sep, const string &l, const string &r)
 	returnclass (string) res retain;
 	if (l) res = l;
 	bool first = true;
-	foreach (node, (*this))
+	
+	// Only reading, a shared array can stay shared.
+	const value &self = *this;
+	foreach (node, self)
 	{
 		if (! first) res.strcat (sep);
 		first = false;
@@ -1910,6 +2139,7 @@ string *value::join (const string &sep, const string &l, const string &r)
 // ========================================================================
 bool value::treecmp (const value &other) const
 {
+	packarray ();
 	if (array)
 	{
 		if (arraysz != other.arraysz) return false;
@@ -2034,16 +2264,19 @@ void value::init (bool first)
 {
 	if (first)
 	{
-		threadref = getref();
 		_type = t_unset;
 		_itype = i_unset;
 		
 		t.lval = 0;
 		key = 0;
-		lower = higher = NULL;
+		hash = NULL;
+		hashbits = 0;
 		array = NULL;
+		arrayhead = 0;
 		arraysz = 0;
 		arrayalloc = 0;
+		arrayholes = 0;
+		arraypos = 0;
 		ucount = 0;
 		attrib = NULL;
 	}
@@ -2069,7 +2302,7 @@ bool value::isempty (void) const
 // ========================================================================
 const value &value::operator[] (const char *str) const
 {
-	value *v;
+	const value *v;
 
 	v = findchild (str);
 	if (!v) return emptyvalue;
@@ -2085,7 +2318,7 @@ value &value::operator[] (const char *str)
 
 const value &value::operator[] (const string &str) const
 {
-	value *v;
+	const value *v;
 
 	v = findchild (str.str());
 	if (!v) return emptyvalue;
@@ -2103,7 +2336,7 @@ value &value::operator[] (const string &str)
 
 const value &value::operator[] (const statstring &str) const
 {
-	value *v;
+	const value *v;
 	
 	v = findchild ((unsigned int) str.key(), (const char *) str.str());
 	if (! v) return emptyvalue;
@@ -2138,7 +2371,7 @@ value &value::operator[] (const value &va)
 
 const value &value::operator[] (const value &va) const
 {
-	value *v;
+	const value *v;
 	if (va.type() == t_int)
 	{
 		v = getposition (va.uval());
@@ -47,16 +47,7 @@ void value::load (const string &fname)
 
 void value::load (file &f)
 {
-	if (arraysz)
-	{
-		for (unsigned int i=0; i<arraysz; ++i)
-		{
-			delete array[i];
-		}
-		::free (array);
-		array = NULL;
-		arraysz = 0;
-	}
+	cleararray ();
 	
 	stack<class value> treestack;
 	value *crsr = this;
@@ -327,6 +318,8 @@ void value::save (const string &fname, bool compact) const
 
 void value::save (file &f, bool compact) const
 {
+	packarray ();
+	
 	for (unsigned int x=0; x<arraysz; ++x)
 	{
 		array[x]->print (0, f, compact);
@@ -339,6 +332,8 @@ void value::save (file &f, bool compact) const
 // ========================================================================
 string *value::encode (bool compact) const
 {
+	packarray ();
+	
 	returnclass (string) res retain;
 	
 	for (unsigned int x=0; x<arraysz; ++x)
@@ -357,6 +352,8 @@ string *value::encode (bool compact) const
 // ========================================================================
 void value::print (int indent, file &out, bool compact) const
 {
+	packarray ();
+	
 	string outstr;
 	string nm;
 	
@@ -454,6 +451,8 @@ void value::print (int indent, file &out, bool compact) const
 // ========================================================================
 void value::printstr (int indent, string &out, bool compact) const
 {
+	packarray ();
+	
 	string outstr;
 	string nm;
 	
@@ -24,11 +24,14 @@
 // Converts a value object to a string containing data in a quoted
 // comma-separated value (CSV) format.
 // ========================================================================
-string *value::tocsv (bool withHeaders, const char *indexName)
+string *value::tocsv (bool withHeaders, const char *indexName) const
 {
+	packarray ();
+	
 	returnclass (string) out retain;
 
-	value *child;
+	// The rows may be shared with other copies, only read them.
+	const value *child;
 	int columnCount;
 	int i;
 	unsigned int row;
@@ -118,10 +121,12 @@ string *value::tocsv (bool withHeaders, const char *indexName)
 // comma-separated value (CSV) format.
 // ========================================================================
 bool value::savecsv (const string &fileName, bool withHeaders,
-					 const char *indexName)
+					 const char *indexName) const
 {
+	packarray ();
+	
 	file csvFile;
-	value *child;
+	const value *child;
 	int columnCount;
 	int i;
 	unsigned int row;
@@ -459,6 +459,8 @@ size_t value::compressbuiltin (size_t offs, string &into,
 size_t value::printcompressed (size_t _offs, string &into, const value &parent,
 							   xmlschema &schema) const
 {
+	packarray ();
+	
 	size_t crsr = _offs;
 	size_t offs = _offs;
 	statstring opcodelabel;
@@ -14,8 +14,10 @@
 // ========================================================================
 // METHOD ::encodegrace
 // ========================================================================
-void value::encodegrace (string &into, int indent)
+void value::encodegrace (string &into, int indent) const
 {
+	packarray ();
+	
 	string dent;
 	if (! count())
 	{
@@ -123,7 +125,7 @@ void value::encodegrace (string &into, int indent)
 // ========================================================================
 // METHOD ::tograce
 // ========================================================================
-string *value::tograce (void)
+string *value::tograce (void) const
 {
 	returnclass (string) res retain;
 	encodegrace (res, 0);
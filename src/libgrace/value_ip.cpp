@@ -30,6 +30,8 @@
 // ========================================================================
 ipaddress value::ipval (void) const
 {
+	packarray ();
+	
 	if (arraysz) return array[0]->ipval ();
 
 	
@@ -352,6 +352,8 @@ void value::encodejsonid (string &into) const
 // ==========================================================================
 void value::encodejson (string &into) const
 {
+	packarray ();
+	
 	if (! count())
 	{
 		if (_itype == i_int)
@@ -302,6 +302,8 @@ string *value::phpserialize (bool withattr) const
 // ========================================================================
 void value::printphp (string &into, bool withattr) const
 {
+	packarray ();
+	
 	unsigned int marraysz;
 	marraysz = arraysz + ((attrib&&withattr) ? attrib->count() : 0);
 	if (withattr && (! arraysz)) marraysz++;
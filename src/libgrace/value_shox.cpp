@@ -289,6 +289,8 @@ string *value::toshox (void) const
 // ========================================================================
 void value::printshox (string &outstr, stringdict &sdict) const
 {
+	packarray ();
+	
 	ipaddress tmpip;
 	string tmpstr;
 	
@@ -330,6 +332,7 @@ void value::printshox (string &outstr, stringdict &sdict) const
 	if ((xtype & SHOX_HAS_ATTRIB) && attrib)
 	{
 		outstr.binputvint (outstr.strlen(), attrib->count());
+		attrib->packarray ();
 		
 		for (int i=0; i<attrib->count(); ++i)
 		{
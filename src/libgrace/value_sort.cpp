@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 // ========================================================================
 // FUNCTION labelSort (left, right, opt)
@@ -152,11 +153,9 @@ int romanNumeralFromString (const string &str, int offs = 0)
 // ========================================================================
 bool naturalSort (value *l, value *r, const string &opt)
 {
-	value left,right;
 	string leftString, rightString;
 	int leftInt, rightInt;
 	int lpos, rpos;
-	int res;
 	bool withRecord = opt.strlen();
 	
 	char leftChar, rightChar;
@@ -354,11 +353,9 @@ bool naturalSort (value *l, value *r, const string &opt)
 // ========================================================================
 bool naturalLabelSort (value *l, value *r, const string &opt)
 {
-	value left,right;
 	string leftString, rightString;
 	int leftInt, rightInt;
 	int lpos, rpos;
-	int res;
 	bool withRecord = opt.strlen();
 	
 	char leftChar, rightChar;
@@ -506,72 +503,315 @@ bool naturalLabelSort (value *l, value *r, const string &opt)
 	return (lpos<leftLength);
 }
 
+
 // ========================================================================
-// METHOD value::sort (compare, opt)
-// ---------------------------------
-// Uses the function 'compare' with optional string argument 'opt' to
-// sort the array.
+// FUNCTION recordSortKey (node, opt, key)
+// ---------------------------------------
+// Key extractor to go with valueSort. Picks the child value that
+// recordSort would compare: the one with the key in the opt string, or
+// the first child if it is empty.
 // ========================================================================
-void value::sort (sortmethod cmpare, const string &opt)
+void recordSortKey (value *node, const string &opt, value &key)
 {
-	value **narray = NULL;
-	unsigned int crsr, min, max;
+	if (opt.strlen()) key = (*node)[opt];
+	else key = (*node)[0];
+}
 
-	if (ucount && (arraysz != ucount)) return;
-	if (arraysz < 2) return;
+// ========================================================================
+// FUNCTION naturalSortKey (node, opt, key)
+// ----------------------------------------
+// Key extractor to go with naturalSort. Resolves the string that
+// naturalSort would compare once, so the comparisons do not have to
+// look up the child node and convert it to a string every time.
+// ========================================================================
+void naturalSortKey (value *node, const string &opt, value &key)
+{
+	if (opt.strlen()) key = (*node)[opt].sval();
+	else key = node->sval();
+}
+
+// Runs shorter than this are sorted by straight insertion before
+// being merged.
+#define SORT_RUN 8
+
+// Arrays need at least this many members per thread before a
+// parallel sort will actually spawn threads.
+#define SORT_PARALLELMIN 4096
+
+// ========================================================================
+// STRUCT sortslot
+// ---------------
+// A node to be sorted, with the value to hand to the comparison
+// function. That is the node itself, unless its key was extracted.
+// ========================================================================
+struct sortslot
+{
+	value	*cmp;
+	value	*node;
+};
+
+// ========================================================================
+// STRUCT sortjob
+// --------------
+// A range of slots for one sorting thread.
+// ========================================================================
+struct sortjob
+{
+	sortslot		*slots;
+	sortslot		*tmp;
+	value			*keys;
+	unsigned int	 count;
+	sortmethod		 cmpare;
+	sortkeymethod	 getkey;
+	const string	*opt;
+	pthread_t		 tid;
+	bool			 threaded;
+};
+
+// ========================================================================
+// FUNCTION sortmerge
+// ------------------
+// Merges the sorted runs left and right into dst. Members of the right
+// run that compare equal to a member of the left run go first, which
+// keeps equal members in the reverse of their original order. That is
+// the order the old insertion sort produced, and some callers depend
+// on it.
+// ========================================================================
+static void sortmerge (sortslot *dst, sortslot *left, unsigned int nleft,
+					   sortslot *right, unsigned int nright,
+					   sortmethod cmpare, const string &opt)
+{
+	unsigned int l = 0, r = 0;
 	
-	narray = (value **) malloc (arrayalloc * sizeof(value *));
-	narray[0] = array[0];
+	while ((l < nleft) && (r < nright))
+	{
+		if (cmpare (right[r].cmp, left[l].cmp, opt)) *dst++ = left[l++];
+		else *dst++ = right[r++];
+	}
 	
-	for (unsigned int x=1; x<arraysz; ++x)
+	if (l < nleft) memcpy (dst, left+l, (nleft-l) * sizeof (sortslot));
+	if (r < nright) memcpy (dst, right+r, (nright-r) * sizeof (sortslot));
+}
+
+// ========================================================================
+// FUNCTION sortrange
+// ------------------
+// Sorts count slots, using tmp as scratch space of the same size. Runs
+// of SORT_RUN slots are sorted by insertion, then merged bottom-up.
+// The result ends up in slots.
+// ========================================================================
+static void sortrange (sortslot *slots, sortslot *tmp, unsigned int count,
+					   sortmethod cmpare, const string &opt)
+{
+	for (unsigned int run=0; run<count; run+=SORT_RUN)
 	{
-		max = x;
-		min = 0;
-		value *insertme = array[x];
-		crsr = x >> 1;
+		unsigned int end = run + SORT_RUN;
+		if (end > count) end = count;
 		
-		while (true)
+		for (unsigned int x=run+1; x<end; ++x)
 		{
-			if (cmpare (insertme, narray[crsr], opt))
+			sortslot insertme = slots[x];
+			unsigned int crsr = x;
+			
+			// A new member goes in front of the ones it is
+			// not greater than, including equal ones.
+			while ((crsr > run) &&
+				   (! cmpare (insertme.cmp, slots[crsr-1].cmp, opt)))
 			{
-				min = crsr;
-				if ((max-min) < 2)
-				{
-					if (max != x)
-					{
-						memmove (narray+max+1, narray+max, (x-max)*sizeof(value*));
-					}
-					narray[max] = insertme;
-					break;
-				}
-				crsr += ((max-min) >> 1);
+				slots[crsr] = slots[crsr-1];
+				--crsr;
 			}
-			else
+			slots[crsr] = insertme;
+		}
+	}
+	
+	sortslot *src = slots;
+	sortslot *dst = tmp;
+	
+	for (unsigned int width=SORT_RUN; width<count; width*=2)
+	{
+		for (unsigned int left=0; left<count; left+=2*width)
+		{
+			unsigned int right = left + width;
+			unsigned int end = right + width;
+			
+			if (right >= count)
 			{
-				max = crsr;
-				if ((max-min) <1 )
-				{
-					if (min != x)
-					{
-						memmove (narray+min+1, narray+min, (x-min)*sizeof(value*));
-					}
-					narray[min] = insertme;
-					break;
-				}
-				crsr -= ((1+max-min) >> 1);
+				memcpy (dst+left, src+left, (count-left) * sizeof (sortslot));
+				break;
 			}
+			if (end > count) end = count;
+			
+			sortmerge (dst+left, src+left, right-left, src+right,
+					   end-right, cmpare, opt);
 		}
+		
+		sortslot *swp = src;
+		src = dst;
+		dst = swp;
 	}
 	
-	::free (array);
-	array = narray;
-	relinktree ();
+	if (src != slots) memcpy (slots, src, count * sizeof (sortslot));
+}
+
+// ========================================================================
+// FUNCTION sortjobrun
+// -------------------
+// Extracts the keys for a range, if needed, and sorts it. Used directly
+// and as the entry point of sorting threads.
+// ========================================================================
+static void *sortjobrun (void *param)
+{
+	sortjob *job = (sortjob *) param;
+	string noopt;
+	
+	if (job->getkey)
+	{
+		for (unsigned int i=0; i<job->count; ++i)
+		{
+			job->getkey (job->slots[i].node, *(job->opt), job->keys[i]);
+			job->slots[i].cmp = job->keys + i;
+		}
+	}
+	
+	// Keys are compared without the option string, it was
+	// already used for extracting them.
+	sortrange (job->slots, job->tmp, job->count, job->cmpare,
+			   job->getkey ? noopt : *(job->opt));
+	return NULL;
+}
+
+// ========================================================================
+// METHOD value::dosort
+// --------------------
+// Implementation of the sort methods. The array is cut into one range
+// per thread, which are sorted, then merged. With a single thread this
+// is just a merge sort.
+// ========================================================================
+void value::dosort (sortkeymethod getkey, sortmethod cmpare,
+					const string &opt, int nthreads)
+{
+	if (ucount && (arraysz != ucount)) return;
+	if (arraysz < 2) return;
+	unshare ();
+	packarray ();
+	
+	unsigned int count = arraysz;
+	if (nthreads < 1) nthreads = 1;
+	if ((unsigned int) nthreads > (count / SORT_PARALLELMIN))
+	{
+		nthreads = count / SORT_PARALLELMIN;
+		if (nthreads < 1) nthreads = 1;
+	}
+	
+	sortslot *slots = (sortslot *) malloc (2 * count * sizeof (sortslot));
+	sortslot *tmp = slots + count;
+	sortjob *jobs = new sortjob[nthreads];
+	unsigned int *bounds = new unsigned int[nthreads+1];
+	value *keys = getkey ? new value[count] : NULL;
+	
+	for (unsigned int i=0; i<count; ++i)
+	{
+		slots[i].cmp = slots[i].node = array[i];
+	}
+	
+	for (int i=0; i<=nthreads; ++i)
+	{
+		bounds[i] = (unsigned int) (((unsigned long long) count * i) / nthreads);
+	}
+	
+	if (nthreads > 1) __THREADED = true;
+	
+	for (int i=0; i<nthreads; ++i)
+	{
+		sortjob &job = jobs[i];
+		job.slots = slots + bounds[i];
+		job.tmp = tmp + bounds[i];
+		job.keys = keys ? keys + bounds[i] : NULL;
+		job.count = bounds[i+1] - bounds[i];
+		job.cmpare = cmpare;
+		job.getkey = getkey;
+		job.opt = &opt;
+		
+		// The last range is sorted by the calling thread. So is
+		// any range we could not get a thread for.
+		job.threaded = (i < (nthreads-1)) &&
+					   (! pthread_create (&job.tid, NULL, sortjobrun, &job));
+		
+		if (! job.threaded) sortjobrun (&job);
+	}
+	
+	for (int i=0; i<nthreads; ++i)
+	{
+		if (jobs[i].threaded) pthread_join (jobs[i].tid, NULL);
+	}
+	
+	// Merge neighbouring ranges until one is left.
+	string noopt;
+	const string &cmpopt = getkey ? noopt : opt;
+	sortslot *src = slots;
+	sortslot *dst = tmp;
+	int nranges = nthreads;
+	
+	while (nranges > 1)
+	{
+		int out = 0;
+		for (int i=0; i<nranges; i+=2)
+		{
+			if ((i+1) == nranges)
+			{
+				memcpy (dst+bounds[i], src+bounds[i],
+						(bounds[i+1]-bounds[i]) * sizeof (sortslot));
+				bounds[out++] = bounds[i];
+				continue;
+			}
+			
+			sortmerge (dst+bounds[i], src+bounds[i], bounds[i+1]-bounds[i],
+					   src+bounds[i+1], bounds[i+2]-bounds[i+1],
+					   cmpare, cmpopt);
+			bounds[out++] = bounds[i];
+		}
+		bounds[out] = count;
+		nranges = out;
+		
+		sortslot *swp = src;
+		src = dst;
+		dst = swp;
+	}
+	
+	for (unsigned int i=0; i<count; ++i) array[i] = src[i].node;
+	
+	if (keys) delete[] keys;
+	delete[] bounds;
+	delete[] jobs;
+	::free (slots);
+}
+
+// ========================================================================
+// METHOD value::sort
+// ------------------
+// Uses the function 'compare' with optional string argument 'opt' to
+// sort the array.
+// ========================================================================
+void value::sort (sortmethod cmpare, const string &opt)
+{
+	dosort (NULL, cmpare, opt, 1);
 }
 
 void value::sort (sortmethod compare)
 {
 	string opt;
 	
-	sort (compare, opt);
+	dosort (NULL, compare, opt, 1);
+}
+
+void value::sort (sortmethod cmpare, const string &opt, int nthreads)
+{
+	dosort (NULL, cmpare, opt, nthreads);
 }
 
+void value::sort (sortkeymethod getkey, sortmethod cmpare,
+				  const string &opt, int nthreads)
+{
+	dosort (getkey, cmpare, opt, nthreads);
+}
@@ -8,269 +8,203 @@
 #include <grace/str.h>
 #include <grace/value.h>
 #include <grace/strutil.h>
+#include <pthread.h>
+#include <stdint.h>
 
 const char __HEXTAB[] = "0123456789abcdef";
 
-string *operator% (const char *args, const value &arglist)
+// Number of compiled formats each thread keeps around.
+#define FORMAT_CACHESZ 64
+
+// ========================================================================
+// A format string is compiled into a list of operations, one for every
+// run of literal text and one for every conversion. The compiled form
+// is cached per thread, keyed by the address of the format string.
+// ========================================================================
+struct formatop
 {
-	returnclass (string) res retain;
+	char			 conv; ///< Conversion character, 0 for literal text.
+	bool			 useskey; ///< Take the argument from a %[key].
+	bool			 plain; ///< Integer conversion without flags.
+	int				 argpos; ///< Argument to continue with, or -1.
+	unsigned int	 start; ///< Offset of literal text.
+	unsigned int	 len; ///< Length of literal text.
+	int				 width; ///< Padding for %s.
+	char			 spec[24]; ///< Format for sprintf().
+	statstring		 key; ///< Argument key for %[key].
+};
+
+struct formatprogram
+{
+					 formatprogram (void)
+					 {
+					 	fmt = text = NULL;
+					 	ops = NULL;
+					 	len = count = litlen = 0;
+					 }
+					~formatprogram (void)
+					 {
+					 	if (ops) delete[] ops;
+					 	if (text) ::free (text);
+					 }
 	
-	char *fmt = (char *) args;
-	char copy[20];
-	char sprintf_out[256];
+	const char		*fmt; ///< Address of the original format.
+	char			*text; ///< Copy of the format text.
+	unsigned int	 len; ///< Length of the format text.
+	formatop		*ops; ///< Compiled operations.
+	unsigned int	 count; ///< Number of operations.
+	unsigned int	 litlen; ///< Combined size of the literal text.
+	
+	formatop		&newop (void)
+					 {
+					 	formatop &op = ops[count++];
+					 	op.conv = 0;
+					 	op.useskey = false;
+					 	op.plain = false;
+					 	op.argpos = -1;
+					 	op.start = op.len = 0;
+					 	op.width = 0;
+					 	op.spec[0] = 0;
+					 	return op;
+					 }
+	
+	void			 literal (unsigned int start, unsigned int sz)
+					 {
+					 	litlen += sz;
+					 	if (count && (! ops[count-1].conv) &&
+					 		(ops[count-1].argpos < 0) &&
+					 		((ops[count-1].start + ops[count-1].len) == start))
+					 	{
+					 		ops[count-1].len += sz;
+					 		return;
+					 	}
+					 	formatop &op = newop ();
+					 	op.start = start;
+					 	op.len = sz;
+					 }
+};
+
+struct formatcache
+{
+	formatprogram	*slot[FORMAT_CACHESZ];
+};
+
+static __thread formatcache *__format_cache = NULL;
+static pthread_key_t __format_cachekey;
+static pthread_once_t __format_cacheonce = PTHREAD_ONCE_INIT;
+
+// ========================================================================
+// FUNCTION __format_threadexit
+// ========================================================================
+static void __format_threadexit (void *p)
+{
+	formatcache *c = (formatcache *) p;
+	for (int i=0; i<FORMAT_CACHESZ; ++i)
+	{
+		if (c->slot[i]) delete c->slot[i];
+	}
+	if (__format_cache == c) __format_cache = NULL;
+	::free (c);
+}
+
+static void __format_mkkey (void)
+{
+	pthread_key_create (&__format_cachekey, __format_threadexit);
+}
+
+// ========================================================================
+// FUNCTION compileformat
+// ----------------------
+// Parses a format string into a formatprogram. The parsing rules are
+// the same as they have always been, including the odd corners.
+// ========================================================================
+static formatprogram *compileformat (const char *args)
+{
+	formatprogram *p = new formatprogram;
+	const char *fmt = args;
+	char copy[24];
 	char *copy_p;
-	int argptr = 0;
-	string copy_s;
-	int sz, asz;
-	int szoffset = 1;
-	statstring key;
-	bool useskey;
-	ipaddress ip;
+	unsigned int nspec = 0;
+	
+	p->fmt = args;
+	p->len = ::strlen (args);
+	p->text = (char *) malloc (p->len + 1);
+	memcpy (p->text, args, p->len + 1);
 	
-	#define KEYORARG (useskey ? arglist[0][key] : arglist[argptr++])
+	for (unsigned int i=0; i<p->len; ++i) if (args[i] == '%') ++nspec;
+	p->ops = new formatop[(2*nspec) + 1];
 	
 	while (*fmt)
 	{
 		if (*fmt != '%')
 		{
-			res.strcat (char (*fmt++));
+			const char *start = fmt;
+			while (*fmt && (*fmt != '%')) ++fmt;
+			p->literal (start - args, fmt - start);
 			continue;
 		}
 		
 		++fmt;
 		copy[0] = '%';
-		useskey = false;
+		formatop &op = p->newop ();
 		
 		for (copy_p = copy+1; copy_p < copy+19;)
 		{
-			switch ((*copy_p++ = *fmt++))
+			char c = (*copy_p++ = *fmt++);
+			switch (c)
 			{
 				case 0:
 					fmt--; goto CONTINUE;
 					
 				case '%':
-					res.strcat ('%'); goto CONTINUE;
-				
-				case 'c':
-					res.strcat ((char) KEYORARG.ival());
-					goto CONTINUE;
-					
-				case '$':
-					printcurrency (res, KEYORARG.getcurrency());
+					op.start = (fmt-1) - args;
+					op.len = 1;
+					p->litlen++;
 					goto CONTINUE;
-					
-				case 'L':
-					--copy_p;
-					*(copy_p++) = 'l';
-					*(copy_p++) = 'l';
-					*(copy_p++) = 'i';
-					*copy_p = 0;
-					
-					sprintf (sprintf_out, copy, KEYORARG.lval());
-					copy_p = sprintf_out;
-					goto DUP;
 				
+				case 'L':
 				case 'X':
-					--copy_p;
-					*(copy_p++) = 'l';
-					*(copy_p++) = 'l';
-					*(copy_p++) = 'x';
-					*copy_p = 0;
-					
-					sprintf (sprintf_out, copy, KEYORARG.ulval());
-					copy_p = sprintf_out;
-					goto DUP;
-					
 				case 'U':
 					--copy_p;
 					*(copy_p++) = 'l';
 					*(copy_p++) = 'l';
-					*(copy_p++) = 'u';
+					*(copy_p++) = (c == 'L') ? 'i' : (c == 'X') ? 'x' : 'u';
 					*copy_p = 0;
-					sprintf (sprintf_out, copy, KEYORARG.lval());
-					copy_p = sprintf_out;
-					goto DUP;
+					strcpy (op.spec, copy);
+					op.conv = c;
+					goto CONTINUE;
 				
 				case 'd':
 				case 'i':
 				case 'o':
 				case 'u':
 				case 'x':
-					*copy_p = 0;
-					sprintf (sprintf_out, copy, KEYORARG.ival());
-					copy_p = sprintf_out;
-					goto DUP;
-				
 				case 'e':
 				case 'E':
 				case 'f':
 				case 'g':
 					*copy_p = 0;
-					sprintf (sprintf_out, copy, KEYORARG.dval());
-					copy_p = sprintf_out;
-					goto DUP;
+					strcpy (op.spec, copy);
+					op.conv = c;
+					op.plain = ((copy_p - copy) == 2);
+					goto CONTINUE;
 				
+				case 'c':
+				case '$':
 				case 'S':
-					copy_p = (char *) KEYORARG.cval();
-					while (*copy_p)
-					{
-						char c = *copy_p;
-						if ((c=='%')||(c=='\\')||(c=='\'')||(c=='\"'))
-						{
-							res.strcat ('\\');
-							res.strcat (*copy_p++);
-						}
-						else if (*copy_p < 32)
-						{
-							res.strcat ('%');
-							res.strcat (__HEXTAB [(*copy_p >> 4) & 15]);
-							res.strcat (__HEXTAB [(*copy_p++) & 15]);
-						}
-						else res.strcat (*copy_p++);
-					}
-					goto CONTINUE;
-					
-				// mysql escape
 				case 'M':
-					{
-						const string &kstr = KEYORARG.sval();
-						char quot;
-						
-						if (kstr.strchr ('\'') >= 0)
-						{
-							quot = '\"';
-						}
-						else
-						{
-							quot = '\'';
-						}
-						
-						res.strcat (quot);
-						
-						for (int ii=0; ii<kstr.strlen(); ++ii)
-						{
-							char c = kstr[ii];
-							switch (c)
-							{
-								case 0 :
-									res.strcat ("\\0");
-									break;
-								
-								case '\\' :
-									res.strcat ("\\\\");
-									break;
-								
-								case '\"' :
-									if (quot == '\"')
-									{
-										res.strcat ("\"\"");
-									}
-									else
-									{
-										res.strcat (c);
-									}
-									break;
-								
-								default:
-									res.strcat (c);
-									break;
-							}
-						}
-						
-						res.strcat (quot);
-					}
-					*copy_p = 0;
-					goto CONTINUE;
-					
-				// ansi sql escape
 				case 'Q':
-					{
-						const string &kstr = KEYORARG.sval();
-						char quot;
-						
-						if (kstr.strchr ('\'') >= 0)
-						{
-							quot = '\"';
-						}
-						else
-						{
-							quot = '\'';
-						}
-						
-						res.strcat (quot);
-						
-						for (int ii=0; ii<kstr.strlen(); ++ii)
-						{
-							char c = kstr[ii];
-							switch (c)
-							{
-								case '\"' :
-									if (quot == '\"')
-									{
-										res.strcat ("\"\"");
-									}
-									else
-									{
-										res.strcat (c);
-									}
-									break;
-								
-								default:
-									res.strcat (c);
-									break;
-							}
-						}
-						
-						res.strcat (quot);
-					}
-					*copy_p = 0;
-					goto CONTINUE;
-								
 				case 'Z':
-					copy_p = (char *) KEYORARG.cval();
-					while (*copy_p)
-					{
-						if ( (*copy_p == '&') )
-						{
-							res.strcat ("&amp;");
-							++copy_p;
-						}
-						else if ( (*copy_p == '<') )
-						{
-							res.strcat ("&lt;");
-							++copy_p;
-						}
-						else if ( (*copy_p == '>') )
-						{
-							res.strcat ("&gt;");
-							++copy_p;
-						}
-						else if (*copy_p < 32)
-						{
-							res.strcat ("&#");
-							::sprintf (sprintf_out,
-									   "%i", (int) *copy_p++);
-							res.strcat (sprintf_out);
-							res.strcat (';');
-						}
-						else res.strcat (*copy_p++);
-					}
-					goto CONTINUE;
-				
 				case '!':
-					copy_s = KEYORARG.toxml (value::compact);
-					res.strcat (copy_s);
-					goto CONTINUE;
-				
 				case 'J':
-					copy_s = KEYORARG.tojson ();
-					res.strcat (copy_s);
+				case '~':
+					op.conv = c;
 					goto CONTINUE;
 					
 				case '{':
 					if (*fmt)
 					{
-						argptr = ::atoi (fmt);
+						op.argpos = ::atoi (fmt);
 						fmt++;
 						if (*fmt) fmt++;
 						copy_p--;
@@ -278,43 +212,341 @@ string *operator% (const char *args, const value &arglist)
 					break;
 					
 				case '[':
-					copy_s.crop ();
-					while ((*fmt) && (*fmt != ']'))
 					{
-						copy_s.strcat (*fmt++);
+						const char *kstart = fmt;
+						while ((*fmt) && (*fmt != ']')) fmt++;
+						op.key.assign (string (kstart, fmt - kstart));
+						if (*fmt) fmt++;
+						op.useskey = true;
+						*copy_p = 0;
+						copy_p--;
 					}
-					if (*fmt) fmt++;
-					key = copy_s;
-					useskey=true;
-					*copy_p = 0;
-					copy_p--;
 					break;
 				
-				case '~':
-					copy_s = strutil::urlencode (KEYORARG.sval());
-					res.strcat (copy_s);
-					goto CONTINUE;
-				
 				case 'P':
 				case 's':
 					*copy_p = 0;
-					sz = atoi ((const char *)copy+1);
-					copy_s = KEYORARG.sval();
-					if (sz != 0)
-					{
-						copy_s.pad (sz, ' ');
-					}
-					res.strcat (copy_s);
-					goto CONTINUE;
-					
-DUP:
-					res.strcat ((char *) copy_p);
+					op.width = atoi ((const char *)copy+1);
+					op.conv = 's';
 					goto CONTINUE;
 			}
 		}
 CONTINUE:
 	;
 	}
+	
+	return p;
+}
+
+// ========================================================================
+// FUNCTION getformat
+// ------------------
+// Finds the compiled version of a format string in the thread's cache,
+// compiling it if needed. Format strings are usually literals, but the
+// text is checked anyway in case the memory got reused.
+// ========================================================================
+static formatprogram *getformat (const char *args)
+{
+	formatcache *c = __format_cache;
+	if (! c)
+	{
+		pthread_once (&__format_cacheonce, __format_mkkey);
+		c = (formatcache *) calloc (1, sizeof (formatcache));
+		pthread_setspecific (__format_cachekey, c);
+		__format_cache = c;
+	}
+	
+	uintptr_t h = (uintptr_t) args;
+	unsigned int idx = ((h >> 3) ^ (h >> 11)) & (FORMAT_CACHESZ-1);
+	formatprogram *p = c->slot[idx];
+	
+	if (p && (p->fmt == args) && (memcmp (p->text, args, p->len) == 0) &&
+		(args[p->len] == 0))
+	{
+		return p;
+	}
+	
+	if (p) delete p;
+	p = c->slot[idx] = compileformat (args);
+	return p;
+}
+
+// ========================================================================
+// FUNCTION printint
+// ----------------------
+// Appends a plain %i / %d without going through sprintf().
+// ========================================================================
+static void printint (string &res, int val)
+{
+	char buf[16];
+	char *p = buf + 16;
+	unsigned int v = (val < 0) ? -(unsigned int) val : val;
+	
+	do
+	{
+		*--p = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	
+	if (val < 0) *--p = '-';
+	res.strcat (p, (buf + 16) - p);
+}
+
+string *operator% (const char *args, const value &arglist)
+{
+	returnclass (string) res retain;
+	
+	formatprogram *prog = getformat (args);
+	char sprintf_out[256];
+	char *copy_p;
+	int argptr = 0;
+	string copy_s;
+	
+	res.reserve (prog->litlen + (8 * prog->count));
+	
+	for (unsigned int i=0; i<prog->count; ++i)
+	{
+		const formatop &op = prog->ops[i];
+		if (op.argpos >= 0) argptr = op.argpos;
+		
+		if (! op.conv)
+		{
+			if (op.len) res.strcat (prog->text + op.start, op.len);
+			continue;
+		}
+		
+		const value &arg = op.useskey ? arglist[0][op.key]
+									  : arglist[argptr++];
+		
+		switch (op.conv)
+		{
+			case 'c':
+				res.strcat ((char) arg.ival());
+				break;
+				
+			case '$':
+				printcurrency (res, arg.getcurrency());
+				break;
+				
+			case 'L':
+			case 'U':
+				sprintf (sprintf_out, op.spec, arg.lval());
+				res.strcat (sprintf_out);
+				break;
+			
+			case 'X':
+				sprintf (sprintf_out, op.spec, arg.ulval());
+				res.strcat (sprintf_out);
+				break;
+			
+			case 'd':
+			case 'i':
+				if (op.plain)
+				{
+					printint (res, arg.ival());
+					break;
+				}
+				// fall through
+			case 'o':
+			case 'u':
+			case 'x':
+				sprintf (sprintf_out, op.spec, arg.ival());
+				res.strcat (sprintf_out);
+				break;
+			
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'g':
+				sprintf (sprintf_out, op.spec, arg.dval());
+				res.strcat (sprintf_out);
+				break;
+			
+			case 'S':
+				copy_p = (char *) arg.cval();
+				while (*copy_p)
+				{
+					char c = *copy_p;
+					if ((c=='%')||(c=='\\')||(c=='\'')||(c=='\"'))
+					{
+						res.strcat ('\\');
+						res.strcat (*copy_p++);
+					}
+					else if (*copy_p < 32)
+					{
+						res.strcat ('%');
+						res.strcat (__HEXTAB [(*copy_p >> 4) & 15]);
+						res.strcat (__HEXTAB [(*copy_p++) & 15]);
+					}
+					else
+					{
+						// Copy the run of characters that need no
+						// escaping in one go.
+						const char *run = copy_p;
+						while (*copy_p && (*copy_p >= 32) &&
+							   (*copy_p != '%') && (*copy_p != '\\') &&
+							   (*copy_p != '\'') && (*copy_p != '\"'))
+						{
+							++copy_p;
+						}
+						res.strcat (run, copy_p - run);
+					}
+				}
+				break;
+				
+			// mysql escape
+			case 'M':
+				{
+					const string &kstr = arg.sval();
+					char quot;
+					
+					if (kstr.strchr ('\'') >= 0)
+					{
+						quot = '\"';
+					}
+					else
+					{
+						quot = '\'';
+					}
+					
+					res.strcat (quot);
+					
+					for (int ii=0; ii<kstr.strlen(); ++ii)
+					{
+						char c = kstr[ii];
+						switch (c)
+						{
+							case 0 :
+								res.strcat ("\\0");
+								break;
+							
+							case '\\' :
+								res.strcat ("\\\\");
+								break;
+							
+							case '\"' :
+								if (quot == '\"')
+								{
+									res.strcat ("\"\"");
+								}
+								else
+								{
+									res.strcat (c);
+								}
+								break;
+							
+							default:
+								res.strcat (c);
+								break;
+						}
+					}
+					
+					res.strcat (quot);
+				}
+				break;
+				
+			// ansi sql escape
+			case 'Q':
+				{
+					const string &kstr = arg.sval();
+					char quot;
+					
+					if (kstr.strchr ('\'') >= 0)
+					{
+						quot = '\"';
+					}
+					else
+					{
+						quot = '\'';
+					}
+					
+					res.strcat (quot);
+					
+					for (int ii=0; ii<kstr.strlen(); ++ii)
+					{
+						char c = kstr[ii];
+						switch (c)
+						{
+							case '\"' :
+								if (quot == '\"')
+								{
+									res.strcat ("\"\"");
+								}
+								else
+								{
+									res.strcat (c);
+								}
+								break;
+							
+							default:
+								res.strcat (c);
+								break;
+						}
+					}
+					
+					res.strcat (quot);
+				}
+				break;
+							
+			case 'Z':
+				copy_p = (char *) arg.cval();
+				while (*copy_p)
+				{
+					if ( (*copy_p == '&') )
+					{
+						res.strcat ("&amp;");
+						++copy_p;
+					}
+					else if ( (*copy_p == '<') )
+					{
+						res.strcat ("&lt;");
+						++copy_p;
+					}
+					else if ( (*copy_p == '>') )
+					{
+						res.strcat ("&gt;");
+						++copy_p;
+					}
+					else if (*copy_p < 32)
+					{
+						res.strcat ("&#");
+						::sprintf (sprintf_out,
+								   "%i", (int) *copy_p++);
+						res.strcat (sprintf_out);
+						res.strcat (';');
+					}
+					else res.strcat (*copy_p++);
+				}
+				break;
+			
+			case '!':
+				copy_s = arg.toxml (value::compact);
+				res.strcat (copy_s);
+				break;
+			
+			case 'J':
+				copy_s = arg.tojson ();
+				res.strcat (copy_s);
+				break;
+			
+			case '~':
+				copy_s = strutil::urlencode (arg.sval());
+				res.strcat (copy_s);
+				break;
+			
+			case 's':
+				if (op.width == 0)
+				{
+					res.strcat (arg.sval());
+					break;
+				}
+				copy_s = arg.sval();
+				copy_s.pad (op.width, ' ');
+				res.strcat (copy_s);
+				break;
+		}
+	}
+	
 	return &res;
 }
 
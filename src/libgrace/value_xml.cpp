@@ -84,21 +84,7 @@ bool value::fromxml (const string &xml, xmlschema *schema, string *err)
 	xmlsource = xml;
 	
 	// Nuke what we have now
-	if (arraysz)
-	{
-		for (unsigned int i=0; i<arraysz; ++i)
-		{
-			delete array[i];
-		}
-	}
-	if (array)
-	{
-
-		::free (array);
-		array = NULL;
-	}
-	arrayalloc = 0;
-	arraysz = 0;
+	cleararray ();
 	
 	if (attrib)
 	{
@@ -837,6 +823,8 @@ void value::printxml (int indent, string &out, bool compact,
 					  xmlschema *schema, value *par, const statstring &ptype,
 					  const statstring &pid) const
 {
+	packarray ();
+	
 	string outstr, nm;
 	int ind;
 	statstring rtype; // resolved type
@@ -0,0 +1,16 @@
+// This file is part of the Grace library (libgrace).
+// The Grace library is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, using version 3 of the License.
+// You should have received a copy of the GNU Lesser General Public License 
+// along with Grace library. If not, see <http://www.gnu.org/licenses/>.
+
+#include <grace/version.h>
+
+namespace grace
+{
+	const char *MAGICSTR = "@VERSION_MAGIC@";
+	const char *VERSION = "1.1.10";
+	const char *VERSION_FULL = "1.1.10";
+	const char *VERSION_DETAILS = "2026-10-18T03:59:13 root@vm";
+};
@@ -0,0 +1 @@
+int foo (int i) { return i; }
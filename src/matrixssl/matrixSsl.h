@@ -118,6 +118,7 @@ MATRIXPUBLIC int32	matrixSslEncode(ssl_t *ssl, unsigned char *in, int32 inlen,
 MATRIXPUBLIC int32	matrixSslEncodeClosureAlert(ssl_t *ssl, sslBuf_t *out);
 
 MATRIXPUBLIC int32	matrixSslHandshakeIsComplete(ssl_t *ssl);
+MATRIXPUBLIC int32	matrixSslSessionIsResumed(ssl_t *ssl);
 
 MATRIXPUBLIC void	matrixSslSetCertValidator(ssl_t *ssl,
 						int32 (*certValidator)(sslCertInfo_t *, void *arg),
@@ -0,0 +1,4 @@
+#ifndef _PLATFORM_H
+#define _PLATFORM_H
+
+#endif
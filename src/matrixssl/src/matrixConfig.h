@@ -44,7 +44,13 @@ extern "C" {
 	Session caching provides such an increase in performance that it isn't
 	an option to disable.
 */
-#define SSL_SESSION_TABLE_SIZE	32
+#define SSL_SESSION_TABLE_SIZE	1024
+
+/*
+	Number of seconds a cached session may be resumed after the full
+	handshake that created it.
+*/
+#define SSL_SESSION_ENTRY_LIFE	3600
 
 /******************************************************************************/
 /*
@@ -90,7 +96,7 @@ extern "C" {
 	cache and memory pools with a mutex.
 	By default this is off, so that on POSIX platforms, pthreads isn't req'd
 */
-/* #define USE_MULTITHREADING */
+#define USE_MULTITHREADING
 
 /******************************************************************************/
 /*
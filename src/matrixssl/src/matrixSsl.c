@@ -77,7 +77,7 @@ void matrixSslClose(void)
 
 	sslLockMutex(&sessionTableLock);
 	for (i = 0; i < SSL_SESSION_TABLE_SIZE; i++) {
-		if (sessionTable[i].inUse == 1) {
+		if (sessionTable[i].inUse > 0) {
 			matrixStrDebugMsg("Warning: closing while session still in use\n",
 				NULL);
 		}
@@ -326,6 +326,16 @@ int32 matrixSslHandshakeIsComplete(ssl_t *ssl)
 	return (ssl->hsState == SSL_HS_DONE) ? 1 : 0;
 }
 
+/******************************************************************************/
+/*
+	Returns 1 if the handshake resumed a cached session rather than
+	negotiating a new master secret
+*/
+int32 matrixSslSessionIsResumed(ssl_t *ssl)
+{
+	return (ssl->flags & SSL_FLAGS_RESUMED) ? 1 : 0;
+}
+
 #ifdef USE_CLIENT_SIDE_SSL
 /******************************************************************************/
 /*
@@ -580,7 +590,9 @@ int32 matrixClearSession(ssl_t *ssl, int32 remove)
 		return -1;
 	}
 	sslLockMutex(&sessionTableLock);
-	sessionTable[i].inUse = 0;
+	if (sessionTable[i].inUse > 0) {
+		sessionTable[i].inUse--;
+	}
 	sessionTable[i].flag = 0;
 /*
 	If this is a full removal, actually delete the entry rather than
@@ -625,14 +637,15 @@ int32 matrixResumeSession(ssl_t *ssl)
 	}
 /*
 	Id looks valid.  Update the access time for expiration check.
-	Expiration is done on daily basis (86400 seconds)
+	Expiration is done after SSL_SESSION_ENTRY_LIFE seconds.  The entry
+	may be in use by other connections that resumed it, inUse counts them
+	so that it is not replaced while any of them is still open.
 */
 	sslInitMsecs(&sessionTable[i].accessTime);
 	if (memcmp(sessionTable[i].id, id, 
 				min(ssl->sessionIdLen, SSL_MAX_SESSION_ID_SIZE)) != 0 ||
 			sslDiffSecs(sessionTable[i].startTime,
-				sessionTable[i].accessTime) > 86400 ||
-			sessionTable[i].inUse ||
+				sessionTable[i].accessTime) > SSL_SESSION_ENTRY_LIFE ||
 			sessionTable[i].majVer != ssl->majVer ||
 			sessionTable[i].minVer != ssl->minVer) {
 		sslUnlockMutex(&sessionTableLock);
@@ -641,7 +654,7 @@ int32 matrixResumeSession(ssl_t *ssl)
 	memcpy(ssl->sec.masterSecret, sessionTable[i].masterSecret,
 		SSL_HS_MASTER_SIZE);
 	ssl->cipher = sessionTable[i].cipher;
-	sessionTable[i].inUse = 1;
+	sessionTable[i].inUse++;
 	sslUnlockMutex(&sessionTableLock);
 	return 0;
 }
@@ -671,7 +684,9 @@ int32 matrixUpdateSession(ssl_t *ssl)
 	If there is an error on the session, invalidate for any future use
 */
 	sslLockMutex(&sessionTableLock);
-	sessionTable[i].inUse = ssl->flags & SSL_FLAGS_CLOSED ? 0 : 1;
+	if ((ssl->flags & SSL_FLAGS_CLOSED) && sessionTable[i].inUse > 0) {
+		sessionTable[i].inUse--;
+	}
 	if (ssl->flags & SSL_FLAGS_ERROR) {
 		memset(sessionTable[i].masterSecret, 0x0, SSL_HS_MASTER_SIZE);
 		sessionTable[i].cipher = NULL;
@@ -701,7 +716,6 @@ int32 matrixSslSetResumptionFlag(ssl_t *ssl, char flag)
 		return -1;
 	}
 	sslLockMutex(&sessionTableLock);
-	sessionTable[i].inUse = ssl->flags & SSL_FLAGS_CLOSED ? 0 : 1;
 	if (ssl->flags & SSL_FLAGS_ERROR) {
 		sslUnlockMutex(&sessionTableLock);
 		return -1;
@@ -727,7 +741,6 @@ int32 matrixSslGetResumptionFlag(ssl_t *ssl, char *flag)
 		return -1;
 	}
 	sslLockMutex(&sessionTableLock);
-	sessionTable[i].inUse = ssl->flags & SSL_FLAGS_CLOSED ? 0 : 1;
 	if (ssl->flags & SSL_FLAGS_ERROR) {
 		sslUnlockMutex(&sessionTableLock);
 		return -1;
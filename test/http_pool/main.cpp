@@ -0,0 +1,365 @@
+#include <grace/application.h>
+#include <grace/httpd.h>
+#include <grace/http.h>
+#include <grace/sslsocket.h>
+#include <grace/defaults.h>
+#include <grace/thread.h>
+
+#define PORT 4284
+#define RAWPORT 4285
+#define SSLPORT 4286
+#define NTHREADS 4
+#define NREQUESTS 25
+
+extern "C" void grace_init (void) { __THREADED = true; }
+
+class http_pooltestApp : public application
+{
+public:
+		 	 http_pooltestApp (void) :
+				application ("grace.testsuite.http_pool")
+			 {
+			 }
+			~http_pooltestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (void);
+	int		 rawtests (void);
+	int		 ssltests (void);
+};
+
+APPOBJECT(http_pooltestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+// Answers with the client's port, so that the client can tell
+// which connection it came in on.
+class portpage : public httpdobject
+{
+public:
+			 portpage (httpd &parent) : httpdobject (parent, "*/port")
+			 {
+			 }
+			~portpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = "%i" %format (s.peer_port);
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+// Returns the port the request came from, or -1 on failure.
+static int fetchport (httpsocket &h, const string &url)
+{
+	string body = h.get (url);
+	if (h.status != 200) return -1;
+	return body.toint ();
+}
+
+// Returns the port of a request from a fresh httpsocket.
+static int fetchport (const string &url)
+{
+	httpsocket h;
+	h.keepalive (true);
+	return fetchport (h, url);
+}
+
+lock<value> PORTS;
+
+// Does its requests from a new httpsocket each, keeping track of
+// the connections they came in on.
+class fetcher : public thread
+{
+public:
+			 fetcher (void) : thread ("fetcher")
+			 {
+			 	failed = 0;
+			 	done = false;
+			 	spawn ();
+			 }
+			~fetcher (void)
+			 {
+			 }
+
+	void	 run (void)
+			 {
+			 	for (int i=0; i<NREQUESTS; ++i)
+			 	{
+			 		int port = fetchport ("http://127.0.0.1:%i/port"
+			 							  %format (PORT));
+			 		if (port < 0)
+			 		{
+			 			failed++;
+			 			continue;
+			 		}
+			 		
+			 		string key = "%i" %format (port);
+			 		exclusivesection (PORTS) { PORTS[key] = true; }
+			 	}
+			 	done = true;
+			 }
+
+	volatile int	 failed;
+	volatile bool	 done;
+};
+
+// A server that hangs up on its own terms. For /linger it says it
+// keeps the connection open, but closes it a bit later. For /close
+// it says it will close, but takes its time.
+class rawserver : public thread
+{
+public:
+			 rawserver (void) : thread ("rawserver")
+			 {
+			 	accepted = 0;
+			 	spawn ();
+			 }
+			~rawserver (void)
+			 {
+			 }
+
+	void	 run (void)
+			 {
+			 	tcplistener l (RAWPORT);
+			 	ready.signal ();
+
+			 	while (true)
+			 	{
+			 		value ev = nextevent ();
+			 		if (ev.type() == "die") break;
+
+			 		tcpsocket *s = l.tryaccept (1.0);
+			 		if (! s) continue;
+			 		accepted++;
+
+			 		string uri;
+			 		string ln;
+			 		while (s->waitforline (ln, 2000) && ln.strlen())
+			 		{
+			 			if (! uri.strlen()) uri = ln;
+			 		}
+
+			 		bool linger = (uri.strstr ("/linger") >= 0);
+			 		s->puts ("HTTP/1.1 200 OK\r\n"
+			 				 "Content-Length: 2\r\n"
+			 				 "Connection: %s\r\n\r\nok"
+			 				 %format (linger ? "keep-alive" : "close"));
+
+			 		__musleep (linger ? 200 : 500);
+			 		s->close ();
+			 		delete s;
+			 	}
+			 }
+
+	void	 shutdown (void)
+			 {
+			 	sendevent ("die");
+			 	hasfinished.wait ();
+			 }
+
+	conditional		 ready;
+	volatile int	 accepted;
+};
+
+int http_pooltestApp::main (void)
+{
+	int res;
+
+	httpd srv (PORT, 2, 4);
+	portpage page (srv);
+	srv.eventloops (1);
+	srv.start ();
+
+	try
+	{
+		res = runtests ();
+		if (! res) res = rawtests ();
+		if (! res) res = ssltests ();
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	HTTPCONNECTIONS.clear ();
+	srv.shutdown ();
+	return res;
+}
+
+int http_pooltestApp::runtests (void)
+{
+	string url = "http://127.0.0.1:%i/port" %format (PORT);
+
+	int first = -1;
+	for (int i=0; (i<500) && (first < 0); ++i)
+	{
+		first = fetchport (url);
+		if (first < 0) __musleep (10);
+	}
+	if (first < 0) FAIL("no server");
+	HTTPCONNECTIONS.clear ();
+
+	// A connection let go of by one httpsocket is picked up by the
+	// next one.
+	unsigned int before = HTTPCONNECTIONS.reused ();
+	first = fetchport (url);
+	if (HTTPCONNECTIONS.count() != 1) FAIL("connection not pooled");
+	if (fetchport (url) != first) FAIL("connection not reused");
+	if (HTTPCONNECTIONS.reused() != (before + 1)) FAIL("reuse count");
+
+	// Without keepalive, nothing goes to the pool.
+	HTTPCONNECTIONS.clear ();
+	{
+		httpsocket h;
+		if (fetchport (h, url) < 0) FAIL("fetch without keepalive");
+	}
+	if (HTTPCONNECTIONS.count()) FAIL("pooled without keepalive");
+
+	// Connections are kept apart by host, a single httpsocket going
+	// back and forth gets the right one back.
+	string otherurl = "http://localhost:%i/port" %format (PORT);
+	{
+		httpsocket h;
+		h.keepalive (true);
+		int a = fetchport (h, url);
+		int b = fetchport (h, otherurl);
+		if ((a < 0) || (b < 0)) FAIL("fetch by host");
+		if (a == b) FAIL("hosts share a connection");
+		if (fetchport (h, url) != a) FAIL("first host connection lost");
+		if (fetchport (h, otherurl) != b) FAIL("second host connection lost");
+	}
+	if (HTTPCONNECTIONS.count() != 2) FAIL("host connections not pooled");
+
+	// Idle connections are closed after a while.
+	HTTPCONNECTIONS.clear ();
+	tune::http::idletime = 1;
+	first = fetchport (url);
+	__musleep (2500);
+	if (fetchport (url) == first) FAIL("idle connection reused");
+	tune::http::idletime = 30;
+
+	// Fetchers in several threads share what is in the pool.
+	HTTPCONNECTIONS.clear ();
+	exclusivesection (PORTS) { PORTS.clear (); }
+
+	fetcher *f[NTHREADS];
+	for (int i=0; i<NTHREADS; ++i) f[i] = new fetcher;
+	for (int i=0; i<NTHREADS; ++i)
+	{
+		for (int j=0; (j<3000) && (! f[i]->done); ++j) __musleep (10);
+	}
+
+	int failed = 0;
+	for (int i=0; i<NTHREADS; ++i)
+	{
+		if (! f[i]->done) failed++;
+		else failed += f[i]->failed;
+	}
+	for (int i=0; i<NTHREADS; ++i)
+	{
+		__musleep (10);
+		delete f[i];
+	}
+
+	int connections;
+	sharedsection (PORTS) { connections = PORTS.count (); }
+	fout.writeln ("%i requests from %i threads over %i connections"
+				  %format (NTHREADS * NREQUESTS, NTHREADS, connections));
+
+	if (failed) FAIL("threaded fetches failed");
+	if (connections > (2 * NTHREADS)) FAIL("threads did not share");
+	if (HTTPCONNECTIONS.count() > tune::http::perhost) FAIL("perhost limit");
+
+	return 0;
+}
+
+int http_pooltestApp::rawtests (void)
+{
+	rawserver srv;
+	srv.ready.wait ();
+	HTTPCONNECTIONS.clear ();
+
+	string url = "http://127.0.0.1:%i/linger" %format (RAWPORT);
+
+	// A connection the server closed while it was in the pool is
+	// not handed out again.
+	unsigned int stalebefore = HTTPCONNECTIONS.stale ();
+	if (fetchport (url) != 0) FAIL("linger fetch");
+	if (HTTPCONNECTIONS.count() != 1) FAIL("linger not pooled");
+	__musleep (500);
+	if (fetchport (url) != 0) FAIL("fetch after server hung up");
+	if (HTTPCONNECTIONS.stale() != (stalebefore + 1)) FAIL("stale count");
+	if (srv.accepted != 2) FAIL("stale connection used");
+
+	// A server that says it will close the connection gets its way.
+	HTTPCONNECTIONS.clear ();
+	__musleep (500);
+	if (fetchport ("http://127.0.0.1:%i/close" %format (RAWPORT)) != 0)
+		FAIL("close fetch");
+	if (HTTPCONNECTIONS.count()) FAIL("closing connection pooled");
+
+	srv.shutdown ();
+	return 0;
+}
+
+int http_pooltestApp::ssltests (void)
+{
+	httpsd srv (SSLPORT, 2, 4);
+	portpage page (srv);
+	srv.eventloops (1);
+	srv.loadkeyfile ("cert.pem");
+	srv.start ();
+
+	HTTPCONNECTIONS.clear ();
+	string url = "https://127.0.0.1:%i/port" %format (SSLPORT);
+
+	int first = -1;
+	for (int i=0; (i<500) && (first < 0); ++i)
+	{
+		httpssocket h;
+		h.keepalive (true);
+		h.nocertcheck ();
+		first = fetchport (h, url);
+		if (first < 0) __musleep (10);
+	}
+	if (first < 0)
+	{
+		srv.shutdown ();
+		FAIL("no ssl server");
+	}
+
+	// The next httpssocket skips the handshake.
+	int second;
+	{
+		httpssocket h;
+		h.keepalive (true);
+		h.nocertcheck ();
+		second = fetchport (h, url);
+	}
+
+	// But not if it checks certificates and the first did not.
+	int third;
+	{
+		httpssocket h;
+		h.keepalive (true);
+		third = fetchport (h, url);
+	}
+
+	int pooled = HTTPCONNECTIONS.count ();
+	HTTPCONNECTIONS.clear ();
+	srv.shutdown ();
+
+	if (second != first) FAIL("ssl connection not reused");
+	if (third == first) FAIL("unchecked connection given to a checker");
+	if (pooled != 1) FAIL("ssl connection not pooled");
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+
+#define PORT 4272
+#define NSERIAL 2000
+#define NBURST 100
+#define NROUNDS 20
+
+class httpd_acceptratetestApp : public application
+{
+public:
+		 	 httpd_acceptratetestApp (void) :
+				application ("grace.testsuite.httpd_acceptrate")
+			 {
+			 }
+			~httpd_acceptratetestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runclient (void);
+};
+
+APPOBJECT(httpd_acceptratetestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class pingpage : public httpdobject
+{
+public:
+			 pingpage (httpd &parent) : httpdobject (parent, "/ping")
+			 {
+			 }
+			~pingpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = "pong";
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+static int openclient (void)
+{
+	struct sockaddr_in addr;
+	int fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (PORT);
+	addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+
+	if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)))
+	{
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool sendrequest (int fd)
+{
+	static const char *req = "GET /ping HTTP/1.0\r\n\r\n";
+	size_t sz = strlen (req);
+	return (write (fd, req, sz) == (ssize_t) sz);
+}
+
+// Reads until the server hangs up.
+static bool readresponse (int fd)
+{
+	char buf[1024];
+	size_t got = 0;
+	ssize_t sz;
+
+	while ((sz = read (fd, buf + got, sizeof (buf) - 1 - got)) > 0)
+	{
+		got += sz;
+		if (got == (sizeof (buf) - 1)) return false;
+	}
+
+	buf[got] = 0;
+	return (strstr (buf, " 200 ") && strstr (buf, "\r\n\r\npong"));
+}
+
+int httpd_acceptratetestApp::main (void)
+{
+	pid_t pid = fork ();
+	if (pid == 0) _exit (runclient ());
+	if (pid < 0) FAIL("fork");
+
+	// Leave room for the bursts in the listen queue, the test is
+	// about how fast they get picked up from there.
+	tune::tcplistener::backlog = 1024;
+	
+	httpd srv;
+	srv.listento (PORT);
+	srv.minthreads (4);
+	srv.maxthreads (8);
+	pingpage ping (srv);
+	srv.start ();
+
+	int status = 0;
+	waitpid (pid, &status, 0);
+	srv.shutdown ();
+
+	if ((! WIFEXITED (status)) || WEXITSTATUS (status))
+	{
+		ferr.writeln ("client failed: %i" %format (WEXITSTATUS (status)));
+		return 1;
+	}
+
+	return 0;
+}
+
+int httpd_acceptratetestApp::runclient (void)
+{
+	int fds[NBURST];
+	double tstart;
+	int fd = -1;
+
+	// Wait for the server to come up.
+	for (int i=0; (i<500) && (fd<0); ++i)
+	{
+		fd = openclient ();
+		if (fd < 0) __musleep (10);
+	}
+	if (fd < 0) FAIL("no server");
+	if (! sendrequest (fd)) FAIL("send failed");
+	if (! readresponse (fd)) FAIL("first response");
+	close (fd);
+
+	// One connection at a time.
+	tstart = now ();
+	for (int i=0; i<NSERIAL; ++i)
+	{
+		fd = openclient ();
+		if (fd < 0) FAIL("connect failed");
+		if (! sendrequest (fd)) FAIL("send failed");
+		if (! readresponse (fd)) FAIL("serial response");
+		close (fd);
+	}
+	double t = now() - tstart;
+	fout.writeln ("%i serial connections: %.4fs (%.0f/s)"
+				  %format (NSERIAL, t, NSERIAL / t));
+
+	// Bursts of connections coming in at the same time.
+	tstart = now ();
+	for (int r=0; r<NROUNDS; ++r)
+	{
+		for (int i=0; i<NBURST; ++i)
+		{
+			fds[i] = openclient ();
+			if (fds[i] < 0) FAIL("connect failed");
+			if (! sendrequest (fds[i])) FAIL("send failed");
+		}
+		for (int i=0; i<NBURST; ++i)
+		{
+			if (! readresponse (fds[i])) FAIL("burst response");
+			close (fds[i]);
+		}
+	}
+	t = now() - tstart;
+	fout.writeln ("%i bursts of %i connections: %.4fs (%.0f/s)"
+				  %format (NROUNDS, NBURST, t, (NROUNDS*NBURST) / t));
+
+	return 0;
+}
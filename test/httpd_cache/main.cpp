@@ -0,0 +1,388 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+#include <grace/tcpsocket.h>
+#include <grace/thread.h>
+
+#include <sys/time.h>
+
+#define PORT 4278
+#define NCLIENTS 8
+#define NROUNDS 3
+#define BIGSIZE 10000
+
+// How often each handler ran.
+static volatile int slowruns = 0;
+static volatile int varyruns = 0;
+static volatile int plainruns = 0;
+static volatile int privateruns = 0;
+static volatile int bigruns = 0;
+
+class httpd_cachetestApp : public application
+{
+public:
+		 	 httpd_cachetestApp (void) :
+				application ("grace.testsuite.httpd_cache")
+			 {
+			 }
+			~httpd_cachetestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (httpd &srv);
+};
+
+APPOBJECT(httpd_cachetestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+// Takes a while, and can be kept for a second.
+class slowpage : public httpdobject
+{
+public:
+			 slowpage (httpd &parent) : httpdobject (parent, "/slow")
+			 {
+			 }
+			~slowpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	int n = __sync_add_and_fetch (&slowruns, 1);
+			 	__musleep (300);
+			 	out = "slow %i" %format (n);
+			 	outhdr["Content-type"] = "text/plain";
+			 	outhdr["Cache-Control"] = "public, max-age=1";
+			 	return 200;
+			 }
+};
+
+// Answers in the language asked for.
+class varypage : public httpdobject
+{
+public:
+			 varypage (httpd &parent) : httpdobject (parent, "/vary")
+			 {
+			 }
+			~varypage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	__sync_add_and_fetch (&varyruns, 1);
+			 	out = "lang %s" %format (inhdr["Accept-Language"]);
+			 	outhdr["Cache-Control"] = "max-age=60";
+			 	outhdr["Vary"] = "accept-language";
+			 	return 200;
+			 }
+};
+
+// Does not ask to be cached.
+class plainpage : public httpdobject
+{
+public:
+			 plainpage (httpd &parent) : httpdobject (parent, "/plain")
+			 {
+			 }
+			~plainpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	__sync_add_and_fetch (&plainruns, 1);
+			 	out = "plain";
+			 	return 200;
+			 }
+};
+
+// Asks not to be cached.
+class privatepage : public httpdobject
+{
+public:
+			 privatepage (httpd &parent) : httpdobject (parent, "/private")
+			 {
+			 }
+			~privatepage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	__sync_add_and_fetch (&privateruns, 1);
+			 	out = "private";
+			 	outhdr["Cache-Control"] = "private, max-age=60";
+			 	return 200;
+			 }
+};
+
+// Big enough to fill up a small cache.
+class bigpage : public httpdobject
+{
+public:
+			 bigpage (httpd &parent) : httpdobject (parent, "/big*")
+			 {
+			 }
+			~bigpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	__sync_add_and_fetch (&bigruns, 1);
+			 	for (int i=0; i<BIGSIZE; ++i) out.strcat ((char) ('a' + (i%26)));
+			 	outhdr["Cache-Control"] = "max-age=60";
+			 	return 200;
+			 }
+};
+
+// Reads a response. Returns the status, or -1 if nothing came in time.
+static int readresponse (tcpsocket &c, value &hdr, string &body)
+{
+	string ln;
+	int status;
+
+	hdr.clear ();
+	body.crop ();
+
+	if (! c.waitforline (ln, 5000)) return -1;
+	string proto = ln.cutat (' ');
+	status = ln.toint ();
+
+	while (true)
+	{
+		ln.crop ();
+		if (! c.waitforline (ln, 5000)) return -1;
+		if (! ln.strlen()) break;
+
+		string name = ln.cutat (": ");
+		hdr[name] = ln;
+	}
+
+	int sz = hdr["Content-length"].ival();
+	while ((int) body.strlen() < sz)
+	{
+		string data = c.read (sz - body.strlen(), 5000);
+		if (! data.strlen()) return -1;
+		body.strcat (data);
+	}
+
+	return status;
+}
+
+// Sends a GET on a keep-alive connection and reads the response.
+static int get (tcpsocket &c, const string &uri, value &hdr, string &body,
+				const string &extra = "")
+{
+	c.puts ("GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n"
+			%format (uri, extra));
+	return readresponse (c, hdr, body);
+}
+
+// A client on a connection of its own.
+class fetcher : public thread
+{
+public:
+			 fetcher (const string &puri) : thread ("fetcher")
+			 {
+			 	uri = puri;
+			 	status = -1;
+			 	done = false;
+			 	spawn ();
+			 }
+			~fetcher (void)
+			 {
+			 }
+
+	void	 run (void)
+			 {
+			 	tcpsocket c;
+			 	value hdr;
+
+			 	if (c.connect ("127.0.0.1", PORT))
+			 	{
+			 		status = get (c, uri, hdr, body);
+			 		c.close ();
+			 	}
+			 	done = true;
+			 }
+
+	string			 uri;
+	string			 body;
+	int				 status;
+	volatile bool	 done;
+};
+
+int httpd_cachetestApp::main (void)
+{
+	httpd srv;
+	srv.listento (PORT);
+	srv.minthreads (4);
+	srv.maxthreads (8);
+	srv.cache.size (256 * 1024);
+	slowpage slow (srv);
+	varypage vary (srv);
+	plainpage plain (srv);
+	privatepage priv (srv);
+	bigpage big (srv);
+	srv.start ();
+
+	int res;
+	try
+	{
+		res = runtests (srv);
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	srv.shutdown ();
+	return res;
+}
+
+int httpd_cachetestApp::runtests (httpd &srv)
+{
+	tcpsocket c;
+	value hdr;
+	string body;
+
+	for (int i=0; (i<500) && (! c.connect ("127.0.0.1", PORT)); ++i)
+	{
+		__musleep (10);
+	}
+	if (! c) FAIL("no server");
+
+	// Clients that ask for the same uri at the same time share one
+	// run of the handler, for as long as the response is fresh.
+	for (int round=0; round<NROUNDS; ++round)
+	{
+		fetcher *f[NCLIENTS];
+		double tstart = now ();
+
+		for (int i=0; i<NCLIENTS; ++i) f[i] = new fetcher ("/slow");
+		for (int i=0; i<NCLIENTS; ++i)
+		{
+			for (int j=0; (j<1000) && (! f[i]->done); ++j) __musleep (10);
+		}
+
+		fout.writeln ("round %i: %i concurrent requests: %.4fs"
+					  %format (round, NCLIENTS, now() - tstart));
+
+		string expect = "slow %i" %format (round+1);
+		for (int i=0; i<NCLIENTS; ++i)
+		{
+			if (! f[i]->done) FAIL("fetcher hangs");
+			if (f[i]->status != 200) FAIL("fetcher status");
+			if (f[i]->body != expect) FAIL("fetcher body");
+		}
+
+		for (int i=0; i<NCLIENTS; ++i)
+		{
+			__musleep (10);
+			delete f[i];
+		}
+
+		if (slowruns != (round+1))
+		{
+			ferr.writeln ("round %i: handler ran %i times"
+						  %format (round, slowruns));
+			return 1;
+		}
+
+		if (round == 0)
+		{
+			if (srv.cache.misses() != 1) FAIL("first round misses");
+			if (srv.cache.hits() != (NCLIENTS-1)) FAIL("first round hits");
+
+			// Served from the cache, with an age and an ETag.
+			if (get (c, "/slow", hdr, body) != 200) FAIL("hit status");
+			if (body != "slow 1") FAIL("hit body");
+			if (! hdr.exists ("Age")) FAIL("hit without age");
+			if (! hdr.exists ("ETag")) FAIL("hit without etag");
+			if (hdr["Connection"] != "keep-alive") FAIL("hit connection");
+
+			// A client that has it gets a 304.
+			string etag = hdr["ETag"];
+			if (get (c, "/slow", hdr, body,
+					 "If-None-Match: %s\r\n" %format (etag)) != 304)
+				FAIL("not modified status");
+			if (body.strlen()) FAIL("not modified body");
+			if (hdr["ETag"] != etag) FAIL("not modified etag");
+
+			if (get (c, "/slow", hdr, body,
+					 "If-None-Match: \"other\"\r\n") != 200)
+				FAIL("other etag status");
+
+			// Credentials go past the cache.
+			if (get (c, "/slow", hdr, body,
+					 "Authorization: Basic Zm9vOmJhcg==\r\n") != 200)
+				FAIL("authorization status");
+			if (slowruns != 2) FAIL("authorization served from cache");
+			slowruns = 1;
+		}
+
+		__musleep (1100);
+	}
+
+	// Every variant is kept apart.
+	const char *langs[] = { "en", "nl", "en", "nl", "de", NULL };
+	for (int i=0; langs[i]; ++i)
+	{
+		if (get (c, "/vary", hdr, body,
+				 "Accept-Language: %s\r\n" %format (langs[i])) != 200)
+			FAIL("vary status");
+		string expect = "lang %s" %format (langs[i]);
+		if (body != expect) FAIL("vary body");
+	}
+	if (varyruns != 3) FAIL("vary runs");
+
+	// Responses that did not ask for it are not kept.
+	for (int i=0; i<3; ++i)
+	{
+		if (get (c, "/plain", hdr, body) != 200) FAIL("plain status");
+		if (get (c, "/private", hdr, body) != 200) FAIL("private status");
+	}
+	if (plainruns != 3) FAIL("plain cached");
+	if (privateruns != 3) FAIL("private cached");
+	if (hdr.exists ("ETag")) FAIL("private etag");
+
+	// A cache that is too small drops the least recently used.
+	srv.cache.size (64 * 1024);
+	for (int i=0; i<10; ++i)
+	{
+		if (get (c, "/big?%i" %format (i), hdr, body) != 200)
+			FAIL("big status");
+		if (body.strlen() != BIGSIZE) FAIL("big body");
+	}
+	if (bigruns != 10) FAIL("big runs");
+	fout.writeln ("%i responses, %i bytes in the cache"
+				  %format (srv.cache.count(), srv.cache.bytes()));
+	if (srv.cache.bytes() > srv.cache.size()) FAIL("over budget");
+
+	if (get (c, "/big?9", hdr, body) != 200) FAIL("big status");
+	if (bigruns != 10) FAIL("recent big dropped");
+	if (get (c, "/big?0", hdr, body) != 200) FAIL("big status");
+	if (bigruns != 11) FAIL("old big kept");
+
+	fout.writeln ("%i hits, %i misses"
+				  %format (srv.cache.hits(), srv.cache.misses()));
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+
+#define PORT 4271
+#define NIDLE 10000
+#define NLOOPS 2
+#define MAXTHREADS 4
+#define NROUNDS 100
+
+class httpd_eventlooptestApp : public application
+{
+public:
+		 	 httpd_eventlooptestApp (void) :
+				application ("grace.testsuite.httpd_eventloop")
+			 {
+			 }
+			~httpd_eventlooptestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runclient (int nclients);
+};
+
+APPOBJECT(httpd_eventlooptestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class pingpage : public httpdobject
+{
+public:
+			 pingpage (httpd &parent) : httpdobject (parent, "/ping")
+			 {
+			 }
+			~pingpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = "pong";
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+// Raw sockets on the client side, a tcpsocket per idle client would
+// mostly measure the client.
+static int openclient (void)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (PORT);
+	addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+
+	if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)))
+	{
+		close (fd);
+		return -1;
+	}
+
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+	return fd;
+}
+
+static bool sendrequest (int fd)
+{
+	static const char *req = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	size_t sz = strlen (req);
+	return (write (fd, req, sz) == (ssize_t) sz);
+}
+
+static bool readresponse (int fd)
+{
+	char buf[1024];
+	size_t got = 0;
+
+	while (got < (sizeof (buf) - 1))
+	{
+		ssize_t sz = read (fd, buf + got, sizeof (buf) - 1 - got);
+		if (sz <= 0) return false;
+		got += sz;
+		buf[got] = 0;
+		if (strstr (buf, "\r\n\r\npong")) return (strstr (buf, "200") != NULL);
+	}
+
+	return false;
+}
+
+static void raisefdlimit (void)
+{
+	struct rlimit rl;
+	if (getrlimit (RLIMIT_NOFILE, &rl)) return;
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit (RLIMIT_NOFILE, &rl);
+}
+
+int httpd_eventlooptestApp::main (void)
+{
+	raisefdlimit ();
+
+	// The client goes in a separate process, so both sides get the
+	// full descriptor limit. It is forked off before any threads
+	// are started.
+	pid_t pid = fork ();
+	if (pid == 0) _exit (runclient (NIDLE));
+	if (pid < 0) FAIL("fork");
+
+	// The client connects in a tight loop, which can easily outrun
+	// the accept on a single cpu.
+	tune::tcplistener::backlog = 1024;
+	
+	httpd srv;
+	srv.listento (PORT);
+	srv.minthreads (2);
+	srv.maxthreads (MAXTHREADS);
+	srv.eventloops (NLOOPS);
+	pingpage ping (srv);
+	srv.start ();
+
+	int status = 0;
+	int maxworkers = 0;
+	while (waitpid (pid, &status, WNOHANG) == 0)
+	{
+		if (srv.workers.count() > maxworkers) maxworkers = srv.workers.count();
+		__musleep (50);
+	}
+
+	fout.writeln ("%i event loops, at most %i worker threads"
+				  %format (srv.loops.count(), maxworkers));
+
+	srv.shutdown ();
+
+	if ((! WIFEXITED (status)) || WEXITSTATUS (status))
+	{
+		ferr.writeln ("client failed: %i" %format (WEXITSTATUS (status)));
+		return 1;
+	}
+	if (maxworkers > MAXTHREADS) FAIL("too many workers");
+
+	return 0;
+}
+
+int httpd_eventlooptestApp::runclient (int nclients)
+{
+	int *fds = new int[nclients];
+	double tstart;
+	int fd = -1;
+
+	// Wait for the server to come up.
+	for (int i=0; (i<500) && (fd<0); ++i)
+	{
+		fd = openclient ();
+		if (fd < 0) __musleep (10);
+	}
+	if (fd < 0) FAIL("no server");
+	fds[0] = fd;
+
+	// Connect everybody and send a request each. All responses
+	// should come in while nobody hangs up.
+	tstart = now ();
+	for (int i=1; i<nclients; ++i)
+	{
+		fds[i] = openclient ();
+		if (fds[i] < 0)
+		{
+			ferr.writeln ("connect failed after %i clients" %format (i));
+			return 2;
+		}
+	}
+	for (int i=0; i<nclients; ++i)
+	{
+		if (! sendrequest (fds[i])) FAIL("send failed");
+	}
+	for (int i=0; i<nclients; ++i)
+	{
+		if (! readresponse (fds[i]))
+		{
+			ferr.writeln ("no response on connection %i" %format (i));
+			return 3;
+		}
+	}
+	fout.writeln ("%i keep-alive clients connected and served: %.4fs"
+				  %format (nclients, now() - tstart));
+
+	// Sequential requests from one client, while the others idle.
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		if (! sendrequest (fds[0])) FAIL("send failed");
+		if (! readresponse (fds[0])) FAIL("sequential response");
+	}
+	fout.writeln ("%i requests next to %i idle clients: %.4fs"
+				  %format (NROUNDS, nclients-1, now() - tstart));
+
+	// Every idle connection should still be served.
+	tstart = now ();
+	for (int i=0; i<nclients; ++i)
+	{
+		if (! sendrequest (fds[i])) FAIL("send failed");
+	}
+	for (int i=0; i<nclients; ++i)
+	{
+		if (! readresponse (fds[i]))
+		{
+			ferr.writeln ("idle connection %i dropped" %format (i));
+			return 4;
+		}
+	}
+	fout.writeln ("second request on all clients: %.4fs"
+				  %format (now() - tstart));
+
+	for (int i=0; i<nclients; ++i) close (fds[i]);
+	delete[] fds;
+	return 0;
+}
@@ -0,0 +1,256 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+#include <grace/tcpsocket.h>
+#include <grace/defaults.h>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PORT 4279
+#define BIGSIZE (5ULL * 1024 * 1024 * 1024)
+
+class httpd_filesharetestApp : public application
+{
+public:
+		 	 httpd_filesharetestApp (void) :
+				application ("grace.testsuite.httpd_fileshare")
+			 {
+			 }
+			~httpd_filesharetestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (httpd &srv, httpdfileshare &share);
+};
+
+APPOBJECT(httpd_filesharetestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+// Reads a response. Returns the status, or -1 if nothing came in time.
+static int readresponse (tcpsocket &c, value &hdr, string &body)
+{
+	string ln;
+	int status;
+
+	hdr.clear ();
+	body.crop ();
+
+	if (! c.waitforline (ln, 5000)) return -1;
+	string proto = ln.cutat (' ');
+	status = ln.toint ();
+
+	while (true)
+	{
+		ln.crop ();
+		if (! c.waitforline (ln, 5000)) return -1;
+		if (! ln.strlen()) break;
+
+		string name = ln.cutat (": ");
+		hdr[name] = ln;
+	}
+
+	int sz = hdr["Content-Length"].ival();
+	while ((int) body.strlen() < sz)
+	{
+		string data = c.read (sz - body.strlen(), 5000);
+		if (! data.strlen()) return -1;
+		body.strcat (data);
+	}
+
+	return status;
+}
+
+// Sends a GET and reads the response. The server may turn down
+// keep-alive when it is busy, the connection is made again if it
+// did.
+static int get (tcpsocket &c, const string &uri, value &hdr, string &body,
+				const string &extra = "")
+{
+	if ((! c) && (! c.connect ("127.0.0.1", PORT))) return -1;
+	c.puts ("GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n"
+			%format (uri, extra));
+	int res = readresponse (c, hdr, body);
+	if (hdr["Connection"] == "close") c.close ();
+	return res;
+}
+
+int httpd_filesharetestApp::main (void)
+{
+	fs.mkdir ("share");
+	fs.mkdir ("share/empty");
+
+	string data;
+	for (int i=0; i<1000; ++i) data.strcat ((char) ('a' + (i%26)));
+	fs.save ("share/data.txt", data);
+
+	// Mostly holes, only the end has anything in it.
+	int fd = ::open ("share/big.bin", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) FAIL("could not create big file");
+	bool bigok = (::ftruncate (fd, BIGSIZE) == 0) &&
+				 (::pwrite (fd, "the very end", 12, BIGSIZE - 12) == 12);
+	::close (fd);
+
+	char cwd[1024];
+	if (! ::getcwd (cwd, sizeof (cwd))) FAIL("no cwd");
+	string root = "%s/share" %format (cwd);
+
+	httpd srv;
+	srv.listento (PORT);
+	srv.minthreads (2);
+	srv.maxthreads (4);
+	httpdfileshare share (srv, "*", root);
+	srv.start ();
+
+	int res;
+	try
+	{
+		res = runtests (srv, share);
+		if ((! res) && bigok)
+		{
+			tcpsocket c;
+			value hdr;
+			string body;
+
+			// Offsets past 4 GB.
+			if (! c.connect ("127.0.0.1", PORT)) FAIL("no server");
+			if (get (c, "/big.bin", hdr, body, "Range: bytes=-12\r\n") != 206)
+				FAIL("big range status");
+			if (body != "the very end") FAIL("big range body");
+			string expect = "bytes %U-%U/%U" %format (BIGSIZE-12, BIGSIZE-1,
+													  BIGSIZE);
+			if (hdr["Content-Range"] != expect) FAIL("big content-range");
+			c.close ();
+		}
+		else if (! bigok) fout.writeln ("no room for a big file, skipped");
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	srv.shutdown ();
+	fs.rm ("share/big.bin");
+	fs.rm ("share/data.txt");
+	::rmdir ("share/empty");
+	::rmdir ("share");
+	return res;
+}
+
+int httpd_filesharetestApp::runtests (httpd &srv, httpdfileshare &share)
+{
+	tcpsocket c;
+	value hdr;
+	string body;
+	string data = fs.load ("share/data.txt");
+
+	for (int i=0; (i<500) && (! c.connect ("127.0.0.1", PORT)); ++i)
+	{
+		__musleep (10);
+	}
+	if (! c) FAIL("no server");
+
+	// The whole file, with validators.
+	if (get (c, "/data.txt", hdr, body) != 200) FAIL("status");
+	if (body != data) FAIL("body");
+	if ((hdr["Connection"] != "keep-alive") && (hdr["Connection"] != "close"))
+		FAIL("connection");
+	if (hdr["Accept-Ranges"] != "bytes") FAIL("accept-ranges");
+	if (! hdr.exists ("ETag")) FAIL("no etag");
+	if (! hdr["Last-Modified"].sval().globcmp ("*, * GMT"))
+		FAIL("last-modified");
+	string etag = hdr["ETag"];
+	string lastmod = hdr["Last-Modified"];
+
+	// Conditional requests.
+	if (get (c, "/data.txt", hdr, body,
+			 "If-None-Match: %s\r\n" %format (etag)) != 304)
+		FAIL("if-none-match");
+	if (hdr["ETag"] != etag) FAIL("304 etag");
+	if (get (c, "/data.txt", hdr, body,
+			 "If-None-Match: \"other\"\r\n") != 200)
+		FAIL("if-none-match other");
+	if (get (c, "/data.txt", hdr, body,
+			 "If-Modified-Since: %s\r\n" %format (lastmod)) != 304)
+		FAIL("if-modified-since");
+	if (get (c, "/data.txt", hdr, body,
+			 "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n") != 200)
+		FAIL("if-modified-since old");
+
+	// A single range.
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=10-19\r\n") != 206)
+		FAIL("range status");
+	string expect = data.mid (10, 10);
+	if (body != expect) FAIL("range body");
+	if (hdr["Content-Range"] != "bytes 10-19/1000") FAIL("content-range");
+
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=990-\r\n") != 206)
+		FAIL("open range status");
+	expect = data.mid (990);
+	if (body != expect) FAIL("open range body");
+
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=-5\r\n") != 206)
+		FAIL("suffix range status");
+	expect = data.mid (995);
+	if (body != expect) FAIL("suffix range body");
+
+	// More than one.
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=0-1,500-502\r\n") != 206)
+		FAIL("multirange status");
+	string ctype = hdr["Content-Type"];
+	if (! ctype.globcmp ("multipart/byteranges; boundary=*"))
+		FAIL("multirange type");
+	string boundary = ctype.mid (ctype.strstr ("boundary=") + 9);
+	string part = data.mid (500, 3);
+	expect.crop ();
+	expect.printf ("\r\n--%s\r\nContent-Type: text/plain\r\n"
+				   "Content-Range: bytes 0-1/1000\r\n\r\nab", boundary.str());
+	expect.printf ("\r\n--%s\r\nContent-Type: text/plain\r\n"
+				   "Content-Range: bytes 500-502/1000\r\n\r\n%s",
+				   boundary.str(), part.str());
+	expect.printf ("\r\n--%s--\r\n", boundary.str());
+	if (body != expect) FAIL("multirange body");
+
+	// Nothing that fits.
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=1000-\r\n") != 416)
+		FAIL("unsatisfiable status");
+	if (hdr["Content-Range"] != "bytes */1000") FAIL("unsatisfiable range");
+
+	// Nonsense is ignored.
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=5-2\r\n") != 200)
+		FAIL("invalid range");
+	if (get (c, "/data.txt", hdr, body, "Range: lines=1-2\r\n") != 200)
+		FAIL("other unit");
+
+	// If-Range.
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=0-0\r\n"
+			 "If-Range: %s\r\n" %format (etag)) != 206)
+		FAIL("if-range etag");
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=0-0\r\n"
+			 "If-Range: %s\r\n" %format (lastmod)) != 206)
+		FAIL("if-range date");
+	if (get (c, "/data.txt", hdr, body, "Range: bytes=0-0\r\n"
+			 "If-Range: \"other\"\r\n") != 200)
+		FAIL("if-range other");
+
+	// Directories without an index, or things that are not there.
+	if (get (c, "/empty", hdr, body) != 404) FAIL("directory");
+	if (get (c, "/nothere.txt", hdr, body) != 404) FAIL("missing");
+
+	// Changes show up once the cached entry is due for a look.
+	tune::httpd::fileshare::revalidate = 0;
+	fs.save ("share/data.txt", "changed");
+	if (get (c, "/data.txt", hdr, body) != 200) FAIL("changed status");
+	if (body != "changed") FAIL("changed body");
+	if (hdr["ETag"] == etag) FAIL("changed etag");
+	if (get (c, "/data.txt", hdr, body,
+			 "If-None-Match: %s\r\n" %format (etag)) != 200)
+		FAIL("changed if-none-match");
+
+	c.close ();
+	return 0;
+}
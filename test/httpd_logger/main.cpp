@@ -0,0 +1,206 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+#include <grace/thread.h>
+
+#include <sys/time.h>
+
+#define NTHREADS 4
+#define NLINES 5000
+
+class httpd_loggertestApp : public application
+{
+public:
+		 	 httpd_loggertestApp (void) :
+				application ("grace.testsuite.httpd_logger")
+			 {
+			 }
+			~httpd_loggertestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (httpd &srv);
+};
+
+APPOBJECT(httpd_loggertestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+// An access event as the httpd sends it.
+static value *accessevent (int n)
+{
+	returnclass (value) res retain;
+
+	res("class") = "access";
+	res["method"] = "GET";
+	res["httpver"] = "1.1";
+	res["uri"] = "/page/%i?query=1" %format (n);
+	res["ip"] = "127.0.0.1";
+	res["user"] = "";
+	res["referrer"] = "http://www.example.net/";
+	res["useragent"] = "test \"agent\"";
+	res["status"] = 200;
+	res["bytes"] = 5000000000ULL;
+	return &res;
+}
+
+// Logs from a worker thread of its own.
+class logclient : public thread
+{
+public:
+			 logclient (httpdlogger &l) : thread ("logclient"), log (l)
+			 {
+			 	done = false;
+			 	spawn ();
+			 }
+			~logclient (void)
+			 {
+			 }
+
+	void	 run (void)
+			 {
+			 	value ev = accessevent (1);
+			 	for (int i=0; i<NLINES; ++i) log.handle (ev);
+			 	done = true;
+			 }
+
+	httpdlogger		&log;
+	volatile bool	 done;
+};
+
+// Runs NTHREADS logclients, returns the time it took.
+static double logfrom (httpdlogger &log)
+{
+	logclient *c[NTHREADS];
+	double tstart = now ();
+
+	for (int i=0; i<NTHREADS; ++i) c[i] = new logclient (log);
+	for (int i=0; i<NTHREADS; ++i)
+	{
+		while (! c[i]->done) __musleep (1);
+	}
+	double res = now() - tstart;
+
+	for (int i=0; i<NTHREADS; ++i)
+	{
+		__musleep (10);
+		delete c[i];
+	}
+	return res;
+}
+
+static int countlines (const string &path)
+{
+	string data = fs.load (path);
+	int res = 0;
+	for (unsigned int i=0; i<data.strlen(); ++i)
+	{
+		if (data[i] == '\n') ++res;
+	}
+	return res;
+}
+
+int httpd_loggertestApp::main (void)
+{
+	httpd srv;
+	int res;
+
+	try
+	{
+		res = runtests (srv);
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	fs.rm ("sync.log");
+	fs.rm ("async.log");
+	fs.rm ("drop.log");
+	return res;
+}
+
+int httpd_loggertestApp::runtests (httpd &srv)
+{
+	fs.rm ("sync.log");
+	fs.rm ("async.log");
+	fs.rm ("drop.log");
+
+	// The lines look the same either way.
+	double tsync;
+	{
+		httpdlogger log (srv, "sync.log");
+		tsync = logfrom (log);
+	}
+	{
+		httpdlogger log (srv, "async.log");
+		log.async ();
+		double tasync = logfrom (log);
+		fout.writeln ("%i lines from %i threads: %.4fs sync, %.4fs async"
+					  %format (NTHREADS * NLINES, NTHREADS, tsync, tasync));
+
+		log.flush ();
+		if (countlines ("async.log") != (NTHREADS * NLINES))
+			FAIL("async lines missing after flush");
+		if (log.dropped()) FAIL("blocking logger dropped lines");
+	}
+
+	if (countlines ("sync.log") != (NTHREADS * NLINES)) FAIL("sync lines");
+	if (countlines ("async.log") != (NTHREADS * NLINES)) FAIL("async lines");
+
+	file f;
+	f.openread ("async.log");
+	string ln = f.gets ();
+	f.close ();
+	if (! ln.globcmp ("127.0.0.1 - - [*] \"GET /page/1 HTTP/1.1\" 200 "
+					  "5000000000 \"http://www.example.net/\" "
+					  "\"test \\\"agent\\\"\""))
+	{
+		ferr.writeln ("got: %s" %format (ln));
+		FAIL("line format");
+	}
+
+	// A queue that is full holds up the workers by default.
+	tune::httpd::log::maxqueue = 4096;
+	fs.rm ("async.log");
+	{
+		httpdlogger log (srv, "async.log");
+		log.async (HTTPDLOG_BLOCK);
+		logfrom (log);
+		if (log.dropped()) FAIL("small queue dropped lines");
+	}
+	if (countlines ("async.log") != (NTHREADS * NLINES))
+		FAIL("small queue lines");
+
+	// Or costs lines, which are counted.
+	tune::httpd::log::flushtime = 60000;
+	tune::httpd::log::flushsize = 1024 * 1024;
+	{
+		httpdlogger log (srv, "drop.log");
+		log.async (HTTPDLOG_DROP);
+		value ev = accessevent (1);
+		for (int i=0; i<1000; ++i) log.handle (ev);
+		if (! log.dropped()) FAIL("nothing dropped");
+
+		// The writer tells flush() when it is done, rather than
+		// leaving it to the flushtime.
+		double tstart = now ();
+		log.flush ();
+		if ((now() - tstart) > 5.0) FAIL("flush waited for flushtime");
+		int written = countlines ("drop.log");
+		fout.writeln ("%i lines written, %i dropped"
+					  %format (written, log.dropped()));
+		if ((written + (int) log.dropped()) != 1000) FAIL("drop count");
+	}
+
+	return 0;
+}
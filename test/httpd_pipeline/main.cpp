@@ -0,0 +1,299 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+#include <grace/tcpsocket.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#define PORT 4274
+#define NPIPELINE 10
+
+// Writes on the server's sockets are counted, the client socket is
+// left out.
+static int clientfd = -1;
+static int nwrites = 0;
+
+static void countwrite (int fd)
+{
+	struct stat st;
+
+	if (fd == clientfd) return;
+	if (fstat (fd, &st) || (! S_ISSOCK (st.st_mode))) return;
+	__sync_fetch_and_add (&nwrites, 1);
+}
+
+extern "C" ssize_t write (int fd, const void *buf, size_t count)
+{
+	countwrite (fd);
+	return syscall (SYS_write, fd, buf, count);
+}
+
+extern "C" ssize_t writev (int fd, const struct iovec *iov, int iovcnt)
+{
+	countwrite (fd);
+	return syscall (SYS_writev, fd, iov, iovcnt);
+}
+
+class httpd_pipelinetestApp : public application
+{
+public:
+		 	 httpd_pipelinetestApp (void) :
+				application ("grace.testsuite.httpd_pipeline")
+			 {
+			 }
+			~httpd_pipelinetestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (int port);
+};
+
+APPOBJECT(httpd_pipelinetestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+// Sends back the uri, or the body for a post.
+class echopage : public httpdobject
+{
+public:
+			 echopage (httpd &parent) : httpdobject (parent, "/echo*")
+			 {
+			 }
+			~echopage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	if (postbody.strlen()) out = postbody;
+			 	else out = uri;
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+// Takes its time, so that more can come in on the connection
+// while it runs.
+class slowpage : public httpdobject
+{
+public:
+			 slowpage (httpd &parent) : httpdobject (parent, "/slow")
+			 {
+			 }
+			~slowpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	__musleep (300);
+			 	out = "slow";
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+static string *getrequest (int n, bool close = false)
+{
+	returnclass (string) res retain;
+
+	res.printf ("GET /echo?n=%i HTTP/1.1\r\nHost: localhost\r\n", n);
+	if (close) res.strcat ("Connection: close\r\n");
+	res.strcat ("\r\n");
+	return &res;
+}
+
+// Reads a response, returns the status or -1 if nothing came in time.
+static int readresponse (tcpsocket &c, string &body, bool &closed)
+{
+	string line;
+	int status = -1;
+	int sz = 0;
+
+	body.crop ();
+	closed = false;
+
+	try
+	{
+		if (! c.waitforline (line, 2000)) return -1;
+		string proto = line.cutat (' ');
+		status = line.toint ();
+
+		while (true)
+		{
+			line.crop ();
+			if (! c.waitforline (line, 2000)) return -1;
+			if (! line.strlen()) break;
+
+			string hdr = line.cutat (": ");
+			if (hdr.strcasecmp ("Content-length") == 0) sz = line.toint ();
+			if ((hdr.strcasecmp ("Connection") == 0) && (line == "close"))
+				closed = true;
+		}
+
+		if (sz) body = c.read (sz, 2000);
+	}
+	catch (exception e)
+	{
+		return -1;
+	}
+
+	if ((int) body.strlen() != sz) return -1;
+	return status;
+}
+
+int httpd_pipelinetestApp::main (void)
+{
+	// Once with a worker thread sticking to each connection, once
+	// with the connections kept in an event loop.
+	for (int loops=0; loops<2; ++loops)
+	{
+		httpd srv;
+		srv.listento (PORT + loops);
+		srv.minthreads (4);
+		srv.maxthreads (8);
+		srv.eventloops (loops);
+		echopage echo (srv);
+		slowpage slow (srv);
+		srv.start ();
+
+		int res = runtests (PORT + loops);
+		srv.shutdown ();
+
+		if (res)
+		{
+			ferr.writeln ("failed with %i event loops" %format (loops));
+			return res;
+		}
+	}
+
+	return 0;
+}
+
+int httpd_pipelinetestApp::runtests (int port)
+{
+	tcpsocket c;
+	string body;
+	bool closed;
+
+	for (int i=0; (i<500) && (! c.connect ("127.0.0.1", port)); ++i)
+	{
+		__musleep (10);
+	}
+	if (! c) FAIL("no server");
+	clientfd = c.filno;
+
+	// A batch of requests in one go. The responses come back in
+	// order, in a single write.
+	string batch;
+	for (int i=0; i<NPIPELINE; ++i) batch.strcat (getrequest (i));
+
+	nwrites = 0;
+	c.puts (batch);
+	for (int i=0; i<NPIPELINE; ++i)
+	{
+		if (readresponse (c, body, closed) != 200) FAIL("batch response");
+		string expect = "/echo?n=%i" %format (i);
+		if (body != expect) FAIL("batch order");
+		if (closed) FAIL("batch closed");
+	}
+	if (nwrites != 1)
+	{
+		ferr.writeln ("batch took %i writes" %format (nwrites));
+		return 1;
+	}
+
+	// A post body in the middle of the batch.
+	batch = getrequest (1);
+	batch.strcat ("POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+				  "Content-Length: 11\r\n\r\nhello world");
+	batch.strcat (getrequest (2));
+
+	nwrites = 0;
+	c.puts (batch);
+	if (readresponse (c, body, closed) != 200) FAIL("post batch 1");
+	if (body != "/echo?n=1") FAIL("post batch 1 body");
+	if (readresponse (c, body, closed) != 200) FAIL("post batch 2");
+	if (body != "hello world") FAIL("post batch 2 body");
+	if (readresponse (c, body, closed) != 200) FAIL("post batch 3");
+	if (body != "/echo?n=2") FAIL("post batch 3 body");
+	if (nwrites != 1) FAIL("post batch writes");
+
+	// Half a request at the end. The complete ones should be
+	// answered while the server waits for the rest.
+	batch = getrequest (3);
+	batch.strcat (getrequest (4));
+	batch.strcat ("GET /echo?n=5 HTTP/1.1\r\nHo");
+
+	c.puts (batch);
+	if (readresponse (c, body, closed) != 200) FAIL("partial batch 1");
+	if (body != "/echo?n=3") FAIL("partial batch 1 body");
+	if (readresponse (c, body, closed) != 200) FAIL("partial batch 2");
+	if (body != "/echo?n=4") FAIL("partial batch 2 body");
+
+	c.puts ("st: localhost\r\n\r\n");
+	if (readresponse (c, body, closed) != 200) FAIL("partial batch 3");
+	if (body != "/echo?n=5") FAIL("partial batch 3 body");
+
+	// The connection closes after the request that asks for it,
+	// requests behind it are not answered.
+	batch = getrequest (6);
+	batch.strcat (getrequest (7, true));
+	batch.strcat (getrequest (8));
+
+	c.puts (batch);
+	if (readresponse (c, body, closed) != 200) FAIL("close batch 1");
+	if (closed) FAIL("close batch 1 closed");
+	if (readresponse (c, body, closed) != 200) FAIL("close batch 2");
+	if (! closed) FAIL("close batch 2 not closed");
+	if (body != "/echo?n=7") FAIL("close batch 2 body");
+	if (readresponse (c, body, closed) != -1) FAIL("answer after close");
+
+	c.close ();
+	clientfd = -1;
+
+	// A request sent right before the client hangs up its side,
+	// while the one ahead of it is still being handled.
+	tcpsocket h;
+	if (! h.connect ("127.0.0.1", port)) FAIL("half-close connect");
+	h.puts ("GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	__musleep (100);
+	h.puts (getrequest (9));
+	::shutdown (h.filno, SHUT_WR);
+
+	if (readresponse (h, body, closed) != 200) FAIL("half-close 1");
+	if (body != "slow") FAIL("half-close 1 body");
+	if (readresponse (h, body, closed) != 200) FAIL("half-close 2");
+	if (body != "/echo?n=9") FAIL("half-close 2 body");
+	h.close ();
+
+	// Headers that leave a few bytes of room in the buffer, too few
+	// to read into, are turned down rather than waited on forever.
+	tcpsocket b;
+	if (! b.connect ("127.0.0.1", port)) FAIL("big header connect");
+	string big = "GET /echo HTTP/1.1\r\nX-Filler: ";
+	unsigned int bigsz = defaults::sz::file::ringbuffer - 256 - 4;
+	while (big.strlen() < bigsz) big.strcat ('x');
+	b.puts (big);
+
+	if (readresponse (b, body, closed) != -1) FAIL("big header answered");
+	try
+	{
+		b.readbuffer (256, 2000);
+	}
+	catch (exception e)
+	{
+	}
+	if (! b.eof()) FAIL("big header not turned down");
+	b.close ();
+
+	return 0;
+}
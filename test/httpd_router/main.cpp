@@ -0,0 +1,206 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+
+#include <sys/time.h>
+
+#define NOBJECTS 80
+#define NFUZZ 20000
+#define NROUNDS 100000
+
+class httpd_routertestApp : public application
+{
+public:
+		 	 httpd_routertestApp (void) :
+				application ("grace.testsuite.httpd_router")
+			 {
+			 }
+			~httpd_routertestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	bool	 samematches (const string &uri);
+
+	httpdrouter	 router;
+	httpdobject	*objects[NOBJECTS + 32];
+	int			 nobjects;
+};
+
+APPOBJECT(httpd_routertestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static unsigned int nextrand (unsigned int &seed)
+{
+	seed = (seed * 1103515245) + 12345;
+	return (seed >> 8);
+}
+
+// Patterns in the style of a control panel setup, and some of the
+// odder things wild_match() understands.
+static const char *patterns[] = {
+	"/favicon.ico",
+	"/login",
+	"/login*",
+	"/images/*",
+	"/Images/Logo.png",
+	"/json/*",
+	"/module/*/icon.png",
+	"*.php",
+	"/dynamic/%",
+	"/foo?bar",
+	"/esc\\*aped",
+	"/a/very/long/path/that/goes/on/and/on/for/more/than/sixty/four/characters",
+	"/a/very/long/path/that/goes/on/and/on/for/more/than/sixty/four/chars/*",
+	"",
+	"/",
+	"*",
+	NULL
+};
+
+static const char *fragments[] = {
+	"/", "login", "images", "Images", "json", "module", "icon.png",
+	".php", "dynamic", "foo", "bar", "x", "?", "*", "esc", "aped",
+	"mod1", "mod42", "status", "api", "v3", "Logo.png", "favicon.ico",
+	"a/very/long/path/that/goes/on/and/on/for/more/than/sixty/four/",
+	"characters", "chars", NULL
+};
+
+int httpd_routertestApp::main (void)
+{
+	httpd srv;
+	nobjects = 0;
+
+	// The bulk goes in first, so the catch-alls from the list above
+	// are at the end of the chain.
+	for (int i=0; i<(NOBJECTS/2); ++i)
+	{
+		string p = "/module/mod%i/*" %format (i);
+		objects[nobjects++] = new httpdobject (srv, p);
+		p = "/api/v%i/*/status" %format (i);
+		objects[nobjects++] = new httpdobject (srv, p);
+	}
+	for (int i=0; patterns[i]; ++i)
+	{
+		objects[nobjects++] = new httpdobject (srv, patterns[i]);
+	}
+	for (int i=0; i<nobjects; ++i) router.add (objects[i]);
+
+	if (router.count() != nobjects) FAIL("count");
+
+	const char *uris[] = {
+		"/", "", "/login", "/LOGIN", "/login.php", "/loginx", "/logi",
+		"/favicon.ico", "/Favicon.ICO", "/images/", "/images/a/b.gif",
+		"/images", "/json/call", "/module/x/icon.png",
+		"/module/mod7/icon.png", "/module/mod79/", "/api/v3/x/status",
+		"/api/v3/x/status/y", "/dynamic/", "/dynamic/a b", "/fooXbar",
+		"/foobar", "/esc*aped", "/escXaped", "/index.php",
+		"/a/very/long/path/that/goes/on/and/on/for/more/than/sixty/four/"
+		"characters",
+		"/a/very/long/path/that/goes/on/and/on/for/more/than/sixty/four/"
+		"chars/x",
+		"/a/very/long/path/that/goes/on/and/on/for/more/than/sixty/four/"
+		"characterS",
+		NULL
+	};
+
+	for (int i=0; uris[i]; ++i)
+	{
+		if (! samematches (uris[i]))
+		{
+			ferr.writeln ("matches differ for '%s'" %format (uris[i]));
+			return 1;
+		}
+	}
+
+	// Uris glued together from bits that show up in the patterns.
+	unsigned int seed = 1;
+	int nfrag = 0;
+	while (fragments[nfrag]) ++nfrag;
+
+	for (int i=0; i<NFUZZ; ++i)
+	{
+		string uri;
+		int n = nextrand (seed) % 6;
+
+		for (int j=0; j<n; ++j)
+		{
+			uri.strcat (fragments[nextrand (seed) % nfrag]);
+		}
+
+		if (! samematches (uri))
+		{
+			ferr.writeln ("matches differ for '%s'" %format (uri));
+			return 1;
+		}
+	}
+
+	// First match for a uri that only the catch-all takes, the way
+	// httpd::handle used to look for it and through the router.
+	string uri = "/panel/index.html";
+	double tstart;
+	int found = 0;
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		for (int j=0; j<nobjects; ++j)
+		{
+			if (uri.globcmp (objects[j]->urimatch))
+			{
+				found += j;
+				break;
+			}
+		}
+	}
+	fout.writeln ("%i objects, linear globcmp: %.4fs"
+				  %format (nobjects, now() - tstart));
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		httpdroutecursor crsr (router, uri);
+		httpdobject *o = crsr.next ();
+		if (o) found -= (o == objects[nobjects-1]) ? (nobjects-1) : 0;
+	}
+	fout.writeln ("%i objects, routing trie: %.4fs"
+				  %format (nobjects, now() - tstart));
+
+	if (found != 0) FAIL("benchmark first match");
+
+	for (int i=0; i<nobjects; ++i) delete objects[i];
+	return 0;
+}
+
+// Compares all matches through the router with what a walk over the
+// chain finds.
+bool httpd_routertestApp::samematches (const string &uri)
+{
+	httpdroutecursor crsr (router, uri);
+	httpdobject *o;
+	int j = 0;
+
+	while ((o = crsr.next()))
+	{
+		while ((j < nobjects) && (! uri.globcmp (objects[j]->urimatch))) ++j;
+		if (j >= nobjects) return false;
+		if (o != objects[j]) return false;
+		++j;
+	}
+
+	while (j < nobjects)
+	{
+		if (uri.globcmp (objects[j]->urimatch)) return false;
+		++j;
+	}
+
+	return true;
+}
@@ -0,0 +1,376 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+#include <grace/http.h>
+#include <grace/tcpsocket.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+#define PORT 4276
+#define NLINES 100000
+#define FLOODSIZE (32*1024*1024)
+
+// State shared between the client and the handlers.
+static volatile bool gateopen = false;
+static volatile int produced = 0;
+static volatile bool floodfailed = false;
+static volatile bool flooddone = false;
+
+class httpd_streamtestApp : public application
+{
+public:
+		 	 httpd_streamtestApp (void) :
+				application ("grace.testsuite.httpd_stream")
+			 {
+			 }
+			~httpd_streamtestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (void);
+};
+
+APPOBJECT(httpd_streamtestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static string *line (int i)
+{
+	returnclass (string) res retain;
+	res.printf ("line %i\n", i);
+	return &res;
+}
+
+// Small enough to go out in one piece.
+class smallpage : public httpdobject
+{
+public:
+			 smallpage (httpd &parent) : httpdobject (parent, "/small")
+			 {
+			 }
+			~smallpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	httpdstream st (s, env, outhdr);
+			 	outhdr["Content-type"] = "text/plain";
+			 	st.write ("hello");
+			 	return st.finish ();
+			 }
+};
+
+// Sends a first piece, then waits for the client to see it.
+class gatedpage : public httpdobject
+{
+public:
+			 gatedpage (httpd &parent) : httpdobject (parent, "/gated")
+			 {
+			 }
+			~gatedpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	httpdstream st (s, env, outhdr);
+			 	outhdr["Content-type"] = "text/plain";
+			 	st.write ("first");
+			 	st.flush ();
+
+			 	for (int i=0; (i<500) && (! gateopen); ++i) __musleep (10);
+
+			 	st.write ("second");
+			 	return st.finish ();
+			 }
+};
+
+// Numbered lines, lots of them.
+class linespage : public httpdobject
+{
+public:
+			 linespage (httpd &parent) : httpdobject (parent, "/lines")
+			 {
+			 }
+			~linespage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	httpdstream st (s, env, outhdr);
+			 	outhdr["Content-type"] = "text/plain";
+			 	for (int i=0; i<NLINES; ++i)
+			 	{
+			 		if (! st.write (line (i))) break;
+			 	}
+			 	return st.finish ();
+			 }
+};
+
+// More data than the socket buffers can take, keeps track of how far
+// it got.
+class floodpage : public httpdobject
+{
+public:
+			 floodpage (httpd &parent) : httpdobject (parent, "/flood")
+			 {
+			 }
+			~floodpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	httpdstream st (s, env, outhdr);
+			 	string blk;
+			 	for (int i=0; i<4096; ++i) blk.strcat ((char) ('a' + (i%26)));
+
+			 	produced = 0;
+			 	floodfailed = false;
+			 	flooddone = false;
+
+			 	while (produced < FLOODSIZE)
+			 	{
+			 		if (! st.write (blk))
+			 		{
+			 			floodfailed = true;
+			 			break;
+			 		}
+			 		produced += blk.strlen();
+			 	}
+
+			 	int res = st.finish ();
+			 	flooddone = true;
+			 	return res;
+			 }
+};
+
+// A serverpage that streams.
+class streampage : public serverpage
+{
+public:
+			 streampage (httpd &parent) : serverpage (parent, "/spage*")
+			 {
+			 }
+			~streampage (void)
+			 {
+			 }
+
+	int		 stream (value &env, value &argv, httpdstream &out)
+			 {
+			 	int n = argv["n"].ival();
+			 	for (int i=0; i<n; ++i) out.write (line (i));
+			 	return 1;
+			 }
+};
+
+// Reads the status line and headers.
+static int readheaders (tcpsocket &c, value &hdr)
+{
+	string ln;
+	int status;
+
+	hdr.clear ();
+	if (! c.waitforline (ln, 2000)) return -1;
+	string proto = ln.cutat (' ');
+	status = ln.toint ();
+
+	while (true)
+	{
+		ln.crop ();
+		if (! c.waitforline (ln, 2000)) return -1;
+		if (! ln.strlen()) break;
+
+		string name = ln.cutat (": ");
+		hdr[name] = ln;
+	}
+
+	return status;
+}
+
+// Reads one chunk. Returns 1 for a chunk, 0 at the end of the body
+// and -1 if nothing came in time.
+static int readchunk (tcpsocket &c, string &into)
+{
+	string ln;
+
+	if (! c.waitforline (ln, 2000)) return -1;
+	unsigned int sz = ln.toint (16);
+	bool gotdata = false;
+	while (sz)
+	{
+		string data = c.read (sz, 2000);
+		if (! data.strlen()) return -1;
+		into.strcat (data);
+		sz -= data.strlen();
+		gotdata = true;
+	}
+
+	ln.crop ();
+	if (! c.waitforline (ln, 2000)) return -1;
+	if (ln.strlen()) return -1;
+	return gotdata ? 1 : 0;
+}
+
+// True if the other side closed the connection.
+static bool closedbypeer (tcpsocket &c)
+{
+	struct pollfd pfd;
+	char tmp;
+
+	pfd.fd = c.filno;
+	pfd.events = POLLIN;
+	if (poll (&pfd, 1, 2000) <= 0) return false;
+	return (recv (c.filno, &tmp, 1, MSG_DONTWAIT) == 0);
+}
+
+int httpd_streamtestApp::main (void)
+{
+	httpd srv;
+	srv.listento (PORT);
+	srv.minthreads (4);
+	srv.maxthreads (8);
+	smallpage small (srv);
+	gatedpage gated (srv);
+	linespage lines (srv);
+	floodpage flood (srv);
+	streampage spage (srv);
+	srv.start ();
+
+	int res;
+	try
+	{
+		res = runtests ();
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	srv.shutdown ();
+	return res;
+}
+
+int httpd_streamtestApp::runtests (void)
+{
+	tcpsocket c;
+	value hdr;
+	string body;
+	int rc;
+
+	for (int i=0; (i<500) && (! c.connect ("127.0.0.1", PORT)); ++i)
+	{
+		__musleep (10);
+	}
+	if (! c) FAIL("no server");
+
+	// A body that fits the buffer goes out with a length.
+	c.puts ("GET /small HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	if (readheaders (c, hdr) != 200) FAIL("small status");
+	if (hdr.exists ("Transfer-Encoding")) FAIL("small chunked");
+	if (hdr["Content-length"].ival() != 5) FAIL("small length");
+	body = c.read (5, 2000);
+	if (body != "hello") FAIL("small body");
+
+	// The first piece has to arrive while the handler is still
+	// busy. The connection stays usable afterwards.
+	gateopen = false;
+	c.puts ("GET /gated HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	if (readheaders (c, hdr) != 200) FAIL("gated status");
+	if (hdr["Transfer-Encoding"] != "chunked") FAIL("gated not chunked");
+	if (hdr.exists ("Content-length")) FAIL("gated length");
+	body.crop ();
+	if (readchunk (c, body) != 1) FAIL("gated first chunk");
+	if (body != "first") FAIL("gated first body");
+	gateopen = true;
+	while ((rc = readchunk (c, body)) > 0);
+	if (rc < 0) FAIL("gated chunks");
+	if (body != "firstsecond") FAIL("gated body");
+
+	c.puts ("GET /small HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	if (readheaders (c, hdr) != 200) FAIL("after gated status");
+	body = c.read (5, 2000);
+	if (body != "hello") FAIL("after gated body");
+
+	// A serverpage with a stream() method.
+	c.puts ("GET /spage?n=3 HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	if (readheaders (c, hdr) != 200) FAIL("spage status");
+	if (hdr["Content-type"] != "text/html") FAIL("spage type");
+	body = c.read (hdr["Content-length"].ival(), 2000);
+	if (body != "line 0\nline 1\nline 2\n") FAIL("spage body");
+	c.close ();
+
+	// Lots of chunks, read back with httpsocket.
+	string expect;
+	for (int i=0; i<NLINES; ++i) expect.strcat (line (i));
+
+	httpsocket hs;
+	double tstart = now ();
+	body = hs.get ("http://127.0.0.1:%i/lines" %format (PORT));
+	fout.writeln ("%i lines, %i bytes streamed: %.4fs"
+				  %format (NLINES, body.strlen(), now() - tstart));
+	if (hs.status != 200) FAIL("lines status");
+	if (body != expect) FAIL("lines body");
+
+	// HTTP/1.0 gets the plain body and a closed connection.
+	if (! c.connect ("127.0.0.1", PORT)) FAIL("reconnect");
+	c.puts ("GET /lines HTTP/1.0\r\n\r\n");
+	if (readheaders (c, hdr) != 200) FAIL("http/1.0 status");
+	if (hdr.exists ("Transfer-Encoding")) FAIL("http/1.0 chunked");
+	if (hdr["Connection"] != "close") FAIL("http/1.0 connection");
+	body.crop ();
+	while (body.strlen() < expect.strlen())
+	{
+		string data = c.read (expect.strlen() - body.strlen(), 2000);
+		if (! data.strlen()) break;
+		body.strcat (data);
+	}
+	if (body != expect) FAIL("http/1.0 body");
+	if (! closedbypeer (c)) FAIL("http/1.0 not closed");
+	c.close ();
+
+	// A client that does not read holds up the handler.
+	if (! c.connect ("127.0.0.1", PORT)) FAIL("reconnect");
+	c.puts ("GET /flood HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	__musleep (500);
+	int held = produced;
+	fout.writeln ("produced while client waits: %i of %i bytes"
+				  %format (held, FLOODSIZE));
+	if (held >= (FLOODSIZE / 2)) FAIL("no back-pressure");
+
+	if (readheaders (c, hdr) != 200) FAIL("flood status");
+	body.crop ();
+	while ((rc = readchunk (c, body)) > 0);
+	if (rc < 0) FAIL("flood chunks");
+	if (body.strlen() != FLOODSIZE) FAIL("flood size");
+	if (floodfailed) FAIL("flood failed");
+
+	// One that never reads makes the writes fail after a while.
+	tune::httpd::stream::timeout = 500;
+	flooddone = false;
+	floodfailed = false;
+	c.puts ("GET /flood HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	for (int i=0; (i<500) && (! flooddone); ++i) __musleep (10);
+	if (! flooddone) FAIL("stalled client not dropped");
+	if (! floodfailed) FAIL("stalled client write succeeded");
+	c.close ();
+
+	return 0;
+}
@@ -0,0 +1,340 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+#include <grace/tcpsocket.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+#define PORT 4277
+#define BIGSIZE (8*1024*1024)
+#define MAXPOST (1024*1024)
+
+// State shared between the client and the handlers.
+static volatile bool uploadstarted = false;
+static volatile int peakbuffered = 0;
+
+class httpd_uploadtestApp : public application
+{
+public:
+		 	 httpd_uploadtestApp (void) :
+				application ("grace.testsuite.httpd_upload")
+			 {
+			 }
+			~httpd_uploadtestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (void);
+};
+
+APPOBJECT(httpd_uploadtestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+// Spools the body to upload.dat.
+class uploadpage : public httpdobject
+{
+public:
+			 uploadpage (httpd &parent) : httpdobject (parent, "/upload")
+			 {
+			 	streambody = true;
+			 }
+			~uploadpage (void)
+			 {
+			 }
+
+	int		 runbody (string &uri, httpdbody &body, value &inhdr,
+					  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	file f;
+			 	if (! f.openwrite ("upload.dat")) return 500;
+
+			 	while (! body.done())
+			 	{
+			 		string data = body.read ();
+			 		if (body.failed()) break;
+			 		if (! f.puts (data)) break;
+			 		uploadstarted = true;
+			 		if ((int) data.strlen() > peakbuffered)
+			 			peakbuffered = data.strlen();
+			 	}
+			 	f.close ();
+
+			 	if (! body.done()) return 500;
+			 	out = "%i" %format (body.received());
+			 	return 200;
+			 }
+};
+
+// Uses httpdbody::spool().
+class spoolpage : public httpdobject
+{
+public:
+			 spoolpage (httpd &parent) : httpdobject (parent, "/spool")
+			 {
+			 	streambody = true;
+			 }
+			~spoolpage (void)
+			 {
+			 }
+
+	int		 runbody (string &uri, httpdbody &body, value &inhdr,
+					  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	if (! body.spool ("upload.dat")) return 500;
+			 	out = "%i" %format (body.received());
+			 	return 200;
+			 }
+};
+
+// Asks for a stream, then never reads it.
+class ignorepage : public httpdobject
+{
+public:
+			 ignorepage (httpd &parent) : httpdobject (parent, "/ignore")
+			 {
+			 	streambody = true;
+			 }
+			~ignorepage (void)
+			 {
+			 }
+
+	int		 runbody (string &uri, httpdbody &body, value &inhdr,
+					  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = "ignored";
+			 	return 200;
+			 }
+};
+
+// Buffered, like before.
+class echopage : public httpdobject
+{
+public:
+			 echopage (httpd &parent) : httpdobject (parent, "/echo")
+			 {
+			 }
+			~echopage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = postbody;
+			 	return 200;
+			 }
+};
+
+// Reads a response. Returns the status, or -1 if nothing came in time.
+static int readresponse (tcpsocket &c, value &hdr, string &body)
+{
+	string ln;
+	int status;
+
+	hdr.clear ();
+	body.crop ();
+
+	if (! c.waitforline (ln, 5000)) return -1;
+	string proto = ln.cutat (' ');
+	status = ln.toint ();
+
+	while (true)
+	{
+		ln.crop ();
+		if (! c.waitforline (ln, 5000)) return -1;
+		if (! ln.strlen()) break;
+
+		string name = ln.cutat (": ");
+		hdr[name] = ln;
+	}
+
+	int sz = hdr["Content-length"].ival();
+	while ((int) body.strlen() < sz)
+	{
+		string data = c.read (sz - body.strlen(), 5000);
+		if (! data.strlen()) return -1;
+		body.strcat (data);
+	}
+
+	return status;
+}
+
+// Request data for a body in chunks of varying sizes, with an
+// extension and a trailer thrown in.
+static string *chunked (const string &data)
+{
+	returnclass (string) res retain;
+	unsigned int pos = 0;
+	unsigned int csz = 1;
+
+	while (pos < data.strlen())
+	{
+		if ((pos + csz) > data.strlen()) csz = data.strlen() - pos;
+		if (csz & 1) res.printf ("%x;name=value\r\n", csz);
+		else res.printf ("%X\r\n", csz);
+		res.strcat (data.mid (pos, csz));
+		res.strcat ("\r\n");
+		pos += csz;
+		csz = (csz * 3) + 7;
+		if (csz > 200000) csz = 1;
+	}
+
+	res.strcat ("0\r\nX-Trailer: yes\r\n\r\n");
+	return &res;
+}
+
+// True if the other side closed the connection. Anything still
+// coming in before that, like the body of a response without a
+// length, is skipped.
+static bool closedbypeer (tcpsocket &c)
+{
+	struct pollfd pfd;
+	char tmp[1024];
+	ssize_t sz;
+
+	if (c.buffer.backlog()) c.buffer.advance (c.buffer.backlog());
+
+	pfd.fd = c.filno;
+	pfd.events = POLLIN;
+
+	do
+	{
+		if (poll (&pfd, 1, 2000) <= 0) return false;
+		sz = recv (c.filno, tmp, sizeof (tmp), MSG_DONTWAIT);
+	} while (sz > 0);
+
+	return (sz == 0);
+}
+
+int httpd_uploadtestApp::main (void)
+{
+	httpd srv;
+	srv.listento (PORT);
+	srv.minthreads (4);
+	srv.maxthreads (8);
+	srv.maxpostsize (MAXPOST);
+	uploadpage upload (srv);
+	spoolpage spool (srv);
+	ignorepage ignore (srv);
+	echopage echo (srv);
+	srv.start ();
+
+	int res = runtests ();
+	srv.shutdown ();
+	fs.rm ("upload.dat");
+	return res;
+}
+
+int httpd_uploadtestApp::runtests (void)
+{
+	tcpsocket c;
+	value hdr;
+	string body;
+
+	for (int i=0; (i<500) && (! c.connect ("127.0.0.1", PORT)); ++i)
+	{
+		__musleep (10);
+	}
+	if (! c) FAIL("no server");
+
+	string big;
+	for (int i=0; i<BIGSIZE; ++i) big.strcat ((char) ('a' + ((i*7)%26)));
+
+	// A body over the post limit, streamed to disk. The handler
+	// gets going before the client is done sending.
+	double tstart = now ();
+	uploadstarted = false;
+	peakbuffered = 0;
+	c.puts ("POST /upload HTTP/1.1\r\nHost: localhost\r\n"
+			"Content-Length: %i\r\n\r\n" %format (BIGSIZE));
+	c.puts (big.left (BIGSIZE/2));
+	for (int i=0; (i<500) && (! uploadstarted); ++i) __musleep (10);
+	if (! uploadstarted) FAIL("handler did not start");
+	c.puts (big.mid (BIGSIZE/2));
+
+	if (readresponse (c, hdr, body) != 200) FAIL("upload status");
+	if (body.toint() != BIGSIZE) FAIL("upload size");
+	string stored = fs.load ("upload.dat");
+	if (stored != big) FAIL("upload data");
+	fout.writeln ("%i bytes streamed to disk: %.4fs, largest read %i"
+				  %format (BIGSIZE, now() - tstart, peakbuffered));
+	if (peakbuffered > MAXPOST) FAIL("upload buffered");
+
+	// The same as a chunked body, on the same connection.
+	c.puts ("POST /spool HTTP/1.1\r\nHost: localhost\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n");
+	c.puts (chunked (big));
+	if (readresponse (c, hdr, body) != 200) FAIL("chunked status");
+	if (body.toint() != BIGSIZE) FAIL("chunked size");
+	stored = fs.load ("upload.dat");
+	if (stored != big) FAIL("chunked data");
+
+	// Expect: 100-continue gets its go-ahead.
+	c.puts ("POST /upload HTTP/1.1\r\nHost: localhost\r\n"
+			"Content-Length: 5\r\nExpect: 100-continue\r\n\r\n");
+	if (readresponse (c, hdr, body) != 100) FAIL("no 100 continue");
+	c.puts ("hello");
+	if (readresponse (c, hdr, body) != 200) FAIL("continue status");
+	if (body != "5") FAIL("continue size");
+
+	// Buffered objects get the body as a string, chunked or not.
+	c.puts ("POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+			"Content-Length: 11\r\n\r\nhello world");
+	if (readresponse (c, hdr, body) != 200) FAIL("echo status");
+	if (body != "hello world") FAIL("echo body");
+
+	string medium = big.left (100000);
+	c.puts ("POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n");
+	c.puts (chunked (medium));
+	if (readresponse (c, hdr, body) != 200) FAIL("chunked echo status");
+	if (body != medium) FAIL("chunked echo body");
+
+	// A buffered body over the limit is turned down, whether the
+	// size was known up front or not. The server stops reading
+	// right past the limit, so that is all that gets sent.
+	c.puts ("POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n");
+	c.puts ("%x\r\n" %format (2 * MAXPOST));
+	c.puts (big.left (MAXPOST + 1));
+	if (readresponse (c, hdr, body) != 413) FAIL("chunked limit");
+	if (! closedbypeer (c)) FAIL("chunked limit not closed");
+	c.close ();
+
+	if (! c.connect ("127.0.0.1", PORT)) FAIL("reconnect");
+	c.puts ("POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+			"Content-Length: %i\r\n\r\n" %format (2 * MAXPOST));
+	if (readresponse (c, hdr, body) != 413) FAIL("length limit");
+	c.close ();
+
+	// A body the handler did not read ends the connection.
+	if (! c.connect ("127.0.0.1", PORT)) FAIL("reconnect");
+	c.puts ("POST /ignore HTTP/1.1\r\nHost: localhost\r\n"
+			"Content-Length: 5\r\n\r\nhello");
+	if (readresponse (c, hdr, body) != 200) FAIL("ignore status");
+	if (hdr["Connection"] != "close") FAIL("ignore keepalive");
+	if (! closedbypeer (c)) FAIL("ignore not closed");
+	c.close ();
+
+	// So does a broken chunk.
+	if (! c.connect ("127.0.0.1", PORT)) FAIL("reconnect");
+	c.puts ("POST /upload HTTP/1.1\r\nHost: localhost\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n"
+			"5\r\nhello\r\nzz\r\n");
+	if (readresponse (c, hdr, body) != 500) FAIL("broken chunk status");
+	if (! closedbypeer (c)) FAIL("broken chunk not closed");
+	c.close ();
+
+	return 0;
+}
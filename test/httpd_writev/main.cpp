@@ -0,0 +1,237 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpd.h>
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define PORT 4273
+#define NREQUESTS 200
+#define BIGSIZE (256*1024)
+
+// The client side of the test runs in-process, its socket is left out
+// of the count.
+static int clientfd = -1;
+static int nwrites = 0;
+
+static void countwrite (int fd)
+{
+	struct stat st;
+
+	if (fd == clientfd) return;
+	if (fstat (fd, &st) || (! S_ISSOCK (st.st_mode))) return;
+	__sync_fetch_and_add (&nwrites, 1);
+}
+
+// Every write and writev on a socket goes through here, libgrace
+// resolves these before the ones in libc.
+extern "C" ssize_t write (int fd, const void *buf, size_t count)
+{
+	countwrite (fd);
+	return syscall (SYS_write, fd, buf, count);
+}
+
+extern "C" ssize_t writev (int fd, const struct iovec *iov, int iovcnt)
+{
+	countwrite (fd);
+	return syscall (SYS_writev, fd, iov, iovcnt);
+}
+
+class httpd_writevtestApp : public application
+{
+public:
+		 	 httpd_writevtestApp (void) :
+				application ("grace.testsuite.httpd_writev")
+			 {
+			 }
+			~httpd_writevtestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runclient (void);
+};
+
+APPOBJECT(httpd_writevtestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class pingpage : public httpdobject
+{
+public:
+			 pingpage (httpd &parent) : httpdobject (parent, "/ping")
+			 {
+			 }
+			~pingpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = "pong";
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+class bigpage : public httpdobject
+{
+public:
+			 bigpage (httpd &parent) : httpdobject (parent, "/big")
+			 {
+			 }
+			~bigpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	for (int i=0; i<BIGSIZE; ++i) out.strcat ((char) ('a' + (i%26)));
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+static int openclient (void)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (PORT);
+	addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+
+	if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)))
+	{
+		close (fd);
+		return -1;
+	}
+
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+	return fd;
+}
+
+static bool sendrequest (int fd, const char *uri)
+{
+	char req[256];
+	sprintf (req, "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", uri);
+	size_t sz = strlen (req);
+	return (write (fd, req, sz) == (ssize_t) sz);
+}
+
+// Reads one response off a keep-alive connection, returns the body.
+static string *readresponse (int fd)
+{
+	returnclass (string) res retain;
+	string buf;
+	char rd[4096];
+	int hdrsz = -1;
+	int bodysz = 0;
+
+	while ((hdrsz < 0) || ((int) buf.strlen() < (hdrsz + bodysz)))
+	{
+		ssize_t sz = read (fd, rd, sizeof (rd));
+		if (sz <= 0) return &res;
+		buf.strcat (rd, sz);
+
+		if (hdrsz < 0)
+		{
+			int eoh = buf.strstr ("\r\n\r\n");
+			if (eoh < 0) continue;
+			hdrsz = eoh + 4;
+
+			int cl = buf.strstr ("Content-length: ");
+			if ((cl < 0) || (cl > eoh)) return &res;
+			bodysz = atoi (buf.str() + cl + 16);
+		}
+	}
+
+	res = buf.mid (hdrsz, bodysz);
+	return &res;
+}
+
+int httpd_writevtestApp::main (void)
+{
+	httpd srv;
+	srv.listento (PORT);
+	srv.minthreads (4);
+	srv.maxthreads (8);
+	pingpage ping (srv);
+	bigpage big (srv);
+	srv.start ();
+
+	int res = runclient ();
+
+	if (clientfd >= 0) close (clientfd);
+	clientfd = -1;
+	srv.shutdown ();
+	return res;
+}
+
+int httpd_writevtestApp::runclient (void)
+{
+	for (int i=0; (i<500) && (clientfd<0); ++i)
+	{
+		clientfd = openclient ();
+		if (clientfd < 0) __musleep (10);
+	}
+	if (clientfd < 0) FAIL("no server");
+
+	// Small responses on a keep-alive connection, each should be a
+	// single write on the server side.
+	if (! sendrequest (clientfd, "/ping")) FAIL("send failed");
+	string body = readresponse (clientfd);
+	if (body != "pong") FAIL("first response");
+
+	nwrites = 0;
+	double tstart = now ();
+	for (int i=0; i<NREQUESTS; ++i)
+	{
+		if (! sendrequest (clientfd, "/ping")) FAIL("send failed");
+		body = readresponse (clientfd);
+		if (body != "pong") FAIL("ping response");
+	}
+	double t = now() - tstart;
+	int small = nwrites;
+
+	fout.writeln ("%i keep-alive requests: %.4fs, %i writes"
+				  %format (NREQUESTS, t, small));
+
+	if (small != NREQUESTS)
+	{
+		ferr.writeln ("expected %i writes, got %i" %format (NREQUESTS, small));
+		return 1;
+	}
+
+	// A response too big for one write should still arrive whole.
+	if (! sendrequest (clientfd, "/big")) FAIL("send failed");
+	body = readresponse (clientfd);
+	if (body.strlen() != BIGSIZE) FAIL("big response size");
+	for (int i=0; i<BIGSIZE; ++i)
+	{
+		if (body[i] != ('a' + (i%26))) FAIL("big response data");
+	}
+
+	return 0;
+}
@@ -0,0 +1,401 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/httpparser.h>
+#include <grace/commonkeys.h>
+#include <grace/ringbuffer.h>
+#include <grace/strutil.h>
+
+#include <sys/time.h>
+
+#define NROUNDS 20000
+#define NFUZZ 5000
+
+class httpparsertestApp : public application
+{
+public:
+		 	 httpparsertestApp (void) :
+				application ("grace.testsuite.httpparser")
+			 {
+			 }
+			~httpparsertestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	bool	 sameparse (const string &raw, unsigned int seed);
+	bool	 sameheaders (const value &oldh, const value &newh);
+	bool	 checkodd (void);
+	value	*oldparse (const string &raw, string &cmd);
+};
+
+APPOBJECT(httpparsertestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+// Compares a returned string with the expected value.
+static bool same (string *s, const string &val)
+{
+	string tmp = s;
+	return (tmp == val);
+}
+
+static unsigned int nextrand (unsigned int &seed)
+{
+	seed = (seed * 1103515245) + 12345;
+	return (seed >> 8);
+}
+
+int httpparsertestApp::main (void)
+{
+	value corpus;
+	value files = fs.ls ("corpus", false);
+	double tstart;
+
+	foreach (f, files)
+	{
+		corpus[f.id()] = fs.load ("corpus/%s" %format (f.id()));
+	}
+	if (corpus.count() < 10) FAIL("corpus missing");
+
+	// Well-formed requests should come out like they used to with
+	// gets() and strutil::parsehdr().
+	const char *wellformed[] = {
+		"chrome-get.txt", "firefox-get.txt", "post-form.txt",
+		"multipart.txt", "lf-only.txt", "many-headers.txt", NULL
+	};
+
+	for (int i=0; wellformed[i]; ++i)
+	{
+		const string &raw = corpus[wellformed[i]];
+		httpparser p;
+		string oldcmd;
+
+		if (! p.parse (raw.str(), raw.strlen())) FAIL("wellformed done");
+
+		value oldh = oldparse (raw, oldcmd);
+		value newh = p.headers (raw.str());
+		if (! sameheaders (oldh, newh))
+		{
+			ferr.writeln ("headers differ for %s" %format (wellformed[i]));
+			return 1;
+		}
+
+		string newcmd = p.method (raw.str());
+		newcmd.strcat (' ');
+		newcmd.strcat (p.uri (raw.str()));
+		if (oldcmd.strncmp (newcmd, newcmd.strlen()) != 0)
+		{
+			FAIL("request line differs");
+		}
+	}
+
+	// Spot checks.
+	{
+		const string &raw = corpus["post-form.txt"];
+		httpparser p;
+		bool found;
+
+		p.parse (raw.str(), raw.strlen());
+		if (p.headeruval (raw.str(), key::http_content_length, found) != 27)
+			FAIL("post content-length");
+		if (! same (raw.mid (p.size()), "user=admin&password=secret"))
+			FAIL("post body offset");
+		if (! p.ishttp11 (raw.str())) FAIL("post version");
+	}
+	{
+		const string &raw = corpus["chrome-get.txt"];
+		httpparser p;
+
+		p.parse (raw.str(), raw.strlen());
+		value h = p.headers (raw.str());
+		if (h["cookie"] != "session=4f1c2a9be0d34e7a; theme=dark; "
+						   "_ga=GA1.2.1234567890.1700000000")
+			FAIL("cookie kept whole");
+		if (h["Accept-Language"].attribexists ("q") == false)
+			FAIL("header attributes");
+		if (! p.headeris (raw.str(), key::http_connection, "Keep-Alive"))
+			FAIL("connection header");
+		if (p.find (raw.str(), "sec-ch-ua-mobile") < 0)
+			FAIL("uninterned lookup");
+	}
+	{
+		const string &raw = corpus["many-headers.txt"];
+		httpparser p;
+
+		p.parse (raw.str(), raw.strlen());
+		if (p.count() != HTTP_MAXHEADERS) FAIL("header limit");
+	}
+	{
+		const string &raw = corpus["http09.txt"];
+		httpparser p;
+
+		if (! p.parse (raw.str(), raw.strlen())) FAIL("http/0.9 done");
+		if (! same (p.uri (raw.str()), "/old")) FAIL("http/0.9 uri");
+		if (p.version (raw.str())->strlen()) FAIL("http/0.9 version");
+	}
+	{
+		const string &raw = corpus["leading-crlf.txt"];
+		httpparser p;
+
+		if (! p.parse (raw.str(), raw.strlen())) FAIL("leading crlf done");
+		if (! same (p.method (raw.str()), "GET")) FAIL("leading crlf method");
+	}
+	{
+		const string &raw = corpus["truncated.txt"];
+		httpparser p;
+
+		if (p.parse (raw.str(), raw.strlen())) FAIL("truncated done");
+		if (! p.gotrequest()) FAIL("truncated request line");
+		if (p.count() != 1) FAIL("truncated header count");
+	}
+	{
+		const string &raw = corpus["empty-lines-only.txt"];
+		httpparser p;
+
+		if (p.parse (raw.str(), raw.strlen())) FAIL("empty lines done");
+		if (p.gotrequest()) FAIL("empty lines request");
+	}
+	if (! checkodd ()) return 1;
+
+	// Every corpus entry, fed in pieces, should parse the same as
+	// when it comes in at once.
+	unsigned int seed = 1;
+	foreach (c, corpus)
+	{
+		if (! sameparse (c.sval(), nextrand (seed)))
+		{
+			ferr.writeln ("split parse differs for %s" %format (c.id()));
+			return 1;
+		}
+	}
+
+	// Mutated corpus entries.
+	for (int i=0; i<NFUZZ; ++i)
+	{
+		string raw = corpus[nextrand (seed) % corpus.count()];
+		int nmut = 1 + (nextrand (seed) % 4);
+
+		for (int m=0; m<nmut; ++m)
+		{
+			static const char special[] = "\r\n: \t;\"\\(";
+			unsigned int at = raw.strlen() ? nextrand (seed) % raw.strlen() : 0;
+			string left = raw.left (at);
+			string right = raw.mid (at);
+
+			switch (nextrand (seed) % 4)
+			{
+				case 0:
+					left.strcat ((char) (nextrand (seed) & 0xff));
+					right = right.mid (1);
+					break;
+
+				case 1:
+					left.strcat (special[nextrand (seed) % 10]);
+					break;
+
+				case 2:
+					right = right.mid (1);
+					break;
+
+				default:
+					right.crop (0);
+					break;
+			}
+
+			raw = left;
+			raw.strcat (right);
+		}
+
+		if (! sameparse (raw, nextrand (seed)))
+		{
+			ferr.writeln ("fuzz case %i differs" %format (i));
+			return 1;
+		}
+	}
+
+	// Benchmarks.
+	const string &chrome = corpus["chrome-get.txt"];
+	int total = 0;
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		string cmd;
+		value h = oldparse (chrome, cmd);
+		total += h.count();
+	}
+	fout.writeln ("gets/parsehdr: %.4fs" %format (now() - tstart));
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		httpparser p;
+		bool found;
+		p.parse (chrome.str(), chrome.strlen());
+		p.headeruval (chrome.str(), key::http_content_length, found);
+		total += p.count();
+	}
+	fout.writeln ("httpparser, parse only: %.4fs" %format (now() - tstart));
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		httpparser p;
+		p.parse (chrome.str(), chrome.strlen());
+		value h = p.headers (chrome.str());
+		total += h.count();
+	}
+	fout.writeln ("httpparser, with headers: %.4fs" %format (now() - tstart));
+
+	if (total != (3 * NROUNDS * 18)) FAIL("benchmark header count");
+
+	return 0;
+}
+
+// Feeds the request in random pieces and compares every detail with
+// a single parse.
+bool httpparsertestApp::sameparse (const string &raw, unsigned int seed)
+{
+	const char *data = raw.str();
+	unsigned int sz = raw.strlen();
+	httpparser whole;
+	httpparser split;
+	unsigned int at = 0;
+
+	whole.parse (data, sz);
+
+	while (at < sz)
+	{
+		at += 1 + (nextrand (seed) % 16);
+		if (at > sz) at = sz;
+		if (split.parse (data, at)) break;
+	}
+
+	if (whole.done() != split.done()) return false;
+	if (whole.gotrequest() != split.gotrequest()) return false;
+	if (whole.size() != split.size()) return false;
+	if (whole.count() != split.count()) return false;
+	if (whole.size() > sz) return false;
+
+	if (whole.gotrequest())
+	{
+		string wm = whole.method (data);
+		string wu = whole.uri (data);
+		string wv = whole.version (data);
+
+		if (! same (split.method (data), wm)) return false;
+		if (! same (split.uri (data), wu)) return false;
+		if (! same (split.version (data), wv)) return false;
+	}
+
+	for (int i=0; i<whole.count(); ++i)
+	{
+		const httpheader &a = whole[i];
+		const httpheader &b = split[i];
+
+		if ((a.name.offs != b.name.offs) || (a.name.len != b.name.len))
+			return false;
+		if ((a.value.offs != b.value.offs) || (a.value.len != b.value.len))
+			return false;
+		if ((a.value.offs + a.value.len) > whole.size()) return false;
+		if (a.key != b.key) return false;
+	}
+
+	if (whole.done())
+	{
+		value h = whole.headers (data);
+		if (h.count() > whole.count()) return false;
+	}
+
+	return true;
+}
+
+bool httpparsertestApp::sameheaders (const value &oldh, const value &newh)
+{
+	if (oldh.count() != newh.count()) return false;
+
+	foreach (o, oldh)
+	{
+		if (! newh.exists (o.id())) return false;
+
+		const value &n = newh[o.id()];
+		if (n.sval() != o.sval()) return false;
+		if (n.attributes().count() != o.attributes().count()) return false;
+
+		foreach (a, o.attributes())
+		{
+			if (n(a.id()) != a.sval()) return false;
+		}
+	}
+
+	return true;
+}
+
+bool httpparsertestApp::checkodd (void)
+{
+	string raw = fs.load ("corpus/odd-headers.txt");
+	const char *data = raw.str();
+	httpparser p;
+	bool found;
+
+	#define ODDFAIL(foo) { ferr.writeln ("odd-headers: " foo); return false; }
+
+	if (! p.parse (data, raw.strlen())) ODDFAIL("done");
+	if (! same (p.method (data), "get")) ODDFAIL("method");
+	if (! same (p.uri (data), "/odd")) ODDFAIL("uri");
+	if (! same (p.version (data), "1.1")) ODDFAIL("version");
+	if (! p.ishttp11 (data)) ODDFAIL("ishttp11");
+	if (p.headeruval (data, key::http_content_length, found) != 12)
+		ODDFAIL("content-length");
+
+	value h = p.headers (data);
+	if (h["Host"] != "no-space.example.com") ODDFAIL("host");
+	if (! h.exists ("X-Empty")) ODDFAIL("empty");
+	if (h["X-Empty"].sval().strlen()) ODDFAIL("empty value");
+	if (h["X-Spaces"] != "padded value") ODDFAIL("spaces");
+	if (h["X-Tab"] != "tabbed") ODDFAIL("tab");
+	if (h["X-Dup"] != "second") ODDFAIL("duplicate");
+	if (h["X-Quoted"] != "a;b") ODDFAIL("quoted");
+	if (h["X-Paren"] != "comment (unclosed") ODDFAIL("paren");
+	if (p.find (data, "this line has no colon") >= 0) ODDFAIL("no colon");
+
+	return true;
+}
+
+// The way httpdworker used to take a request apart.
+value *httpparsertestApp::oldparse (const string &raw, string &cmd)
+{
+	returnclass (value) res retain;
+	ringbuffer buf (raw.strlen() + 256);
+	bool gotcmd = false;
+
+	buf.add (raw.str(), raw.strlen());
+	cmd.crop ();
+
+	while (buf.hasline())
+	{
+		string line = buf.readline();
+		if (gotcmd && (! line.strlen())) break;
+		if (! line.strlen()) continue;
+
+		if (! gotcmd)
+		{
+			gotcmd = true;
+			cmd = line;
+		}
+		else if (res.count() < HTTP_MAXHEADERS)
+		{
+			value test = strutil::parsehdr (line);
+			res << test;
+		}
+	}
+
+	return &res;
+}
@@ -0,0 +1,192 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/thread.h>
+
+#include <sys/time.h>
+
+#define NROUNDS 200000
+#define NBATCH 48
+#define NHANDOFF 64
+
+lock<int> donecount;
+lock<int> failcount;
+string *handoff[NHANDOFF];
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static string *mkretained (int i)
+{
+	returnclass (string) res retain;
+	res.printf ("%i", i);
+	return &res;
+}
+
+class worker : public thread
+{
+public:
+				 worker (int id, int nthreads, bool usepool)
+				 	: thread ("worker")
+				 {
+				 	_id = id;
+				 	_nthreads = nthreads;
+				 	_usepool = usepool;
+				 	spawn ();
+				 }
+				~worker (void) {}
+
+	void		 run (void)
+				 {
+				 	int nrounds = NROUNDS / _nthreads;
+				 	bool failed = false;
+
+				 	for (int i=0; i<nrounds; ++i)
+				 	{
+				 		if (_usepool)
+				 		{
+				 			string s = mkretained (i);
+				 			if (s.toint() != i) failed = true;
+				 		}
+				 		else
+				 		{
+				 			string *s = new string;
+				 			s->printf ("%i", i);
+				 			if (s->toint() != i) failed = true;
+				 			delete s;
+				 		}
+				 	}
+
+				 	if (_usepool && (_id == 0))
+				 	{
+				 		// Hold on to more blocks than fit in a thread cache.
+				 		string *batch[NBATCH];
+				 		for (int i=0; i<NBATCH; ++i)
+				 		{
+				 			batch[i] = new (memory::retainable::onstack) string;
+				 			batch[i]->printf ("%i.%i", _id, i);
+				 		}
+				 		for (int i=0; i<NBATCH; ++i)
+				 		{
+				 			string want;
+				 			want.printf ("%i.%i", _id, i);
+				 			if (*(batch[i]) != want) failed = true;
+				 			delete batch[i];
+				 		}
+				 	}
+
+				 	if (_usepool)
+				 	{
+				 		// Free blocks that were allocated by the main thread.
+				 		for (int i=_id; i<NHANDOFF; i+=_nthreads)
+				 		{
+				 			if (handoff[i]->toint() != i) failed = true;
+				 			delete handoff[i];
+				 			handoff[i] = NULL;
+				 		}
+				 	}
+
+				 	if (failed) exclusivesection (failcount) failcount++;
+				 	exclusivesection (donecount) donecount++;
+				 }
+
+protected:
+	int			 _id;
+	int			 _nthreads;
+	bool		 _usepool;
+};
+
+class retain_contentiontestApp : public application
+{
+public:
+		 	 retain_contentiontestApp (void) :
+				application ("grace.testsuite.retain_contention")
+			 {
+			 }
+			~retain_contentiontestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	bool	 runset (int nthreads, bool usepool, double &elapsed);
+};
+
+APPOBJECT(retain_contentiontestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+int retain_contentiontestApp::main (void)
+{
+	static int nthreads[3] = { 1, 4, 16 };
+
+	for (int i=0; i<3; ++i)
+	{
+		double tpool, tmalloc;
+
+		if (! runset (nthreads[i], true, tpool)) FAIL("pool run failed");
+		if (! runset (nthreads[i], false, tmalloc)) FAIL("malloc run failed");
+
+		fout.writeln ("threads %2i: pool %.4fs malloc %.4fs"
+					  %format (nthreads[i], tpool, tmalloc));
+	}
+
+	return 0;
+}
+
+bool retain_contentiontestApp::runset (int nthreads, bool usepool,
+									   double &elapsed)
+{
+	for (int i=0; i<NHANDOFF; ++i)
+	{
+		handoff[i] = new (memory::retainable::onstack) string;
+		handoff[i]->printf ("%i", i);
+	}
+
+	exclusivesection (failcount) failcount = 0;
+	exclusivesection (donecount) donecount = 0;
+
+	double tstart = now ();
+	for (int i=0; i<nthreads; ++i) new worker (i, nthreads, usepool);
+
+	bool done = false;
+	for (int i=0; (i<60000) && (! done); ++i)
+	{
+		sharedsection (donecount) done = (donecount == nthreads);
+		if (! done) __musleep (1);
+	}
+	elapsed = now () - tstart;
+
+	if (! done)
+	{
+		ferr.writeln ("timeout");
+		return false;
+	}
+
+	sharedsection (failcount)
+	{
+		if (failcount)
+		{
+			ferr.writeln ("thread checks failed");
+			breaksection return false;
+		}
+	}
+
+	for (int i=0; i<NHANDOFF; ++i)
+	{
+		if (handoff[i])
+		{
+			if (usepool)
+			{
+				ferr.writeln ("handoff block not freed");
+				return false;
+			}
+			delete handoff[i];
+			handoff[i] = NULL;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,145 @@
+#include <grace/application.h>
+#include <grace/httpd.h>
+#include <grace/sslsocket.h>
+
+#include <sys/time.h>
+
+#define PORT 4281
+#define BULKSIZE (32 * 1024 * 1024)
+#define NROUNDS 3
+
+extern "C" void grace_init (void) { __THREADED = true; }
+
+class ssl_bulktestApp : public application
+{
+public:
+		 	 ssl_bulktestApp (void) :
+				application ("grace.testsuite.ssl_bulk")
+			 {
+			 }
+			~ssl_bulktestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (const string &bulk);
+};
+
+APPOBJECT(ssl_bulktestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class bulkpage : public httpdobject
+{
+public:
+			 bulkpage (httpd &parent, const string &b)
+			 	: httpdobject (parent, "*/bulk"), bulk (b)
+			 {
+			 }
+			~bulkpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = bulk;
+			 	outhdr["Content-type"] = "application/octet-stream";
+			 	return 200;
+			 }
+
+	const string &bulk;
+};
+
+// Downloads the bulk page over a fresh connection.
+static bool fetch (string &body)
+{
+	sslsocket s;
+	s.nocertcheck ();
+	if (! s.connect ("127.0.0.1", PORT)) return false;
+
+	string ln;
+	int sz = -1;
+	s.puts ("GET /bulk HTTP/1.0\r\nHost: localhost\r\n\r\n");
+	do
+	{
+		ln.crop ();
+		if (! s.waitforline (ln, 5000)) return false;
+		if (ln.strncasecmp ("Content-length: ", 16) == 0)
+		{
+			string len = ln.mid (16);
+			sz = len.toint ();
+		}
+	} while (ln.strlen());
+	if (sz < 0) return false;
+
+	body.crop ();
+	while ((int) body.strlen() < sz)
+	{
+		string data = s.read (sz - body.strlen(), 5000);
+		if (! data.strlen()) return false;
+		body.strcat (data);
+	}
+	s.close ();
+	return true;
+}
+
+int ssl_bulktestApp::main (void)
+{
+	string bulk;
+	for (int i=0; i<BULKSIZE; ++i) bulk.strcat ((char) ('a' + ((i*7)%26)));
+
+	httpsd srv (PORT);
+	bulkpage page (srv, bulk);
+	srv.loadkeyfile ("cert.pem");
+	srv.start ();
+
+	int res;
+	try
+	{
+		res = runtests (bulk);
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	srv.shutdown ();
+	return res;
+}
+
+int ssl_bulktestApp::runtests (const string &bulk)
+{
+	string body;
+	bool ok = false;
+	for (int i=0; (i<500) && (! ok); ++i)
+	{
+		ok = fetch (body);
+		if (! ok) __musleep (10);
+	}
+	if (! ok) FAIL("no server");
+	if (body != bulk) FAIL("body");
+
+	double best = 0.0;
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		double tstart = now ();
+		if (! fetch (body)) FAIL("fetch");
+		double rate = (BULKSIZE / (1024.0 * 1024.0)) / (now() - tstart);
+		if (rate > best) best = rate;
+		if (body.strlen() != BULKSIZE) FAIL("size");
+	}
+	if (body != bulk) FAIL("body after rounds");
+
+	fout.writeln ("%i MB over loopback https: %.1f MB/s"
+				  %format (BULKSIZE / (1024*1024), best));
+	return 0;
+}
@@ -0,0 +1,217 @@
+#include <grace/application.h>
+#include <grace/httpd.h>
+#include <grace/sslsocket.h>
+#include <grace/defaults.h>
+#include <grace/thread.h>
+
+#include <sys/time.h>
+
+#define PORT 4282
+#define LOOPPORT 4283
+#define NSTALLED 6
+#define NCLIENTS 20
+
+extern "C" void grace_init (void) { __THREADED = true; }
+
+class ssl_handshaketestApp : public application
+{
+public:
+		 	 ssl_handshaketestApp (void) :
+				application ("grace.testsuite.ssl_handshake")
+			 {
+			 }
+			~ssl_handshaketestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (httpsd &srv);
+};
+
+APPOBJECT(ssl_handshaketestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class okpage : public httpdobject
+{
+public:
+			 okpage (httpd &parent) : httpdobject (parent, "*/ok")
+			 {
+			 }
+			~okpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = "ok";
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+// Makes a connection, asks for a page and closes.
+static bool fetch (int port)
+{
+	sslsocket s;
+	s.nocertcheck ();
+	if (! s.connect ("127.0.0.1", port)) return false;
+
+	string ln;
+	s.puts ("GET /ok HTTP/1.0\r\nHost: localhost\r\n\r\n");
+	if (! s.waitforline (ln, 5000)) return false;
+	s.close ();
+	return (ln == "HTTP/1.1 200 OK");
+}
+
+// A client on a connection of its own.
+class fetcher : public thread
+{
+public:
+			 fetcher (void) : thread ("fetcher")
+			 {
+			 	ok = false;
+			 	done = false;
+			 	spawn ();
+			 }
+			~fetcher (void)
+			 {
+			 }
+
+	void	 run (void)
+			 {
+			 	ok = fetch (PORT);
+			 	done = true;
+			 }
+
+	volatile bool	 ok;
+	volatile bool	 done;
+};
+
+int ssl_handshaketestApp::main (void)
+{
+	// Fewer workers and handshake threads than stalled clients.
+	tune::ssl::handshakers = 4;
+	tune::ssl::handshakequeue = 16;
+
+	httpsd srv (PORT, 2, 2);
+	okpage page (srv);
+	srv.loadkeyfile ("cert.pem");
+	srv.start ();
+
+	int res;
+	try
+	{
+		res = runtests (srv);
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	srv.shutdown ();
+	if (res) return res;
+
+	// Event loops wait on the queue through listenfd().
+	httpsd lsrv (LOOPPORT, 2, 2);
+	okpage lpage (lsrv);
+	lsrv.eventloops (1);
+	lsrv.loadkeyfile ("cert.pem");
+	lsrv.start ();
+
+	bool ok = false;
+	for (int i=0; (i<500) && (! ok); ++i)
+	{
+		ok = fetch (LOOPPORT);
+		if (! ok) __musleep (10);
+	}
+	lsrv.shutdown ();
+	if (! ok) FAIL("no event loop server");
+	return 0;
+}
+
+int ssl_handshaketestApp::runtests (httpsd &srv)
+{
+	ssllistener &pool = srv.handshakepool ();
+
+	bool ok = false;
+	for (int i=0; (i<500) && (! ok); ++i)
+	{
+		ok = fetch (PORT);
+		if (! ok) __musleep (10);
+	}
+	if (! ok) FAIL("no server");
+
+	// Clients that never start their handshake hold up neither the
+	// handshake threads nor the workers, everyone else gets served.
+	tcpsocket stalled[NSTALLED];
+	for (int i=0; i<NSTALLED; ++i)
+	{
+		if (! stalled[i].connect ("127.0.0.1", PORT)) FAIL("stalled connect");
+	}
+	for (int i=0; (i<200) && (pool.handshaking() < NSTALLED); ++i)
+	{
+		__musleep (10);
+	}
+	if (pool.handshaking() != NSTALLED) FAIL("stalled clients not seen");
+
+	double tstart = now ();
+	if (! fetch (PORT)) FAIL("fetch next to stalled clients");
+	double tfetch = now() - tstart;
+	fout.writeln ("fetch next to %i stalled clients: %.4fs"
+				  %format (NSTALLED, tfetch));
+	if (tfetch > 2.0) FAIL("stalled clients held up the workers");
+
+	for (int i=0; i<NSTALLED; ++i) stalled[i].close ();
+	for (int i=0; (i<200) && (pool.failedhandshakes() < NSTALLED); ++i)
+	{
+		__musleep (10);
+	}
+	if (pool.failedhandshakes() != NSTALLED) FAIL("failed handshakes");
+
+	// A burst of new clients.
+	unsigned int before = pool.handshakes ();
+	fetcher *f[NCLIENTS];
+
+	tstart = now ();
+	for (int i=0; i<NCLIENTS; ++i) f[i] = new fetcher;
+	for (int i=0; i<NCLIENTS; ++i)
+	{
+		for (int j=0; (j<1000) && (! f[i]->done); ++j) __musleep (10);
+	}
+	double tburst = now() - tstart;
+
+	int nok = 0;
+	for (int i=0; i<NCLIENTS; ++i)
+	{
+		if (f[i]->done && f[i]->ok) nok++;
+	}
+	for (int i=0; i<NCLIENTS; ++i)
+	{
+		__musleep (10);
+		delete f[i];
+	}
+
+	fout.writeln ("%i concurrent clients: %.4fs, %i handshakes, "
+				  "%.2fms average, %.2fms max"
+				  %format (NCLIENTS, tburst, pool.handshakes(),
+				  		   pool.handshaketime(), pool.maxhandshaketime()));
+
+	if (nok != NCLIENTS) FAIL("burst clients failed");
+	if ((pool.handshakes() - before) != NCLIENTS) FAIL("handshake count");
+	if (pool.handshaketime() <= 0.0) FAIL("handshake time");
+	if (pool.maxhandshaketime() < pool.handshaketime()) FAIL("max time");
+	if (pool.queued()) FAIL("connections left in the queue");
+	if (pool.handshaking()) FAIL("handshakes left in progress");
+
+	return 0;
+}
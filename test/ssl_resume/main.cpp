@@ -0,0 +1,158 @@
+#include <grace/application.h>
+#include <grace/httpd.h>
+#include <grace/sslsocket.h>
+#include <grace/defaults.h>
+
+#include <sys/time.h>
+
+#define PORT 4280
+#define NCONNECTS 50
+
+extern "C" void grace_init (void) { __THREADED = true; }
+
+class ssl_resumetestApp : public application
+{
+public:
+		 	 ssl_resumetestApp (void) :
+				application ("grace.testsuite.ssl_resume")
+			 {
+			 }
+			~ssl_resumetestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	int		 runtests (void);
+};
+
+APPOBJECT(ssl_resumetestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class okpage : public httpdobject
+{
+public:
+			 okpage (httpd &parent) : httpdobject (parent, "*/ok")
+			 {
+			 }
+			~okpage (void)
+			 {
+			 }
+
+	int		 run (string &uri, string &postbody, value &inhdr,
+				  string &out, value &outhdr, value &env, tcpsocket &s)
+			 {
+			 	out = "ok";
+			 	outhdr["Content-type"] = "text/plain";
+			 	return 200;
+			 }
+};
+
+// Makes a connection, asks for a page and closes. Returns the
+// number of resumed handshakes (0 or 1), or -1 on failure.
+static int fetch (void)
+{
+	sslsocket s;
+	s.nocertcheck ();
+	if (! s.connect ("127.0.0.1", PORT)) return -1;
+
+	string ln;
+	s.puts ("GET /ok HTTP/1.0\r\nHost: localhost\r\n\r\n");
+	if (! s.waitforline (ln, 5000)) return -1;
+	if (ln != "HTTP/1.1 200 OK") return -1;
+
+	int res = s.resumed() ? 1 : 0;
+	s.close ();
+	return res;
+}
+
+// Returns the number of handshakes per second over NCONNECTS
+// connections, or -1 on failure.
+static double rate (int &resumed)
+{
+	resumed = 0;
+	double tstart = now ();
+	for (int i=0; i<NCONNECTS; ++i)
+	{
+		int r = fetch ();
+		if (r < 0) return -1;
+		resumed += r;
+	}
+	return NCONNECTS / (now() - tstart);
+}
+
+int ssl_resumetestApp::main (void)
+{
+	httpsd srv (PORT);
+	okpage ok (srv);
+	srv.loadkeyfile ("cert.pem");
+	srv.start ();
+
+	int res;
+	try
+	{
+		res = runtests ();
+	}
+	catch (exception e)
+	{
+		ferr.writeln ("exception: %s" %format (e.description));
+		res = 1;
+	}
+
+	srv.shutdown ();
+	return res;
+}
+
+int ssl_resumetestApp::runtests (void)
+{
+	int r = -1;
+	for (int i=0; (i<500) && (r < 0); ++i)
+	{
+		r = fetch ();
+		if (r < 0) __musleep (10);
+	}
+	if (r < 0) FAIL("no server");
+
+	// Every connection resumes the session of the one before.
+	int resumed;
+	double tresume = rate (resumed);
+	if (tresume < 0) FAIL("resumed connects");
+	if (resumed != NCONNECTS) FAIL("sessions not resumed");
+
+	// Nothing kept once the kept session expired, nothing resumed.
+	tune::ssl::sessions = 0;
+	tune::ssl::sessionlife = 0;
+	__musleep (1100);
+
+	double tfull = rate (resumed);
+	if (tfull < 0) FAIL("full connects");
+	if (resumed) FAIL("resumed without a kept session");
+
+	fout.writeln ("%i connections: %.1f/s full handshake, "
+				  "%.1f/s resumed" %format (NCONNECTS, tfull, tresume));
+
+	// And back again.
+	tune::ssl::sessions = 256;
+	tune::ssl::sessionlife = 3600;
+	if (fetch () != 0) FAIL("first after enable");
+	if (fetch () != 1) FAIL("second after enable");
+
+	httpssocket hs;
+	hs.nocertcheck ();
+	hs.nokeepalive ();
+	for (int i=0; i<2; ++i)
+	{
+		string body = hs.get ("https://127.0.0.1:%i/ok" %format (PORT));
+		if (body != "ok") FAIL("httpssocket body");
+	}
+	if (! hs.resumed()) FAIL("httpssocket not resumed");
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/thread.h>
+
+#include <sys/time.h>
+
+#define NKEYS 1024
+#define NROUNDS 400000
+
+lock<int> donecount;
+lock<int> failcount;
+statstring keys[NKEYS];
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class worker : public thread
+{
+public:
+				 worker (int id, int nthreads) : thread ("worker")
+				 {
+				 	_id = id;
+				 	_nthreads = nthreads;
+				 	spawn ();
+				 }
+				~worker (void) {}
+
+	void		 run (void)
+				 {
+				 	int nrounds = NROUNDS / _nthreads;
+				 	bool failed = false;
+				 	char buf[64];
+
+				 	for (int i=0; i<nrounds; ++i)
+				 	{
+				 		const statstring &k = keys[i & (NKEYS-1)];
+
+				 		// Copies of a live key never touch the table.
+				 		statstring cp = k;
+				 		statstring cp2 = cp;
+				 		if (cp2.id() != k.id()) failed = true;
+
+				 		// Looking a live key up by its text has to find
+				 		// the same reference.
+				 		if ((i & 7) == 0)
+				 		{
+				 			statstring byname = k.str();
+				 			if (byname.id() != k.id()) failed = true;
+				 		}
+
+				 		// Short-lived keys that nobody else holds, to
+				 		// keep the reaper busy.
+				 		if ((i & 15) == 0)
+				 		{
+				 			sprintf (buf, "tmp-%i-%i", _id, i);
+				 			statstring tmp = buf;
+				 			statstring tmp2 = (const char *) buf;
+				 			if (tmp.id() != tmp2.id()) failed = true;
+				 			if (tmp != buf) failed = true;
+				 		}
+				 	}
+
+				 	if (failed) exclusivesection (failcount) failcount++;
+				 	exclusivesection (donecount) donecount++;
+				 }
+
+protected:
+	int			 _id;
+	int			 _nthreads;
+};
+
+class statstring_threadstestApp : public application
+{
+public:
+		 	 statstring_threadstestApp (void) :
+				application ("grace.testsuite.statstring_threads")
+			 {
+			 }
+			~statstring_threadstestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	bool	 runset (int nthreads, double &elapsed);
+};
+
+APPOBJECT(statstring_threadstestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+int statstring_threadstestApp::main (void)
+{
+	static int nthreads[3] = { 1, 4, 16 };
+
+	for (int i=0; i<NKEYS; ++i)
+	{
+		keys[i] = "key-%i" %format (i);
+	}
+
+	for (int i=0; i<3; ++i)
+	{
+		double elapsed;
+		if (! runset (nthreads[i], elapsed)) FAIL("run failed");
+		fout.writeln ("threads %2i: %.4fs" %format (nthreads[i], elapsed));
+	}
+
+	// Keys that were dropped and reaped can be interned again.
+	for (int i=0; i<NKEYS; ++i)
+	{
+		statstring k = "key-%i" %format (i);
+		if (k.id() != keys[i].id()) FAIL("live key changed id");
+		if (k != keys[i]) FAIL("live key mismatch");
+	}
+
+	statstring a = "reborn";
+	a.clear ();
+	for (int i=0; i<4096; ++i)
+	{
+		statstring junk = "junk-%i" %format (i);
+	}
+	a = "reborn";
+	statstring b = "reborn";
+	if (a.id() != b.id()) FAIL("reinterned key mismatch");
+	if (a.sval() != "reborn") FAIL("reinterned key text mismatch");
+
+	return 0;
+}
+
+bool statstring_threadstestApp::runset (int nthreads, double &elapsed)
+{
+	exclusivesection (failcount) failcount = 0;
+	exclusivesection (donecount) donecount = 0;
+
+	double tstart = now ();
+	for (int i=0; i<nthreads; ++i) new worker (i, nthreads);
+
+	bool done = false;
+	for (int i=0; (i<60000) && (! done); ++i)
+	{
+		sharedsection (donecount) done = (donecount == nthreads);
+		if (! done) __musleep (1);
+	}
+	elapsed = now () - tstart;
+
+	if (! done)
+	{
+		ferr.writeln ("timeout");
+		return false;
+	}
+
+	sharedsection (failcount)
+	{
+		if (failcount)
+		{
+			ferr.writeln ("thread checks failed");
+			breaksection return false;
+		}
+	}
+
+	return true;
+}
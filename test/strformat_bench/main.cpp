@@ -0,0 +1,95 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+
+#include <sys/time.h>
+
+#define NROUNDS 100000
+
+class strformat_benchtestApp : public application
+{
+public:
+		 	 strformat_benchtestApp (void) :
+				application ("grace.testsuite.strformat_bench")
+			 {
+			 }
+			~strformat_benchtestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+};
+
+APPOBJECT(strformat_benchtestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+int strformat_benchtestApp::main (void)
+{
+	value ev;
+	ev["ip"] = "192.168.1.10";
+	ev["method"] = "GET";
+	ev["httpver"] = "1.1";
+	ev["status"] = 200;
+	ev["bytes"] = 5120;
+	ev["referrer"] = "http://www.example.net/index.html";
+	ev["useragent"] = "Mozilla/5.0 (X11; Linux x86_64) \"quoted\"";
+	string remuser = "-";
+	string timestr = "17/Oct/2026:21:22:31 +0000";
+	string uri = "/images/logo.png";
+
+	string want = "192.168.1.10 - - [17/Oct/2026:21:22:31 +0000] "
+				  "\"GET /images/logo.png HTTP/1.1\" 200 5120 "
+				  "\"http://www.example.net/index.html\" "
+				  "\"Mozilla/5.0 (X11; Linux x86_64) \\\"quoted\\\"\"\n";
+
+	// The access log line written by httpdlogger.
+	double tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		string line = "%[ip]s - %{1}S [%{2}s] \"%[method]s %{3}s "
+					  "HTTP/%[httpver]s\" %[status]i %[bytes]i "
+					  "\"%[referrer]S\" \"%[useragent]S\"\n"
+					  %format (ev, remuser, timestr, uri);
+		if ((i == 0) && (line != want))
+		{
+			ferr.writeln ("got: %s" %format (line));
+			FAIL("access line mismatch");
+		}
+	}
+	fout.writeln ("access line: %.4fs" %format (now() - tstart));
+
+	// A response header line.
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		string hdr = "HTTP/1.1 %i %s\r\n" %format (200, "OK");
+		if ((i == 0) && (hdr != "HTTP/1.1 200 OK\r\n")) FAIL("header mismatch");
+	}
+	fout.writeln ("status line: %.4fs" %format (now() - tstart));
+
+	// Formats that live in reused memory still get parsed again.
+	char buf[64];
+	::strcpy (buf, "a=%i");
+	string r1 = buf %format (1);
+	::strcpy (buf, "b=%s!");
+	string r2 = buf %format ("x");
+	if (r1 != "a=1") FAIL("reused buffer first format");
+	if (r2 != "b=x!") FAIL("reused buffer second format");
+
+	// Odd corners of the parser.
+	string odd = "%% %c %5i|%-4s|%{0}i %" %format (65, 42, "ab");
+	if (odd != "% A    42|  ab|65 ")
+	{
+		ferr.writeln ("got: [%s]" %format (odd));
+		FAIL("odd corners");
+	}
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+
+#include <sys/time.h>
+#include <utility>
+#include <string>
+
+#define NROUNDS 1000000
+
+class string_smalltestApp : public application
+{
+public:
+		 	 string_smalltestApp (void) :
+				application ("grace.testsuite.string_small")
+			 {
+			 }
+			~string_smalltestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+};
+
+APPOBJECT(string_smalltestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+int string_smalltestApp::main (void)
+{
+	double tstart;
+	int total = 0;
+
+	// Short strings growing past the inline storage, and back.
+	string grow;
+	for (int i=0; i<64; ++i)
+	{
+		grow.strcat ((char) ('a' + (i % 26)));
+		if (grow.strlen() != (unsigned int) (i+1)) FAIL("strcat size");
+		if (grow[-1] != ('a' + (i % 26))) FAIL("strcat data");
+	}
+	grow.crop (5);
+	if (grow != "abcde") FAIL("crop");
+
+	// Copies of short strings are independent.
+	string a = "Content-Type";
+	string b = a;
+	b.strcat (": text/html");
+	if (a != "Content-Type") FAIL("copy changed original");
+	if (b != "Content-Type: text/html") FAIL("copy data");
+	a = b;
+	a.ctolower ();
+	if (b != "Content-Type: text/html") FAIL("long copy changed original");
+	if (a != "content-type: text/html") FAIL("long copy data");
+
+	// Moves out of an inline string.
+	string m1 = "short";
+	string m2 = std::move (m1);
+	if (m2 != "short") FAIL("move data");
+	if (m1.strlen()) FAIL("moved-from not empty");
+
+	// Substrings of short and long strings.
+	string s = "0123456789";
+	string l = s.left (4);
+	string r = s.mid (4, 3);
+	if (l != "0123") FAIL("left");
+	if (r != "456") FAIL("mid");
+	l.strcat ("x");
+	if (s != "0123456789") FAIL("left changed original");
+
+	// Appending to a string that starts further into its block.
+	string o = "abcdefghijklmnopqr";
+	o = o.mid (7);
+	o.strcat ("hello world");
+	o.strcat ("hello world");
+	if (o != "hijklmnopqrhello worldhello world") FAIL("append after mid");
+
+	// The same for every append flavour, start and length.
+	for (int start=0; start<40; ++start)
+	{
+		for (int cut=0; cut<start; ++cut)
+		{
+			std::string model;
+			string base;
+			for (int i=0; i<start; ++i)
+			{
+				base.strcat ((char) ('a' + (i % 26)));
+				if (i >= cut) model += (char) ('a' + (i % 26));
+			}
+			string t = base.mid (cut);
+			string part = "0123456789abcdef";
+			for (int round=0; round<6; ++round)
+			{
+				switch (round % 3)
+				{
+					case 0: t.strcat (part); model += part.str(); break;
+					case 1: t.strcat ("xyz"); model += "xyz"; break;
+					case 2: t.strcat ('!'); model += '!'; break;
+				}
+				if ((t.strlen() != model.size()) || (model != t.str()))
+				{
+					ferr.writeln ("start %i cut %i round %i: %s"
+								  %format (start, cut, round, t));
+					FAIL("append after mid model");
+				}
+			}
+		}
+	}
+
+	// Escaping rebuilds the string from its own data.
+	string e = "it's";
+	e.escape ();
+	if (e != "it\\'s") FAIL("escape");
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		string t;
+		t.strcat ("key");
+		t.strcat ('-');
+		t.strcat ("abc");
+		total += t.strlen();
+	}
+	fout.writeln ("strcat: %.4fs" %format (now() - tstart));
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		string t;
+		t.strcpy ("Content-Length");
+		string u = t;
+		total += u.strlen();
+	}
+	fout.writeln ("strcpy: %.4fs" %format (now() - tstart));
+
+	string src = "Accept-Encoding: gzip";
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		string t = src.mid (8, 8);
+		total += t.strlen();
+	}
+	fout.writeln ("mid: %.4fs" %format (now() - tstart));
+
+	tstart = now ();
+	for (int i=0; i<NROUNDS; ++i)
+	{
+		string t = src.left (6);
+		total += t.strlen();
+	}
+	fout.writeln ("left: %.4fs" %format (now() - tstart));
+
+	if (total != (NROUNDS * (7 + 14 + 8 + 6))) FAIL("benchmark sizes");
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/thread.h>
+
+#include <sys/time.h>
+
+#define PAYLOADSZ (4*1024*1024)
+#define NWORKERS 4
+#define NCOPIES 1000
+
+lock<int> donecount;
+lock<int> failcount;
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+class worker : public thread
+{
+public:
+				 worker (void) : thread ("worker")
+				 {
+				 	spawn ();
+				 }
+				~worker (void) {}
+
+	void		 run (void)
+				 {
+				 	value ev = waitevent ();
+				 	const string &payload = ev["payload"].sval();
+				 	bool failed = false;
+
+				 	for (int i=0; i<NCOPIES; ++i)
+				 	{
+				 		// Copies of data from another thread should share
+				 		// its buffer.
+				 		string cp = payload;
+				 		if (cp.strlen() != PAYLOADSZ) failed = true;
+
+				 		// Writing to a copy leaves the original alone.
+				 		if ((i & 63) == 0)
+				 		{
+				 			cp.strcat ('!');
+				 			if (cp.strlen() != (PAYLOADSZ+1)) failed = true;
+				 			if (payload.strlen() != PAYLOADSZ) failed = true;
+				 			if (payload[-1] != 'x') failed = true;
+				 		}
+
+				 		value v = ev;
+				 		if (v["payload"].sval().strlen() != PAYLOADSZ) failed = true;
+				 	}
+
+				 	if (failed) exclusivesection (failcount) failcount++;
+				 	exclusivesection (donecount) donecount++;
+				 }
+};
+
+class string_threadsharetestApp : public application
+{
+public:
+		 	 string_threadsharetestApp (void) :
+				application ("grace.testsuite.string_threadshare")
+			 {
+			 }
+			~string_threadsharetestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+};
+
+APPOBJECT(string_threadsharetestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+int string_threadsharetestApp::main (void)
+{
+	string payload;
+	worker *workers[NWORKERS];
+
+	for (int i=0; i<PAYLOADSZ; ++i) payload.strcat ('x');
+
+	exclusivesection (failcount) failcount = 0;
+	exclusivesection (donecount) donecount = 0;
+
+	double tstart = now ();
+
+	for (int i=0; i<NWORKERS; ++i)
+	{
+		value ev;
+		ev["payload"] = payload;
+		workers[i] = new worker;
+		workers[i]->sendevent ("payload", ev);
+	}
+
+	bool done = false;
+	for (int i=0; (i<60000) && (! done); ++i)
+	{
+		sharedsection (donecount) done = (donecount == NWORKERS);
+		if (! done) __musleep (1);
+	}
+
+	fout.writeln ("%i workers, %i copies of %i bytes: %.4fs"
+				  %format (NWORKERS, NCOPIES, PAYLOADSZ, now() - tstart));
+
+	if (! done) FAIL("timeout");
+	sharedsection (failcount)
+	{
+		if (failcount) breaksection FAIL("thread checks failed");
+	}
+
+	// The workers' copies are gone, the original should be intact.
+	if (payload.strlen() != PAYLOADSZ) FAIL("payload size changed");
+	if (payload[0] != 'x') FAIL("payload changed");
+
+	return 0;
+}
@@ -0,0 +1,349 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/strutil.h>
+#include <grace/checksum.h>
+
+#include <sys/time.h>
+
+#define NKEYS 20000
+
+// Replica of the unbalanced checksum tree that value used to index its
+// keyed children with, kept around for benchmark comparison.
+class treenode
+{
+public:
+				 treenode (const statstring &k)
+				 {
+				 	id = k;
+				 	key = checksum (k.str());
+				 	lower = higher = NULL;
+				 }
+				~treenode (void)
+				 {
+				 	if (lower) delete lower;
+				 	if (higher) delete higher;
+				 }
+
+	statstring	 id;
+	unsigned int key;
+	treenode	*lower, *higher;
+};
+
+class checksumtree
+{
+public:
+				 checksumtree (void) { root = NULL; }
+				~checksumtree (void) { if (root) delete root; }
+
+	void		 insert (const statstring &k)
+				 {
+				 	treenode *n = new treenode (k);
+				 	if (! root) { root = n; return; }
+				 	treenode *crsr = root;
+				 	while (true)
+				 	{
+				 		if (n->key < crsr->key)
+				 		{
+				 			if (! crsr->lower) { crsr->lower = n; return; }
+				 			crsr = crsr->lower;
+				 		}
+				 		else
+				 		{
+				 			if (! crsr->higher) { crsr->higher = n; return; }
+				 			crsr = crsr->higher;
+				 		}
+				 	}
+				 }
+
+	bool		 exists (const statstring &k)
+				 {
+				 	unsigned int ki = checksum (k.str());
+				 	treenode *crsr = root;
+				 	while (crsr)
+				 	{
+				 		if (ki < crsr->key) crsr = crsr->lower;
+				 		else
+				 		{
+				 			if ((ki == crsr->key) &&
+				 				(::strcasecmp (k.str(), crsr->id.str()) == 0))
+				 			{
+				 				return true;
+				 			}
+				 			crsr = crsr->higher;
+				 		}
+				 	}
+				 	return false;
+				 }
+
+protected:
+	treenode	*root;
+};
+
+class value_bigdicttestApp : public application
+{
+public:
+		 	 value_bigdicttestApp (void) :
+				application ("grace.testsuite.value_bigdict")
+			 {
+			 }
+			~value_bigdicttestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	bool	 runset (const char *name, const value &keys);
+	double	 drainset (int nkeys);
+};
+
+APPOBJECT(value_bigdicttestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static bool checksumOrder (value *l, value *r, const string &opt)
+{
+	return checksum (l->cval()) > checksum (r->cval());
+}
+
+int value_bigdicttestApp::main (void)
+{
+	value seqkeys, randkeys, advkeys;
+
+	for (int i=0; i<NKEYS; ++i)
+	{
+		seqkeys.newval() = "key%05i" %format (i);
+		randkeys.newval() = strutil::uuid ();
+	}
+
+	// Keys inserted in ascending checksum order turn the old tree into
+	// a linked list.
+	advkeys = randkeys;
+	advkeys.sort (checksumOrder);
+
+	if (! runset ("sequential", seqkeys)) return 1;
+	if (! runset ("random", randkeys)) return 1;
+	if (! runset ("adversarial", advkeys)) return 1;
+
+	// Removal has to keep the index consistent.
+	value d;
+	foreach (k, seqkeys) d[k.sval()] = k.sval();
+	for (int i=0; i<NKEYS; i+=2) d.rmval (seqkeys[i].sval());
+	if (d.count() != NKEYS/2) FAIL("count mismatch after removal");
+	for (int i=0; i<NKEYS; ++i)
+	{
+		bool want = (i & 1);
+		if (d.exists (seqkeys[i].sval()) != want) FAIL("removal mismatch");
+	}
+
+	// Draining a dictionary one key at a time, from either end, should
+	// cost time proportional to the number of keys removed.
+	value q;
+	double tstart;
+	foreach (k, randkeys) q[k.sval()] = k.sval();
+	tstart = now ();
+	for (int i=0; i<NKEYS/2; ++i)
+	{
+		q.rmval (randkeys[i].sval());
+		q.rmval (randkeys[NKEYS-1-i].sval());
+		if ((i & 1023) == 0)
+		{
+			if (! q.exists (randkeys[NKEYS/2].sval())) FAIL("drain lost key");
+			if (q.exists (randkeys[i].sval())) FAIL("drain kept key");
+		}
+	}
+	if (q.count()) FAIL("drain left keys");
+	fout.writeln ("drain: %.4fs" %format (now() - tstart));
+	
+	// Draining in an order unrelated to the insertion order should
+	// scale the same way. Eight times the keys may take a few times
+	// eight times as long, not sixty-four.
+	double tsmall = drainset (NKEYS);
+	if (tsmall < 0) return 1;
+	double tlarge = drainset (8 * NKEYS);
+	if (tlarge < 0) return 1;
+	fout.writeln ("random drain: %.4fs / %.4fs" %format (tsmall, tlarge));
+	if (tsmall < 0.002) tsmall = 0.002;
+	if (tlarge > (24 * tsmall)) FAIL("random drain does not scale");
+
+	// Unkeyed and keyed children mixed in a single node.
+	value mixed;
+	for (int i=0; i<64; ++i)
+	{
+		statstring k = "k%i" %format (i);
+		mixed.newval() = i;
+		mixed[k] = i;
+	}
+	mixed.rmindex (0);
+	mixed.rmval ("k0");
+	for (int i=1; i<64; ++i)
+	{
+		statstring k = "k%i" %format (i);
+		if (mixed[k].ival() != i) FAIL("mixed lookup failed");
+		if (mixed[i-1].ival() != i) FAIL("mixed index failed");
+	}
+
+	// Appends that grow the array after removals at the front, used
+	// as a queue. The model is the range of numbers still in it.
+	value fifo;
+	int qfirst = 0;
+	int qnext = 0;
+	for (int round=0; round<2000; ++round)
+	{
+		int nadd = 1 + (round % 7);
+		for (int i=0; i<nadd; ++i) fifo.newval() = qnext++;
+		int nrm = (round % 5);
+		for (int i=0; (i<nrm) && fifo.count(); ++i)
+		{
+			fifo.rmindex (0);
+			qfirst++;
+		}
+	}
+	if (fifo.count() != (qnext - qfirst)) FAIL("queue count mismatch");
+	for (int i=0; i<fifo.count(); ++i)
+	{
+		if (fifo[i].ival() != (qfirst + i)) FAIL("queue content mismatch");
+	}
+
+	value kfifo;
+	qfirst = qnext = 0;
+	for (int round=0; round<2000; ++round)
+	{
+		int nadd = 1 + (round % 7);
+		for (int i=0; i<nadd; ++i)
+		{
+			statstring k = "q%i" %format (qnext);
+			kfifo[k] = qnext++;
+		}
+		int nrm = (round % 5);
+		for (int i=0; (i<nrm) && kfifo.count(); ++i)
+		{
+			kfifo.rmindex (0);
+			qfirst++;
+		}
+	}
+	if (kfifo.count() != (qnext - qfirst)) FAIL("keyed queue count mismatch");
+	for (int i=0; i<kfifo.count(); ++i)
+	{
+		statstring k = "q%i" %format (qfirst + i);
+		if (kfifo[i].ival() != (qfirst + i)) FAIL("keyed queue mismatch");
+		if (kfifo[k].ival() != (qfirst + i)) FAIL("keyed queue lookup");
+	}
+	statstring gone = "q%i" %format (qfirst - 1);
+	if (kfifo.exists (gone)) FAIL("keyed queue kept key");
+
+	// Case-insensitive key matching.
+	if (! d.exists ("KEY00001")) FAIL("case insensitive lookup failed");
+
+	return 0;
+}
+
+double value_bigdicttestApp::drainset (int nkeys)
+{
+	value keys, order, q;
+	
+	for (int i=0; i<nkeys; ++i) keys.newval() = strutil::uuid ();
+	order = keys;
+	order.sort (checksumOrder);
+	foreach (k, keys) q[k.sval()] = k.sval();
+	
+	double tstart = now ();
+	for (int i=0; i<nkeys; ++i)
+	{
+		q.rmval (order[i].sval());
+		if (q.exists (order[i].sval()))
+		{
+			ferr.printf ("random drain kept key\n");
+			return -1.0;
+		}
+	}
+	double res = now () - tstart;
+	
+	if (q.count())
+	{
+		ferr.printf ("random drain left keys\n");
+		return -1.0;
+	}
+	
+	// Half-way through, whatever is left should still be in
+	// insertion order.
+	foreach (k, keys) q[k.sval()] = k.sval();
+	for (int i=0; i<nkeys; i+=2) q.rmval (order[i].sval());
+	
+	int pos = 0;
+	foreach (node, q)
+	{
+		while ((pos < nkeys) && (keys[pos].sval() != node.id().sval())) ++pos;
+		if (pos == nkeys)
+		{
+			ferr.printf ("random drain broke the order\n");
+			return -1.0;
+		}
+	}
+	if (q.count() != (nkeys/2))
+	{
+		ferr.printf ("random drain count mismatch\n");
+		return -1.0;
+	}
+	
+	return res;
+}
+
+bool value_bigdicttestApp::runset (const char *name, const value &keys)
+{
+	value dict;
+	checksumtree tree;
+	double tstart, tinsert, tlookup, tt_insert, tt_lookup;
+
+	tstart = now ();
+	foreach (k, keys) dict[k.sval()] = 1;
+	tinsert = now () - tstart;
+
+	tstart = now ();
+	foreach (k, keys)
+	{
+		if (! dict.exists (k.sval()))
+		{
+			ferr.printf ("%s: key %s not found\n", name, k.cval());
+			return false;
+		}
+	}
+	tlookup = now () - tstart;
+
+	if (dict.count() != keys.count())
+	{
+		ferr.printf ("%s: count mismatch\n", name);
+		return false;
+	}
+
+	if (dict.exists ("nonexistent"))
+	{
+		ferr.printf ("%s: found nonexistent key\n", name);
+		return false;
+	}
+
+	tstart = now ();
+	foreach (k, keys) tree.insert (k.sval());
+	tt_insert = now () - tstart;
+
+	tstart = now ();
+	foreach (k, keys)
+	{
+		if (! tree.exists (k.sval()))
+		{
+			ferr.printf ("%s: tree key %s not found\n", name, k.cval());
+			return false;
+		}
+	}
+	tt_lookup = now () - tstart;
+
+	fout.writeln ("%s: hash insert %.4fs lookup %.4fs | "
+				  "tree insert %.4fs lookup %.4fs"
+				  %format (name, tinsert, tlookup, tt_insert, tt_lookup));
+	return true;
+}
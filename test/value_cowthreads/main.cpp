@@ -0,0 +1,233 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/thread.h>
+#include <grace/strutil.h>
+
+#include <sys/time.h>
+
+#define NRECORDS 64
+#define NREADERS 4
+#define NROUNDS 500
+
+lock<value> db;
+lock<int> failcount;
+lock<int> donecount;
+
+static void fail (const char *msg)
+{
+	ferr.writeln (msg);
+	exclusivesection (failcount) failcount++;
+}
+
+// Keeps rewriting the shared database in place, while the readers
+// hold copies that share its nodes.
+class producer : public thread
+{
+public:
+				 producer (void) : thread ("producer")
+				 {
+				 	spawn ();
+				 }
+				~producer (void) {}
+	
+	void		 run (void)
+				 {
+				 	for (int gen=1; gen<=NROUNDS; ++gen)
+				 	{
+				 		exclusivesection (db)
+				 		{
+				 			db["gen"] = gen;
+				 			for (int i=0; i<NRECORDS; ++i)
+				 			{
+				 				db["records"][i]["gen"] = gen;
+				 			}
+				 			foreach (rec, db["records"])
+				 			{
+				 				if (rec["gen"].ival() != gen)
+				 				{
+				 					fail ("producer: reader write leaked");
+				 				}
+				 			}
+				 		}
+				 		__musleep (rand() & 1);
+				 	}
+				 	exclusivesection (donecount) donecount++;
+				 }
+};
+
+// Takes snapshots of the database and checks that they stay
+// consistent while the producer changes the original.
+class reader : public thread
+{
+public:
+				 reader (void) : thread ("reader")
+				 {
+				 	spawn ();
+				 }
+				~reader (void) {}
+	
+	void		 run (void)
+				 {
+				 	for (int round=0; round<NROUNDS; ++round)
+				 	{
+				 		value snap;
+				 		sharedsection (db)
+				 		{
+				 			snap = db;
+				 		}
+				 		
+				 		const value &c = snap;
+				 		const string &gen = c["gen"].sval();
+				 		
+				 		foreach (rec, c["records"])
+				 		{
+				 			if (rec["gen"].sval() != gen)
+				 			{
+				 				fail ("reader: snapshot changed underneath");
+				 				break;
+				 			}
+				 			if (rec["name"].sval().strlen() != 36)
+				 			{
+				 				fail ("reader: bad string payload");
+				 				break;
+				 			}
+				 		}
+				 		
+				 		// Changing our copy must not leak into the database
+				 		// or into a copy of the copy.
+				 		value mine = snap;
+				 		snap["records"][round % NRECORDS]["gen"] = -1;
+				 		snap["records"].rmindex (0);
+				 		if (mine["records"].count() != NRECORDS)
+				 		{
+				 			fail ("reader: copy lost a record");
+				 		}
+				 		if (mine["records"][round % NRECORDS]["gen"] == -1)
+				 		{
+				 			fail ("reader: copy saw a write");
+				 		}
+				 	}
+				 	exclusivesection (donecount) donecount++;
+				 }
+};
+
+class value_cowthreadstestApp : public application
+{
+public:
+		 	 value_cowthreadstestApp (void) :
+				application ("grace.testsuite.value_cowthreads")
+			 {
+			 }
+			~value_cowthreadstestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+};
+
+APPOBJECT(value_cowthreadstestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+int value_cowthreadstestApp::main (void)
+{
+	// A tree of roughly 10MB. Copies should not cost more than the
+	// top node, changing a copy should only clone the changed path.
+	value big;
+	string payload;
+	payload.pad (500, 'x');
+	for (int i=0; i<20000; ++i)
+	{
+		value &rec = big["records"].newval();
+		rec["id"] = i;
+		rec["payload"] = payload;
+	}
+	
+	double tstart = now ();
+	for (int i=0; i<1000; ++i)
+	{
+		value copy = big;
+		if (copy["records"].count() != 20000) FAIL("copy lost records");
+	}
+	double tcopy = now () - tstart;
+	
+	value copy = big;
+	copy["records"][123]["id"] = -1;
+	copy["records"].newval() = "extra";
+	if (big["records"][123]["id"].ival() != 123) FAIL("write leaked to original");
+	if (big["records"].count() != 20000) FAIL("append leaked to original");
+	big["records"][124]["id"] = -2;
+	if (copy["records"][124]["id"].ival() != 124) FAIL("write leaked to copy");
+	if (copy["records"][123]["id"].ival() != -1) FAIL("copy lost its write");
+	
+	value sorted = copy["records"];
+	sorted.sort (valueSort, "id");
+	if (copy["records"][0]["id"].ival() != 0) FAIL("sort leaked to original");
+	
+	// Conversions only read, even from a non-const copy. The second
+	// row is shorter than the first, its missing column must not be
+	// filled in on the original.
+	value rows;
+	rows[0]["a"] = 1;
+	rows[0]["b"] = 2;
+	rows[1]["a"] = 3;
+	value rowcopy = rows;
+	string csv = rowcopy.tocsv (false);
+	string grace = rowcopy.tograce ();
+	if (rows[1].count() != 1) FAIL("tocsv wrote to the original");
+	string joined = rowcopy.join (',');
+	if (joined != "1,3") FAIL("join mismatch");
+	
+	tstart = now ();
+	for (int i=0; i<100; ++i)
+	{
+		value v = big;
+		v["records"][i]["id"] = i;
+	}
+	double tpath = now () - tstart;
+	
+	fout.writeln ("copy: %.6fs, copy+write: %.6fs per round"
+				  %format (tcopy / 1000, tpath / 100));
+	
+	exclusivesection (db)
+	{
+		for (int i=0; i<NRECORDS; ++i)
+		{
+			db["records"][i]["gen"] = 0;
+			db["records"][i]["name"] = strutil::uuid ();
+		}
+		db["gen"] = 0;
+	}
+	
+	exclusivesection (failcount) failcount = 0;
+	exclusivesection (donecount) donecount = 0;
+	
+	new producer;
+	for (int i=0; i<NREADERS; ++i) new reader;
+	
+	for (int i=0; i<600; ++i)
+	{
+		bool done = false;
+		sharedsection (donecount) done = (donecount == (NREADERS+1));
+		if (done) break;
+		__musleep (100);
+	}
+	
+	sharedsection (donecount)
+	{
+		if (donecount != (NREADERS+1)) breaksection FAIL("timeout");
+	}
+	sharedsection (failcount)
+	{
+		if (failcount) breaksection FAIL("thread checks failed");
+	}
+	
+	return 0;
+}
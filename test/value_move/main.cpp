@@ -0,0 +1,111 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+#include <grace/thread.h>
+
+#include <utility>
+
+class value_movetestApp : public application
+{
+public:
+		 	 value_movetestApp (void) :
+				application ("grace.testsuite.value_move")
+			 {
+			 }
+			~value_movetestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+};
+
+APPOBJECT(value_movetestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static value mkrow (int i)
+{
+	value res;
+	res("id") = i;
+	res["name"] = "row%i" %format (i);
+	res["flag"] = (i & 1) ? true : false;
+	return res;
+}
+
+int value_movetestApp::main (void)
+{
+	// Moving a string hands over the refblock. Short strings are
+	// stored inline, so use one that needs a heap block.
+	string a = "the quick brown fox jumps over the lazy dog";
+	const char *adata = a.str();
+	string b = std::move (a);
+	if (b.str() != adata) FAIL("string move constructor copied data");
+	if (a.strlen()) FAIL("moved-from string not empty");
+	a = std::move (b);
+	if (a != "the quick brown fox jumps over the lazy dog")
+		FAIL("string move assignment failed");
+	
+	// Moving a shared string leaves the other owner alone.
+	string c = a;
+	string d = std::move (c);
+	d.strcat (" again");
+	if (a != "the quick brown fox jumps over the lazy dog")
+		FAIL("copy-on-write broken after move");
+	
+	// Statstrings carry their reference.
+	statstring s1 = "somekey";
+	statstring s2 = std::move (s1);
+	if (s1) FAIL("moved-from statstring not empty");
+	if (s2 != "somekey") FAIL("statstring move failed");
+	s1 = std::move (s2);
+	if (s1 != "somekey") FAIL("statstring move assignment failed");
+	
+	// Moving a value keeps children, attributes and the key index.
+	value big;
+	for (int i=0; i<100; ++i)
+	{
+		statstring k = "k%i" %format (i);
+		big[k] = i;
+	}
+	big("attr") = "yes";
+	big.type ("bigtype");
+	value *first = &(big[0]);
+	
+	value moved = std::move (big);
+	if (moved.count() != 100) FAIL("value move lost children");
+	if (&(moved[0]) != first) FAIL("value move copied children");
+	if (moved["k42"].ival() != 42) FAIL("value move lost index");
+	if (moved("attr") != "yes") FAIL("value move lost attributes");
+	if (moved.type() != "bigtype") FAIL("value move lost type");
+	if (big.count()) FAIL("moved-from value has children");
+	if (big.attribexists ("attr")) FAIL("moved-from value has attributes");
+	
+	// Assigning into a keyed child keeps the child's key.
+	value tree;
+	tree["data"] = std::move (moved);
+	if (tree["data"]["k99"].ival() != 99) FAIL("move into child failed");
+	if (tree["data"].id() != "data") FAIL("move into child changed key");
+	
+	// Moving a child into its parent.
+	tree = std::move (tree["data"]);
+	if (tree["k7"].ival() != 7) FAIL("move from own child failed");
+	
+	// Emplace builders.
+	value rows;
+	for (int i=0; i<10; ++i) rows.emplace (mkrow (i));
+	value res;
+	value &r = res.emplace ("rows", std::move (rows));
+	res.emplace ("count", value (10));
+	if (r.count() != 10) FAIL("emplace lost rows");
+	if (res["rows"][3]["name"] != "row3") FAIL("emplace row mismatch");
+	if (res["rows"][3]("id").ival() != 3) FAIL("emplace attribute mismatch");
+	if (res["count"].ival() != 10) FAIL("emplace keyed failed");
+	res.emplace ("count", value ("ten"));
+	if (res.count() != 2) FAIL("emplace on existing key added child");
+	if (res["count"] != "ten") FAIL("emplace did not replace child");
+	
+	// The retained-pointer idiom still works on top of this.
+	value ret = $("a", 1) -> $("b", 2);
+	if (ret["b"].ival() != 2) FAIL("retained builder failed");
+	
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include <grace/application.h>
+#include <grace/filesystem.h>
+
+#include <sys/time.h>
+
+#define NROWS 100000
+
+class value_sortbenchtestApp : public application
+{
+public:
+		 	 value_sortbenchtestApp (void) :
+				application ("grace.testsuite.value_sortbench")
+			 {
+			 }
+			~value_sortbenchtestApp (void)
+			 {
+			 }
+
+	int		 main (void);
+	bool	 checkorder (const value &v, sortmethod cmpare,
+						 const string &opt);
+	string	*roworder (const value &v);
+	bool	 sameorder (const value &v, const string &order);
+};
+
+APPOBJECT(value_sortbenchtestApp);
+
+#define FAIL(foo) { ferr.printf (foo "\n"); return 1; }
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static const char *titles[8] = {
+	"The Wall", "Rocky IV", "rocky ii", "Track 12", "track 9",
+	"a tale", "Zebra", "Apollo XIII"
+};
+
+int value_sortbenchtestApp::main (void)
+{
+	value rows;
+	double tstart;
+
+	// Lots of duplicate sort keys, so the order of equal rows
+	// gets tested as well.
+	unsigned int seed = 1;
+	for (int i=0; i<NROWS; ++i)
+	{
+		seed = (seed * 1103515245) + 12345;
+		int n = (seed >> 8) % 5000;
+
+		value &r = rows.newval();
+		r["id"] = i;
+		r["n"] = n;
+		r["title"] = "%s %i" %format (titles[n & 7], n % 100);
+	}
+
+	value v = rows;
+	tstart = now ();
+	v.sort (recordSort, "n");
+	fout.writeln ("record: %.4fs" %format (now() - tstart));
+	if (! checkorder (v, recordSort, "n")) FAIL("record order");
+	string recordorder = roworder (v);
+
+	v = rows;
+	tstart = now ();
+	v.sort (recordSortKey, valueSort, "n");
+	fout.writeln ("record keyed: %.4fs" %format (now() - tstart));
+	if (! sameorder (v, recordorder)) FAIL("keyed record order");
+
+	v = rows;
+	tstart = now ();
+	v.sort (recordSort, "n", 4);
+	fout.writeln ("record 4 threads: %.4fs" %format (now() - tstart));
+	if (! sameorder (v, recordorder)) FAIL("parallel record order");
+
+	v = rows;
+	tstart = now ();
+	v.sort (naturalSort, "title");
+	fout.writeln ("natural: %.4fs" %format (now() - tstart));
+	if (! checkorder (v, naturalSort, "title")) FAIL("natural order");
+	string naturalorder = roworder (v);
+
+	v = rows;
+	tstart = now ();
+	v.sort (naturalSortKey, naturalSort, "title", 4);
+	fout.writeln ("natural keyed 4 threads: %.4fs" %format (now() - tstart));
+	if (! sameorder (v, naturalorder)) FAIL("keyed natural order");
+
+	// Equal rows end up in the reverse of their original order.
+	value keyed;
+	for (int i=0; i<40; ++i)
+	{
+		statstring key = "row%02i" %format (i);
+		keyed[key] = i % 3;
+	}
+	value expect;
+	for (int k=0; k<3; ++k)
+	{
+		for (int i=39; i>=0; --i)
+		{
+			if ((i % 3) == k) expect.newval() = "row%02i" %format (i);
+		}
+	}
+	keyed.sort (valueSort);
+	for (int i=0; i<40; ++i)
+	{
+		if (keyed[i].id() != expect[i].sval()) FAIL("equal member order");
+	}
+	if (keyed["row07"].ival() != 1) FAIL("index after sort");
+
+	return 0;
+}
+
+bool value_sortbenchtestApp::checkorder (const value &v, sortmethod cmpare,
+										 const string &opt)
+{
+	if (v.count() != NROWS) return false;
+
+	for (int i=1; i<v.count(); ++i)
+	{
+		value l = v[i-1];
+		value r = v[i];
+		if (cmpare (&l, &r, opt)) return false;
+	}
+
+	return true;
+}
+
+string *value_sortbenchtestApp::roworder (const value &v)
+{
+	returnclass (string) res retain;
+
+	foreach (r, v)
+	{
+		res.printf ("%i,", r["id"].ival());
+	}
+
+	return &res;
+}
+
+bool value_sortbenchtestApp::sameorder (const value &v, const string &order)
+{
+	string got = roworder (v);
+	return (got == order);
+}